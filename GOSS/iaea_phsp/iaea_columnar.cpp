@@ -0,0 +1,677 @@
+/*
+ * Columnar compressed phase space files (.GOSSphsp).
+ * See iaea_columnar.h for the file layout.
+ *
+ * Block layout (integers little endian):
+ *   u32 n                      records in the block
+ *   column 0                   particle type bytes: u8 transform, 1 plane
+ *   column 1..nwords           record words:        u8 transform, 4 planes
+ *
+ * Word transforms (the word is read as a little endian u32, so that files
+ * decode the same on any machine):
+ *   0 stored as is
+ *   1 XOR with the word of the previous record (slowly varying floats)
+ *   2 difference with the word of the previous record (counters)
+ * The transform of each column is chosen per block as the one whose byte
+ * planes have the lowest order-0 entropy.
+ *
+ * Plane layout:
+ *   u8 mode = 0  raw:      n bytes
+ *   u8 mode = 1  constant: 1 byte
+ *   u8 mode = 2  rANS:     u8 present[32] (bit map of the symbols used),
+ *                          u16 freq[] (one per symbol used, sum 1<<RANS_SCALE),
+ *                          u32 length, length bytes of rANS stream
+ *                          (RANS_STATES interleaved states)
+ */
+#if (defined WIN32) || (defined WIN64)
+#include <iostream>  // so that namespace std becomes defined
+#endif
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#if !(defined WIN32) && !(defined WIN64)
+#include <unistd.h>
+using namespace std;
+#endif
+
+#include "iaea_record.h"
+#include "iaea_columnar.h"
+
+#define RANS_SCALE 12
+#define RANS_TOTAL (1u << RANS_SCALE)
+#define RANS_LOW   (1u << 23)
+#define RANS_STATES 4 // interleaved rANS states
+
+/* *********************************************************************** */
+// Little endian integers of the file
+
+static void put_u32(std::vector<unsigned char> &out, unsigned int v)
+{
+  for(int i=0; i<4; i++) out.push_back((unsigned char)(v >> (8*i)));
+}
+
+static unsigned int get_u32(const unsigned char *p)
+{
+  return (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+         ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static void set_u64(unsigned char *p, IAEA_I64 v)
+{
+  for(int i=0; i<8; i++) p[i] = (unsigned char)((unsigned long long)v >> (8*i));
+}
+
+static IAEA_I64 get_u64(const unsigned char *p)
+{
+  unsigned long long v = 0;
+  for(int i=7; i>=0; i--) v = (v << 8) | p[i];
+  return (IAEA_I64)v;
+}
+
+static short read_bytes(FILE *p_file, void *dst, IAEA_I64 nbytes, IAEA_I64 offset)
+{
+#if (defined WIN32) || (defined WIN64)
+  if(_fseeki64(p_file, offset, SEEK_SET) != 0) return(FAIL);
+  return fread(dst, 1, (size_t)nbytes, p_file) == (size_t)nbytes ? OK : FAIL;
+#else
+  // pread keeps read_at() safe when several threads share the file
+  int fd = fileno(p_file);
+  char *p = (char *)dst;
+  while(nbytes > 0)
+  {
+    ssize_t got = pread(fd, p, (size_t)nbytes, (off_t)offset);
+    if(got <= 0) return(FAIL);
+    p += got; offset += got; nbytes -= got;
+  }
+  return(OK);
+#endif
+}
+
+/* *********************************************************************** */
+// Byte plane coding
+
+static double plane_entropy(const unsigned int *count, IAEA_I64 n)
+{
+  double bits = 0.;
+  for(int s=0; s<256; s++)
+    if(count[s] > 0) bits -= count[s]*log2((double)count[s]/(double)n);
+  return bits;
+}
+
+// Scale the symbol counts to frequencies summing RANS_TOTAL, keeping every
+// symbol used at a frequency of at least 1
+static void normalize_freqs(const unsigned int *count, IAEA_I64 n, unsigned int *freq)
+{
+  int sum = 0, largest = 0;
+  for(int s=0; s<256; s++)
+  {
+    freq[s] = 0;
+    if(count[s] == 0) continue;
+    freq[s] = (unsigned int)(((unsigned long long)count[s]*RANS_TOTAL)/(unsigned long long)n);
+    if(freq[s] == 0) freq[s] = 1;
+    sum += freq[s];
+    if(freq[s] > freq[largest]) largest = s;
+  }
+  if(sum < (int)RANS_TOTAL) freq[largest] += RANS_TOTAL - sum;
+  while(sum > (int)RANS_TOTAL)
+  {
+    for(int s=0; s<256 && sum > (int)RANS_TOTAL; s++)
+      if(freq[s] > 1) { freq[s]--; sum--; }
+  }
+}
+
+static void encode_plane(const unsigned char *in, IAEA_I64 n,
+                         std::vector<unsigned char> &out)
+{
+  unsigned int count[256] = {0};
+  for(IAEA_I64 i=0; i<n; i++) count[in[i]]++;
+
+  int used = 0;
+  for(int s=0; s<256; s++) if(count[s] > 0) used++;
+  if(used <= 1)
+  {
+    out.push_back(1);
+    out.push_back(n > 0 ? in[0] : 0);
+    return;
+  }
+
+  unsigned int freq[256], cum[257];
+  normalize_freqs(count, n, freq);
+  cum[0] = 0;
+  for(int s=0; s<256; s++) cum[s+1] = cum[s] + freq[s];
+
+  // rANS emits its bytes backwards from the end of the buffer. Symbol i
+  // is coded with state i%RANS_STATES, which lets the decoder work on
+  // several independent states at once.
+  std::vector<unsigned char> stream((size_t)n + (size_t)n/2 + 16 + 4*RANS_STATES);
+  unsigned char *begin = &stream[0];
+  unsigned char *end = begin + stream.size();
+  unsigned char *p = end;
+  unsigned int x[RANS_STATES];
+  for(int k=0; k<RANS_STATES; k++) x[k] = RANS_LOW;
+  for(IAEA_I64 i=n-1; i>=0 && p != NULL; i--)
+  {
+    unsigned int &xi = x[i % RANS_STATES];
+    unsigned int f = freq[in[i]];
+    unsigned int x_max = ((RANS_LOW >> RANS_SCALE) << 8) * f;
+    while(xi >= x_max)
+    {
+      if(p - begin <= 4*RANS_STATES) { p = NULL; break; }
+      *--p = (unsigned char)(xi & 0xff);
+      xi >>= 8;
+    }
+    xi = ((xi / f) << RANS_SCALE) + (xi % f) + cum[in[i]];
+  }
+  if(p != NULL)
+  {
+    for(int k=RANS_STATES-1; k>=0; k--)
+    {
+      p -= 4;
+      for(int b=0; b<4; b++) p[b] = (unsigned char)(x[k] >> (8*b));
+    }
+  }
+
+  // Planes that hardly compress are stored raw, they decode faster
+  IAEA_I64 len = (p != NULL) ? (IAEA_I64)(end - p) : n;
+  IAEA_I64 coded = 1 + 32 + 2*used + 4 + len;
+  if(p == NULL || coded >= n - n/32)
+  {
+    out.push_back(0);
+    out.insert(out.end(), in, in + n);
+    return;
+  }
+
+  out.push_back(2);
+  unsigned char present[32] = {0};
+  for(int s=0; s<256; s++) if(freq[s] > 0) present[s >> 3] |= (unsigned char)(1 << (s & 7));
+  out.insert(out.end(), present, present + 32);
+  for(int s=0; s<256; s++)
+  {
+    if(freq[s] == 0) continue;
+    out.push_back((unsigned char)(freq[s] & 0xff));
+    out.push_back((unsigned char)(freq[s] >> 8));
+  }
+  put_u32(out, (unsigned int)len);
+  out.insert(out.end(), p, end);
+}
+
+// Returns the bytes of the plane consumed from in, 0 on corrupt data
+static IAEA_I64 decode_plane(const unsigned char *in, IAEA_I64 avail,
+                             unsigned char *out, IAEA_I64 n)
+{
+  if(avail < 1) return 0;
+  const unsigned char mode = in[0];
+  if(mode == 0)
+  {
+    if(avail < 1 + n) return 0;
+    memcpy(out, in + 1, (size_t)n);
+    return 1 + n;
+  }
+  if(mode == 1)
+  {
+    if(avail < 2) return 0;
+    memset(out, in[1], (size_t)n);
+    return 2;
+  }
+  if(mode != 2 || avail < 33) return 0;
+
+  const unsigned char *present = in + 1;
+  const unsigned char *p = in + 33;
+  const unsigned char *end = in + avail;
+  unsigned int freq[256], cum[256], sum = 0;
+  for(int s=0; s<256; s++)
+  {
+    freq[s] = 0;
+    cum[s] = sum;
+    if(!(present[s >> 3] & (1 << (s & 7)))) continue;
+    if(end - p < 2) return 0;
+    freq[s] = (unsigned int)p[0] | ((unsigned int)p[1] << 8);
+    p += 2;
+    sum += freq[s];
+  }
+  if(sum != RANS_TOTAL || end - p < 4) return 0;
+  IAEA_I64 len = get_u32(p);
+  p += 4;
+  if(len < 4*RANS_STATES || end - p < len) return 0;
+  const unsigned char *stream_end = p + len;
+
+  // slot -> symbol, frequency and start packed together for the decoder
+  // (with two symbols or more every frequency is below RANS_TOTAL)
+  std::vector<unsigned int> slot(RANS_TOTAL);
+  for(int s=0; s<256; s++)
+  {
+    if(freq[s] >= RANS_TOTAL) return 0;
+    for(unsigned int k=cum[s]; k<cum[s]+freq[s]; k++)
+      slot[k] = (unsigned int)s | (freq[s] << 8) | (cum[s] << (8 + RANS_SCALE));
+  }
+
+  unsigned int x[RANS_STATES];
+  for(int k=0; k<RANS_STATES; k++) { x[k] = get_u32(p); p += 4; }
+  IAEA_I64 i = 0;
+  for(; i + RANS_STATES <= n; i += RANS_STATES)
+  {
+    for(int k=0; k<RANS_STATES; k++)
+    {
+      unsigned int slot_k = x[k] & (RANS_TOTAL - 1);
+      unsigned int e = slot[slot_k];
+      out[i+k] = (unsigned char)(e & 0xff);
+      x[k] = ((e >> 8) & (RANS_TOTAL - 1)) * (x[k] >> RANS_SCALE)
+             + slot_k - (e >> (8 + RANS_SCALE));
+    }
+    // A state needs at most two bytes to get back into range
+    if(stream_end - p < 2*RANS_STATES)
+    {
+      for(int k=0; k<RANS_STATES; k++)
+        while(x[k] < RANS_LOW)
+        {
+          if(p == stream_end) return 0;
+          x[k] = (x[k] << 8) | *p++;
+        }
+      continue;
+    }
+    for(int k=0; k<RANS_STATES; k++)
+    {
+      if(x[k] < RANS_LOW) x[k] = (x[k] << 8) | *p++;
+      if(x[k] < RANS_LOW) x[k] = (x[k] << 8) | *p++;
+    }
+  }
+  for(; i < n; i++)
+  {
+    unsigned int &xi = x[i % RANS_STATES];
+    unsigned int slot_k = xi & (RANS_TOTAL - 1);
+    unsigned int e = slot[slot_k];
+    out[i] = (unsigned char)(e & 0xff);
+    xi = ((e >> 8) & (RANS_TOTAL - 1)) * (xi >> RANS_SCALE)
+         + slot_k - (e >> (8 + RANS_SCALE));
+    while(xi < RANS_LOW)
+    {
+      if(p == stream_end) return 0;
+      xi = (xi << 8) | *p++;
+    }
+  }
+  return (IAEA_I64)(stream_end - in);
+}
+
+/* *********************************************************************** */
+// Block coding
+
+static unsigned int load_word(const char *p)
+{
+  return get_u32((const unsigned char *)p);
+}
+
+static void store_word(char *p, unsigned int v)
+{
+  for(int i=0; i<4; i++) p[i] = (char)(unsigned char)(v >> (8*i));
+}
+
+static void encode_block(const char *rows, IAEA_I64 n, IAEA_I64 record_length,
+                         std::vector<unsigned char> &out)
+{
+  out.clear();
+  put_u32(out, (unsigned int)n);
+
+  std::vector<unsigned char> plane((size_t)n);
+  for(IAEA_I64 i=0; i<n; i++) plane[i] = (unsigned char)rows[i*record_length];
+  out.push_back(0);
+  encode_plane(&plane[0], n, out);
+
+  const IAEA_I64 nwords = (record_length - 1)/4;
+  std::vector<unsigned int> word((size_t)n), coded((size_t)n);
+  for(IAEA_I64 j=0; j<nwords; j++)
+  {
+    const char *col = rows + 1 + 4*j;
+    for(IAEA_I64 i=0; i<n; i++) word[i] = load_word(col + i*record_length);
+
+    // Transform whose byte planes compress best
+    int best = 0;
+    double best_bits = 0.;
+    for(int t=0; t<3; t++)
+    {
+      unsigned int count[4][256];
+      memset(count, 0, sizeof(count));
+      unsigned int prev = 0;
+      for(IAEA_I64 i=0; i<n; i++)
+      {
+        unsigned int v = word[i];
+        if(t == 1) v ^= prev;
+        else if(t == 2) v -= prev;
+        prev = word[i];
+        for(int b=0; b<4; b++) count[b][(v >> (8*b)) & 0xff]++;
+      }
+      double bits = 0.;
+      for(int b=0; b<4; b++) bits += plane_entropy(count[b], n);
+      if(t == 0 || bits < best_bits) { best = t; best_bits = bits; }
+    }
+
+    unsigned int prev = 0;
+    for(IAEA_I64 i=0; i<n; i++)
+    {
+      unsigned int v = word[i];
+      if(best == 1) v ^= prev;
+      else if(best == 2) v -= prev;
+      prev = word[i];
+      coded[i] = v;
+    }
+    out.push_back((unsigned char)best);
+    for(int b=0; b<4; b++)
+    {
+      for(IAEA_I64 i=0; i<n; i++) plane[i] = (unsigned char)(coded[i] >> (8*b));
+      encode_plane(&plane[0], n, out);
+    }
+  }
+}
+
+static short decode_block(const unsigned char *in, IAEA_I64 avail,
+                          IAEA_I64 record_length, IAEA_I64 max_records,
+                          char *rows, IAEA_I64 *n_out)
+{
+  if(avail < 4) return(FAIL);
+  const IAEA_I64 n = get_u32(in);
+  if(n > max_records) return(FAIL);
+  const unsigned char *p = in + 4;
+  const unsigned char *end = in + avail;
+
+  std::vector<unsigned char> plane((size_t)n + 1);
+  if(end - p < 1 || p[0] != 0) return(FAIL);
+  p++;
+  IAEA_I64 used = decode_plane(p, end - p, &plane[0], n);
+  if(used == 0) return(FAIL);
+  p += used;
+  for(IAEA_I64 i=0; i<n; i++) rows[i*record_length] = (char)plane[i];
+
+  // The 4 byte planes of a column are decoded, then put together with the
+  // inverse transform in one pass over the records
+  const IAEA_I64 nwords = (record_length - 1)/4;
+  std::vector<unsigned char> planes(4*(size_t)n + 1);
+  unsigned char *b0 = &planes[0], *b1 = b0 + n, *b2 = b1 + n, *b3 = b2 + n;
+  for(IAEA_I64 j=0; j<nwords; j++)
+  {
+    if(end - p < 1 || p[0] > 2) return(FAIL);
+    const int transform = p[0];
+    p++;
+    for(int b=0; b<4; b++)
+    {
+      used = decode_plane(p, end - p, b0 + b*n, n);
+      if(used == 0) return(FAIL);
+      p += used;
+    }
+
+    char *col = rows + 1 + 4*j;
+    unsigned int prev = 0;
+    for(IAEA_I64 i=0; i<n; i++)
+    {
+      unsigned int v = (unsigned int)b0[i] | ((unsigned int)b1[i] << 8) |
+                       ((unsigned int)b2[i] << 16) | ((unsigned int)b3[i] << 24);
+      if(transform == 1) v ^= prev;
+      else if(transform == 2) v += prev;
+      prev = v;
+      store_word(col + i*record_length, v);
+    }
+  }
+  *n_out = n;
+  return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_columnar_file::create(const char *filename)
+{
+  memset(this, 0, sizeof(*this));
+  cache_block = -1;
+
+  p_file = fopen(filename, "wb");
+  if(p_file == NULL) return(FAIL);
+  writing = 1;
+  block_records = IAEA_COLUMNAR_BLOCK;
+
+  unsigned char head[16] = {0};
+  memcpy(head, IAEA_COLUMNAR_MAGIC, 8);
+  for(int i=0; i<4; i++) head[8+i] = (unsigned char)((unsigned long long)block_records >> (8*i));
+  if(fwrite(head, 1, 16, p_file) != 16) { close(); return(FAIL); }
+  return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_columnar_file::open(const char *filename)
+{
+  memset(this, 0, sizeof(*this));
+  cache_block = -1;
+
+  p_file = fopen(filename, "rb");
+  if(p_file == NULL) return(FAIL);
+
+  unsigned char head[16], tail[32];
+#if (defined WIN32) || (defined WIN64)
+  _fseeki64(p_file, 0, SEEK_END);
+  IAEA_I64 total = _ftelli64(p_file);
+#else
+  fseeko(p_file, 0, SEEK_END);
+  IAEA_I64 total = (IAEA_I64)ftello(p_file);
+#endif
+  if(total < 16 + 24 ||
+     read_bytes(p_file, head, 16, 0) != OK ||
+     read_bytes(p_file, tail, 24, total - 24) != OK ||
+     memcmp(head, IAEA_COLUMNAR_MAGIC, 8) != 0)
+  {
+    close();
+    return(FAIL);
+  }
+  if(memcmp(tail + 16, IAEA_COLUMNAR_END, 8) != 0)
+  {
+    fprintf(stderr,"\n ERROR: GOSS phsp file %s was not finalized\n", filename);
+    close();
+    return(FAIL);
+  }
+
+  block_records = get_u32(head + 8);
+  n_records = get_u64(tail);
+  n_blocks = get_u32(tail + 8);
+  record_length = get_u32(tail + 12);
+  const IAEA_I64 table = total - 24 - 8*n_blocks;
+  if(n_records < 0 || block_records < 1 || table < 16 ||
+     (n_records > 0 && (record_length < 1 || (record_length - 1) % 4 != 0)) ||
+     n_blocks != (n_records + block_records - 1)/block_records)
+  {
+    close();
+    return(FAIL);
+  }
+
+  capacity = n_blocks + 1;
+  offset = (IAEA_I64 *)malloc((size_t)capacity*sizeof(IAEA_I64));
+  std::vector<unsigned char> raw((size_t)(8*n_blocks) + 8);
+  if(offset == NULL || (n_blocks > 0 && read_bytes(p_file, &raw[0], 8*n_blocks, table) != OK))
+  {
+    close();
+    return(FAIL);
+  }
+  for(IAEA_I64 k=0; k<n_blocks; k++) offset[k] = get_u64(&raw[8*k]);
+  offset[n_blocks] = table;
+  for(IAEA_I64 k=0; k<n_blocks; k++)
+    if(offset[k] < 16 || offset[k] >= offset[k+1]) { close(); return(FAIL); }
+
+  p_cache = (char *)malloc((size_t)(block_records*record_length) + 1);
+  if(p_cache == NULL) { close(); return(FAIL); }
+  return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_columnar_file::close()
+{
+  short result = OK;
+  if(p_file != NULL && writing)
+  {
+    if(rows_len > 0 && rows_len % record_length != 0)
+    {
+      fprintf(stderr,"\n ERROR: partial record written to GOSS phsp file\n");
+      result = FAIL;
+    }
+    else if(rows_len > 0) result = flush_block(rows_len/record_length);
+
+    if(result == OK)
+    {
+      std::vector<unsigned char> tail((size_t)(8*n_blocks) + 24);
+      for(IAEA_I64 k=0; k<n_blocks; k++) set_u64(&tail[8*k], offset[k]);
+      unsigned char *t = &tail[8*n_blocks];
+      set_u64(t, n_records);
+      for(int i=0; i<4; i++) t[8+i]  = (unsigned char)((unsigned long long)n_blocks >> (8*i));
+      for(int i=0; i<4; i++) t[12+i] = (unsigned char)((unsigned long long)record_length >> (8*i));
+      memcpy(t + 16, IAEA_COLUMNAR_END, 8);
+      if(fwrite(&tail[0], 1, tail.size(), p_file) != tail.size()) result = FAIL;
+    }
+  }
+  if(p_file != NULL && fclose(p_file) != 0) result = FAIL;
+  p_file = NULL;
+  free(p_rows);   p_rows = NULL;
+  free(p_cache);  p_cache = NULL;
+  free(offset);   offset = NULL;
+  writing = 0;
+  return(result);
+}
+
+/* *********************************************************************** */
+short iaea_columnar_file::flush_block(IAEA_I64 n)
+{
+  if(n_blocks + 1 > capacity)
+  {
+    IAEA_I64 new_capacity = capacity > 0 ? 2*capacity : 64;
+    IAEA_I64 *p = (IAEA_I64 *)realloc(offset, (size_t)new_capacity*sizeof(IAEA_I64));
+    if(p == NULL) return(FAIL);
+    offset = p;
+    capacity = new_capacity;
+  }
+#if (defined WIN32) || (defined WIN64)
+  offset[n_blocks] = _ftelli64(p_file);
+#else
+  offset[n_blocks] = (IAEA_I64)ftello(p_file);
+#endif
+
+  std::vector<unsigned char> out;
+  encode_block(p_rows, n, record_length, out);
+  if(fwrite(&out[0], 1, out.size(), p_file) != out.size()) return(FAIL);
+
+  n_blocks++;
+  n_records += n;
+  rows_len -= n*record_length;
+  if(rows_len > 0) memmove(p_rows, p_rows + n*record_length, (size_t)rows_len);
+  return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_columnar_file::write(const char *src, IAEA_I64 nbytes,
+                                IAEA_I64 the_length)
+{
+  if(p_file == NULL || !writing) return(FAIL);
+  if(p_rows == NULL)
+  {
+    if(the_length < 1 || (the_length - 1) % 4 != 0) return(FAIL);
+    record_length = the_length;
+    p_rows = (char *)malloc((size_t)(block_records*record_length));
+    if(p_rows == NULL) return(FAIL);
+  }
+  else if(the_length != record_length)
+  {
+    fprintf(stderr,"\n ERROR: record length changed while writing GOSS phsp file\n");
+    return(FAIL);
+  }
+  const IAEA_I64 block_bytes = block_records*record_length;
+  while(nbytes > 0)
+  {
+    IAEA_I64 k = block_bytes - rows_len;
+    if(k > nbytes) k = nbytes;
+    memcpy(p_rows + rows_len, src, (size_t)k);
+    rows_len += k;
+    src += k;
+    nbytes -= k;
+    if(rows_len == block_bytes && flush_block(block_records) != OK) return(FAIL);
+  }
+  return(OK);
+}
+
+/* *********************************************************************** */
+short iaea_columnar_file::load_block(IAEA_I64 block, char *dst, IAEA_I64 *n)
+{
+  const IAEA_I64 len = offset[block+1] - offset[block];
+  unsigned char *in = (unsigned char *)malloc((size_t)len);
+  if(in == NULL) return(FAIL);
+  short status = read_bytes(p_file, in, len, offset[block]);
+  if(status == OK) status = decode_block(in, len, record_length, block_records, dst, n);
+  free(in);
+  if(status != OK)
+  {
+    fprintf(stderr,"\n ERROR: corrupt block %lld in GOSS phsp file\n", (long long)block);
+    return(FAIL);
+  }
+  const IAEA_I64 expected = (block < n_blocks - 1) ? block_records
+                          : n_records - block*block_records;
+  return (*n == expected) ? OK : FAIL;
+}
+
+/* *********************************************************************** */
+const char *iaea_columnar_file::rows(IAEA_I64 pos, IAEA_I64 *avail)
+{
+  *avail = 0;
+  if(p_file == NULL || writing || pos < 0 || pos >= size()) return NULL;
+  const IAEA_I64 block_bytes = block_records*record_length;
+  const IAEA_I64 block = pos/block_bytes;
+  if(block != cache_block)
+  {
+    IAEA_I64 n;
+    cache_block = -1;
+    if(load_block(block, p_cache, &n) != OK) return NULL;
+    cache_block = block;
+    cache_len = n*record_length;
+  }
+  const IAEA_I64 in_block = pos - block*block_bytes;
+  *avail = cache_len - in_block;
+  return p_cache + in_block;
+}
+
+/* *********************************************************************** */
+IAEA_I64 iaea_columnar_file::read_at(char *dst, IAEA_I64 nbytes, IAEA_I64 pos)
+{
+  if(p_file == NULL || writing || pos < 0) return 0;
+  if(pos + nbytes > size()) nbytes = size() - pos;
+  if(nbytes <= 0) return 0;
+
+  const IAEA_I64 block_bytes = block_records*record_length;
+  std::vector<char> rows_buf;
+  IAEA_I64 done = 0;
+  while(done < nbytes)
+  {
+    const IAEA_I64 block = (pos + done)/block_bytes;
+    const IAEA_I64 in_block = pos + done - block*block_bytes;
+    IAEA_I64 n;
+    if(rows_buf.empty()) rows_buf.resize((size_t)block_bytes);
+    if(load_block(block, &rows_buf[0], &n) != OK) break;
+    IAEA_I64 k = n*record_length - in_block;
+    if(k > nbytes - done) k = nbytes - done;
+    memcpy(dst + done, &rows_buf[0] + in_block, (size_t)k);
+    done += k;
+  }
+  return done;
+}
+
+/* *********************************************************************** */
+IAEA_I64 iaea_columnar_file::size()
+{
+  return writing ? n_records*record_length + rows_len : n_records*record_length;
+}
+
+IAEA_I64 iaea_columnar_file::file_offset(IAEA_I64 pos)
+{
+  if(writing)
+  {
+     #if (defined WIN32) || (defined WIN64)
+     return (IAEA_I64) _ftelli64(p_file);
+     #else
+     return (IAEA_I64) ftello(p_file);
+     #endif
+  }
+  if(n_blocks == 0 || record_length == 0) return 0;
+  IAEA_I64 block = pos/(record_length*block_records);
+  if(block > n_blocks) block = n_blocks;
+  return offset[block];
+}
@@ -0,0 +1,85 @@
+#ifndef IAEA_COLUMNAR
+#define IAEA_COLUMNAR
+
+/* *********************************************************************** */
+#include <cstdio>
+#include "iaea_config.h"
+
+// Columnar compressed storage of phase space records (.GOSSphsp files).
+//
+// The records are the same as in a .IAEAphsp file (particle type byte
+// followed by 4-byte words, layout given by the .IAEAheader), grouped in
+// blocks of IAEA_COLUMNAR_BLOCK records. Within a block every field is
+// stored as a column: the type bytes, then each word of the record. Word
+// columns are optionally XOR- or delta-coded against the previous record,
+// split into byte planes and each plane is entropy coded (rANS). Nothing
+// is quantized, so the records read back are bit for bit those written.
+//
+// File layout (integers little endian):
+//   char magic[8] = IAEA_COLUMNAR_MAGIC, u32 block_records, u32 0
+//   blocks
+//   u64 block_offset[n_blocks], u64 n_records, u32 n_blocks,
+//   u32 record_length, char magic[8] = IAEA_COLUMNAR_END
+
+#ifndef IAEA_COLUMNAR_BLOCK
+  #define IAEA_COLUMNAR_BLOCK 65536 // records per compressed block
+#endif
+
+#define IAEA_COLUMNAR_MAGIC "GOSSphs1"
+#define IAEA_COLUMNAR_END   "GOSSend1"
+
+struct iaea_columnar_file
+{
+  FILE *p_file;
+  int writing;
+
+  IAEA_I64 record_length;
+  IAEA_I64 block_records;
+  IAEA_I64 n_records;
+  IAEA_I64 n_blocks;
+  IAEA_I64 *offset;        // file offset of each block (n_blocks+1 entries
+  IAEA_I64 capacity;       //  when reading, the last one ends the blocks)
+
+  // Writing: records waiting for their block to be full
+  char *p_rows;
+  IAEA_I64 rows_len;
+
+  // Reading: last block decoded by rows()
+  char *p_cache;
+  IAEA_I64 cache_block;
+  IAEA_I64 cache_len;
+
+// CLASS FUNCTIONS
+
+public:
+      short create(const char *filename);
+      short open(const char *filename);
+      // Flushes the last block and writes the block table if writing
+      short close();
+
+      // Append nbytes of records (any split, whole records in the end).
+      // The record length is fixed by the first call (the layout of a new
+      // phsp file may change until the first particle is written).
+      short write(const char *rows, IAEA_I64 nbytes, IAEA_I64 record_length);
+
+      // Records at byte offset (as if the file were a .IAEAphsp), *avail
+      // being set to the bytes available there up to the end of the block.
+      // NULL at the end of the file or on failure.
+      const char *rows(IAEA_I64 offset, IAEA_I64 *avail);
+
+      // Read nbytes at byte offset into dst without using the cache, so
+      // that several threads may read the same file. Returns bytes read.
+      IAEA_I64 read_at(char *dst, IAEA_I64 nbytes, IAEA_I64 offset);
+
+      IAEA_I64 size(); // bytes of the records (record_length*n_records)
+
+      // Offset in the file of the compressed block holding the record at
+      // byte pos (when writing, the end of the data written so far)
+      IAEA_I64 file_offset(IAEA_I64 pos);
+
+private:
+      short flush_block(IAEA_I64 n);
+      short load_block(IAEA_I64 block, char *dst, IAEA_I64 *n);
+};
+
+#endif
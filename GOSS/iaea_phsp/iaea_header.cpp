@@ -54,7 +54,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <cctype>
 #include <cmath>
+#include <thread>
+#include <vector>
 
 #if !(defined WIN32) && !(defined WIN64)
 using namespace std;
@@ -446,6 +449,8 @@ int iaea_header_type::set_record_contents(iaea_record_type *p_iaea_record)
    if(p_iaea_record->iextrafloat>0) record_contents[7] = p_iaea_record->iextrafloat;
    if(p_iaea_record->iextralong>0) record_contents[8] = p_iaea_record->iextralong;
 
+   p_iaea_record->select_codec(); // dispatch once per layout, not per record
+
    record_length = 5; // To consider for particle type (1 byte) and energy (4 bytes)
    for(i=0;i<8;i++) record_length += record_contents[i]*sizeof(float);
    record_length -= 4; // 4 bytes substracted as w is not stored, just his sign
@@ -496,6 +501,8 @@ int iaea_header_type::get_record_contents(iaea_record_type *p_iaea_record)
    p_iaea_record->iextralong = 0;
    if(record_contents[8] > 0) p_iaea_record->iextralong = record_contents[8];
 
+   p_iaea_record->select_codec(); // dispatch once per layout, not per record
+
    record_length = 5; // To consider for particle type (1 bytes) and energy (4 bytes)
    for(i=0;i<8;i++) record_length += record_contents[i]*sizeof(float);
    record_length -= 4; // 4 bytes substracted as w is not stored, just his sign
@@ -525,42 +532,304 @@ void iaea_header_type::initialize_counters()
   minimumX = minimumY = minimumZ = 32000.f;
   maximumX = maximumY = maximumZ = -32000.f;
 
+  stats.reset();
 }
 
+// Records are accumulated in stats, a compact partial away from the long
+// text fields of the header; they reach the header counters through
+// reduce_statistics() when the header is written or printed.
 void iaea_header_type::update_counters(iaea_record_type *p_iaea_record)
 {
-  if (p_iaea_record->x > maximumX )  maximumX = p_iaea_record->x;
-  if (p_iaea_record->x < minimumX )  minimumX = p_iaea_record->x;
+  stats.add(p_iaea_record);
+}
+
+void iaea_header_type::update_counters(const iaea_particle_block *b, IAEA_I32 n,
+                                       const iaea_record_type *p_iaea_record)
+{
+  stats.add(b, n, p_iaea_record);
+}
+
+void iaea_header_type::reduce_statistics()
+{
+  if(stats.n_particles == 0 && stats.indep_histories == 0) return;
+
+  nParticles += stats.n_particles;
+  read_indep_histories += stats.indep_histories;
+
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      particle_number[i] += stats.particle_number[i];
+      sumParticleWeight[i] += stats.sum_weight[i];
+      averageKineticEnergy[i] += stats.sum_energy[i];
+      if (stats.max_weight[i] > maximumWeight[i] ) maximumWeight[i] = stats.max_weight[i];
+      if (stats.min_weight[i] < minimumWeight[i] ) minimumWeight[i] = stats.min_weight[i];
+      if (stats.max_energy[i] > maximumKineticEnergy[i] )
+         maximumKineticEnergy[i] = stats.max_energy[i];
+      if (stats.min_energy[i] < minimumKineticEnergy[i] )
+         minimumKineticEnergy[i] = stats.min_energy[i];
+  }
+  if (stats.max_x > maximumX )  maximumX = stats.max_x;
+  if (stats.min_x < minimumX )  minimumX = stats.min_x;
+  if (stats.max_y > maximumY )  maximumY = stats.max_y;
+  if (stats.min_y < minimumY )  minimumY = stats.min_y;
+  if (stats.max_z > maximumZ )  maximumZ = stats.max_z;
+  if (stats.min_z < minimumZ )  minimumZ = stats.min_z;
+
+  stats.reset();
+}
+
+void iaea_header_type::get_statistics(iaea_statistics *s)
+{
+  s->reset();
+  s->n_particles = nParticles;
+
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      if(particle_number[i] == 0) continue;
+      s->particle_number[i] = particle_number[i];
+      s->sum_weight[i] = sumParticleWeight[i];
+      // The header stores the mean energy, partials the weighted sum
+      s->sum_energy[i] = averageKineticEnergy[i]*sumParticleWeight[i];
+      s->min_weight[i] = minimumWeight[i];
+      s->max_weight[i] = maximumWeight[i];
+      s->min_energy[i] = minimumKineticEnergy[i];
+      s->max_energy[i] = maximumKineticEnergy[i];
+  }
+  if(record_contents[0] == 1) { s->min_x = minimumX; s->max_x = maximumX; }
+  if(record_contents[1] == 1) { s->min_y = minimumY; s->max_y = maximumY; }
+  if(record_contents[2] == 1) { s->min_z = minimumZ; s->max_z = maximumZ; }
+}
+
+// Scans records [rec_0, rec_1) of a source into a partial. Reads at explicit
+// offsets only, so that several threads can scan the same source.
+static void scan_range(iaea_record_type *p, IAEA_I64 rec_0, IAEA_I64 rec_1,
+                       int nstat_long, iaea_statistics *partial, int *result)
+{
+  const IAEA_I64 record_length = p->record_size();
+  const IAEA_I32 per_read = (IAEA_PREAD_BUFFER/record_length > 0) ?
+                            (IAEA_I32)(IAEA_PREAD_BUFFER/record_length) : 1;
+  std::vector<char> buf((size_t)(per_read*record_length));
+  std::vector<IAEA_I32> n_stat(per_read), type(per_read);
+  std::vector<float> columns(8*(size_t)per_read);
+
+  iaea_particle_block block;
+  block.n_stat = n_stat.data();
+  block.type = type.data();
+  block.energy = &columns[0];
+  block.weight = &columns[(size_t)per_read];
+  block.x = &columns[2*(size_t)per_read];
+  block.y = &columns[3*(size_t)per_read];
+  block.z = &columns[4*(size_t)per_read];
+  block.u = &columns[5*(size_t)per_read];
+  block.v = &columns[6*(size_t)per_read];
+  block.w = &columns[7*(size_t)per_read];
+  block.extrafloat = NULL;
+  block.extralong = NULL;
+  block.stride = per_read;
+
+  partial->reset();
+  *result = OK;
+  for(IAEA_I64 rec=rec_0;rec<rec_1;rec+=per_read)
+  {
+     IAEA_I32 n = (rec_1 - rec > per_read) ? per_read : (IAEA_I32)(rec_1 - rec);
+     if( p->read_at(buf.data(), n*record_length, rec*record_length) !=
+         n*record_length ||
+         p->decode_records(buf.data(), n, &block, nstat_long) != n )
+     {
+        *result = FAIL;
+        return;
+     }
+     partial->add(&block, n, p);
+  }
+}
+
+int iaea_header_type::scan_statistics(iaea_record_type *p_iaea_record,
+                                      IAEA_I32 n_threads)
+{
+  IAEA_I64 n_records = p_iaea_record->file_size()/record_length;
+
+  #if (defined WIN32) || (defined WIN64)
+  n_threads = 1; // read_at() moves the stdio position
+  #endif
+  if(n_threads < 1) n_threads = 1;
+  if(n_records < (IAEA_I64)n_threads) n_threads = 1;
+
+  // Looking for incremental number of histories
+  int nstat_long = -1;
+  for(int j=0;j<p_iaea_record->iextralong;j++)
+      if(extralong_contents[j] == 1) nstat_long = j;
+
+  std::vector<iaea_statistics> partial(n_threads);
+  std::vector<int> status(n_threads, FAIL);
+  std::vector<std::thread> workers;
+  for(IAEA_I32 t=0;t<n_threads;t++)
+  {
+     IAEA_I64 rec_0 = (n_records/n_threads)*t;
+     IAEA_I64 rec_1 = (t == n_threads-1) ? n_records : rec_0 + n_records/n_threads;
+     if(n_threads == 1)
+        scan_range(p_iaea_record, rec_0, rec_1, nstat_long, &partial[t], &status[t]);
+     else
+        workers.push_back(std::thread(scan_range, p_iaea_record, rec_0, rec_1,
+                                      nstat_long, &partial[t], &status[t]));
+  }
+  for(size_t t=0;t<workers.size();t++) workers[t].join();
+
+  for(IAEA_I32 t=0;t<n_threads;t++)
+     if(status[t] != OK)
+     {
+        fprintf(stderr, "\n ERROR: Failed to scan the phsp file\n");
+        return(FAIL);
+     }
+
+  // The counters now describe the whole file, not what was read from it
+  IAEA_I64 read_so_far = read_indep_histories;
+  initialize_counters();
+  for(IAEA_I32 t=0;t<n_threads;t++) stats.merge(&partial[t]);
+  reduce_statistics();
+  read_indep_histories = read_so_far;
+  checksum = (IAEA_I64)record_length * nParticles;
+  return(OK);
+}
+
+/* *********************************************************************** */
+// Partial statistics
+
+void iaea_statistics::reset()
+{
+  n_particles = indep_histories = 0;
 
-  if (p_iaea_record->y > maximumY )  maximumY = p_iaea_record->y;
-  if (p_iaea_record->y < minimumY )  minimumY = p_iaea_record->y;
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+        particle_number[i] = 0;
+        sum_weight[i] = 0.;
+        sum_energy[i] = 0.;
+        max_energy[i] = 0.;
+        min_energy[i] = 32000.;
+        min_weight[i] = 32000.;
+        max_weight[i] = 0.;
+  }
+  min_x = min_y = min_z = 32000.f;
+  max_x = max_y = max_z = -32000.f;
+}
+
+// Min and max of the n values of column v, or of the constant c if v is NULL
+static void min_max(const float *v, float c, IAEA_I32 n, float *vmin, float *vmax)
+{
+  if(v == NULL) { *vmin = *vmax = c; return; }
+
+  float lo = v[0], hi = v[0];
+  for(IAEA_I32 i=1;i<n;i++)
+  {
+      lo = (v[i] < lo) ? v[i] : lo;
+      hi = (v[i] > hi) ? v[i] : hi;
+  }
+  *vmin = lo;
+  *vmax = hi;
+}
 
-  if (p_iaea_record->z > maximumZ )  maximumZ = p_iaea_record->z;
-  if (p_iaea_record->z < minimumZ )  minimumZ = p_iaea_record->z;
+void iaea_statistics::add(const iaea_record_type *p_iaea_record)
+{
+  if (p_iaea_record->x > max_x )  max_x = p_iaea_record->x;
+  if (p_iaea_record->x < min_x )  min_x = p_iaea_record->x;
 
+  if (p_iaea_record->y > max_y )  max_y = p_iaea_record->y;
+  if (p_iaea_record->y < min_y )  min_y = p_iaea_record->y;
 
-  nParticles++;
+  if (p_iaea_record->z > max_z )  max_z = p_iaea_record->z;
+  if (p_iaea_record->z < min_z )  min_z = p_iaea_record->z;
+
+
+  n_particles++;
 
   if ( p_iaea_record->IsNewHistory > 0 )
-      read_indep_histories += p_iaea_record->IsNewHistory;
+      indep_histories += p_iaea_record->IsNewHistory;
 
   int i = p_iaea_record->particle-1;
   if( i >= 0 && i < MAX_NUM_PARTICLES ) {
       particle_number[i]++;
-      sumParticleWeight[i] +=  p_iaea_record->weight;
-      averageKineticEnergy[i] += p_iaea_record->weight*
-                                 fabs(p_iaea_record->energy);
-      if (p_iaea_record->weight > maximumWeight[i] )
-            maximumWeight[i] = p_iaea_record->weight;
-      if (p_iaea_record->weight < minimumWeight[i] )
-            minimumWeight[i] = p_iaea_record->weight;
-
-      if (fabs(p_iaea_record->energy) > maximumKineticEnergy[i] )
-         maximumKineticEnergy[i] = fabs(p_iaea_record->energy);
-      if (fabs(p_iaea_record->energy) < minimumKineticEnergy[i] )
-         minimumKineticEnergy[i] = fabs(p_iaea_record->energy);
+      sum_weight[i] +=  p_iaea_record->weight;
+      sum_energy[i] += p_iaea_record->weight*
+                       fabs(p_iaea_record->energy);
+      if (p_iaea_record->weight > max_weight[i] )
+            max_weight[i] = p_iaea_record->weight;
+      if (p_iaea_record->weight < min_weight[i] )
+            min_weight[i] = p_iaea_record->weight;
+
+      if (fabs(p_iaea_record->energy) > max_energy[i] )
+         max_energy[i] = fabs(p_iaea_record->energy);
+      if (fabs(p_iaea_record->energy) < min_energy[i] )
+         min_energy[i] = fabs(p_iaea_record->energy);
+  }
+
+}
+
+// Same as above for n particles stored in a block. Equivalent to n calls
+// of add(iaea_record_type*), but the min/max reductions run over
+// contiguous arrays. Variables not stored in the phsp file (constant
+// for the whole source) are taken from p_iaea_record instead of the block.
+void iaea_statistics::add(const iaea_particle_block *b, IAEA_I32 n,
+                          const iaea_record_type *p_iaea_record)
+{
+  if(n <= 0) return;
+
+  int i, j;
+  float xmin, xmax, ymin, ymax, zmin, zmax;
+  min_max(p_iaea_record->ix > 0 ? b->x : NULL, p_iaea_record->x, n, &xmin, &xmax);
+  min_max(p_iaea_record->iy > 0 ? b->y : NULL, p_iaea_record->y, n, &ymin, &ymax);
+  min_max(p_iaea_record->iz > 0 ? b->z : NULL, p_iaea_record->z, n, &zmin, &zmax);
+  if (xmax > max_x )  max_x = xmax;
+  if (xmin < min_x )  min_x = xmin;
+  if (ymax > max_y )  max_y = ymax;
+  if (ymin < min_y )  min_y = ymin;
+  if (zmax > max_z )  max_z = zmax;
+  if (zmin < min_z )  min_z = zmin;
+
+  n_particles += n;
+
+  IAEA_I64 new_histories = 0;
+  for(i=0;i<n;i++)
+      new_histories += (b->n_stat[i] > 0) ? b->n_stat[i] : 0;
+  indep_histories += new_histories;
+
+  for(i=0;i<n;i++)
+  {
+      j = b->type[i]-1;
+      if( j < 0 || j >= MAX_NUM_PARTICLES ) continue;
+
+      float wt = (p_iaea_record->iweight > 0) ? b->weight[i] : p_iaea_record->weight;
+      float energy = fabs(b->energy[i]);
+
+      particle_number[j]++;
+      sum_weight[j] += wt;
+      sum_energy[j] += wt*energy;
+      if (wt > max_weight[j] ) max_weight[j] = wt;
+      if (wt < min_weight[j] ) min_weight[j] = wt;
+      if (energy > max_energy[j] ) max_energy[j] = energy;
+      if (energy < min_energy[j] ) min_energy[j] = energy;
   }
+}
+
+void iaea_statistics::merge(const iaea_statistics *s)
+{
+  n_particles += s->n_particles;
+  indep_histories += s->indep_histories;
 
+  for(int i=0;i<MAX_NUM_PARTICLES;i++)
+  {
+      particle_number[i] += s->particle_number[i];
+      sum_weight[i] += s->sum_weight[i];
+      sum_energy[i] += s->sum_energy[i];
+      if (s->max_weight[i] > max_weight[i] ) max_weight[i] = s->max_weight[i];
+      if (s->min_weight[i] < min_weight[i] ) min_weight[i] = s->min_weight[i];
+      if (s->max_energy[i] > max_energy[i] ) max_energy[i] = s->max_energy[i];
+      if (s->min_energy[i] < min_energy[i] ) min_energy[i] = s->min_energy[i];
+  }
+  if (s->max_x > max_x )  max_x = s->max_x;
+  if (s->min_x < min_x )  min_x = s->min_x;
+  if (s->max_y > max_y )  max_y = s->max_y;
+  if (s->min_y < min_y )  min_y = s->min_y;
+  if (s->max_z > max_z )  max_z = s->max_z;
+  if (s->min_z < min_z )  min_z = s->min_z;
 }
 
 void iaea_header_type::print_statistics()
@@ -707,13 +976,18 @@ int iaea_header_type::write_header()
       printf("\n ERROR: Opening header file to write \n"); return(FAIL);
   }
 
+  reduce_statistics();
+
   rewind(fheader);
 
   if( write_blockname("IAEA_INDEX") == FAIL ) return(FAIL);
 
   fprintf(fheader,"%i   // Test header\n\n",iaea_index);
 
-  write_blockname("TITLE");fprintf(fheader,"%s \n\n",title);
+  // A title read from a header keeps its line end, which is written here
+  int title_len = (int)strlen(title);
+  while(title_len > 0 && isspace((unsigned char)title[title_len-1])) title_len--;
+  write_blockname("TITLE");fprintf(fheader,"%.*s \n\n",title_len,title);
 
   write_blockname("FILE_TYPE");fprintf(fheader,"0\n\n"); // phasespace is assumed
 
@@ -925,6 +1199,8 @@ int iaea_header_type::write_header()
 
 int iaea_header_type::print_header ()
 {
+    reduce_statistics();
+
 
     if(checksum == 0) printf("\n NEW PHASE SPACE FILE WILL BE CREATED\n");
 
@@ -3,6 +3,7 @@
 
 /* *********************************************************************** */
 #include "iaea_record.h"
+#include "iaea_index.h"
 
 // defines
 #define SEGMENT_BEG_TOKEN '$'
@@ -33,9 +34,36 @@
  //  more to be defined
 
 
+// Statistics of a set of records, kept apart from the header so that they
+// can be accumulated cheaply (one partial per source being written, or per
+// scanning thread) and reduced into the header counters afterwards.
+// Weighted energies are summed, as in the header while it is being written.
+struct iaea_statistics
+{
+  IAEA_I64 n_particles;
+  IAEA_I64 indep_histories;
+  IAEA_I64 particle_number[MAX_NUM_PARTICLES];
+  double sum_weight[MAX_NUM_PARTICLES];
+  double sum_energy[MAX_NUM_PARTICLES];  // weighted kinetic energy
+  double min_weight[MAX_NUM_PARTICLES], max_weight[MAX_NUM_PARTICLES];
+  double min_energy[MAX_NUM_PARTICLES], max_energy[MAX_NUM_PARTICLES];
+  double min_x, max_x;
+  double min_y, max_y;
+  double min_z, max_z;
+
+public:
+      void reset();
+      void add(const iaea_record_type *p_iaea_record);
+      // Variables not stored in the phsp file are taken from p_iaea_record
+      void add(const iaea_particle_block *block, IAEA_I32 n,
+               const iaea_record_type *p_iaea_record);
+      void merge(const iaea_statistics *s);
+};
+
 struct iaea_header_type
 {
   FILE *fheader;
+  int access;               // as given to iaea_new_source
   // ******************************************************************************
   // 1. PHSP format
   
@@ -136,6 +164,19 @@ struct iaea_header_type
 
   IAEA_I64 read_indep_histories;  
 
+  // Statistics of the records written (or read, if read_statistics is set)
+  // since they were last reduced into the counters above, which happens
+  // when the header is written or printed.
+  iaea_statistics stats;
+  int read_statistics;
+
+  // History index (.IAEAindex sidecar). Loaded when a phsp file is opened
+  // for reading if it matches the file; kept up to date and written when
+  // a new phsp file is written (write_index != 0). NULL if not available.
+  iaea_index_type *p_index;
+  int write_index;
+  char index_file[MAX_STR_LEN];
+
 // CLASS FUNCTIONS
 
 public:
@@ -146,6 +187,15 @@ public:
       int get_record_contents(iaea_record_type *p_iaea_record);
       void initialize_counters();
       void update_counters(iaea_record_type *p_iaea_record);
+      void update_counters(const iaea_particle_block *block, IAEA_I32 n,
+                           const iaea_record_type *p_iaea_record);
+      void reduce_statistics(); // fold stats into the header counters
+      // Counters of a header read from a file, as a partial that can be
+      // merged into the statistics of another source
+      void get_statistics(iaea_statistics *s);
+      // Recompute the counters from all records of the phsp file, reading
+      // it with n_threads threads. Returns OK or FAIL.
+      int scan_statistics(iaea_record_type *p_iaea_record, IAEA_I32 n_threads);
 
 private:
       int read_block(char *lineread, const char *blockname);
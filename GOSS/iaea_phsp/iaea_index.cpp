@@ -0,0 +1,315 @@
+/*
+ * History index (.IAEAindex sidecar) of IAEA phase space files.
+ * See iaea_index.h for the layout of the index.
+ *
+ * File format (byte order of the machine that wrote it):
+ *   char     magic[8]   = IAEA_INDEX_MAGIC
+ *   IAEA_I64 byte_order = IAEA_INDEX_BYTE_ORDER
+ *   IAEA_I64 stride, n_records, n_histories, record_length, n_entries
+ *   IAEA_I64 history[n_entries]
+ *   IAEA_I64 offset[n_entries]
+ *
+ * The byte_order word reads reversed on a machine of the opposite byte
+ * order, and the values are then swapped as they are read. Indexes of the
+ * first version (IAEA_INDEX_MAGIC_V1) have no such word and are read in
+ * the native byte order.
+ */
+#if (defined WIN32) || (defined WIN64)
+#include <iostream>  // so that namespace std becomes defined
+#endif
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if !(defined WIN32) && !(defined WIN64)
+using namespace std;
+#endif
+
+#include "iaea_index.h"
+
+short iaea_index_type::initialize(IAEA_I64 the_stride, IAEA_I64 the_length)
+{
+  release();
+  if(the_stride <= 0 || the_length <= 0) return (FAIL);
+
+  stride = the_stride;
+  record_length = the_length;
+  n_records = 0;
+  n_histories = 0;
+  return (OK);
+}
+
+void iaea_index_type::release()
+{
+  free(history);
+  free(offset);
+  history = NULL;
+  offset = NULL;
+  n_entries = 0;
+  capacity = 0;
+}
+
+short iaea_index_type::add(IAEA_I64 the_history, IAEA_I64 the_offset)
+{
+  if(n_entries == capacity)
+  {
+     IAEA_I64 n = (capacity > 0) ? 2*capacity : 1024;
+     IAEA_I64 *h = (IAEA_I64 *) realloc(history, (size_t)n*sizeof(IAEA_I64));
+     if(h == NULL) return (FAIL);
+     history = h;
+     IAEA_I64 *o = (IAEA_I64 *) realloc(offset, (size_t)n*sizeof(IAEA_I64));
+     if(o == NULL) return (FAIL);
+     offset = o;
+     capacity = n;
+  }
+  history[n_entries] = the_history;
+  offset[n_entries] = the_offset;
+  n_entries++;
+  return (OK);
+}
+
+short iaea_index_type::note_record(int new_history)
+{
+  short result = OK;
+  if(new_history)
+  {
+     if(n_histories % stride == 0)
+        result = add(n_histories, n_records*record_length);
+     n_histories++;
+  }
+  n_records++;
+  return result;
+}
+
+static IAEA_I64 swap_i64(IAEA_I64 value)
+{
+  unsigned char b[8], s[8];
+  memcpy(b, &value, 8);
+  for(int i=0;i<8;i++) s[i] = b[7-i];
+  memcpy(&value, s, 8);
+  return value;
+}
+
+static void swap_i64s(IAEA_I64 *values, IAEA_I64 n)
+{
+  for(IAEA_I64 i=0;i<n;i++) values[i] = swap_i64(values[i]);
+}
+
+short iaea_index_type::read(const char *filename)
+{
+  release();
+
+  FILE *f = fopen(filename, "rb");
+  if(f == NULL) return (FAIL);
+
+  char magic[8];
+  IAEA_I64 order = IAEA_INDEX_BYTE_ORDER;
+  IAEA_I64 v[5];
+  short result = FAIL;
+  int swap = 0, known = 0;
+  if( fread(magic, 1, 8, f) == 8 )
+  {
+     if( memcmp(magic, IAEA_INDEX_MAGIC, 8) == 0 )
+     {
+        if( fread(&order, sizeof(IAEA_I64), 1, f) == 1 )
+        {
+           swap = (order == swap_i64(IAEA_INDEX_BYTE_ORDER));
+           known = swap || (order == IAEA_INDEX_BYTE_ORDER);
+        }
+        if(!known)
+           fprintf(stderr, "\n ERROR: %s has an unknown byte order\n", filename);
+     }
+     else if( memcmp(magic, IAEA_INDEX_MAGIC_V1, 8) == 0 ) known = 1;
+  }
+
+  if( known && fread(v, sizeof(IAEA_I64), 5, f) == 5 )
+  {
+     if(swap) swap_i64s(v, 5);
+  }
+  else known = 0;
+
+  if( known && v[0] > 0 && v[4] >= 0 )
+  {
+     stride = v[0];
+     n_records = v[1];
+     n_histories = v[2];
+     record_length = v[3];
+     n_entries = capacity = v[4];
+     history = (IAEA_I64 *) malloc((size_t)(n_entries+1)*sizeof(IAEA_I64));
+     offset = (IAEA_I64 *) malloc((size_t)(n_entries+1)*sizeof(IAEA_I64));
+     if( history != NULL && offset != NULL &&
+         fread(history, sizeof(IAEA_I64), (size_t)n_entries, f) == (size_t)n_entries &&
+         fread(offset, sizeof(IAEA_I64), (size_t)n_entries, f) == (size_t)n_entries )
+     {
+        if(swap)
+        {
+           swap_i64s(history, n_entries);
+           swap_i64s(offset, n_entries);
+        }
+        result = OK;
+     }
+  }
+  fclose(f);
+
+  if(result != OK) release();
+  return result;
+}
+
+short iaea_index_type::write(const char *filename)
+{
+  FILE *f = fopen(filename, "wb");
+  if(f == NULL)
+  {
+     fprintf(stderr, "\n ERROR: Cannot open index file %s\n", filename);
+     return (FAIL);
+  }
+
+  IAEA_I64 v[5] = {stride, n_records, n_histories, record_length, n_entries};
+  const IAEA_I64 order = IAEA_INDEX_BYTE_ORDER;
+  short result = OK;
+  if( fwrite(IAEA_INDEX_MAGIC, 1, 8, f) != 8 ||
+      fwrite(&order, sizeof(IAEA_I64), 1, f) != 1 ||
+      fwrite(v, sizeof(IAEA_I64), 5, f) != 5 ||
+      fwrite(history, sizeof(IAEA_I64), (size_t)n_entries, f) != (size_t)n_entries ||
+      fwrite(offset, sizeof(IAEA_I64), (size_t)n_entries, f) != (size_t)n_entries )
+     result = FAIL;
+  if( fclose(f) != 0 ) result = FAIL;
+
+  if(result != OK)
+     fprintf(stderr, "\n ERROR: Failed to write index file %s\n", filename);
+  return result;
+}
+
+IAEA_I64 iaea_index_type::find(IAEA_I64 the_history)
+{
+  // Binary search, entries are sorted by history
+  IAEA_I64 lo = 0, hi = n_entries;
+  while(lo < hi)
+  {
+     IAEA_I64 mid = lo + (hi - lo)/2;
+     if(history[mid] <= the_history) lo = mid + 1;
+     else hi = mid;
+  }
+  return lo - 1;
+}
+
+IAEA_I64 iaea_index_type::chunk_start(IAEA_I32 i_chunk, IAEA_I32 n_chunk)
+{
+  // Records before the first new history belong to the first chunk
+  if(i_chunk <= 1) return 0;
+  if(i_chunk > n_chunk) return n_records;
+
+  IAEA_I64 target = (n_histories/n_chunk)*(i_chunk-1) +
+                    ((n_histories%n_chunk)*(i_chunk-1))/n_chunk;
+  IAEA_I64 e = find(target);
+  if(e < 0) return 0;
+  return offset[e]/record_length;
+}
+
+// Scans n records of record_length bytes at src, the first of them being
+// record number first. *n_hist is the ordinal of the next new history, it
+// is advanced for every new history found. Those whose ordinal is a
+// multiple of stride are added to index. The records are as stored in the
+// file, swap tells whether their byte order is the opposite of ours.
+static short scan_histories(const char *src, IAEA_I64 n, IAEA_I64 first,
+                            IAEA_I64 record_length, IAEA_I64 stride, int swap,
+                            IAEA_I64 *n_hist, iaea_index_type *index)
+{
+  for(IAEA_I64 i=0;i<n;i++)
+  {
+     float energy;
+     if(swap) iaea_swap_words((char *)&energy, src + i*record_length + 1, 1);
+     else memcpy(&energy, src + i*record_length + 1, sizeof(float));
+     if(energy < 0) // new history is signaled by negative energy
+     {
+        if( *n_hist % stride == 0 &&
+            index->add(*n_hist, (first + i)*record_length) != OK )
+           return (FAIL);
+        (*n_hist)++;
+     }
+  }
+  return (OK);
+}
+
+// Scans records [rec_0, rec_1) of a source into a local index whose
+// history ordinals start from 0. Reads at explicit offsets only.
+static void scan_range(iaea_record_type *p, IAEA_I64 rec_0, IAEA_I64 rec_1,
+                       IAEA_I64 record_length, IAEA_I64 stride,
+                       iaea_index_type *local, short *result)
+{
+  const IAEA_I64 per_read = (IAEA_PREAD_BUFFER/record_length > 0) ?
+                            IAEA_PREAD_BUFFER/record_length : 1;
+  std::vector<char> buf((size_t)(per_read*record_length));
+
+  IAEA_I64 n_hist = 0;
+  *result = OK;
+  for(IAEA_I64 rec=rec_0;rec<rec_1;rec+=per_read)
+  {
+     IAEA_I64 n = rec_1 - rec;
+     if(n > per_read) n = per_read;
+     if( p->read_at(buf.data(), n*record_length, rec*record_length) !=
+         n*record_length ||
+         scan_histories(buf.data(), n, rec, record_length, stride,
+                        p->swap_bytes, &n_hist, local) != OK )
+     {
+        *result = FAIL;
+        return;
+     }
+  }
+  local->n_histories = n_hist;
+}
+
+short iaea_index_type::build(iaea_record_type *p, IAEA_I64 the_records,
+                             IAEA_I64 the_stride, IAEA_I32 n_threads)
+{
+  if( initialize(the_stride, p->record_size()) != OK ) return (FAIL);
+  n_records = the_records;
+
+  #if (defined WIN32) || (defined WIN64)
+  n_threads = 1; // read_at() moves the stdio position
+  #endif
+  if(n_threads < 1) n_threads = 1;
+  if(n_records < (IAEA_I64)n_threads) n_threads = 1;
+
+  // Each thread indexes its own range as if it were a file of its own,
+  // with history ordinals relative to the range. Spacing is therefore
+  // exactly stride within a range and may be shorter at range boundaries.
+  std::vector<iaea_index_type> local(n_threads);
+  std::vector<short> status(n_threads, FAIL);
+  std::vector<std::thread> workers;
+  for(IAEA_I32 t=0;t<n_threads;t++)
+  {
+     memset(&local[t], 0, sizeof(iaea_index_type));
+     local[t].initialize(stride, record_length);
+  }
+
+  for(IAEA_I32 t=0;t<n_threads;t++)
+  {
+     IAEA_I64 rec_0 = (n_records/n_threads)*t;
+     IAEA_I64 rec_1 = (t == n_threads-1) ? n_records : rec_0 + n_records/n_threads;
+     if(n_threads == 1)
+        scan_range(p, rec_0, rec_1, record_length, stride, &local[t], &status[t]);
+     else
+        workers.push_back(std::thread(scan_range, p, rec_0, rec_1, record_length,
+                                      stride, &local[t], &status[t]));
+  }
+  for(size_t t=0;t<workers.size();t++) workers[t].join();
+
+  short result = OK;
+  n_histories = 0;
+  for(IAEA_I32 t=0;t<n_threads;t++)
+  {
+     if(status[t] != OK) result = FAIL;
+     for(IAEA_I64 e=0;result==OK && e<local[t].n_entries;e++)
+        if( add(n_histories + local[t].history[e], local[t].offset[e]) != OK )
+           result = FAIL;
+     n_histories += local[t].n_histories;
+     local[t].release();
+  }
+
+  if(result != OK)
+     fprintf(stderr, "\n ERROR: Failed to build the history index\n");
+  return result;
+}
@@ -0,0 +1,63 @@
+#ifndef IAEA_INDEX
+#define IAEA_INDEX
+
+/* *********************************************************************** */
+#include "iaea_record.h"
+
+// History index of a phase space file, stored in a .IAEAindex sidecar
+// next to the .IAEAheader and .IAEAphsp files.
+//
+// An entry is kept for (about) every stride-th new history, i.e. every
+// stride-th record with negative energy. Each entry holds the ordinal of
+// that history (counting from 0) and the byte offset of its record, so
+// that a source can be positioned at the start of any history, and split
+// into chunks that never cut a history, without reading the whole file.
+
+#ifndef IAEA_INDEX_STRIDE
+  #define IAEA_INDEX_STRIDE 1024 // new histories between index entries
+#endif
+
+#define IAEA_INDEX_MAGIC "IAEAidx2"
+#define IAEA_INDEX_MAGIC_V1 "IAEAidx1" // no byte-order word, native order
+#define IAEA_INDEX_BYTE_ORDER 0x0102030405060708LL
+
+struct iaea_index_type
+{
+  IAEA_I64 stride;        // nominal number of new histories between entries
+  IAEA_I64 n_records;     // records in the phsp file
+  IAEA_I64 n_histories;   // records starting a new history
+  IAEA_I64 record_length; // bytes per record
+
+  IAEA_I64 n_entries;
+  IAEA_I64 capacity;
+  IAEA_I64 *history;      // ordinal of the new history of each entry
+  IAEA_I64 *offset;       // byte offset of its record
+
+// CLASS FUNCTIONS
+
+public:
+      // Empty index for a file with records of record_length bytes
+      short initialize(IAEA_I64 stride, IAEA_I64 record_length);
+      void  release();
+
+      short add(IAEA_I64 history, IAEA_I64 offset);
+      // Book-keeping of a record appended by a writer (see iaea_write_particle)
+      short note_record(int new_history);
+
+      short read(const char *filename);
+      short write(const char *filename);
+
+      // Last entry whose history is not after the given one (-1 if none)
+      IAEA_I64 find(IAEA_I64 history);
+
+      // Record number (from 0) starting chunk i_chunk of n_chunk (1 based),
+      // chunks holding the same number of histories up to the stride
+      IAEA_I64 chunk_start(IAEA_I32 i_chunk, IAEA_I32 n_chunk);
+
+      // Scans the records of a read source with n_threads threads and
+      // fills the index. Returns OK or FAIL.
+      short build(iaea_record_type *p_iaea_record, IAEA_I64 n_records,
+                  IAEA_I64 stride, IAEA_I32 n_threads);
+};
+
+#endif
@@ -54,6 +54,7 @@
 #include <cmath>
 #include <cctype>
 #include <algorithm>  // for max() and min()
+#include <atomic>
 
 #include<sys/types.h>
 #include<sys/stat.h>
@@ -73,9 +74,240 @@ using namespace std;
 // These variables are defined globally. They contain pointers
 // to header and record structures defined by calling iaea_new_source()
 // routine to maintain a list of already initialized IAEA sources.
+//
+// The list is a table of segments of IAEA_SOURCE_SEGMENT slots. Segments
+// are allocated on demand and never moved or freed, so looking up a
+// source needs no lock while other threads create or destroy sources.
+// Slots are claimed and released with atomic operations only.
+
+struct iaea_source_slot
+{
+  std::atomic<int> used;
+  iaea_header_type *header;
+  iaea_record_type *record;
+};
+
+#define IAEA_NUM_SEGMENTS (MAX_NUM_SOURCES/IAEA_SOURCE_SEGMENT)
+
+static std::atomic<iaea_source_slot *> __iaea_segment[IAEA_NUM_SEGMENTS];
+
+// Unused or out of range Id's resolve to empty header and record
+// structures (fheader == NULL), so that every function can report
+// a non-existing source instead of dereferencing a stale pointer.
+static iaea_header_type __iaea_no_header;
+static iaea_record_type __iaea_no_record;
+
+static iaea_source_slot *iaea_get_slot(IAEA_I32 id)
+{
+   if( id < 0 || id >= MAX_NUM_SOURCES ) return NULL;
+   iaea_source_slot *seg =
+      __iaea_segment[id/IAEA_SOURCE_SEGMENT].load(std::memory_order_acquire);
+   if( seg == NULL ) return NULL;
+   return &seg[id%IAEA_SOURCE_SEGMENT];
+}
+
+static struct iaea_header_table
+{
+   iaea_header_type *operator[](IAEA_I32 id) const
+   {
+     iaea_source_slot *slot = iaea_get_slot(id);
+     if( slot == NULL || slot->header == NULL ) return &__iaea_no_header;
+     return slot->header;
+   }
+} p_iaea_header;
+
+static struct iaea_record_table
+{
+   iaea_record_type *operator[](IAEA_I32 id) const
+   {
+     iaea_source_slot *slot = iaea_get_slot(id);
+     if( slot == NULL || slot->record == NULL ) return &__iaea_no_record;
+     return slot->record;
+   }
+} p_iaea_record;
+
+// Claims the lowest free slot, adding a segment if all are in use.
+// Returns the source Id or -1 if MAX_NUM_SOURCES sources already exist.
+static IAEA_I32 iaea_claim_slot()
+{
+   for(int k=0; k<IAEA_NUM_SEGMENTS; k++) {
+       iaea_source_slot *seg = __iaea_segment[k].load(std::memory_order_acquire);
+       if( seg == NULL ) {
+           iaea_source_slot *fresh = new iaea_source_slot[IAEA_SOURCE_SEGMENT];
+           for(int j=0; j<IAEA_SOURCE_SEGMENT; j++) {
+               fresh[j].used.store(0, std::memory_order_relaxed);
+               fresh[j].header = NULL;
+               fresh[j].record = NULL;
+           }
+           if( __iaea_segment[k].compare_exchange_strong(seg, fresh,
+                                                         std::memory_order_acq_rel) )
+               seg = fresh;
+           else
+               delete [] fresh; // another thread added it, seg is now set
+       }
+       for(int j=0; j<IAEA_SOURCE_SEGMENT; j++) {
+           int expected = 0;
+           if( seg[j].used.compare_exchange_strong(expected, 1,
+                                                   std::memory_order_acq_rel) )
+               return k*IAEA_SOURCE_SEGMENT + j;
+       }
+   }
+   return -1;
+}
+
+static void iaea_release_slot(IAEA_I32 id)
+{
+   iaea_source_slot *slot = iaea_get_slot(id);
+   if( slot == NULL ) return;
+   slot->header = NULL;
+   slot->record = NULL;
+   slot->used.store(0, std::memory_order_release);
+}
+
+// Name of a file of the phsp with the given extension, from the name of
+// the header file (given with or without its extension)
+static short iaea_file_name(const char *header_file, const char *extension,
+                            char *name)
+{
+   const char *header_extension = ".IAEAheader";
+   size_t len = strlen(header_file);
+   size_t elen = strlen(header_extension);
+   if( len >= elen && !strcmp(header_file + len - elen, header_extension) ) len -= elen;
+   if( len + strlen(extension) >= MAX_STR_LEN ) { name[0] = '\0'; return (FAIL); }
+   memcpy(name, header_file, len);
+   strcpy(name + len, extension);
+   return (OK);
+}
+
+// The history index of a phsp file is kept in a .IAEAindex sidecar
+static void iaea_index_name(iaea_header_type *h, const char *header_file)
+{
+   iaea_file_name(header_file, ".IAEAindex", h->index_file);
+}
+
+// True if the records of a phsp being read are in a GOSS columnar file,
+// i.e. there is a .GOSSphsp file and no .IAEAphsp one
+static int iaea_is_columnar(const char *header_file)
+{
+   char name[MAX_STR_LEN];
+   FILE *f;
+   if( iaea_file_name(header_file, ".IAEAphsp", name) != OK ) return 0;
+   if( (f = fopen(name, "rb")) != NULL ) { fclose(f); return 0; }
+   if( iaea_file_name(header_file, ".GOSSphsp", name) != OK ) return 0;
+   if( (f = fopen(name, "rb")) == NULL ) return 0;
+   fclose(f);
+   return 1;
+}
+
+// Opens the .GOSSphsp file of a source, to write a new one or to read it
+static short iaea_open_columnar(iaea_record_type *r, const char *header_file,
+                                int writing)
+{
+   char name[MAX_STR_LEN];
+   if( iaea_file_name(header_file, ".GOSSphsp", name) != OK ) return (FAIL);
+   r->p_columnar = (iaea_columnar_file *) calloc(1, sizeof(iaea_columnar_file));
+   if( r->p_columnar == NULL ) return (FAIL);
+   short status = writing ? r->p_columnar->create(name) : r->p_columnar->open(name);
+   if( status != OK )
+   {
+      fprintf(stderr,"\n ERROR: Failed to open GOSS phsp file %s\n", name);
+      free(r->p_columnar);
+      r->p_columnar = NULL;
+   }
+   return status;
+}
+
+static void iaea_free_index(iaea_header_type *h)
+{
+   if( h->p_index == NULL ) return;
+   h->p_index->release();
+   free(h->p_index);
+   h->p_index = NULL;
+}
+
+// Loads the index of a source opened for reading. An index that does not
+// match the phsp file (e.g. left over from a previous version) is ignored.
+static void iaea_load_index(iaea_header_type *h)
+{
+   if( h->index_file[0] == '\0' ) return;
+   h->p_index = (iaea_index_type *) calloc(1, sizeof(iaea_index_type));
+   if( h->p_index == NULL ) return;
+
+   if( h->p_index->read(h->index_file) != OK ) { iaea_free_index(h); return; }
+
+   if( h->p_index->n_records != h->nParticles ||
+       h->p_index->record_length != h->record_length )
+   {
+       fprintf(stderr,
+         "\n WARNING: %s does not match the phsp file and is ignored\n",
+         h->index_file);
+       iaea_free_index(h);
+   }
+}
 
-static iaea_header_type *p_iaea_header[MAX_NUM_SOURCES];
-static iaea_record_type *p_iaea_record[MAX_NUM_SOURCES];
+// Rewrites the .IAEAheader file of a source opened for reading with the
+// current header values. The new header is written next to the old one
+// and renamed over it, so the file is never left half written.
+static int iaea_rewrite_header(iaea_header_type *h)
+{
+   const char *extension = ".IAEAindex";
+   size_t len = strlen(h->index_file);
+   size_t elen = strlen(extension);
+   if( len <= elen ) return (FAIL);
+
+   char name[MAX_STR_LEN+16], temp[MAX_STR_LEN+32];
+   memcpy(name, h->index_file, len - elen);
+   strcpy(name + len - elen, ".IAEAheader");
+   sprintf(temp, "%s.tmp", name);
+
+   FILE *old_header = h->fheader;
+   h->fheader = fopen(temp, "wb");
+   if( h->fheader == NULL ) { h->fheader = old_header; return (FAIL); }
+   int status = h->write_header();
+   if( fclose(h->fheader) != 0 ) status = FAIL;
+
+   fclose(old_header);
+   #if (defined WIN32) || (defined WIN64)
+   if( status == OK ) remove(name); // rename() does not replace files
+   #endif
+   if( status != OK || rename(temp, name) != 0 ) { remove(temp); status = FAIL; }
+
+   h->fheader = fopen(name, "rb");
+   if( h->fheader == NULL ) return (FAIL);
+   return status;
+}
+
+// Records of a file written on a machine of the opposite byte order are
+// swapped while they are read. Other orders (e.g. PDP) are left alone.
+static void iaea_set_byte_swap(IAEA_I32 id)
+{
+   int file_order = p_iaea_header[id]->byte_order;
+   int machine_order = check_byte_order();
+   p_iaea_record[id]->swap_bytes =
+      ( (file_order == LITTLE_ENDIAN && machine_order == BIG_ENDIAN) ||
+        (file_order == BIG_ENDIAN && machine_order == LITTLE_ENDIAN) ) ? 1 : 0;
+}
+
+// First record (from 0) and end record of chunk i_chunk of n_chunk. With
+// a history index the chunks start at new histories, otherwise the file
+// is split in n_chunk equal portions (any remainder is not used).
+// Returns 1 if the chunk limits are history aligned, 0 otherwise.
+static int iaea_chunk_limits(IAEA_I32 id, IAEA_I32 i_chunk, IAEA_I32 n_chunk,
+                             IAEA_I64 *first, IAEA_I64 *last)
+{
+   iaea_index_type *index = p_iaea_header[id]->p_index;
+   if( index != NULL && !p_iaea_header[id]->write_index )
+   {
+       *first = index->chunk_start(i_chunk, n_chunk);
+       *last = index->chunk_start(i_chunk+1, n_chunk);
+       return 1;
+   }
+
+   IAEA_I64 number_record_per_chunk = p_iaea_header[id]->nParticles/n_chunk;
+   *first = (i_chunk-1)*number_record_per_chunk;
+   *last = *first + number_record_per_chunk;
+   return 0;
+}
 
 /************************************************************************
 * Initialization
@@ -96,12 +328,25 @@ static iaea_record_type *p_iaea_record[MAX_NUM_SOURCES];
 * access = 1 => opening read-only file
 * access = 2 => opening file for writing
 * access = 3 => opening file for appending/updating
+* access = 4 => opening read-only file, memory-mapped. Records are decoded
+*               from the mapped region and all sources reading the same
+*               file share its page cache. Falls back to access = 1 if the
+*               file cannot be mapped.
+* access = 5 => opening read-only file for positional reads. The file is
+*               opened once per process and all sources reading it share
+*               the descriptor, each one reading at its own offset with
+*               pread(). Falls back to access = 1 if not available.
+* access = 6 => opening file for writing in the GOSS columnar format: the
+*               records go to a compressed .GOSSphsp file instead of the
+*               .IAEAphsp one (see iaea_columnar.h), the header is the same.
+*
+* When reading (access = 1, 4 or 5), a .GOSSphsp file is read if there is
+* no .IAEAphsp file. Its records are returned exactly as they were written.
+* It is not memory-mapped, its blocks are decompressed as they are read.
+* Appending (access = 3) to a .GOSSphsp file is not supported.
 *
 ***********************************************************************/
 
-static int __iaea_source_used[MAX_NUM_SOURCES];
-static int __iaea_n_source = 0;
-
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
                      const IAEA_I32 *access, IAEA_I32 *result,
@@ -110,7 +355,7 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
    if( !header_file ) {
        *result = 105; *source_ID = -1; return;
    } // null header file name
-   if(*access != 1 && *access != 2 && *access != 3) {
+   if(*access < 1 || *access > 6) {
        *result = -99 ; *source_ID = -1; return;
    } // Wrong access requested
 
@@ -121,24 +366,12 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
        *result = -101 ; *source_ID = -1; return;
    } // String length < 1
 
-   if( !__iaea_n_source ) { // called for the first time
-       for(int j=0; j<MAX_NUM_SOURCES; j++) __iaea_source_used[j] = false;
-   }
-   int sid=-1;
-   // do we have a spare spot in the arrays ?
-   // (e.g. because a source was destroyed)
-   for(int j=0; j<__iaea_n_source; j++) {
-       if( !__iaea_source_used[j] ) { sid = j; break; }
-   }
+   // The lowest free Id is always assigned, whatever *source_ID holds
+   IAEA_I32 sid = iaea_claim_slot();
    if( sid < 0 ) {
-       // so, we don't => increase source count and check if
-       // space left in arrays.
-       if( ++__iaea_n_source >= MAX_NUM_SOURCES ) {
-           *result = -98; *source_ID = -1; return;
-       }
-       sid = __iaea_n_source-1; *source_ID = sid;
-   }
-   __iaea_source_used[sid] = true;
+       *result = -98; *source_ID = -1; return;
+   } // No space left in the source table
+   *source_ID = sid;
 
    //int ilen = strlen(header_file);
    // the above requires a null-terminated string, which may not be
@@ -151,34 +384,47 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
    }
 
    // Creating IAEA phsp header and allocating memory for it
-   p_iaea_header[*source_ID] = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
+   iaea_source_slot *slot = iaea_get_slot(*source_ID);
+   slot->header = (iaea_header_type *) calloc(1, sizeof(iaea_header_type));
+   p_iaea_header[*source_ID]->access = *access;
    // Opening header file
-   if(*access == 1) p_iaea_header[*source_ID]->fheader =
+   if(*access == 1 || *access == 4 || *access == 5) p_iaea_header[*source_ID]->fheader =
          open_file(header_file,".IAEAheader","rb");
-   if(*access == 2) p_iaea_header[*source_ID]->fheader =
+   if(*access == 2 || *access == 6) p_iaea_header[*source_ID]->fheader =
          open_file(header_file,".IAEAheader","wb");
    if(*access == 3) p_iaea_header[*source_ID]->fheader =
          open_file(header_file,".IAEAheader","r+b");
 
    if(p_iaea_header[*source_ID]->fheader == NULL) { *result = -96; return;} // phsp failed to open
 
+   iaea_index_name(p_iaea_header[*source_ID], header_file);
+
    // Creating IAEA record and allocating memory for it
-   p_iaea_record[*source_ID] = (iaea_record_type *) calloc(1, sizeof(iaea_record_type));
+   slot->record = (iaea_record_type *) calloc(1, sizeof(iaea_record_type));
 
    p_iaea_header[*source_ID]->initialize_counters();
 
    switch( *access )
    {
          case 2: // writing a new phsp
+         case 6: // writing a new phsp in the GOSS columnar format
 
              strcpy(p_iaea_header[*source_ID]->title,"PHASESPACE in IAEA format");
              // Default IAEA index
              *result = p_iaea_header[*source_ID]->iaea_index = 1000;
 
-             p_iaea_record[*source_ID]->p_file =
-                 open_file(header_file, ".IAEAphsp", "wb");
+             if(*access == 6)
+             {
+                 if( iaea_open_columnar(p_iaea_record[*source_ID], header_file, 1) != OK )
+                     { *result = -94 ; return; }
+             }
+             else
+             {
+                 p_iaea_record[*source_ID]->p_file =
+                     open_file(header_file, ".IAEAphsp", "wb");
 
-             if(p_iaea_record[*source_ID]->p_file == NULL) { *result = -94 ; return; }
+                 if(p_iaea_record[*source_ID]->p_file == NULL) { *result = -94 ; return; }
+             }
 
              // Setting default i/o flags
              if(p_iaea_record[*source_ID]->initialize() != OK)
@@ -187,6 +433,13 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
              if( p_iaea_header[*source_ID]->set_record_contents(p_iaea_record[*source_ID])
                  == FAIL ) { *result = -95; return;}
 
+             // The history index is built as particles are written
+             // (it is started at the first one, once the layout is known)
+             p_iaea_header[*source_ID]->p_index =
+                 (iaea_index_type *) calloc(1, sizeof(iaea_index_type));
+             p_iaea_header[*source_ID]->write_index =
+                 (p_iaea_header[*source_ID]->p_index != NULL);
+
              return;
 
          case 3 : // appending to the existing phsp
@@ -200,6 +453,16 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
                  p_iaea_header[*source_ID]->averageKineticEnergy[i] *=
                  p_iaea_header[*source_ID]->sumParticleWeight[i];
 
+             if( iaea_is_columnar(header_file) )
+             {
+                 fprintf(stderr,
+                   "\n ERROR: appending to a GOSS columnar phsp file is not supported\n");
+                 *result = -94; return;
+             }
+
+             // An existing history index would not cover the new records
+             remove(p_iaea_header[*source_ID]->index_file);
+
              // Opening phsp file to append
              p_iaea_record[*source_ID]->p_file =
                  open_file(header_file, ".IAEAphsp", "a+b");
@@ -217,15 +480,64 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
              break;
 
          case 1 : // reading existing phsp
+         case 4 : // reading existing phsp through a memory mapping
 
              if( p_iaea_header[*source_ID]->read_header() != OK) { *result = -93; return;}
 
              // Opening phsp file to read
-             p_iaea_record[*source_ID]->p_file =
-                 open_file(header_file, ".IAEAphsp", "rb");
+             if( iaea_is_columnar(header_file) )
+             {
+                 if( iaea_open_columnar(p_iaea_record[*source_ID], header_file, 0) != OK )
+                     { *result = -94 ; return; }
+             }
+             else
+             {
+                 p_iaea_record[*source_ID]->p_file =
+                     open_file(header_file, ".IAEAphsp", "rb");
+
+                 if(p_iaea_record[*source_ID]->p_file == NULL)
+                     { *result = -94 ; return; }
+             }
+
+             if(p_iaea_record[*source_ID]->initialize() != OK) {*result = -1; return;}
+
+             // Get read/write logical block from the header
+             if( p_iaea_header[*source_ID]->get_record_contents(p_iaea_record[*source_ID])
+                 == FAIL) { *result = -91; return;}
+
+             if(*access == 4 && p_iaea_record[*source_ID]->p_columnar == NULL &&
+                p_iaea_record[*source_ID]->map_file() != OK)
+                 fprintf(stderr,
+                   "\n WARNING: phsp file could not be mapped, using stdio access\n");
 
-             if(p_iaea_record[*source_ID]->p_file == NULL)
-                 { *result = -94 ; return; }
+             iaea_set_byte_swap(*source_ID);
+             iaea_load_index(p_iaea_header[*source_ID]);
+
+             *result = p_iaea_header[*source_ID]->iaea_index; // returning IAEA index
+
+             break;
+
+         case 5 : // reading existing phsp through a shared descriptor
+
+             if( p_iaea_header[*source_ID]->read_header() != OK) { *result = -93; return;}
+
+             // Opening phsp file to read, unless another source already did.
+             // Columnar files are read with pread() anyway.
+             if( iaea_is_columnar(header_file) )
+             {
+                 if( iaea_open_columnar(p_iaea_record[*source_ID], header_file, 0) != OK )
+                     { *result = -94 ; return; }
+             }
+             else if( p_iaea_record[*source_ID]->open_shared(header_file) != OK )
+             {
+                 fprintf(stderr,
+                   "\n WARNING: phsp file could not be shared, using stdio access\n");
+                 p_iaea_record[*source_ID]->p_file =
+                     open_file(header_file, ".IAEAphsp", "rb");
+
+                 if(p_iaea_record[*source_ID]->p_file == NULL)
+                     { *result = -94 ; return; }
+             }
 
              if(p_iaea_record[*source_ID]->initialize() != OK) {*result = -1; return;}
 
@@ -233,6 +545,9 @@ void iaea_new_source(IAEA_I32 *source_ID, char *header_file,
              if( p_iaea_header[*source_ID]->get_record_contents(p_iaea_record[*source_ID])
                  == FAIL) { *result = -91; return;}
 
+             iaea_set_byte_swap(*source_ID);
+             iaea_load_index(p_iaea_header[*source_ID]);
+
              *result = p_iaea_header[*source_ID]->iaea_index; // returning IAEA index
 
              break;
@@ -304,10 +619,12 @@ void iaea_get_max_particles(const IAEA_I32 *id, const IAEA_I32 *type,
             return;
       }
       // phsp file
-      if (*type < 0) {*n_particle = p_iaea_header[*id]->nParticles; return;}
+      // including the particles not yet reduced into the header counters
+      iaea_header_type *h = p_iaea_header[*id];
+      if (*type < 0) {*n_particle = h->nParticles + h->stats.n_particles; return;}
       if ( (*type >= MAX_NUM_PARTICLES) || (*type ==0) ) {*n_particle = 0; return;}
 
-      *n_particle = p_iaea_header[*id]->particle_number[*type-1];
+      *n_particle = h->particle_number[*type-1] + h->stats.particle_number[*type-1];
 
       return;
 }
@@ -825,7 +1142,8 @@ void iaea_get_used_original_particles(const IAEA_I32 *id, IAEA_I64 *n_indep_part
       if(p_iaea_header[*id]->fheader == NULL) {*n_indep_particles = -1; return;}
 
       // (Number of electron histories for linacs)
-      *n_indep_particles = p_iaea_header[*id]->read_indep_histories;
+      *n_indep_particles = p_iaea_header[*id]->read_indep_histories +
+                           p_iaea_header[*id]->stats.indep_histories;
       return;
 }
 IAEA_EXTERN_C IAEA_EXPORT
@@ -934,6 +1252,8 @@ void IAEA_SET_TOTAL_ORIGINAL_PARTICLES__(const IAEA_I32 *id,
 * should divide the available phase space of source with Id id
 * into n_chunk equal portions and from now on deliver particles
 * from the i_chunk-th portion. (i_chunk must be between 1 and n_chunk)
+* If the phsp file has a history index (.IAEAindex) the portions start at
+* new histories, see iaea_get_parallel_limits().
 * The extra parameter i_parallel is needed
 * for the cases where the source is an event generator and should
 * be used to adjust the random number sequence.
@@ -957,14 +1277,11 @@ void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32* /*i_parallel*/,
          return;
    }
 
-   IAEA_I64 nrecords =  p_iaea_header[*id]->nParticles;
    IAEA_I32 record_length =  p_iaea_header[*id]->record_length;
-   // IAEA_I32 number_record_per_chunk = (IAEA_I32)nrecords/(*n_chunk); // changed, May 2011
-   IAEA_I64 number_record_per_chunk = nrecords/(*n_chunk);
+   IAEA_I64 first_record, last_record;
+   iaea_chunk_limits(*id, *i_chunk, *n_chunk, &first_record, &last_record);
 
-
-   // IAEA_I32 offset = ((*i_chunk)-1)*record_length * number_record_per_chunk;	// changed, May 2011
-   IAEA_I64 offset = ((*i_chunk)-1)*record_length * number_record_per_chunk;
+   IAEA_I64 offset = record_length * first_record;
    /*
    SEEK_CUR   Current position of file pointer
    SEEK_END   End of file
@@ -973,11 +1290,13 @@ void iaea_set_parallel(const IAEA_I32 *id, const IAEA_I32* /*i_parallel*/,
    offset   Number of bytes from origin
    origin   Initial position
    */
-   if( fseek(p_iaea_record[*id]->p_file, offset ,SEEK_SET) == 0)
+   if( p_iaea_record[*id]->seek(offset) == OK)
    {
-         // IAEA_I32 pos = ftell(p_iaea_record[*id]->p_file);  // changed, May 2011
-	     IAEA_I64 pos = (IAEA_I64)ftell(p_iaea_record[*id]->p_file);
-	 (void) pos; //(MACG) -Wunused-variable
+         // For mapped sources tell the kernel which part of the file this
+         // chunk will stream through. The last chunk runs to end of file.
+         IAEA_I64 length = record_length * (last_record - first_record);
+         if(*i_chunk == *n_chunk) length = p_iaea_record[*id]->map_size - offset;
+         p_iaea_record[*id]->advise(offset, length);
          *result = 0;
          return;
    }
@@ -1040,16 +1359,7 @@ void iaea_check_file_size_byte_order(const IAEA_I32 *id,
 
    int machine_byte_order = check_byte_order();
 
-   #if (defined WIN32) || (defined WIN64)
-     // IAEA_I64 size = _filelengthi64(fileno(p_iaea_record[*id]->p_file));
-     struct _stati64 fileStatus;
-     _fstati64(fileno(p_iaea_record[*id]->p_file),&fileStatus);
-   #else
-     struct stat fileStatus;
-     fstat(fileno(p_iaea_record[*id]->p_file),&fileStatus);
-   #endif
-
-   IAEA_I64 size = fileStatus.st_size;
+   IAEA_I64 size = p_iaea_record[*id]->file_size();
    printf(" phsp size = %llu\n",size);
 
    // bug found, changed to filelength use. May 2011
@@ -1128,10 +1438,8 @@ void iaea_set_record(const IAEA_I32 *id, const IAEA_I64 *record_num,
    origin   Initial position
    */
 
-   if( fseek(p_iaea_record[*id]->p_file, offset ,SEEK_SET) == 0)
+   if( p_iaea_record[*id]->seek(offset) == OK)
    {
-     IAEA_I32 pos = ftell(p_iaea_record[*id]->p_file);
-     (void) pos; //(MACG)-Wunused-variable
      *result = 0;
      return;
    }
@@ -1165,6 +1473,404 @@ void IAEA_SET_RECORD__(const IAEA_I32 *id,
                                             IAEA_I32 *is_ok)
 { iaea_set_record(id, record_num, is_ok); }
 
+/**************************************************************************
+* Chunk limits for parallel runs
+*
+* Set first_record and last_record to the records that iaea_set_parallel()
+* delivers for chunk i_chunk of n_chunk: records first_record+1 up to
+* last_record (counting from 1). If the phsp file has a history index
+* (.IAEAindex) every chunk starts at a new history and holds about the
+* same number of histories; otherwise the file is split in n_chunk equal
+* portions of records.
+* result is set to 1 if the chunks are history aligned, to 0 if not, and
+* to the same negative codes as iaea_set_parallel() on error.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_limits(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *last_record, IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+   if(*n_chunk <= 0) {*result = -2; return;}
+   if( (*i_chunk < 1) || (*i_chunk > *n_chunk) ) {*result = -3; return;}
+
+   *result = iaea_chunk_limits(*id, *i_chunk, *n_chunk, first_record, last_record);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_limits_(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *last_record, IAEA_I32 *result)
+{ iaea_get_parallel_limits(id, i_chunk, n_chunk, first_record, last_record, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_limits__(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *last_record, IAEA_I32 *result)
+{ iaea_get_parallel_limits(id, i_chunk, n_chunk, first_record, last_record, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARALLEL_LIMITS(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *last_record, IAEA_I32 *result)
+{ iaea_get_parallel_limits(id, i_chunk, n_chunk, first_record, last_record, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARALLEL_LIMITS_(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *last_record, IAEA_I32 *result)
+{ iaea_get_parallel_limits(id, i_chunk, n_chunk, first_record, last_record, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARALLEL_LIMITS__(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *last_record, IAEA_I32 *result)
+{ iaea_get_parallel_limits(id, i_chunk, n_chunk, first_record, last_record, result); }
+
+/**************************************************************************
+* Build the history index of a phsp file
+*
+* Scan the phsp file of source id (open for reading) with n_threads
+* threads, write its .IAEAindex sidecar and use it from now on. An entry
+* is stored for every stride-th new history (stride <= 0 selects the
+* default IAEA_INDEX_STRIDE). Files written through these routines get
+* their index when the source is destroyed, so this is only needed for
+* files coming from elsewhere.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist, to -2 if the file could not be scanned and to -3 if the index
+* could not be written (it is used anyway).
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_build_index(const IAEA_I32 *id, const IAEA_I64 *stride,
+                      const IAEA_I32 *n_threads, IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   if( h->write_index ) {*result = -1; return;} // not for files being written
+
+   iaea_free_index(h);
+   h->p_index = (iaea_index_type *) calloc(1, sizeof(iaea_index_type));
+   if( h->p_index == NULL ) {*result = -2; return;}
+
+   IAEA_I64 every = (*stride > 0) ? *stride : IAEA_INDEX_STRIDE;
+   IAEA_I64 n_records = p->file_size()/h->record_length;
+   if( h->p_index->build(p, n_records, every, *n_threads) != OK )
+   {
+      iaea_free_index(h);
+      *result = -2;
+      return;
+   }
+
+   *result = 0;
+   if( h->index_file[0] == '\0' || h->p_index->write(h->index_file) != OK )
+      *result = -3;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_build_index_(const IAEA_I32 *id, const IAEA_I64 *stride,
+                      const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_build_index(id, stride, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_build_index__(const IAEA_I32 *id, const IAEA_I64 *stride,
+                      const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_build_index(id, stride, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_BUILD_INDEX(const IAEA_I32 *id, const IAEA_I64 *stride,
+                      const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_build_index(id, stride, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_BUILD_INDEX_(const IAEA_I32 *id, const IAEA_I64 *stride,
+                      const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_build_index(id, stride, n_threads, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_BUILD_INDEX__(const IAEA_I32 *id, const IAEA_I64 *stride,
+                      const IAEA_I32 *n_threads, IAEA_I32 *result)
+{ iaea_build_index(id, stride, n_threads, result); }
+
+/**************************************************************************
+* Setting the pointer to a user-specified history in the file
+*
+* Position source id at the record starting the history_num-th new
+* history (counting from 1) of the file. With a history index this reads
+* at most one index stride of records, otherwise the file is scanned from
+* the beginning.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist or a read error occurs, to -2 if history_num < 1 and to -3 if
+* the file holds fewer histories.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history(const IAEA_I32 *id, const IAEA_I64 *history_num,
+                      IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+   if(*history_num < 1) {*result = -2; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   iaea_record_type *p = p_iaea_record[*id];
+   const IAEA_I64 record_length = h->record_length;
+   const IAEA_I64 n_records = p->file_size()/record_length;
+   const IAEA_I64 target = *history_num - 1; // ordinal counting from 0
+
+   // Start from the closest indexed history before the target
+   IAEA_I64 n_hist = 0, record = 0;
+   if( h->p_index != NULL && !h->write_index )
+   {
+      IAEA_I64 e = h->p_index->find(target);
+      if(e >= 0)
+      {
+         n_hist = h->p_index->history[e];
+         record = h->p_index->offset[e]/record_length;
+      }
+   }
+
+   const IAEA_I64 per_read = (IAEA_PREAD_BUFFER/record_length > 0) ?
+                             IAEA_PREAD_BUFFER/record_length : 1;
+   char *buf = (char *) malloc((size_t)(per_read*record_length));
+   if(buf == NULL) {*result = -1; return;}
+
+   *result = -3;
+   while(record < n_records && *result == -3)
+   {
+      IAEA_I64 n = n_records - record;
+      if(n > per_read) n = per_read;
+      if( p->read_at(buf, n*record_length, record*record_length) != n*record_length )
+      {
+         *result = -1;
+         break;
+      }
+      for(IAEA_I64 i=0;i<n;i++)
+      {
+         float energy;
+         if(p->swap_bytes)
+            iaea_swap_words((char *)&energy, buf + i*record_length + 1, 1);
+         else memcpy(&energy, buf + i*record_length + 1, sizeof(float));
+         if(energy < 0) // new history is signaled by negative energy
+         {
+            if(n_hist == target)
+            {
+               *result = (p->seek((record + i)*record_length) == OK) ? 0 : -1;
+               break;
+            }
+            n_hist++;
+         }
+      }
+      record += n;
+   }
+
+   free(buf);
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history_(const IAEA_I32 *id, const IAEA_I64 *history_num,
+                      IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history__(const IAEA_I32 *id, const IAEA_I64 *history_num,
+                      IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HISTORY(const IAEA_I32 *id, const IAEA_I64 *history_num,
+                      IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HISTORY_(const IAEA_I32 *id, const IAEA_I64 *history_num,
+                      IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_HISTORY__(const IAEA_I32 *id, const IAEA_I64 *history_num,
+                      IAEA_I32 *result)
+{ iaea_set_history(id, history_num, result); }
+
+/**************************************************************************
+* Statistics of the particles read
+*
+* By default reading a source only counts the statistically independent
+* histories read (iaea_get_used_original_particles). With mode = 1 every
+* particle read from source id is also added to the header counters
+* (number of particles of each type, weights, energies and coordinates), as
+* is always done when writing; mode = 0 turns this off again.
+* result is set to 0 if everything went smoothly and to -1 if the source
+* does not exist.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_statistics(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   h->read_statistics = (*mode != 0);
+
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_statistics_(const IAEA_I32 *id, const IAEA_I32 *mode,
+                          IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_statistics__(const IAEA_I32 *id, const IAEA_I32 *mode,
+                           IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STATISTICS(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STATISTICS_(const IAEA_I32 *id, const IAEA_I32 *mode,
+                          IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STATISTICS__(const IAEA_I32 *id, const IAEA_I32 *mode,
+                           IAEA_I32 *result)
+{ iaea_set_statistics(id, mode, result); }
+
+/**************************************************************************
+* Read-ahead
+*
+* Keep up to n_bytes of source id (open for reading) following the current
+* position read in advance by a background thread, so that the file is
+* read (and a GOSS file decompressed) while the caller processes the
+* previous records. Seeks (iaea_set_record, iaea_set_parallel, ...) move
+* the read-ahead along. n_bytes = 0 stops it.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist or is not open for reading and to -2 if the source is memory
+* mapped (access = 4, read ahead by the kernel) or the thread could not be
+* started.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_ahead(const IAEA_I32 *id, const IAEA_I64 *n_bytes,
+                         IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   if( h->access == 2 || h->access == 3 || h->access == 6 ) {*result = -1; return;}
+
+   iaea_record_type *p = p_iaea_record[*id];
+   if( p->p_map != NULL ) {*result = -2; return;}
+   if( p->start_read_ahead(*n_bytes) != OK ) {*result = -2; return;}
+
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_ahead_(const IAEA_I32 *id, const IAEA_I64 *n_bytes,
+                          IAEA_I32 *result)
+{ iaea_set_read_ahead(id, n_bytes, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_ahead__(const IAEA_I32 *id, const IAEA_I64 *n_bytes,
+                           IAEA_I32 *result)
+{ iaea_set_read_ahead(id, n_bytes, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_READ_AHEAD(const IAEA_I32 *id, const IAEA_I64 *n_bytes,
+                         IAEA_I32 *result)
+{ iaea_set_read_ahead(id, n_bytes, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_READ_AHEAD_(const IAEA_I32 *id, const IAEA_I64 *n_bytes,
+                          IAEA_I32 *result)
+{ iaea_set_read_ahead(id, n_bytes, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_READ_AHEAD__(const IAEA_I32 *id, const IAEA_I64 *n_bytes,
+                           IAEA_I32 *result)
+{ iaea_set_read_ahead(id, n_bytes, result); }
+
+/**************************************************************************
+* Streaming
+*
+* With mode = 1 the pages of the phsp file of source id that have already
+* been read or written are dropped from the page cache as the source moves
+* on (every few MB), so that streaming huge files does not evict the data
+* of other jobs from memory. Written pages are flushed to disk before being
+* dropped. mode = 0 turns this off again.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist and to -2 if the source is memory mapped (access = 4) or the
+* page cache cannot be controlled on this system.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_streaming(const IAEA_I32 *id, const IAEA_I32 *mode,
+                        IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   short writing = ( h->access == 2 || h->access == 3 || h->access == 6 );
+   short stream_mode = (*mode == 0) ? 0 : (writing ? 2 : 1);
+
+   if( p_iaea_record[*id]->set_streaming(stream_mode) != OK ) {*result = -2; return;}
+
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_streaming_(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_streaming(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_streaming__(const IAEA_I32 *id, const IAEA_I32 *mode,
+                          IAEA_I32 *result)
+{ iaea_set_streaming(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STREAMING(const IAEA_I32 *id, const IAEA_I32 *mode,
+                        IAEA_I32 *result)
+{ iaea_set_streaming(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STREAMING_(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result)
+{ iaea_set_streaming(id, mode, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SET_STREAMING__(const IAEA_I32 *id, const IAEA_I32 *mode,
+                          IAEA_I32 *result)
+{ iaea_set_streaming(id, mode, result); }
+
+/**************************************************************************
+* Recompute the header statistics of a phsp file
+*
+* Read all the records of source id (open for reading) with n_threads
+* threads and replace the counters of its header (number of particles of
+* each type, weights, energies and coordinates, checksum) with those of the
+* records found. Each thread accumulates its own partial statistics, which
+* are reduced at the end. If update_header is not 0 the .IAEAheader file is
+* rewritten with the new values.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist or is not open for reading, to -2 if the file could not be
+* scanned and to -3 if the header could not be rewritten.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_scan_statistics(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                          const IAEA_I32 *update_header, IAEA_I32 *result)
+{
+   if(p_iaea_header[*id]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*id];
+   if( h->access == 2 || h->access == 3 || h->access == 6 ) {*result = -1; return;}
+
+   if( h->scan_statistics(p_iaea_record[*id], *n_threads) != OK )
+      {*result = -2; return;}
+
+   *result = 0;
+   if( *update_header != 0 && iaea_rewrite_header(h) != OK ) *result = -3;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_scan_statistics_(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                           const IAEA_I32 *update_header, IAEA_I32 *result)
+{ iaea_scan_statistics(id, n_threads, update_header, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_scan_statistics__(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                            const IAEA_I32 *update_header, IAEA_I32 *result)
+{ iaea_scan_statistics(id, n_threads, update_header, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SCAN_STATISTICS(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                          const IAEA_I32 *update_header, IAEA_I32 *result)
+{ iaea_scan_statistics(id, n_threads, update_header, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SCAN_STATISTICS_(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                           const IAEA_I32 *update_header, IAEA_I32 *result)
+{ iaea_scan_statistics(id, n_threads, update_header, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_SCAN_STATISTICS__(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                            const IAEA_I32 *update_header, IAEA_I32 *result)
+{ iaea_scan_statistics(id, n_threads, update_header, result); }
+
 /**************************************************************************
 * Get a particle
 *
@@ -1193,9 +1899,9 @@ IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints)
 {
-      if(feof(p_iaea_record[*id]->p_file)) {
+      if(p_iaea_record[*id]->at_end()) {
          *n_stat = -2;
-         rewind (p_iaea_record[*id]->p_file);
+         p_iaea_record[*id]->seek(0);
          return;
       }
 
@@ -1256,8 +1962,13 @@ IAEA_I32 *extra_ints)
         Total number of particles,
         Total number of each particle type
         Number of statistically independent histories
+        Only the last one is counted unless statistics are requested
+        on read (see iaea_set_statistics)
       */
-      p_iaea_header[*id]->update_counters(p_iaea_record[*id]);
+      if( p_iaea_header[*id]->read_statistics )
+          p_iaea_header[*id]->update_counters(p_iaea_record[*id]);
+      else if( p->IsNewHistory > 0 )
+          p_iaea_header[*id]->read_indep_histories += p->IsNewHistory;
 
       return;
 }
@@ -1337,6 +2048,170 @@ IAEA_I32 *extra_ints)
 { iaea_get_particle(id, n_stat, type,
                                 E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 
+/**************************************************************************
+* Get a block of particles
+*
+* Same as iaea_get_particle() for up to n_max consecutive particles of
+* source id, decoded into caller-provided arrays of length n_max
+* (structure of arrays). Extra variable k of particle i is returned in
+* extra_floats[k*n_max + i] (resp. extra_ints); both may be NULL if the
+* extra variables are not needed.
+* n_read is set to the number of particles decoded, which is smaller than
+* n_max only at the end of the file. Set n_read to -1 if a source with
+* Id id does not exist or a read error occurs, and to -2 if the end of
+* the phase space file was already reached.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{
+      if(p_iaea_header[*id]->fheader == NULL) {*n_read = -1; return;}
+      if(*n_max <= 0) {*n_read = 0; return;}
+
+      iaea_record_type *p = p_iaea_record[*id];
+
+      if(p->at_end()) {
+         *n_read = -2;
+         p->seek(0);
+         return;
+      }
+
+      // Looking for incremental number of histories
+      // (Type 1 of the extralong stored variable)
+      int nstat_long = -1;
+      for(int j=0;j<p->iextralong ;j++)
+          if(p_iaea_header[*id]->extralong_contents[j] == 1) nstat_long = j;
+
+      iaea_particle_block block;
+      block.n_stat = n_stat;
+      block.type = type;
+      block.energy = E;
+      block.weight = wt;
+      block.x = x; block.y = y; block.z = z;
+      block.u = u; block.v = v; block.w = w;
+      block.extrafloat = extra_floats;
+      block.extralong = extra_ints;
+      block.stride = *n_max;
+
+      IAEA_I32 n = p->read_particles(*n_max, &block, nstat_long);
+      if( n == FAIL ) { *n_read = -1; return;}
+      if( n == 0 ) {
+         *n_read = -2;
+         p->seek(0);
+         return;
+      }
+
+      // Updating counters as iaea_get_particle() does for each particle
+      if( p_iaea_header[*id]->read_statistics )
+          p_iaea_header[*id]->update_counters(&block, n, p);
+      else {
+          IAEA_I64 new_histories = 0;
+          for(IAEA_I32 i=0;i<n;i++)
+              new_histories += (n_stat[i] > 0) ? n_stat[i] : 0;
+          p_iaea_header[*id]->read_indep_histories += new_histories;
+      }
+
+      *n_read = n;
+      return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles_(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particles(id, n_max, n_read, n_stat, type,
+                     E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles__(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particles(id, n_max, n_read, n_stat, type,
+                     E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLES(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particles(id, n_max, n_read, n_stat, type,
+                     E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLES_(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particles(id, n_max, n_read, n_stat, type,
+                     E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_GET_PARTICLES__(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints)
+{ iaea_get_particles(id, n_max, n_read, n_stat, type,
+                     E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+
 /**************************************************************************
 * Write a particle
 * n_stat = 0 for a secondary particle
@@ -1380,6 +2255,13 @@ const IAEA_I32 *extra_ints)
 
       if( p->write_particle() == FAIL ) {*n_stat = -1; return;}
 
+      iaea_header_type *h = p_iaea_header[*id];
+      if( h->write_index ) {
+          if( h->p_index->stride == 0 )
+              h->p_index->initialize(IAEA_INDEX_STRIDE, p->record_size());
+          h->p_index->note_record(*n_stat > 0);
+      }
+
       /*
         Updating counters including:
         Min and Max Weight per particle,
@@ -1470,6 +2352,152 @@ const IAEA_I32 *extra_ints)
 { iaea_write_particle(id, n_stat, type,
                                 E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
 
+/**************************************************************************
+* Write a block of particles
+*
+* Same as iaea_write_particle() for the n consecutive particles held in
+* arrays of length n (structure of arrays). Extra variable k of particle i
+* is taken from extra_floats[k*n + i] (resp. extra_ints); both may be NULL
+* if the source stores no extra variables of that kind (zeros are written).
+* The records are staged in memory and written with a few large writes.
+* n_written is set to the number of particles written, or to -1 if a
+* source with Id id does not exist or a write error occurs.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{
+      if(p_iaea_header[*id]->fheader == NULL) {*n_written = -1; return;}
+      if(*n <= 0) {*n_written = 0; return;}
+
+      iaea_record_type *p = p_iaea_record[*id];
+
+      iaea_particle_block block;
+      block.n_stat = (IAEA_I32 *) n_stat;
+      block.type = (IAEA_I32 *) type;
+      block.energy = (IAEA_Float *) E;
+      block.weight = (IAEA_Float *) wt;
+      block.x = (IAEA_Float *) x; block.y = (IAEA_Float *) y;
+      block.z = (IAEA_Float *) z;
+      block.u = (IAEA_Float *) u; block.v = (IAEA_Float *) v;
+      block.w = (IAEA_Float *) w;
+      block.extrafloat = (IAEA_Float *) extra_floats;
+      block.extralong = (IAEA_I32 *) extra_ints;
+      block.stride = *n;
+
+      if( p->write_particles(*n, &block) == FAIL ) {*n_written = -1; return;}
+
+      iaea_header_type *h = p_iaea_header[*id];
+      if( h->write_index ) {
+          if( h->p_index->stride == 0 )
+              h->p_index->initialize(IAEA_INDEX_STRIDE, p->record_size());
+          for(IAEA_I32 i=0;i<*n;i++) h->p_index->note_record(n_stat[i] > 0);
+      }
+
+      // Updating counters as iaea_write_particle() does for each particle
+      p_iaea_header[*id]->update_counters(&block, *n, p);
+
+      *n_written = *n;
+      return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles_(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type,
+                       E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_write_particles__(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type,
+                       E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type,
+                       E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES_(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type,
+                       E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_WRITE_PARTICLES__(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints)
+{ iaea_write_particles(id, n, n_written, n_stat, type,
+                       E, wt, x, y, z, u, v, w, extra_floats, extra_ints); }
+
 /***************************************************************************
 * Destroy a source
 *
@@ -1480,7 +2508,7 @@ const IAEA_I32 *extra_ints)
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_destroy_source(const IAEA_I32 *source_ID, IAEA_I32 *result)
 {
-   if(*source_ID > MAX_NUM_SOURCES) { *result = -98 ; return;} // Too big phsp ID
+   if(*source_ID >= MAX_NUM_SOURCES) { *result = -98 ; return;} // Too big phsp ID
    if(*source_ID < 0)               { *result = -97 ; return;} // wrong ID number
 
    if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
@@ -1489,19 +2517,27 @@ void iaea_destroy_source(const IAEA_I32 *source_ID, IAEA_I32 *result)
    // For read-only files nothing happens
    p_iaea_header[*source_ID]->write_header();
 
+   // Writing the history index of a new phsp file
+   if( p_iaea_header[*source_ID]->write_index &&
+       p_iaea_header[*source_ID]->p_index->stride > 0 )
+       p_iaea_header[*source_ID]->p_index->write(p_iaea_header[*source_ID]->index_file);
+   iaea_free_index(p_iaea_header[*source_ID]);
+
    // Closing header file
    fclose(p_iaea_header[*source_ID]->fheader);
    // Deallocating IAEA phsp header
    free(p_iaea_header[*source_ID]);
 
    // Closing phsp file
-   fclose(p_iaea_record[*source_ID]->p_file);
+   short closed = p_iaea_record[*source_ID]->release();
+   if(p_iaea_record[*source_ID]->p_file != NULL)
+      fclose(p_iaea_record[*source_ID]->p_file);
    // Deallocating IAEA record
    free(p_iaea_record[*source_ID]);
 
-   __iaea_source_used[*source_ID] = false;
+   iaea_release_slot(*source_ID);
 
-   *result = 1; // Return OK
+   *result = (closed == OK) ? 1 : -1; // Return OK
 
    return;
 }
@@ -1672,6 +2708,121 @@ void IAEA_COPY_HEADER__(const IAEA_I32 *source_ID,
                                            IAEA_I32 *result)
 { iaea_copy_header(source_ID, destiny_ID, result); }
 
+/***************************************************************************
+* Append all the particles of source_ID to destiny_ID
+*
+* source_ID must be open for reading and destiny_ID for writing (new or
+* appended file). The records are concatenated as they are, without being
+* decoded, copied in the kernel where the system allows it (if either file
+* is in the GOSS columnar format they are recompressed or decompressed
+* instead, which converts between the formats). The header of
+* destiny_ID is updated from that of source_ID: original histories,
+* number of particles of each type and the rest of its statistics. If
+* nothing has been written to destiny_ID yet it takes the record layout of
+* source_ID, otherwise both layouts (stored variables, constants and extra
+* variables) must be the same. The history index of destiny_ID is kept if
+* source_ID has one, and dropped otherwise.
+* result is set to 0 if everything went smoothly, to -1 if a source does
+* not exist or is not open in the right mode, to -2 if the record layouts
+* differ and to -3 if the particles could not be copied.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_append_source(const IAEA_I32 *destiny_ID, const IAEA_I32 *source_ID,
+                        IAEA_I32 *result)
+{
+   if(p_iaea_header[*destiny_ID]->fheader == NULL) {*result = -1; return;}
+   if(p_iaea_header[*source_ID]->fheader == NULL) {*result = -1; return;}
+
+   iaea_header_type *h = p_iaea_header[*destiny_ID];
+   iaea_header_type *hs = p_iaea_header[*source_ID];
+   iaea_record_type *p = p_iaea_record[*destiny_ID];
+   iaea_record_type *ps = p_iaea_record[*source_ID];
+   if( h->access != 2 && h->access != 3 && h->access != 6 ) {*result = -1; return;}
+   if( hs->access == 2 || hs->access == 3 || hs->access == 6 || hs->file_type != 0 )
+      {*result = -1; return;}
+
+   int i;
+   if( h->nParticles + h->stats.n_particles == 0 )
+   {
+      // Nothing written yet: same layout as the source
+      for(i=0;i<9;i++) h->record_contents[i] = hs->record_contents[i];
+      for(i=0;i<7;i++) h->record_constant[i] = hs->record_constant[i];
+      for(i=0;i<NUM_EXTRA_FLOAT;i++) h->extrafloat_contents[i] = hs->extrafloat_contents[i];
+      for(i=0;i<NUM_EXTRA_LONG;i++) h->extralong_contents[i] = hs->extralong_contents[i];
+      if( h->get_record_contents(p) == FAIL ) {*result = -2; return;}
+   }
+   else
+   {
+      int same = (h->record_length == hs->record_length);
+      for(i=0;i<9;i++) same = same && h->record_contents[i] == hs->record_contents[i];
+      for(i=0;i<7;i++) same = same && ( h->record_contents[i] == 1 ||
+                                  h->record_constant[i] == hs->record_constant[i] );
+      for(i=0;i<h->record_contents[7];i++)
+         same = same && h->extrafloat_contents[i] == hs->extrafloat_contents[i];
+      for(i=0;i<h->record_contents[8];i++)
+         same = same && h->extralong_contents[i] == hs->extralong_contents[i];
+      if( !same ) {*result = -2; return;}
+   }
+
+   const IAEA_I64 record_length = hs->record_length;
+   const IAEA_I64 n_records = ps->file_size()/record_length;
+   const IAEA_I64 n_before = h->nParticles + h->stats.n_particles;
+   if( p->append_file(ps, n_records*record_length) != OK ) {*result = -3; return;}
+
+   // Header counters of the source, as stored in its header file
+   iaea_statistics s;
+   hs->get_statistics(&s);
+   s.n_particles = n_records;
+   h->stats.merge(&s);
+   h->orig_histories += hs->orig_histories;
+
+   // History index: the entries of the source follow those written so far
+   if( h->write_index )
+   {
+      iaea_index_type *index = h->p_index;
+      iaea_index_type *source = hs->p_index;
+      if( source == NULL || source->record_length != record_length ||
+          (index->stride > 0 && index->n_records != n_before) )
+      {
+         iaea_free_index(h);
+         h->write_index = 0;
+      }
+      else
+      {
+         if( index->stride == 0 )
+            index->initialize(source->stride, record_length);
+         for(IAEA_I64 e=0;e<source->n_entries;e++)
+            index->add(index->n_histories + source->history[e],
+                       index->n_records*record_length + source->offset[e]);
+         index->n_records += source->n_records;
+         index->n_histories += source->n_histories;
+      }
+   }
+
+   *result = 0;
+   return;
+}
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_append_source_(const IAEA_I32 *destiny_ID, const IAEA_I32 *source_ID,
+                         IAEA_I32 *result)
+{ iaea_append_source(destiny_ID, source_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_append_source__(const IAEA_I32 *destiny_ID, const IAEA_I32 *source_ID,
+                          IAEA_I32 *result)
+{ iaea_append_source(destiny_ID, source_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_APPEND_SOURCE(const IAEA_I32 *destiny_ID, const IAEA_I32 *source_ID,
+                        IAEA_I32 *result)
+{ iaea_append_source(destiny_ID, source_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_APPEND_SOURCE_(const IAEA_I32 *destiny_ID, const IAEA_I32 *source_ID,
+                         IAEA_I32 *result)
+{ iaea_append_source(destiny_ID, source_ID, result); }
+IAEA_EXTERN_C IAEA_EXPORT
+void IAEA_APPEND_SOURCE__(const IAEA_I32 *destiny_ID, const IAEA_I32 *source_ID,
+                          IAEA_I32 *result)
+{ iaea_append_source(destiny_ID, source_ID, result); }
+
 
 /***************************************************************************
 * Update header of the source_id
@@ -1687,6 +2838,12 @@ void iaea_update_header(const IAEA_I32 *source_ID, IAEA_I32 *result)
    // For read-only files nothing happens
    p_iaea_header[*source_ID]->write_header();
 
+   // Writing the history index of a new phsp file. The index is kept, as
+   // the file may still be written, and freed by iaea_destroy_source()
+   if( p_iaea_header[*source_ID]->write_index &&
+       p_iaea_header[*source_ID]->p_index->stride > 0 )
+       p_iaea_header[*source_ID]->p_index->write(p_iaea_header[*source_ID]->index_file);
+
    *result = 1; // Return OK
    return;
 
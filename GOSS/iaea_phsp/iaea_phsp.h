@@ -70,6 +70,26 @@
 * access = 1 => opening read-only file
 * access = 2 => opening file for writing
 * access = 3 => opening file for appending/updating
+* access = 4 => opening read-only file, memory-mapped. Records are decoded
+*               from the mapped region and all sources reading the same
+*               file share its page cache. Falls back to access = 1 if the
+*               file cannot be mapped.
+* access = 5 => opening read-only file for positional reads. The file is
+*               opened once per process and all sources reading it share
+*               the descriptor, each one reading at its own offset with
+*               pread(). Falls back to access = 1 if not available.
+* access = 6 => opening file for writing in the GOSS columnar format: the
+*               records go to a compressed .GOSSphsp file instead of the
+*               .IAEAphsp one (see iaea_columnar.h), the header is the same.
+*
+* When reading (access = 1, 4 or 5), a .GOSSphsp file is read if there is
+* no .IAEAphsp file. Its records are returned exactly as they were written.
+* It is not memory-mapped, its blocks are decompressed as they are read.
+* Appending (access = 3) to a .GOSSphsp file is not supported.
+*
+* Files written on a machine of the opposite byte order (BYTE_ORDER in the
+* header) are read with any of the read accesses, their records being
+* byte-swapped as they are fetched.
 *
 ***********************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT 
@@ -298,6 +318,8 @@ void iaea_set_total_original_particles(const IAEA_I32 *id,
 * should divide the available phase space of source with Id id
 * into n_chunk equal portions and from now on deliver particles
 * from the i_chunk-th portion. (i_chunk must be between 1 and n_chunk)
+* If the phsp file has a history index (.IAEAindex) the portions start at
+* new histories, see iaea_get_parallel_limits().
 * The extra parameter i_parallel is needed
 * for the cases where the source is an event generator and should
 * be used to adjust the random number sequence.
@@ -321,12 +343,127 @@ IAEA_EXTERN_C IAEA_EXPORT
 void iaea_set_record(const IAEA_I32 *id, const IAEA_I64 *record_num,
                            IAEA_I32 *result);
 
+/**************************************************************************
+* Chunk limits for parallel runs
+*
+* Set first_record and last_record to the records that iaea_set_parallel()
+* delivers for chunk i_chunk of n_chunk: records first_record+1 up to
+* last_record (counting from 1). If the phsp file has a history index
+* (.IAEAindex) every chunk starts at a new history and holds about the
+* same number of histories; otherwise the file is split in n_chunk equal
+* portions of records.
+* result is set to 1 if the chunks are history aligned, to 0 if not, and
+* to the same negative codes as iaea_set_parallel() on error.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_parallel_limits(const IAEA_I32 *id, const IAEA_I32 *i_chunk,
+                              const IAEA_I32 *n_chunk, IAEA_I64 *first_record,
+                              IAEA_I64 *last_record, IAEA_I32 *result);
+
+/**************************************************************************
+* Build the history index of a phsp file
+*
+* Scan the phsp file of source id (open for reading) with n_threads
+* threads, write its .IAEAindex sidecar and use it from now on. An entry
+* is stored for every stride-th new history (stride <= 0 selects the
+* default IAEA_INDEX_STRIDE). Files written through these routines get
+* their index when the source is destroyed, so this is only needed for
+* files coming from elsewhere.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist, to -2 if the file could not be scanned and to -3 if the index
+* could not be written (it is used anyway).
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_build_index(const IAEA_I32 *id, const IAEA_I64 *stride,
+                      const IAEA_I32 *n_threads, IAEA_I32 *result);
+
+/**************************************************************************
+* Setting the pointer to a user-specified history in the file
+*
+* Position source id at the record starting the history_num-th new
+* history (counting from 1) of the file. With a history index this reads
+* at most one index stride of records, otherwise the file is scanned from
+* the beginning.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist or a read error occurs, to -2 if history_num < 1 and to -3 if
+* the file holds fewer histories.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_history(const IAEA_I32 *id, const IAEA_I64 *history_num,
+                      IAEA_I32 *result);
+
+/**************************************************************************
+* Statistics of the particles read
+*
+* By default reading a source only counts the statistically independent
+* histories read (iaea_get_used_original_particles). With mode = 1 every
+* particle read from source id is also added to the header counters
+* (number of particles of each type, weights, energies and coordinates), as
+* is always done when writing; mode = 0 turns this off again.
+* result is set to 0 if everything went smoothly and to -1 if the source
+* does not exist.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_statistics(const IAEA_I32 *id, const IAEA_I32 *mode,
+                         IAEA_I32 *result);
+
+/**************************************************************************
+* Read-ahead
+*
+* Keep up to n_bytes of source id (open for reading) following the current
+* position read in advance by a background thread, so that the file is
+* read (and a GOSS file decompressed) while the caller processes the
+* previous records. Seeks (iaea_set_record, iaea_set_parallel, ...) move
+* the read-ahead along. n_bytes = 0 stops it.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist or is not open for reading and to -2 if the source is memory
+* mapped (access = 4, read ahead by the kernel) or the thread could not be
+* started.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_read_ahead(const IAEA_I32 *id, const IAEA_I64 *n_bytes,
+                         IAEA_I32 *result);
+
+/**************************************************************************
+* Streaming
+*
+* With mode = 1 the pages of the phsp file of source id that have already
+* been read or written are dropped from the page cache as the source moves
+* on (every few MB), so that streaming huge files does not evict the data
+* of other jobs from memory. Written pages are flushed to disk before being
+* dropped. mode = 0 turns this off again.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist and to -2 if the source is memory mapped (access = 4) or the
+* page cache cannot be controlled on this system.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_set_streaming(const IAEA_I32 *id, const IAEA_I32 *mode,
+                        IAEA_I32 *result);
+
+/**************************************************************************
+* Recompute the header statistics of a phsp file
+*
+* Read all the records of source id (open for reading) with n_threads
+* threads and replace the counters of its header (number of particles of
+* each type, weights, energies and coordinates, checksum) with those of the
+* records found. Each thread accumulates its own partial statistics, which
+* are reduced at the end. If update_header is not 0 the .IAEAheader file is
+* rewritten with the new values.
+* result is set to 0 if everything went smoothly, to -1 if the source does
+* not exist or is not open for reading, to -2 if the file could not be
+* scanned and to -3 if the header could not be rewritten.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_scan_statistics(const IAEA_I32 *id, const IAEA_I32 *n_threads,
+                          const IAEA_I32 *update_header, IAEA_I32 *result);
+
 /**************************************************************************
 * check that the file size equals the value of checksum in the header
 *
 * id is the phase space file identifier.  If the size of the phase space
 * file is not equal to checksum, then result returns -1, otherwise result
-* is set to 0.
+* is set to 0. A byte order mismatch is reported as -4 (-5 together with a
+* size mismatch); sources opened for reading swap such records themselves.
 **************************************************************************/
 IAEA_EXTERN_C IAEA_EXPORT
 void iaea_check_file_size_byte_order(const IAEA_I32 *id, IAEA_I32 *result);
@@ -358,6 +495,35 @@ IAEA_Float *w,  /* direction in cartesian coordinates*/
 IAEA_Float *extra_floats,
 IAEA_I32 *extra_ints);
 
+/**************************************************************************
+* Get a block of particles
+*
+* Same as iaea_get_particle() for up to n_max consecutive particles of
+* source id, decoded into caller-provided arrays of length n_max
+* (structure of arrays). Extra variable k of particle i is returned in
+* extra_floats[k*n_max + i] (resp. extra_ints); both may be NULL if the
+* extra variables are not needed.
+* n_read is set to the number of particles decoded, which is smaller than
+* n_max only at the end of the file. Set n_read to -1 if a source with
+* Id id does not exist or a read error occurs, and to -2 if the end of
+* the phase space file was already reached.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_get_particles(const IAEA_I32 *id, const IAEA_I32 *n_max,
+IAEA_I32 *n_read,
+IAEA_I32 *n_stat,
+IAEA_I32 *type, /* particle type */
+IAEA_Float *E,  /* kinetic energy in MeV */
+IAEA_Float *wt, /* statistical weight */
+IAEA_Float *x,
+IAEA_Float *y,
+IAEA_Float *z,  /* position in cartesian coordinates*/
+IAEA_Float *u,
+IAEA_Float *v,
+IAEA_Float *w,  /* direction in cartesian coordinates*/
+IAEA_Float *extra_floats,
+IAEA_I32 *extra_ints);
+
 /**************************************************************************
 * Write a particle 
 * n_stat = 0 for a secondary particle
@@ -380,6 +546,33 @@ const IAEA_Float *w,  /* direction in cartesian coordinates*/
 const IAEA_Float *extra_floats,
 const IAEA_I32 *extra_ints);
 
+/**************************************************************************
+* Write a block of particles
+*
+* Same as iaea_write_particle() for the n consecutive particles held in
+* arrays of length n (structure of arrays). Extra variable k of particle i
+* is taken from extra_floats[k*n + i] (resp. extra_ints); both may be NULL
+* if the source stores no extra variables of that kind (zeros are written).
+* The records are staged in memory and written with a few large writes.
+* n_written is set to the number of particles written, or to -1 if a
+* source with Id id does not exist or a write error occurs.
+**************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT 
+void iaea_write_particles(const IAEA_I32 *id, const IAEA_I32 *n,
+IAEA_I32 *n_written,
+const IAEA_I32 *n_stat,
+const IAEA_I32 *type, /* particle type */
+const IAEA_Float *E,  /* kinetic energy in MeV */
+const IAEA_Float *wt, /* statistical weight */
+const IAEA_Float *x,
+const IAEA_Float *y,
+const IAEA_Float *z,  /* position in cartesian coordinates*/
+const IAEA_Float *u,
+const IAEA_Float *v,
+const IAEA_Float *w,  /* direction in cartesian coordinates*/
+const IAEA_Float *extra_floats,
+const IAEA_I32 *extra_ints);
+
 /***************************************************************************
 * Destroy a source 
 *
@@ -405,6 +598,28 @@ IAEA_EXTERN_C IAEA_EXPORT
 void iaea_copy_header(const IAEA_I32 *source_ID, const IAEA_I32 *destiny_ID, 
                       IAEA_I32 *result);
 
+/***************************************************************************
+* Append all the particles of source_ID to destiny_ID
+*
+* source_ID must be open for reading and destiny_ID for writing (new or
+* appended file). The records are concatenated as they are, without being
+* decoded, copied in the kernel where the system allows it (if either file
+* is in the GOSS columnar format they are recompressed or decompressed
+* instead, which converts between the formats). The header of
+* destiny_ID is updated from that of source_ID: original histories,
+* number of particles of each type and the rest of its statistics. If
+* nothing has been written to destiny_ID yet it takes the record layout of
+* source_ID, otherwise both layouts (stored variables, constants and extra
+* variables) must be the same. The history index of destiny_ID is kept if
+* source_ID has one, and dropped otherwise.
+* result is set to 0 if everything went smoothly, to -1 if a source does
+* not exist or is not open in the right mode, to -2 if the record layouts
+* differ and to -3 if the particles could not be copied.
+****************************************************************************/
+IAEA_EXTERN_C IAEA_EXPORT
+void iaea_append_source(const IAEA_I32 *destiny_ID, const IAEA_I32 *source_ID,
+                        IAEA_I32 *result);
+
 /***************************************************************************
 * Update header of the source_id 
 ****************************************************************************/
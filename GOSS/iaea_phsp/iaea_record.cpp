@@ -49,16 +49,48 @@
 #endif
 #include <math.h>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <condition_variable>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <stdint.h>
+
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#if !(defined WIN32) && !(defined WIN64)
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
 
 #if !(defined WIN32) && !(defined WIN64)
 using namespace std;
 #endif
 
+// Streaming needs posix_fadvise() (not on Windows nor macOS)
+#if !(defined WIN32) && !(defined WIN64) && defined(POSIX_FADV_DONTNEED)
+  #define IAEA_FADVISE
+#endif
+
 #include "iaea_record.h"
 
 short iaea_record_type::initialize()
 {
-  if(p_file == NULL) {
+  if(p_file == NULL && p_shared == NULL && p_columnar == NULL) {
      fprintf(stderr, "\n ERROR: Failed to open Phase Space file \n");
      return (FAIL);
   }
@@ -91,20 +123,1442 @@ short iaea_record_type::initialize()
   return (OK);
 }
 
+/* *********************************************************************** */
+// Memory-mapped access
+
+short iaea_record_type::map_file()
+{
+  p_map = NULL;
+  map_size = 0;
+  map_pos = 0;
+
+  if(p_file == NULL) return (FAIL);
+
+  #if (defined WIN32) || (defined WIN64)
+  return (FAIL); // not available, stdio access is kept
+  #else
+  struct stat fileStatus;
+  if( fstat(fileno(p_file), &fileStatus) != 0 ) return (FAIL);
+  if( fileStatus.st_size <= 0 ) return (FAIL);
+
+  void *addr = mmap(NULL, (size_t)fileStatus.st_size, PROT_READ, MAP_SHARED,
+                    fileno(p_file), 0);
+  if( addr == MAP_FAILED )
+  {
+     fprintf(stderr, "\n ERROR: map_file: mmap of phsp file failed\n");
+     return (FAIL);
+  }
+
+  p_map = (const char *) addr;
+  map_size = (IAEA_I64) fileStatus.st_size;
+  map_pos = 0;
+  madvise(addr, (size_t)map_size, MADV_SEQUENTIAL);
+
+  return (OK);
+  #endif
+}
+
+void iaea_record_type::unmap_file()
+{
+  #if !(defined WIN32) && !(defined WIN64)
+  if(p_map != NULL) munmap((void *)p_map, (size_t)map_size);
+  #endif
+  p_map = NULL;
+  map_size = 0;
+  map_pos = 0;
+}
+
+/* *********************************************************************** */
+// Positional read access
+
+// One entry per phsp file open for positional reads, looked up by device
+// and inode so that different paths to the same file share it too.
+struct iaea_shared_file
+{
+  int fd;
+  int refs;
+  IAEA_I64 size;
+  IAEA_I64 dev, ino;
+  iaea_shared_file *next;
+};
+
+static iaea_shared_file *__iaea_shared_files = NULL;
+static std::mutex __iaea_shared_mutex;
+
+short iaea_record_type::open_shared(const char *filename)
+{
+  p_shared = NULL;
+  file_pos = 0;
+  rbuf_start = rbuf_len = 0;
+
+  #if (defined WIN32) || (defined WIN64)
+  (void) filename;
+  return (FAIL); // not available, stdio access is kept
+  #else
+  // Same naming rule as open_file(): add the extension if it is not there
+  const char *extension = ".IAEAphsp";
+  char name[MAX_STR_LEN];
+  size_t len = strlen(filename);
+  if( len + strlen(extension) >= MAX_STR_LEN ) return (FAIL);
+  strcpy(name, filename);
+  if( len < strlen(extension) || strcmp(name + len - strlen(extension), extension) )
+     strcat(name, extension);
+
+  struct stat fileStatus;
+  if( stat(name, &fileStatus) != 0 )
+  {
+     fprintf(stderr, "\n ERROR: open_shared: cannot access %s\n", name);
+     return (FAIL);
+  }
+
+  std::lock_guard<std::mutex> lock(__iaea_shared_mutex);
+
+  iaea_shared_file *f;
+  for(f = __iaea_shared_files; f != NULL; f = f->next)
+     if( f->dev == (IAEA_I64) fileStatus.st_dev &&
+         f->ino == (IAEA_I64) fileStatus.st_ino ) break;
+
+  if(f == NULL)
+  {
+     int fd = open(name, O_RDONLY);
+     if(fd < 0)
+     {
+        fprintf(stderr, "\n ERROR: open_shared: cannot open %s\n", name);
+        return (FAIL);
+     }
+     f = (iaea_shared_file *) calloc(1, sizeof(iaea_shared_file));
+     if(f == NULL) { close(fd); return (FAIL); }
+     f->fd = fd;
+     f->size = (IAEA_I64) fileStatus.st_size;
+     f->dev = (IAEA_I64) fileStatus.st_dev;
+     f->ino = (IAEA_I64) fileStatus.st_ino;
+     f->next = __iaea_shared_files;
+     __iaea_shared_files = f;
+  }
+  f->refs++;
+  p_shared = f;
+
+  return (OK);
+  #endif
+}
+
+void iaea_record_type::close_shared()
+{
+  #if !(defined WIN32) && !(defined WIN64)
+  if(p_shared != NULL)
+  {
+     std::lock_guard<std::mutex> lock(__iaea_shared_mutex);
+
+     if(--p_shared->refs == 0)
+     {
+        iaea_shared_file **pf = &__iaea_shared_files;
+        while(*pf != p_shared) pf = &(*pf)->next;
+        *pf = p_shared->next;
+        close(p_shared->fd);
+        free(p_shared);
+     }
+  }
+  #endif
+  p_shared = NULL;
+
+  free(p_rbuf);
+  p_rbuf = NULL;
+  rbuf_start = rbuf_len = 0;
+}
+
+// Reads up to nbytes at offset from descriptor fd, looping on short
+// reads. Returns the number of bytes read, or -1 on error.
+static IAEA_I64 read_fd(int fd, char *dst, IAEA_I64 nbytes, IAEA_I64 offset)
+{
+  #if (defined WIN32) || (defined WIN64)
+  (void) fd; (void) dst; (void) nbytes; (void) offset;
+  return -1;
+  #else
+  IAEA_I64 got = 0;
+  while(got < nbytes)
+  {
+     ssize_t nr = pread(fd, dst + got, (size_t)(nbytes - got),
+                        (off_t)(offset + got));
+     if(nr < 0)
+     {
+        if(errno == EINTR) continue;
+        return -1;
+     }
+     if(nr == 0) break; // end of file
+     got += nr;
+  }
+  return got;
+  #endif
+}
+
+// Same for any read source. Neither the file position nor the read
+// buffer of the source are touched, so several threads may call it at
+// once (except on Windows, where the stdio position is used).
+IAEA_I64 iaea_record_type::read_at(char *dst, IAEA_I64 nbytes, IAEA_I64 offset)
+{
+  if(p_map != NULL)
+  {
+     if(offset >= map_size) return 0;
+     if(offset + nbytes > map_size) nbytes = map_size - offset;
+     memcpy(dst, p_map + offset, (size_t)nbytes);
+     return nbytes;
+  }
+  if(p_shared != NULL) return read_fd(p_shared->fd, dst, nbytes, offset);
+  if(p_columnar != NULL) return p_columnar->read_at(dst, nbytes, offset);
+
+  #if (defined WIN32) || (defined WIN64)
+  if( _fseeki64(p_file, offset, SEEK_SET) != 0 ) return -1;
+  return (IAEA_I64) fread(dst, 1, (size_t)nbytes, p_file);
+  #else
+  return read_fd(fileno(p_file), dst, nbytes, offset);
+  #endif
+}
+
+IAEA_I64 iaea_record_type::file_size()
+{
+  if(p_shared != NULL) return p_shared->size;
+  if(p_columnar != NULL) return p_columnar->size();
+
+  #if (defined WIN32) || (defined WIN64)
+  struct _stati64 fileStatus;
+  if( _fstati64(fileno(p_file),&fileStatus) != 0 ) return -1;
+  #else
+  struct stat fileStatus;
+  if( fstat(fileno(p_file),&fileStatus) != 0 ) return -1;
+  #endif
+  return (IAEA_I64) fileStatus.st_size;
+}
+
+/* *********************************************************************** */
+// Read-ahead
+
+// Ring of n_buf buffers filled in file order by a background thread with
+// read_at(). Buffers [head, head+count) hold the data following the
+// position of the consumer, which keeps using the buffer at head until it
+// moves past its end. Moving elsewhere bumps generation and the read in
+// flight, if any, is dropped when it completes.
+struct iaea_read_ahead
+{
+  iaea_record_type *owner;
+  std::thread thread;
+  std::mutex lock;
+  std::condition_variable filled;   // a buffer was read (or a read failed)
+  std::condition_variable drained;  // a buffer was released, or restart/stop
+
+  int n_buf;
+  IAEA_I64 buf_size;
+  char **buf;
+  IAEA_I64 *buf_start, *buf_len;
+  int head, count;
+
+  IAEA_I64 next;        // offset of the read in flight or of the next one
+  IAEA_I64 end;         // size of the phsp file
+  unsigned generation;
+  bool failed, stop;
+
+  void run();
+  void restart(IAEA_I64 offset); // lock held
+};
+
+void iaea_read_ahead::run()
+{
+  std::unique_lock<std::mutex> guard(lock);
+  while(!stop)
+  {
+     if(count == n_buf || next >= end || failed)
+     {
+        drained.wait(guard);
+        continue;
+     }
+     // The slot after the last one filled is not in use by the consumer
+     const int slot = (head + count) % n_buf;
+     const IAEA_I64 offset = next;
+     const unsigned gen = generation;
+     // Reads are aligned to buf_size (whole blocks of a columnar file)
+     IAEA_I64 n = (offset/buf_size + 1)*buf_size - offset;
+     if(n > end - offset) n = end - offset;
+
+     guard.unlock();
+     IAEA_I64 got = owner->read_at(buf[slot], n, offset);
+     guard.lock();
+
+     if(gen != generation) continue; // the consumer moved elsewhere
+     if(got <= 0) failed = true;
+     else
+     {
+        buf_start[slot] = offset;
+        buf_len[slot] = got;
+        count++;
+        next = offset + got;
+     }
+     filled.notify_one();
+  }
+}
+
+void iaea_read_ahead::restart(IAEA_I64 offset)
+{
+  generation++;
+  count = 0;
+  next = offset;
+  failed = false;
+  drained.notify_one();
+}
+
+short iaea_record_type::start_read_ahead(IAEA_I64 nbytes)
+{
+  stop_read_ahead();
+  if(nbytes <= 0) return (OK);
+  if(p_map != NULL) return (FAIL); // the kernel reads mappings ahead itself
+
+  IAEA_I64 reclength = record_size();
+  IAEA_I64 buf_size = (IAEA_PREAD_BUFFER/reclength)*reclength;
+  if(buf_size < reclength) buf_size = reclength;
+  // A columnar block is decompressed whole, read it in one go
+  if(p_columnar != NULL) buf_size = p_columnar->block_records*reclength;
+  int n_buf = (int)((nbytes + buf_size - 1)/buf_size);
+  if(n_buf < 2) n_buf = 2; // one in use, one being read
+
+  // Continue from the current position of the source
+  if(p_shared == NULL && p_columnar == NULL)
+  {
+     #if (defined WIN32) || (defined WIN64)
+     file_pos = (IAEA_I64) _ftelli64(p_file);
+     #else
+     file_pos = (IAEA_I64) ftello(p_file);
+     #endif
+     if(file_pos < 0) return (FAIL);
+  }
+
+  iaea_read_ahead *a = new (std::nothrow) iaea_read_ahead;
+  if(a == NULL) return (FAIL);
+  a->owner = this;
+  a->n_buf = n_buf;
+  a->buf_size = buf_size;
+  a->buf = (char **) calloc(n_buf, sizeof(char *));
+  a->buf_start = (IAEA_I64 *) calloc(n_buf, sizeof(IAEA_I64));
+  a->buf_len = (IAEA_I64 *) calloc(n_buf, sizeof(IAEA_I64));
+  short status = (a->buf != NULL && a->buf_start != NULL &&
+                  a->buf_len != NULL) ? OK : FAIL;
+  for(int i = 0; status == OK && i < n_buf; i++)
+     if( (a->buf[i] = (char *) malloc((size_t)buf_size)) == NULL ) status = FAIL;
+  a->head = a->count = 0;
+  a->next = file_pos;
+  a->end = file_size();
+  a->generation = 0;
+  a->failed = a->stop = false;
+
+  if(status == OK)
+  {
+     try { a->thread = std::thread(&iaea_read_ahead::run, a); }
+     catch(...) { status = FAIL; }
+  }
+  p_ahead = a;
+  if(status != OK)
+  {
+     fprintf(stderr, "\n ERROR: start_read_ahead: cannot start reading ahead\n");
+     stop_read_ahead();
+  }
+  return status;
+}
+
+void iaea_record_type::stop_read_ahead()
+{
+  iaea_read_ahead *a = p_ahead;
+  if(a == NULL) return;
+  if(a->thread.joinable())
+  {
+     {
+        std::lock_guard<std::mutex> guard(a->lock);
+        a->stop = true;
+        a->drained.notify_one();
+     }
+     a->thread.join();
+  }
+  if(a->buf != NULL)
+     for(int i = 0; i < a->n_buf; i++) free(a->buf[i]);
+  free(a->buf);
+  free(a->buf_start);
+  free(a->buf_len);
+  delete a;
+  p_ahead = NULL;
+
+  // stdio sources go on from where the read-ahead stopped
+  if(p_shared == NULL && p_columnar == NULL && p_file != NULL)
+  {
+     #if (defined WIN32) || (defined WIN64)
+     _fseeki64(p_file, file_pos, SEEK_SET);
+     #else
+     fseeko(p_file, (off_t)file_pos, SEEK_SET);
+     #endif
+  }
+}
+
+// Pointer to the data at offset of the phsp, *avail being set to the
+// bytes that follow it in the same buffer. Waits for the background
+// thread if needed. NULL at the end of the file or if a read failed.
+const char *iaea_record_type::ahead(IAEA_I64 offset, IAEA_I64 *avail)
+{
+  iaea_read_ahead *a = p_ahead;
+  std::unique_lock<std::mutex> guard(a->lock);
+  *avail = 0;
+  for(;;)
+  {
+     if(offset >= a->end) return NULL;
+     if(a->count > 0)
+     {
+        const IAEA_I64 start = a->buf_start[a->head];
+        const IAEA_I64 stop = start + a->buf_len[a->head];
+        if(offset >= start && offset < stop)
+        {
+           *avail = stop - offset;
+           return a->buf[a->head] + (offset - start);
+        }
+        if(offset >= stop)
+        {
+           // Done with the head buffer
+           a->head = (a->head + 1) % a->n_buf;
+           a->count--;
+           a->drained.notify_one();
+        }
+        else a->restart(offset);
+        continue;
+     }
+     if(a->next != offset) { a->restart(offset); continue; }
+     if(a->failed) return NULL;
+     a->filled.wait(guard);
+  }
+}
+
+// Copies the next nbytes into dst, fewer at the end of the file. Returns
+// the number of bytes copied, file_pos is moved past them.
+IAEA_I64 iaea_record_type::ahead_copy(char *dst, IAEA_I64 nbytes)
+{
+  IAEA_I64 got = 0, avail;
+  while(got < nbytes)
+  {
+     const char *src = ahead(file_pos, &avail);
+     if(src == NULL) break;
+     IAEA_I64 k = (avail < nbytes - got) ? avail : nbytes - got;
+     memcpy(dst + got, src, (size_t)k);
+     got += k;
+     file_pos += k;
+  }
+  return got;
+}
+
+/* *********************************************************************** */
+// Streaming
+
+short iaea_record_type::set_streaming(short mode)
+{
+  streaming = 0;
+  if(mode == 0) return (OK);
+  #if defined(IAEA_FADVISE)
+  if(p_map != NULL) return (FAIL); // clean mapped pages are reclaimed anyway
+  streaming = mode;
+  stream_from((p_file != NULL && p_ahead == NULL && p_columnar == NULL) ?
+              (IAEA_I64) ftello(p_file) : file_pos);
+  return (OK);
+  #else
+  return (FAIL);
+  #endif
+}
+
+// Drops from the page cache the pages of the phsp file before pos, the
+// offset (as in a .IAEAphsp file) reached when reading, or before the end
+// of the data written. -1 means the current position of the source.
+// Dirty pages cannot be dropped: the write-back of the pages written since
+// the last call is only started here, they are dropped at the next call.
+void iaea_record_type::drop_pages(IAEA_I64 pos)
+{
+  stream_count = 0;
+  #if defined(IAEA_FADVISE)
+  if(streaming == 0) return;
+
+  int fd;
+  FILE *stream_file = (p_columnar != NULL) ? p_columnar->p_file : p_file;
+  if(streaming == 2)
+  {
+     if(stream_file != NULL && fflush(stream_file) != 0) return;
+     fd = (stream_file != NULL) ? fileno(stream_file) : -1;
+     pos = (fd < 0) ? -1 : (IAEA_I64) lseek(fd, 0, SEEK_CUR);
+  }
+  else
+  {
+     if(pos < 0)
+        pos = (p_file != NULL && p_ahead == NULL && p_columnar == NULL) ?
+              (IAEA_I64) ftello(p_file) : file_pos;
+     if(p_columnar != NULL) pos = p_columnar->file_offset(pos);
+     fd = (p_shared != NULL) ? p_shared->fd : fileno(stream_file);
+  }
+  if(fd < 0 || pos <= stream_drop) return;
+
+  IAEA_I64 end = pos;
+  if(streaming == 2)
+  {
+     #if defined(__linux__)
+     if(stream_sync > stream_drop)
+        sync_file_range(fd, (off_t)stream_drop, (off_t)(stream_sync - stream_drop),
+                        SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE |
+                        SYNC_FILE_RANGE_WAIT_AFTER);
+     if(pos > stream_sync)
+        sync_file_range(fd, (off_t)stream_sync, (off_t)(pos - stream_sync),
+                        SYNC_FILE_RANGE_WRITE);
+     end = stream_sync;
+     #else
+     fdatasync(fd);
+     #endif
+     stream_sync = pos;
+  }
+
+  // Whole pages only, the one holding end is still in use
+  const IAEA_I64 page = (IAEA_I64) sysconf(_SC_PAGESIZE);
+  end = (end/page)*page;
+  if(end > stream_drop)
+  {
+     posix_fadvise(fd, (off_t)stream_drop, (off_t)(end - stream_drop),
+                   POSIX_FADV_DONTNEED);
+     // The page cache may hold the file in large folios (2 MB), dropped
+     // only when the whole folio is in the range: the next range starts
+     // again at an aligned offset so that the folio holding end goes too
+     stream_drop = (end/IAEA_STREAM_CHUNK)*IAEA_STREAM_CHUNK;
+  }
+  #else
+  (void) pos;
+  #endif
+}
+
+// Pages are only dropped from pos on, the offset (as in a .IAEAphsp file)
+// of the records read or written next: the pages before it may be in use
+// by other sources of the same file, e.g. threads reading other chunks.
+// The start is aligned to IAEA_STREAM_CHUNK, as in drop_pages().
+void iaea_record_type::stream_from(IAEA_I64 pos)
+{
+  if(p_columnar != NULL) pos = p_columnar->file_offset(pos);
+  stream_count = 0;
+  stream_drop = stream_sync = (pos/IAEA_STREAM_CHUNK)*IAEA_STREAM_CHUNK;
+}
+
+/* *********************************************************************** */
+// Any access
+
+short iaea_record_type::release()
+{
+  short status = OK;
+  stop_read_ahead();
+  unmap_file();
+  close_shared();
+  if(p_columnar != NULL)
+  {
+     status = p_columnar->close();
+     if(status != OK)
+        fprintf(stderr, "\n ERROR: release: Failed to complete GOSS phsp file\n");
+     free(p_columnar);
+     p_columnar = NULL;
+  }
+  free(p_block);
+  p_block = NULL;
+  block_size = 0;
+
+  free(p_stage);
+  p_stage = NULL;
+  return status;
+}
+
+short iaea_record_type::seek(IAEA_I64 offset)
+{
+  if(p_map != NULL)
+  {
+     if(offset < 0 || offset > map_size) return (FAIL);
+     map_pos = offset;
+     return (OK);
+  }
+  if(p_ahead != NULL)
+  {
+     if(offset < 0 || offset > file_size()) return (FAIL);
+     if(offset != file_pos)
+     {
+        // Start reading there now rather than at the next fetch
+        std::lock_guard<std::mutex> guard(p_ahead->lock);
+        p_ahead->restart(offset);
+     }
+     file_pos = offset;
+     if(streaming) stream_from(offset);
+     return (OK);
+  }
+  if(p_shared != NULL || p_columnar != NULL)
+  {
+     if(offset < 0 || offset > file_size()) return (FAIL);
+     file_pos = offset;
+     if(streaming) stream_from(offset);
+     return (OK);
+  }
+  if( fseek(p_file, offset, SEEK_SET) != 0 ) return (FAIL);
+  if(streaming) stream_from(offset);
+  return (OK);
+}
+
+int iaea_record_type::at_end()
+{
+  if(p_map != NULL) return (map_pos >= map_size);
+  if(p_ahead != NULL) return (file_pos >= p_ahead->end);
+  if(p_shared != NULL) return (file_pos >= p_shared->size);
+  if(p_columnar != NULL) return (file_pos >= p_columnar->size());
+  return feof(p_file);
+}
+
+void iaea_record_type::advise(IAEA_I64 offset, IAEA_I64 length)
+{
+  #if !(defined WIN32) && !(defined WIN64)
+  if(p_map == NULL || length <= 0) return;
+  if(offset + length > map_size) length = map_size - offset;
+  if(length <= 0) return;
+
+  // madvise() wants a page aligned address
+  IAEA_I64 page = (IAEA_I64) sysconf(_SC_PAGESIZE);
+  IAEA_I64 start = (offset/page)*page;
+  length += offset - start;
+
+  madvise((void *)(p_map + start), (size_t)length, MADV_SEQUENTIAL);
+  madvise((void *)(p_map + start), (size_t)length, MADV_WILLNEED);
+  #else
+  (void) offset; (void) length;
+  #endif
+}
+
+// Returns a pointer to the next nbytes of the phsp. With a mapping the
+// data is used in place, with positional reads it comes from the source's
+// read buffer, from a columnar file it is used in its decompressed block,
+// with read-ahead in the buffer read in advance, otherwise it is read into
+// buf.
+const char *iaea_record_type::fetch_native(char *buf, size_t nbytes)
+{
+  if(p_ahead != NULL)
+  {
+     IAEA_I64 n = (IAEA_I64) nbytes, avail;
+     const char *src = ahead(file_pos, &avail);
+     if(src == NULL) return NULL;
+     if(avail >= n)
+     {
+        file_pos += n;
+        return src;
+     }
+     // Straddles two buffers
+     IAEA_I64 pos = file_pos;
+     if( ahead_copy(buf, n) != n ) { file_pos = pos; return NULL; }
+     return buf;
+  }
+  if(p_map != NULL)
+  {
+     if(map_pos + (IAEA_I64)nbytes > map_size) return NULL;
+     const char *src = p_map + map_pos;
+     map_pos += nbytes;
+     return src;
+  }
+  if(p_shared != NULL)
+  {
+     IAEA_I64 n = (IAEA_I64) nbytes;
+     if(file_pos < rbuf_start || file_pos + n > rbuf_start + rbuf_len)
+     {
+        if(n > IAEA_PREAD_BUFFER)
+        {
+           if( read_fd(p_shared->fd, buf, n, file_pos) != n ) return NULL;
+           file_pos += n;
+           return buf;
+        }
+        if(p_rbuf == NULL)
+        {
+           p_rbuf = (char *) malloc(IAEA_PREAD_BUFFER);
+           if(p_rbuf == NULL) return NULL;
+        }
+        rbuf_start = file_pos;
+        rbuf_len = read_fd(p_shared->fd, p_rbuf, IAEA_PREAD_BUFFER, file_pos);
+        if(rbuf_len < n) { rbuf_len = 0; return NULL; }
+     }
+     const char *src = p_rbuf + (file_pos - rbuf_start);
+     file_pos += n;
+     return src;
+  }
+  if(p_columnar != NULL)
+  {
+     // Records never straddle blocks, reads of parts of a record do not
+     IAEA_I64 n = (IAEA_I64) nbytes, avail;
+     const char *src = p_columnar->rows(file_pos, &avail);
+     if(src == NULL) return NULL;
+     if(avail < n)
+     {
+        if( p_columnar->read_at(buf, n, file_pos) != n ) return NULL;
+        src = buf;
+     }
+     file_pos += n;
+     return src;
+  }
+  if( fread(buf, 1, nbytes, p_file) != nbytes ) return NULL;
+  return buf;
+}
+
+// Same as fetch_native() for n_max consecutive records of nbytes each.
+// Only complete records are returned, their number is set in n_got.
+const char *iaea_record_type::fetch_block_native(IAEA_I32 n_max, size_t nbytes,
+                                                 IAEA_I32 *n_got)
+{
+  *n_got = 0;
+  if(p_map != NULL)
+  {
+     IAEA_I64 avail = (map_size - map_pos)/(IAEA_I64)nbytes;
+     if(avail > n_max) avail = n_max;
+     const char *src = p_map + map_pos;
+     map_pos += avail*(IAEA_I64)nbytes;
+     *n_got = (IAEA_I32) avail;
+     return src;
+  }
+
+  IAEA_I64 need = (IAEA_I64)n_max*(IAEA_I64)nbytes;
+  if(p_ahead != NULL)
+  {
+     // In place if the records are in the current buffer, else gathered
+     IAEA_I64 avail;
+     const char *src = ahead(file_pos, &avail);
+     if(src != NULL && avail >= need)
+     {
+        *n_got = n_max;
+        file_pos += need;
+        return src;
+     }
+     if(reserve_block(need) != OK) return NULL;
+     IAEA_I64 got = ahead_copy(p_block, need);
+     file_pos -= got % (IAEA_I64)nbytes; // whole records only
+     *n_got = (IAEA_I32)(got/(IAEA_I64)nbytes);
+     return p_block;
+  }
+  if(p_columnar != NULL)
+  {
+     // In place if the records are in the current block, else gathered
+     IAEA_I64 avail;
+     const char *src = p_columnar->rows(file_pos, &avail);
+     if(src == NULL)
+        return (at_end() && reserve_block(need) == OK) ? p_block : NULL;
+     if(avail >= need || file_pos + avail >= file_size())
+     {
+        *n_got = (IAEA_I32)((avail < need ? avail : need)/(IAEA_I64)nbytes);
+        file_pos += (IAEA_I64)(*n_got)*(IAEA_I64)nbytes;
+        return src;
+     }
+     if(reserve_block(need) != OK) return NULL;
+     IAEA_I64 got = 0;
+     while(src != NULL && got < need)
+     {
+        IAEA_I64 k = (avail < need - got) ? avail : need - got;
+        memcpy(p_block + got, src, (size_t)k);
+        got += k;
+        file_pos += k;
+        if(got < need) src = p_columnar->rows(file_pos, &avail);
+     }
+     *n_got = (IAEA_I32)(got/(IAEA_I64)nbytes);
+     return p_block;
+  }
+  if(reserve_block(need) != OK) return NULL;
+  if(p_shared != NULL)
+  {
+     IAEA_I64 got = read_fd(p_shared->fd, p_block, need, file_pos);
+     if(got < 0) return NULL;
+     *n_got = (IAEA_I32)(got/(IAEA_I64)nbytes);
+     file_pos += (IAEA_I64)(*n_got)*(IAEA_I64)nbytes;
+     return p_block;
+  }
+  *n_got = (IAEA_I32) fread(p_block, nbytes, (size_t)n_max, p_file);
+  return p_block;
+}
+
+short iaea_record_type::reserve_block(IAEA_I64 nbytes)
+{
+  if(nbytes <= block_size) return (OK);
+  char *tmp = (char *) realloc(p_block, (size_t)nbytes);
+  if(tmp == NULL)
+  {
+     fprintf(stderr, "\n ERROR: fetch_block: Not enough memory\n");
+     return (FAIL);
+  }
+  p_block = tmp;
+  block_size = nbytes;
+  return (OK);
+}
+
+/* *********************************************************************** */
+// Opposite byte order
+
+void iaea_swap_words(char *dst, const char *src, size_t nwords)
+{
+  size_t i = 0;
+
+  // Four words per 16 byte vector. When copying to another buffer a last
+  // partial vector is handled by swapping the final four words again,
+  // overlapping words already done; in place that would undo them.
+  #if defined(__SSSE3__)
+  const __m128i mask = _mm_setr_epi8(3,2,1,0, 7,6,5,4, 11,10,9,8, 15,14,13,12);
+  #define IAEA_SWAP4(d,s) _mm_storeu_si128((__m128i *)(d), \
+      _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(s)), mask))
+  #elif defined(__SSE2__) || defined(_M_X64)
+  // No byte shuffle in SSE2: swap the 16 bit halves, then the bytes of each
+  #define IAEA_SWAP4(d,s) do { \
+      __m128i x_ = _mm_loadu_si128((const __m128i *)(s)); \
+      x_ = _mm_shufflehi_epi16(_mm_shufflelo_epi16(x_, 0xB1), 0xB1); \
+      x_ = _mm_or_si128(_mm_slli_epi16(x_, 8), _mm_srli_epi16(x_, 8)); \
+      _mm_storeu_si128((__m128i *)(d), x_); } while(0)
+  #elif defined(__ARM_NEON)
+  #define IAEA_SWAP4(d,s) vst1q_u8((uint8_t *)(d), \
+      vrev32q_u8(vld1q_u8((const uint8_t *)(s))))
+  #endif
+
+  #ifdef IAEA_SWAP4
+  for(;i+4<=nwords;i+=4) IAEA_SWAP4(dst + 4*i, src + 4*i);
+  if(i < nwords && nwords >= 4 && dst != src)
+  {
+     IAEA_SWAP4(dst + 4*(nwords-4), src + 4*(nwords-4));
+     return;
+  }
+  #undef IAEA_SWAP4
+  #endif
+
+  for(;i<nwords;i++)
+  {
+     uint32_t word;
+     memcpy(&word, src + 4*i, 4);
+     word = (word >> 24) | ((word >> 8) & 0xff00u) |
+            ((word << 8) & 0xff0000u) | (word << 24);
+     memcpy(dst + 4*i, &word, 4);
+  }
+}
+
+// Records are a particle type byte followed by 4-byte words
+static void swap_records(char *dst, const char *src, IAEA_I64 n, size_t nbytes)
+{
+  const size_t nwords = (nbytes - 1)/4;
+  for(IAEA_I64 r=0;r<n;r++)
+  {
+     dst[0] = src[0];
+     iaea_swap_words(dst + 1, src + 1, nwords);
+     dst += nbytes;
+     src += nbytes;
+  }
+}
+
+// fetch() and fetch_block() return the data in the byte order of this
+// machine. Reads are either whole records (1 + 4*k bytes, type first) or
+// runs of 4-byte words (the generic decoder), told apart by their length.
+const char *iaea_record_type::fetch(char *buf, size_t nbytes)
+{
+  const char *src = fetch_native(buf, nbytes);
+  if(streaming && src != NULL) stream((IAEA_I64)nbytes);
+  if(!swap_bytes || src == NULL) return src;
+
+  if(nbytes % 4 == 1) swap_records(buf, src, 1, nbytes);
+  else iaea_swap_words(buf, src, nbytes/4);
+  return buf;
+}
+
+const char *iaea_record_type::fetch_block(IAEA_I32 n_max, size_t nbytes,
+                                          IAEA_I32 *n_got)
+{
+  const char *src = fetch_block_native(n_max, nbytes, n_got);
+  if(streaming && src != NULL) stream((IAEA_I64)(*n_got)*(IAEA_I64)nbytes);
+  if(!swap_bytes || src == NULL || *n_got == 0) return src;
+
+  // Mapped records are read-only, they are swapped into the block buffer
+  if(reserve_block((IAEA_I64)(*n_got)*(IAEA_I64)nbytes) != OK) return NULL;
+  swap_records(p_block, src, *n_got, nbytes);
+  return p_block;
+}
+
+int iaea_record_type::record_size()
+{
+  int nfloat = 1; // energy is always stored
+  if(ix > 0) nfloat++;
+  if(iy > 0) nfloat++;
+  if(iz > 0) nfloat++;
+  if(iu > 0) nfloat++;
+  if(iv > 0) nfloat++;
+  if(iweight > 0) nfloat++;
+  if(iextrafloat > 0) nfloat += iextrafloat;
+
+  int nlong = (iextralong > 0) ? iextralong : 0;
+
+  return (int)(sizeof(char) + nfloat*sizeof(float) + nlong*sizeof(IAEA_I32));
+}
+
+// Copies one 4 byte column out of n fixed-stride records
+template <typename T>
+static inline void gather_column(const char *src, size_t stride, IAEA_I32 n,
+                                 T *dst)
+{
+  for(IAEA_I32 i=0;i<n;i++) memcpy(dst+i, src + i*stride, sizeof(T));
+}
+
+static inline void fill_column(float value, IAEA_I32 n, float *dst)
+{
+  for(IAEA_I32 i=0;i<n;i++) dst[i] = value;
+}
+
+// Pass 2 of the block decoding, common to all record layouts. On entry
+// type and energy hold the raw stored values; n_stat has been filled only
+// if the history number is stored as an extralong (nstat_long >= 0).
+// All the loops are branch-free over contiguous arrays so they vectorize.
+void iaea_record_type::finish_block(const iaea_particle_block *b, IAEA_I32 n,
+                                    int nstat_long)
+{
+  IAEA_I32 i;
+
+  // New history is signaled by negative energy
+  float *energy_col = b->energy;
+  if(nstat_long < 0)
+  {
+     IAEA_I32 *nstat_col = b->n_stat;
+     for(i=0;i<n;i++) nstat_col[i] = (energy_col[i] < 0.f) ? 1 : 0;
+  }
+  for(i=0;i<n;i++) energy_col[i] = fabsf(energy_col[i]);
+
+  // Sign of w is stored in particle type
+  IAEA_I32 *type_col = b->type;
+  float *w_col = b->w;
+  for(i=0;i<n;i++)
+  {
+     IAEA_I32 t = type_col[i];
+     w_col[i] = (t < 0) ? -1.f : 1.f;
+     type_col[i] = (t < 0) ? -t : t;
+  }
+
+  if(iw > 0)
+  {
+     float *u_col = b->u;
+     float *v_col = b->v;
+     for(i=0;i<n;i++)
+     {
+        float uu = u_col[i], vv = v_col[i];
+        float aux = uu*uu + vv*vv;
+        float norm = (aux > 1.f) ? sqrtf(aux) : 1.f;
+        float ww = sqrtf(fmaxf(1.f - aux, 0.f));
+        u_col[i] = uu/norm;
+        v_col[i] = vv/norm;
+        w_col[i] = (aux > 1.f) ? 0.f : w_col[i]*ww;
+     }
+  }
+  else fill_column(w, n, w_col);
+}
+
+IAEA_I32 iaea_record_type::read_particles(IAEA_I32 n_max,
+                                          const iaea_particle_block *b,
+                                          int nstat_long)
+{
+  if(read_block_fn != NULL) return (*read_block_fn)(this, n_max, b, nstat_long);
+
+  IAEA_I32 i, n;
+  int k;
+
+  const size_t reclength = (size_t) record_size();
+  const char *src = fetch_block(n_max, reclength, &n);
+  if(src == NULL) return (FAIL);
+  if(n == 0) return 0;
+
+  // ---------------------------------------------------------------
+  // Pass 1: split the fixed-stride records into contiguous columns
+  // ---------------------------------------------------------------
+  for(i=0;i<n;i++) b->type[i] = (IAEA_I32)(signed char) src[i*reclength];
+
+  size_t off = sizeof(char);
+  gather_column(src+off, reclength, n, b->energy); off += sizeof(float);
+
+  if(ix > 0) {gather_column(src+off, reclength, n, b->x); off += sizeof(float);}
+  else fill_column(x, n, b->x);
+  if(iy > 0) {gather_column(src+off, reclength, n, b->y); off += sizeof(float);}
+  else fill_column(y, n, b->y);
+  if(iz > 0) {gather_column(src+off, reclength, n, b->z); off += sizeof(float);}
+  else fill_column(z, n, b->z);
+  if(iu > 0) {gather_column(src+off, reclength, n, b->u); off += sizeof(float);}
+  else fill_column(u, n, b->u);
+  if(iv > 0) {gather_column(src+off, reclength, n, b->v); off += sizeof(float);}
+  else fill_column(v, n, b->v);
+  if(iweight > 0) {gather_column(src+off, reclength, n, b->weight); off += sizeof(float);}
+  else fill_column(weight, n, b->weight);
+
+  for(k=0;k<iextrafloat;k++)
+  {
+     if(b->extrafloat != NULL)
+        gather_column(src+off, reclength, n, b->extrafloat + k*b->stride);
+     off += sizeof(float);
+  }
+
+  for(k=0;k<iextralong;k++)
+  {
+     if(b->extralong != NULL)
+        gather_column(src+off, reclength, n, b->extralong + k*b->stride);
+     if(k == nstat_long)
+        gather_column(src+off, reclength, n, b->n_stat);
+     off += sizeof(IAEA_I32);
+  }
+
+  // ---------------------------------------------------------------
+  // Pass 2: branch-free kernels over the columns
+  // ---------------------------------------------------------------
+  finish_block(b, n, nstat_long);
+
+  return n;
+}
+
+IAEA_I32 iaea_record_type::decode_records(const char *src, IAEA_I32 n,
+                                          const iaea_particle_block *b,
+                                          int nstat_long)
+{
+  // A copy of this record (layout, constants and codec) reading from src
+  // as if it were a mapping of the phsp file
+  iaea_record_type view = *this;
+  view.p_file = NULL;
+  view.p_shared = NULL;
+  view.p_columnar = NULL;
+  view.p_ahead = NULL;
+  view.streaming = 0;
+  view.p_rbuf = NULL;
+  view.p_stage = NULL;
+  view.p_block = NULL;
+  view.block_size = 0;
+  view.p_map = src;
+  view.map_size = (IAEA_I64)n*(IAEA_I64)record_size();
+  view.map_pos = 0;
+
+  IAEA_I32 got = view.read_particles(n, b, nstat_long);
+  free(view.p_block); // used for byte swapping only
+  return got;
+}
+
+/* *********************************************************************** */
+// Record codecs specialized for fixed layouts
+//
+// x, y, u, v and weight stored, z stored or constant (HasZ), no extra
+// floats and NLong extra longs. This covers the files written by
+// G4IAEAphspWriter (full record with the incremental history number) and
+// constant-z scoring planes. Record length and field offsets are
+// compile-time constants, so there is no branching on the i/o flags.
+
+template <bool HasZ, int NLong>
+struct iaea_codec
+{
+  enum { NFLOAT = HasZ ? 7 : 6,
+         RECLENGTH = 1 + NFLOAT*sizeof(float) + NLong*sizeof(IAEA_I32) };
+
+  static short read(iaea_record_type *p)
+  {
+    char buf[RECLENGTH];
+    const char *src = p->fetch(buf, RECLENGTH);
+    if( src == NULL )
+    {
+      fprintf(stderr, "\n ERROR: read_particle: Failed to read particle\n");
+      return (FAIL);
+    }
+
+    float f[NFLOAT];
+    memcpy(f, src+1, NFLOAT*sizeof(float));
+
+    int is = 1; // getting sign of Z director cosine w
+    p->particle = (short)(signed char) src[0];
+    if(p->particle < 0) {is = -1; p->particle = -p->particle;}
+
+    p->IsNewHistory = (f[0] < 0) ? 1 : 0;
+    p->energy = fabsf(f[0]);
+
+    int i = 0;
+    p->x = f[++i];
+    p->y = f[++i];
+    if(HasZ) p->z = f[++i];
+    p->u = f[++i];
+    p->v = f[++i];
+    p->weight = f[++i];
+
+    p->w = 0.f;
+    float aux = p->u*p->u + p->v*p->v;
+    if(aux <= 1.f) p->w = is*sqrtf(1.f - aux);
+    else
+    {
+      aux = sqrtf(aux);
+      p->u /= aux;
+      p->v /= aux;
+    }
+
+    if(NLong > 0)
+      memcpy(p->extralong, src+1+NFLOAT*sizeof(float), NLong*sizeof(IAEA_I32));
+
+    return RECLENGTH;
+  }
+
+  static short write(iaea_record_type *p)
+  {
+    char buf[RECLENGTH];
+    float f[NFLOAT];
+
+    signed char ishort = (signed char) p->particle;
+    if(p->w < 0) ishort = -ishort; // Sign of w is stored in particle type
+
+    if(p->IsNewHistory > 0) p->energy *= (-1); // New history is signaled by negative energy
+
+    int i = 0;
+    f[i] = p->energy;
+    f[++i] = p->x;
+    f[++i] = p->y;
+    if(HasZ) f[++i] = p->z;
+    f[++i] = p->u;
+    f[++i] = p->v;
+    f[++i] = p->weight;
+
+    buf[0] = (char) ishort;
+    memcpy(buf+1, f, NFLOAT*sizeof(float));
+    if(NLong > 0)
+      memcpy(buf+1+NFLOAT*sizeof(float), p->extralong, NLong*sizeof(IAEA_I32));
+
+    if( (p->p_columnar != NULL || p->streaming) ? p->put(buf, RECLENGTH) != OK
+                                                : fwrite(buf, RECLENGTH, 1, p->p_file) != 1 )
+    {
+      fprintf(stderr, "\n ERROR: write_particle: Failed to write particle\n");
+      return (FAIL);
+    }
+    return (OK);
+  }
+
+  static IAEA_I32 read_block(iaea_record_type *p, IAEA_I32 n_max,
+                             const iaea_particle_block *b, int nstat_long)
+  {
+    IAEA_I32 i, n;
+    const char *src = p->fetch_block(n_max, RECLENGTH, &n);
+    if(src == NULL) return (FAIL);
+    if(n == 0) return 0;
+
+    // Pass 1: one sweep over the records, fixed offsets
+    for(i=0;i<n;i++)
+    {
+      const char *r = src + i*RECLENGTH;
+      float f[NFLOAT];
+      memcpy(f, r+1, NFLOAT*sizeof(float));
+
+      int k = 0;
+      b->type[i]   = (IAEA_I32)(signed char) r[0];
+      b->energy[i] = f[k];
+      b->x[i]      = f[++k];
+      b->y[i]      = f[++k];
+      if(HasZ) b->z[i] = f[++k];
+      b->u[i]      = f[++k];
+      b->v[i]      = f[++k];
+      b->weight[i] = f[++k];
+
+      if(NLong > 0)
+      {
+        IAEA_I32 l[NLong > 0 ? NLong : 1];
+        memcpy(l, r+1+NFLOAT*sizeof(float), NLong*sizeof(IAEA_I32));
+        if(b->extralong != NULL)
+          for(int j=0;j<NLong;j++) b->extralong[j*b->stride + i] = l[j];
+        if(nstat_long >= 0) b->n_stat[i] = l[nstat_long];
+      }
+    }
+    if(!HasZ) fill_column(p->z, n, b->z);
+
+    // Pass 2: common kernels
+    p->finish_block(b, n, nstat_long);
+
+    return n;
+  }
+
+  static void encode_block(iaea_record_type *, const iaea_particle_block *b,
+                           IAEA_I32 first, IAEA_I32 n, char *dst)
+  {
+    for(IAEA_I32 k=0;k<n;k++)
+    {
+      const IAEA_I32 i = first + k;
+      char *r = dst + k*RECLENGTH;
+      float f[NFLOAT];
+
+      // Sign of w is stored in particle type,
+      // new history is signaled by negative energy
+      signed char ishort = (signed char) b->type[i];
+      r[0] = (char)((b->w[i] < 0) ? -ishort : ishort);
+
+      int j = 0;
+      f[j]   = (b->n_stat[i] > 0) ? -b->energy[i] : b->energy[i];
+      f[++j] = b->x[i];
+      f[++j] = b->y[i];
+      if(HasZ) f[++j] = b->z[i];
+      f[++j] = b->u[i];
+      f[++j] = b->v[i];
+      f[++j] = b->weight[i];
+      memcpy(r+1, f, NFLOAT*sizeof(float));
+
+      if(NLong > 0)
+      {
+        IAEA_I32 l[NLong > 0 ? NLong : 1];
+        for(int m=0;m<NLong;m++)
+          l[m] = (b->extralong != NULL) ? b->extralong[m*b->stride + i] : 0;
+        memcpy(r+1+NFLOAT*sizeof(float), l, NLong*sizeof(IAEA_I32));
+      }
+    }
+  }
+};
+
+template <bool HasZ, int NLong>
+static void set_codec(iaea_record_type *p)
+{
+  p->read_fn = &iaea_codec<HasZ, NLong>::read;
+  p->write_fn = &iaea_codec<HasZ, NLong>::write;
+  p->read_block_fn = &iaea_codec<HasZ, NLong>::read_block;
+  p->encode_block_fn = &iaea_codec<HasZ, NLong>::encode_block;
+}
+
+void iaea_record_type::select_codec()
+{
+  read_fn = NULL;
+  write_fn = NULL;
+  read_block_fn = NULL;
+  encode_block_fn = NULL;
+
+  if(ix <= 0 || iy <= 0 || iu <= 0 || iv <= 0 || iw <= 0 || iweight <= 0)
+     return;
+  if(iextrafloat > 0) return;
+
+  if(iz > 0)
+  {
+     if(iextralong == 1) set_codec<true,1>(this);
+     else if(iextralong <= 0) set_codec<true,0>(this);
+  }
+  else
+  {
+     if(iextralong == 1) set_codec<false,1>(this);
+     else if(iextralong <= 0) set_codec<false,0>(this);
+  }
+}
+
+/* *********************************************************************** */
+// Block writes
+
+// Loads each particle of the block into the record and encodes it, the
+// same way iaea_write_particle() + write_particle() do one at a time
+void iaea_record_type::encode_block_generic(const iaea_particle_block *b,
+                                            IAEA_I32 first, IAEA_I32 n,
+                                            char *dst)
+{
+  for(IAEA_I32 i=first;i<first+n;i++)
+  {
+     IsNewHistory = (b->n_stat[i] > 0) ? b->n_stat[i] : 0;
+     particle = (short) b->type[i];
+     energy = b->energy[i];
+     if(iweight > 0) weight = b->weight[i];
+     if(ix > 0) x = b->x[i];
+     if(iy > 0) y = b->y[i];
+     if(iz > 0) z = b->z[i];
+     if(iu > 0) u = b->u[i];
+     if(iv > 0) v = b->v[i];
+     if(iw > 0) w = b->w[i];
+
+     int k;
+     for(k=0;k<iextrafloat;k++)
+        extrafloat[k] = (b->extrafloat != NULL) ? b->extrafloat[k*b->stride + i] : 0.f;
+     for(k=0;k<iextralong;k++)
+        extralong[k] = (b->extralong != NULL) ? b->extralong[k*b->stride + i] : 0;
+
+     dst += encode_particle(dst);
+  }
+}
+
+// Writes the first nbytes of the staging buffer with a single write()
+// (looping only on short writes). Anything still buffered by stdio for
+// p_file is flushed first so that the record order is preserved.
+short iaea_record_type::flush_stage(size_t nbytes)
+{
+  if(p_columnar != NULL) return put(p_stage, nbytes);
+
+  #if (defined WIN32) || (defined WIN64)
+  if( fwrite(p_stage, 1, nbytes, p_file) != nbytes ) return (FAIL);
+  return (OK);
+  #else
+  if( fflush(p_file) != 0 ) return (FAIL);
+
+  int fd = fileno(p_file);
+  const char *src = p_stage;
+  while(nbytes > 0)
+  {
+     ssize_t nw = write(fd, src, nbytes);
+     if(nw < 0)
+     {
+        if(errno == EINTR) continue;
+        return (FAIL);
+     }
+     src += nw;
+     nbytes -= (size_t) nw;
+     if(streaming) stream((IAEA_I64)nw);
+  }
+  return (OK);
+  #endif
+}
+
+short iaea_record_type::put(const char *src, size_t nbytes)
+{
+  short status;
+  if(p_columnar != NULL)
+     status = p_columnar->write(src, (IAEA_I64)nbytes, record_size());
+  else status = (fwrite(src, 1, nbytes, p_file) == nbytes) ? OK : FAIL;
+  if(streaming && status == OK) stream((IAEA_I64)nbytes);
+  return status;
+}
+
+short iaea_record_type::append_file(iaea_record_type *src, IAEA_I64 nbytes)
+{
+  if((p_file == NULL && p_columnar == NULL) || nbytes < 0) return (FAIL);
+  if( p_file != NULL && fflush(p_file) != 0 ) return (FAIL);
+
+  IAEA_I64 done = 0;
+
+  #if defined(__linux__)
+  // The records are moved between the files in the kernel, without being
+  // copied to user space: copy_file_range() (which may share the extents
+  // on file systems supporting it) or else sendfile(). Either may refuse
+  // (other file system, O_APPEND output, old kernel), then the loop below
+  // copies whatever is left. Columnar files are recoded by the loop.
+  if( !src->swap_bytes && p_columnar == NULL && src->p_columnar == NULL )
+  {
+     // When streaming, pages are dropped every IAEA_STREAM_CHUNK bytes
+     const IAEA_I64 step = (streaming || src->streaming) ? IAEA_STREAM_CHUNK : nbytes;
+     int out = fileno(p_file);
+     int in = (src->p_shared != NULL) ? src->p_shared->fd : fileno(src->p_file);
+     #if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 27)
+     loff_t in_off = 0;
+     while(done < nbytes)
+     {
+        IAEA_I64 len = (nbytes - done < step) ? nbytes - done : step;
+        ssize_t nc = copy_file_range(in, &in_off, out, NULL, (size_t)len, 0);
+        if(nc < 0 && errno == EINTR) continue;
+        if(nc <= 0) break;
+        done += nc;
+        if(streaming) stream(nc);
+        if(src->streaming) src->drop_pages(done);
+     }
+     #endif
+     off_t off = (off_t) done;
+     while(done < nbytes)
+     {
+        IAEA_I64 len = (nbytes - done < step) ? nbytes - done : step;
+        ssize_t nc = sendfile(out, in, &off, (size_t)len);
+        if(nc < 0 && errno == EINTR) continue;
+        if(nc <= 0) break;
+        done += nc;
+        if(streaming) stream(nc);
+        if(src->streaming) src->drop_pages(done);
+     }
+  }
+  #endif
+
+  if(done < nbytes)
+  {
+     // Whole records through a buffer, swapped if the byte orders differ
+     const IAEA_I64 reclength = record_size();
+     IAEA_I64 chunk = (IAEA_STAGE_SIZE/reclength)*reclength;
+     if(chunk <= 0) chunk = reclength;
+     char *buf = (char *) malloc((size_t)chunk);
+     if(buf == NULL) return (FAIL);
+
+     while(done < nbytes)
+     {
+        IAEA_I64 n = (nbytes - done > chunk) ? chunk : nbytes - done;
+        if( src->read_at(buf, n, done) != n ) break;
+        if( src->streaming ) src->drop_pages(done + n);
+        if( src->swap_bytes ) swap_records(buf, buf, n/reclength, (size_t)reclength);
+        #if (defined WIN32) || (defined WIN64)
+        if( put(buf, (size_t)n) != OK ) break;
+        #else
+        if( p_columnar != NULL )
+        {
+           if( put(buf, (size_t)n) != OK ) break;
+           done += n;
+           continue;
+        }
+        const char *p = buf;
+        IAEA_I64 left = n;
+        while(left > 0)
+        {
+           ssize_t nw = write(fileno(p_file), p, (size_t)left);
+           if(nw < 0 && errno == EINTR) continue;
+           if(nw <= 0) break;
+           p += nw;
+           left -= nw;
+        }
+        if(left > 0) break;
+        if(streaming) stream(n);
+        #endif
+        done += n;
+     }
+     free(buf);
+  }
+
+  // Keep stdio in step with the descriptor
+  if(p_file != NULL) fseek(p_file, 0, SEEK_END);
+  return (done == nbytes) ? OK : FAIL;
+}
+
+IAEA_I32 iaea_record_type::write_particles(IAEA_I32 n,
+                                           const iaea_particle_block *b)
+{
+  if(n <= 0) return 0;
+
+  if(p_stage == NULL)
+  {
+     #if (defined WIN32) || (defined WIN64)
+     p_stage = (char *) malloc(IAEA_STAGE_SIZE);
+     #else
+     void *mem = NULL;
+     if( posix_memalign(&mem, 4096, IAEA_STAGE_SIZE) != 0 ) mem = NULL;
+     p_stage = (char *) mem;
+     #endif
+     if(p_stage == NULL)
+     {
+        fprintf(stderr, "\n ERROR: write_particles: Not enough memory\n");
+        return (FAIL);
+     }
+  }
+
+  const IAEA_I32 reclength = record_size();
+  const IAEA_I32 per_stage = IAEA_STAGE_SIZE/reclength;
+
+  for(IAEA_I32 first=0;first<n;first+=per_stage)
+  {
+     IAEA_I32 m = n - first;
+     if(m > per_stage) m = per_stage;
+
+     if(encode_block_fn != NULL) (*encode_block_fn)(this, b, first, m, p_stage);
+     else encode_block_generic(b, first, m, p_stage);
+
+     if( flush_stage((size_t)m*reclength) != OK )
+     {
+        fprintf(stderr, "\n ERROR: write_particles: Failed to write phsp data\n");
+        return (FAIL);
+     }
+  }
+
+  return n;
+}
+
+short iaea_record_type::read_particle()
+{
+  if(read_fn != NULL) return (*read_fn)(this);
+  return read_particle_generic();
+}
+
 short iaea_record_type::write_particle()
+{
+  if(write_fn != NULL) return (*write_fn)(this);
+  return write_particle_generic();
+}
+
+// Encodes the current record into dst, returns the number of bytes used
+int iaea_record_type::encode_particle(char *dst)
 {
   float floatArray[NUM_EXTRA_FLOAT+7];
-  IAEA_I32 longArray[NUM_EXTRA_LONG];
 
   char ishort = (char) particle;
   if(w < 0) ishort = -ishort; // Sign of w is stored in particle type
 
-  if( fwrite(&ishort, sizeof(char),   1, p_file) != 1)
-  {
-    fprintf(stderr, "\n ERROR: write_particle: Failed to write particle type\n");
-    return (FAIL);;
-  }
-
+  dst[0] = ishort;
   int reclength = sizeof(char);
 
   if(IsNewHistory > 0) energy *= (-1); // New history is signaled by negative energy
@@ -123,28 +1577,35 @@ short iaea_record_type::write_particle()
   int j;
   for(j=0;j<iextrafloat;j++) floatArray[++i] = extrafloat[j];
 
+  memcpy(dst+reclength, floatArray, (i+1)*sizeof(float));
   reclength += (i+1)*sizeof(float);
 
-  if( fwrite(floatArray, sizeof(float), (size_t)(i+1), p_file) != (size_t) (i+1))
+  if(iextralong > 0)
   {
-     fprintf(stderr, "\n ERROR: write_particle: Failed to write FLOAT phsp data\n");
-     return (FAIL);
+     memcpy(dst+reclength, extralong, iextralong*sizeof(IAEA_I32));
+     reclength += iextralong*sizeof(IAEA_I32);
   }
 
-  if(iextralong > 0)
+  return reclength;
+}
+
+short iaea_record_type::write_particle_generic()
+{
+  char buf[sizeof(char) + (NUM_EXTRA_FLOAT+7)*sizeof(float)
+           + NUM_EXTRA_LONG*sizeof(IAEA_I32)];
+
+  int reclength = encode_particle(buf);
+
+  if( put(buf, (size_t)reclength) != OK )
   {
-     for(j=0;j<iextralong;j++) longArray[j] = extralong[j];
-     reclength += iextralong*sizeof(IAEA_I32);
-     if( fwrite(longArray, sizeof(IAEA_I32), (size_t)iextralong, p_file) != (size_t)iextralong)
-     {
-        fprintf(stderr, "\n ERROR: write_particle: Failed to write LONG phsp data\n");
-        return (FAIL);
-     }
+     fprintf(stderr, "\n ERROR: write_particle: Failed to write phsp data\n");
+     return (FAIL);
   }
 
   if(reclength == 0) return(FAIL);
 
   #ifdef DEBUG
+  int j;
   // charge defined
   int iaea_charge[MAX_NUM_PARTICLES]={0,-1,+1,0,+1};
   int charge = iaea_charge[particle - 1];
@@ -162,23 +1623,25 @@ short iaea_record_type::write_particle()
   return(OK);
 }
 
-short iaea_record_type::read_particle()
+short iaea_record_type::read_particle_generic()
 {
   float floatArray[NUM_EXTRA_FLOAT+7];
   IAEA_I32 longArray[NUM_EXTRA_LONG+7];
   //(MACG) -Wshadow int i,j,is,reclength;
   int i,j,l,is,reclength;
   char ctmp;
+  const char *src;
 
   // IAEA_I32 pos = ftell(p_file); // To check file position
 
-  if( fread(&ctmp, sizeof(char),   1, p_file) != 1) // particle type is always read
+  src = fetch(&ctmp, sizeof(char));
+  if( src == NULL ) // particle type is always read
   {
     fprintf(stderr, "\n ERROR: read_particle: Failed to read particle type\n");
     return (FAIL);;
   }
 
-  particle = (short) ctmp;
+  particle = (short) *src;
 
   is = 1; // getting sign of Z director cosine w
   if(particle < 0) {is = -1; particle = -particle;}
@@ -194,11 +1657,14 @@ short iaea_record_type::read_particle()
   if(iweight > 0) rec_to_read++;
   if(iextrafloat>0) rec_to_read += iextrafloat;
 
-  if( fread(floatArray, sizeof(float), rec_to_read, p_file) != rec_to_read)
+  src = fetch((char *)floatArray, rec_to_read*sizeof(float));
+  if( src == NULL )
   {
     fprintf(stderr, "\n ERROR: read_particle: Failed to read FLOATs \n");
     return (FAIL);;
   }
+  if( src != (const char *)floatArray )
+     memcpy(floatArray, src, rec_to_read*sizeof(float));
 
   reclength += rec_to_read*sizeof(float);
 
@@ -231,11 +1697,14 @@ short iaea_record_type::read_particle()
 
   if(iextralong > 0)
   {
-     if( fread(longArray, sizeof(IAEA_I32), (size_t)iextralong, p_file) != (size_t)iextralong)
+     src = fetch((char *)longArray, iextralong*sizeof(IAEA_I32));
+     if( src == NULL )
      {
        fprintf(stderr, "\n ERROR: read_particle: Failed to read LONGS\n");
        return (FAIL);
      }
+     if( src != (const char *)longArray )
+        memcpy(longArray, src, iextralong*sizeof(IAEA_I32));
      //(MACG) -Wshadow for(int l=0,j=0;j<iextralong;j++) extralong[j] = longArray[l++];
      for(l=0,j=0;j<iextralong;j++) extralong[j] = longArray[l++];
      reclength += (iextralong)*sizeof(IAEA_I32);
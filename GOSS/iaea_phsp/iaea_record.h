@@ -5,6 +5,7 @@
 
 #include "utilities.h"
 #include "iaea_config.h"
+#include "iaea_columnar.h"
 
 /* *********************************************************************** */
 // defines
@@ -24,14 +25,64 @@
                             // 3 positrons
                             // 4 neutrons
                             // 5 protons
-#define MAX_NUM_SOURCES 30
+#define IAEA_SOURCE_SEGMENT 64 // sources per segment of the source table
+#define MAX_NUM_SOURCES 65536   // segments are allocated on demand
+
+#ifndef IAEA_PREAD_BUFFER
+  #define IAEA_PREAD_BUFFER 1048576 // bytes per pread() in positional reads
+#endif
+
+#ifndef IAEA_STREAM_CHUNK
+  #define IAEA_STREAM_CHUNK 8388608 // bytes between page cache drops when streaming
+#endif
+
+#ifndef IAEA_STAGE_SIZE
+  #define IAEA_STAGE_SIZE 4194304 // bytes staged per write() in block writes
+#endif
 
 #define OK     0
 #define FAIL  -1
 
+/* *********************************************************************** */
+// functions
+
+// Copy nwords 4-byte words from src to dst reversing the byte order of each
+// word. src and dst may be the same buffer but must not partially overlap.
+void iaea_swap_words(char *dst, const char *src, size_t nwords);
+
 /* *********************************************************************** */
 // structures
 
+struct iaea_record_type;
+
+// Phsp file opened once per process for positional reads (see
+// iaea_record_type::open_shared() in iaea_record.cpp)
+struct iaea_shared_file;
+
+// Buffers read in advance by a background thread (see
+// iaea_record_type::start_read_ahead() in iaea_record.cpp)
+struct iaea_read_ahead;
+
+// Record codec specialized at compile time for a fixed layout (see
+// iaea_record_type::select_codec() in iaea_record.cpp)
+template <bool HasZ, int NLong> struct iaea_codec;
+
+// Caller-provided structure of arrays used by the block read/write routines.
+// Extra variable k of particle i is stored at extrafloat[k*stride + i]
+// (resp. extralong). Extra arrays may be NULL if they are not wanted.
+struct iaea_particle_block
+{
+  IAEA_I32 *n_stat;
+  IAEA_I32 *type;
+  float *energy;
+  float *weight;
+  float *x, *y, *z;
+  float *u, *v, *w;
+  float *extrafloat;
+  IAEA_I32 *extralong;
+  IAEA_I32 stride;
+};
+
 struct iaea_record_type
 {
   FILE *p_file;   // phase space file pointer   
@@ -57,10 +108,130 @@ struct iaea_record_type
   float extrafloat[NUM_EXTRA_FLOAT];  // (default: no extra float stored)
   IAEA_I32 extralong[NUM_EXTRA_LONG];      // (default: one extra long stored)
 
+  // Memory-mapped read access (access = 4 in iaea_new_source).
+  // If p_map is NULL the record is read through p_file as usual.
+  const char *p_map;   // read-only mapping of the whole phsp file
+  IAEA_I64 map_size;   // size of the mapping in bytes
+  IAEA_I64 map_pos;    // offset of the next record inside the mapping
+
+  // Positional read access (access = 5 in iaea_new_source). The phsp file
+  // descriptor is shared by all such sources of the process and p_file is
+  // NULL; each source keeps its own offset and read buffer.
+  iaea_shared_file *p_shared;
+  IAEA_I64 file_pos;    // offset of the next record in the phsp file
+  char *p_rbuf;         // IAEA_PREAD_BUFFER bytes read at rbuf_start
+  IAEA_I64 rbuf_start, rbuf_len;
+
+  // GOSS columnar file (access = 6 in iaea_new_source, or a .GOSSphsp file
+  // found when reading). The records are compressed and decompressed in
+  // blocks, p_file is NULL and file_pos is the offset of the next record
+  // as if the file were a .IAEAphsp one.
+  iaea_columnar_file *p_columnar;
+
+  // Read-ahead (iaea_set_read_ahead in iaea_phsp.h). While p_ahead is set
+  // the records come from buffers filled in advance by a background thread
+  // and file_pos is the offset of the next record; p_file is not used.
+  iaea_read_ahead *p_ahead;
+
+  // Streaming (iaea_set_streaming in iaea_phsp.h). Every IAEA_STREAM_CHUNK
+  // bytes the pages of the phsp file already used are dropped from the
+  // page cache; written pages are flushed to disk before.
+  short streaming;        // 0 off, 1 reading, 2 writing
+  IAEA_I64 stream_count;  // bytes read or written since the last drop
+  IAEA_I64 stream_drop;   // file offset from which pages are dropped next
+  IAEA_I64 stream_sync;   // writing: offset up to which write-back started
+
+  // Scratch buffer for block reads through p_file
+  char *p_block;
+  IAEA_I64 block_size;
+
+  // Codec selected once per source from the i/o flags by select_codec().
+  // NULL pointers mean the generic (layout-agnostic) code is used.
+  short (*read_fn)(iaea_record_type *p);
+  short (*write_fn)(iaea_record_type *p);
+  IAEA_I32 (*read_block_fn)(iaea_record_type *p, IAEA_I32 n_max,
+                            const iaea_particle_block *block, int nstat_long);
+  void (*encode_block_fn)(iaea_record_type *p, const iaea_particle_block *block,
+                          IAEA_I32 first, IAEA_I32 n, char *dst);
+
+  // Page aligned staging buffer for block writes (IAEA_STAGE_SIZE bytes)
+  char *p_stage;
+
+  // Set when the phsp file was written with the opposite byte order of
+  // this machine; records are then byte-swapped as they are fetched.
+  short swap_bytes;
+
 public:
       short read_particle();
       short write_particle();
       short initialize();
+      // Unmap and free buffers, p_file is not closed (a columnar file is,
+      // completing it if it was being written). Returns OK or FAIL.
+      short release();
+
+      // Decode up to n_max records into block, nstat_long is the index of
+      // the extralong holding the incremental history number (-1 if none).
+      // Returns the number of records read, or FAIL.
+      IAEA_I32 read_particles(IAEA_I32 n_max, const iaea_particle_block *block,
+                              int nstat_long);
+      // Decode n records at src, as stored in the phsp file, into block.
+      // The source position is not used, so several threads may decode
+      // records they have read with read_at(). Returns n, or FAIL.
+      IAEA_I32 decode_records(const char *src, IAEA_I32 n,
+                              const iaea_particle_block *block, int nstat_long);
+      // Encode n particles from block and write them with as few write()
+      // calls as possible. Returns n, or FAIL.
+      IAEA_I32 write_particles(IAEA_I32 n, const iaea_particle_block *block);
+      int record_size();   // bytes per record for the current i/o flags
+      void select_codec(); // to be called whenever the i/o flags change
+
+      short map_file();    // map p_file read-only, FAIL if not possible
+      void  unmap_file();
+      // Open filename for positional reads, sharing the descriptor with
+      // other sources of the process reading the same file
+      short open_shared(const char *filename);
+      void  close_shared();
+      IAEA_I64 file_size(); // size in bytes of the phsp file
+      // Append the first nbytes of the phsp file of src (a read source) to
+      // this one, copying in the kernel where possible. Returns OK or FAIL.
+      short append_file(iaea_record_type *src, IAEA_I64 nbytes);
+      // Read nbytes at a byte offset without moving the source position
+      IAEA_I64 read_at(char *dst, IAEA_I64 nbytes, IAEA_I64 offset);
+      short seek(IAEA_I64 offset);  // position to a byte offset in the phsp
+      int   at_end();               // true if no more records can be read
+      void  advise(IAEA_I64 offset, IAEA_I64 length); // madvise a mapped range
+      // Keep up to nbytes following the current position read in advance
+      // by a background thread (0 stops it). FAIL for mapped sources.
+      short start_read_ahead(IAEA_I64 nbytes);
+      void  stop_read_ahead();
+      // Streaming mode 0 (off), 1 (reading) or 2 (writing). FAIL for
+      // mapped sources or where the page cache cannot be controlled.
+      short set_streaming(short mode);
+
+private:
+      template <bool HasZ, int NLong> friend struct iaea_codec;
+
+      short read_particle_generic();
+      short write_particle_generic();
+      int   encode_particle(char *dst);
+      void  encode_block_generic(const iaea_particle_block *block,
+                                 IAEA_I32 first, IAEA_I32 n, char *dst);
+      short flush_stage(size_t nbytes);
+      short put(const char *src, size_t nbytes); // write through p_columnar or p_file
+      void  finish_block(const iaea_particle_block *block, IAEA_I32 n,
+                         int nstat_long);
+      const char *fetch(char *buf, size_t nbytes);
+      const char *fetch_block(IAEA_I32 n_max, size_t nbytes, IAEA_I32 *n_got);
+      const char *fetch_native(char *buf, size_t nbytes);
+      const char *fetch_block_native(IAEA_I32 n_max, size_t nbytes,
+                                     IAEA_I32 *n_got);
+      short reserve_block(IAEA_I64 nbytes);
+      const char *ahead(IAEA_I64 offset, IAEA_I64 *avail);
+      IAEA_I64 ahead_copy(char *dst, IAEA_I64 nbytes);
+      void stream(IAEA_I64 nbytes) // count bytes used, drop pages if due
+      { if((stream_count += nbytes) >= IAEA_STREAM_CHUNK) drop_pages(-1); }
+      void drop_pages(IAEA_I64 pos);
+      void stream_from(IAEA_I64 pos); // pages before pos are not dropped
 };
 
 #endif
@@ -0,0 +1,462 @@
+/*
+ * phsp_bench - throughput of the iaea_phsp library, without Geant4.
+ *
+ * Writes a synthetic phsp file with the requested layout, then reads it
+ * back sequentially and in n_chunk portions read by as many threads, the
+ * way the workers of a Geant4 run read their chunk. Every measurement is
+ * printed to stdout as one JSON object per line:
+ *
+ *   {"test":"write","format":"IAEA","access":"write","threads":1,
+ *    "records":..., "record_bytes":..., "file_bytes":..., "seconds":...,
+ *    "records_per_s":..., "gb_per_s":..., "checksum":...}
+ *
+ * gb_per_s is computed from the bytes of the file on disk (1 GB = 1e9 B),
+ * so that a compressed .GOSSphsp file reports its real i/o rate. Reads
+ * that start right after the write find the file in the page cache;
+ * use --cold to drop its pages as it is written and read.
+ *
+ * Run "phsp_bench --help" for the options.
+ */
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "iaea_phsp.h"
+#include "iaea_record.h"  // NUM_EXTRA_FLOAT, NUM_EXTRA_LONG
+
+struct bench_options
+{
+  IAEA_I64 n_records = 10000000;
+  IAEA_I32 n_block = 4096;          // particles per iaea_get/write_particles
+  int n_extra_float = 0;
+  int n_extra_long = 1;             // the first one is the history number
+  bool const_z = true;
+  bool const_weight = false;
+  bool goss = false;                // write a .GOSSphsp file
+  IAEA_I32 access = 5;              // 1 stdio, 4 mmap, 5 pread
+  IAEA_I64 read_ahead = 0;          // bytes, 0 = off
+  std::vector<int> threads;         // parallel read runs
+  int repeat = 1;
+  bool cold = false;
+  bool keep = false;
+  std::string prefix = "phsp_bench";
+};
+
+// Synthetic particles, roughly those of a linac scoring plane
+struct bench_particles
+{
+  IAEA_I64 size = 0;
+  std::vector<IAEA_I32> n_stat, type, extra_long;
+  std::vector<float> energy, weight, x, y, z, u, v, w, extra_float;
+};
+
+static void usage()
+{
+  printf(
+"Usage: phsp_bench [options]\n"
+"  -n, --records N        particles in the file (default 10000000)\n"
+"  -b, --block N          particles per library call (default 4096)\n"
+"      --extra-floats N   extra floats per particle (default 0)\n"
+"      --extra-longs N    extra longs per particle, the first one being\n"
+"                         the incremental history number (default 1)\n"
+"      --store-z          store z (default: constant z)\n"
+"      --const-weight     do not store the weight (default: stored)\n"
+"      --format IAEA|GOSS file format written (default IAEA)\n"
+"      --access stdio|mmap|pread  read access (default pread)\n"
+"      --read-ahead MB    background read-ahead of each reader (default 0)\n"
+"  -t, --threads N[,N..]  threads of the chunked parallel reads\n"
+"                         (default: 1,2,4,... up to the hardware threads)\n"
+"  -r, --repeat N         times every read is repeated (default 1)\n"
+"      --cold             keep the file out of the page cache\n"
+"  -o, --output PREFIX    phsp file written (default phsp_bench)\n"
+"  -k, --keep             do not remove the phsp file at the end\n");
+}
+
+static double now()
+{
+  return std::chrono::duration<double>(
+           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static IAEA_I64 file_size(const std::string &name)
+{
+  std::ifstream f(name.c_str(), std::ios::binary | std::ios::ate);
+  return f ? (IAEA_I64) f.tellg() : 0;
+}
+
+static std::string data_file(const bench_options &o)
+{
+  return o.prefix + (o.goss ? ".GOSSphsp" : ".IAEAphsp");
+}
+
+static int record_bytes(const bench_options &o)
+{
+  int nfloat = 5 + (o.const_z ? 0 : 1) + (o.const_weight ? 0 : 1);
+  return 1 + 4*(nfloat + o.n_extra_float + o.n_extra_long);
+}
+
+static void report(const char *test, const bench_options &o, const char *access,
+                   int threads, IAEA_I64 records, double seconds, double checksum)
+{
+  IAEA_I64 bytes = file_size(data_file(o));
+  if(seconds <= 0.) seconds = 1.e-9;
+  printf("{\"test\":\"%s\",\"format\":\"%s\",\"access\":\"%s\",\"threads\":%d,"
+         "\"records\":%lld,\"record_bytes\":%d,\"file_bytes\":%lld,"
+         "\"extra_floats\":%d,\"extra_longs\":%d,\"const_z\":%s,"
+         "\"const_weight\":%s,\"block\":%d,\"cold\":%s,"
+         "\"seconds\":%.6f,\"records_per_s\":%.1f,\"gb_per_s\":%.4f,"
+         "\"checksum\":%.17g}\n",
+         test, o.goss ? "GOSS" : "IAEA", access, threads,
+         (long long) records, record_bytes(o), (long long) bytes,
+         o.n_extra_float, o.n_extra_long, o.const_z ? "true" : "false",
+         o.const_weight ? "true" : "false", (int) o.n_block,
+         o.cold ? "true" : "false",
+         seconds, records/seconds, bytes/seconds*1.e-9, checksum);
+  fflush(stdout);
+}
+
+static const char *access_name(IAEA_I32 access)
+{
+  switch(access)
+  {
+    case 1: return "stdio";
+    case 4: return "mmap";
+    case 5: return "pread";
+  }
+  return "?";
+}
+
+// A pool of particles written cyclically, so that generating them is not
+// measured. About 30% of the particles start a new history.
+static void make_particles(const bench_options &o, bench_particles *p)
+{
+  IAEA_I64 n = (o.n_records < (1 << 20)) ? o.n_records : (1 << 20);
+  if(n < 1) n = 1;
+  p->size = n;
+  p->n_stat.resize(n); p->type.resize(n);
+  p->energy.resize(n); p->weight.resize(n);
+  p->x.resize(n); p->y.resize(n); p->z.resize(n);
+  p->u.resize(n); p->v.resize(n); p->w.resize(n);
+  p->extra_float.resize(n*o.n_extra_float);
+  p->extra_long.resize(n*o.n_extra_long);
+
+  std::mt19937 rng(12345);
+  std::uniform_real_distribution<float> uniform(0.f, 1.f);
+  std::normal_distribution<float> spot(0.f, 3.f), spread(0.f, 0.002f);
+  std::exponential_distribution<float> spectrum(1.f/1.5f);
+
+  for(IAEA_I64 i=0;i<n;i++)
+  {
+    p->n_stat[i] = (i == 0 || uniform(rng) < 0.3f) ? 1 : 0;
+    float r = uniform(rng);
+    p->type[i] = (r < 0.95f) ? 1 : ((r < 0.99f) ? 2 : 3);
+    p->energy[i] = spectrum(rng) + 0.01f;
+    p->weight[i] = o.const_weight ? 1.f : 0.5f + uniform(rng);
+    p->x[i] = spot(rng);
+    p->y[i] = spot(rng);
+    p->z[i] = o.const_z ? 100.f : 100.f + uniform(rng);
+    p->u[i] = p->x[i]/100.f + spread(rng);
+    p->v[i] = p->y[i]/100.f + spread(rng);
+    p->w[i] = std::sqrt(1.f - p->u[i]*p->u[i] - p->v[i]*p->v[i]);
+    for(int k=0;k<o.n_extra_float;k++) p->extra_float[k*n + i] = uniform(rng);
+    for(int k=0;k<o.n_extra_long;k++)
+      p->extra_long[k*n + i] = (k == 0) ? p->n_stat[i] : (IAEA_I32)(rng() & 0xffff);
+  }
+}
+
+static int open_source(const bench_options &o, IAEA_I32 access, IAEA_I32 *id)
+{
+  IAEA_I32 result = 0;
+  std::string name = o.prefix;
+  iaea_new_source(id, const_cast<char*>(name.data()), &access, &result,
+                  (int) name.size()+1);
+  if(*id < 0 || result < 0)
+  {
+    fprintf(stderr, "\n ERROR: phsp_bench: cannot open %s (access %d)\n",
+            name.c_str(), (int) access);
+    return -1;
+  }
+  if(o.cold)
+  {
+    IAEA_I32 mode = 1;
+    iaea_set_streaming(id, &mode, &result);
+  }
+  return 0;
+}
+
+// -------------------------------------------------------------------------
+// Write
+// -------------------------------------------------------------------------
+
+static int bench_write(const bench_options &o, const bench_particles &p)
+{
+  IAEA_I32 id, result;
+  if(open_source(o, o.goss ? 6 : 2, &id) != 0) return -1;
+
+  if(o.const_z) { IAEA_I32 index = 2; float z = 100.f;
+                  iaea_set_constant_variable(&id, &index, &z); }
+  if(o.const_weight) { IAEA_I32 index = 6; float wt = 1.f;
+                       iaea_set_constant_variable(&id, &index, &wt); }
+
+  IAEA_I32 n_float = o.n_extra_float, n_long = o.n_extra_long;
+  iaea_set_extra_numbers(&id, &n_float, &n_long);
+  for(IAEA_I32 k=0;k<n_long;k++)
+  {
+    IAEA_I32 type = (k == 0) ? 1 : 0; // incremental history number
+    iaea_set_type_extralong_variable(&id, &k, &type);
+  }
+  for(IAEA_I32 k=0;k<n_float;k++)
+  {
+    IAEA_I32 type = 0;
+    iaea_set_type_extrafloat_variable(&id, &k, &type);
+  }
+
+  // Columns of one block, the extras with stride n_block
+  const IAEA_I32 nb = o.n_block;
+  std::vector<IAEA_I32> n_stat(nb), type(nb), extra_long(nb*(n_long+1));
+  std::vector<float> energy(nb), weight(nb), x(nb), y(nb), z(nb), u(nb), v(nb),
+                     w(nb), extra_float(nb*(n_float+1));
+
+  double histories = 0., checksum = 0.;
+  double t0 = now();
+  for(IAEA_I64 done=0; done<o.n_records; )
+  {
+    IAEA_I32 n = (o.n_records - done < nb) ? (IAEA_I32)(o.n_records - done) : nb;
+    for(IAEA_I32 i=0;i<n;i++)
+    {
+      IAEA_I64 j = (done + i) % p.size;
+      n_stat[i] = p.n_stat[j]; type[i] = p.type[j];
+      energy[i] = p.energy[j]; weight[i] = p.weight[j];
+      x[i] = p.x[j]; y[i] = p.y[j]; z[i] = p.z[j];
+      u[i] = p.u[j]; v[i] = p.v[j]; w[i] = p.w[j];
+      for(int k=0;k<n_float;k++) extra_float[k*nb + i] = p.extra_float[k*p.size + j];
+      for(int k=0;k<n_long;k++) extra_long[k*nb + i] = p.extra_long[k*p.size + j];
+      histories += n_stat[i];
+    }
+    // The extras are read with stride n (see iaea_write_particles)
+    if(n < nb)
+    {
+      for(int k=1;k<n_float;k++)
+        memmove(&extra_float[k*n], &extra_float[k*nb], n*sizeof(float));
+      for(int k=1;k<n_long;k++)
+        memmove(&extra_long[k*n], &extra_long[k*nb], n*sizeof(IAEA_I32));
+    }
+    IAEA_I32 n_written = 0;
+    iaea_write_particles(&id, &n, &n_written, n_stat.data(), type.data(),
+                         energy.data(), weight.data(), x.data(), y.data(),
+                         z.data(), u.data(), v.data(), w.data(),
+                         extra_float.data(), extra_long.data());
+    if(n_written != n)
+    {
+      fprintf(stderr, "\n ERROR: phsp_bench: write failed (%d)\n", (int) n_written);
+      iaea_destroy_source(&id, &result);
+      return -1;
+    }
+    for(IAEA_I32 i=0;i<n;i++) checksum += energy[i];
+    done += n;
+  }
+  IAEA_I64 n_orig = (IAEA_I64) histories;
+  iaea_set_total_original_particles(&id, &n_orig);
+  iaea_destroy_source(&id, &result); // flushes the file, header and index
+  double t1 = now();
+
+  if(result < 0)
+  {
+    fprintf(stderr, "\n ERROR: phsp_bench: cannot close %s\n", o.prefix.c_str());
+    return -1;
+  }
+  report("write", o, "write", 1, o.n_records, t1 - t0, checksum);
+  return 0;
+}
+
+// -------------------------------------------------------------------------
+// Read
+// -------------------------------------------------------------------------
+
+// Reads records first+1 up to last of the file (all of it if last < 0)
+// through iaea_get_particles(). Returns the number of records read, or -1.
+static IAEA_I64 read_range(const bench_options &o, IAEA_I32 i_chunk,
+                           IAEA_I32 n_chunk, double *checksum)
+{
+  IAEA_I32 id, result;
+  if(open_source(o, o.access, &id) != 0) return -1;
+  if(o.read_ahead > 0) iaea_set_read_ahead(&id, &o.read_ahead, &result);
+
+  IAEA_I64 first = 0, last = -1;
+  if(n_chunk > 1)
+  {
+    iaea_get_parallel_limits(&id, &i_chunk, &n_chunk, &first, &last, &result);
+    IAEA_I32 i_parallel = 0;
+    iaea_set_parallel(&id, &i_parallel, &i_chunk, &n_chunk, &result);
+    if(result < 0) { iaea_destroy_source(&id, &result); return -1; }
+  }
+  else
+  {
+    IAEA_I32 all_types = -1;
+    iaea_get_max_particles(&id, &all_types, &last);
+  }
+
+  const IAEA_I32 nb = o.n_block;
+  const int n_float = o.n_extra_float, n_long = o.n_extra_long;
+  std::vector<IAEA_I32> n_stat(nb), type(nb), extra_long(nb*(n_long+1));
+  std::vector<float> energy(nb), weight(nb), x(nb), y(nb), z(nb), u(nb), v(nb),
+                     w(nb), extra_float(nb*(n_float+1));
+
+  IAEA_I64 n_total = 0;
+  double sum = 0.;
+  while(first + n_total < last)
+  {
+    IAEA_I64 left = last - first - n_total;
+    IAEA_I32 n_max = (left < nb) ? (IAEA_I32) left : nb;
+    IAEA_I32 n_read = 0;
+    iaea_get_particles(&id, &n_max, &n_read, n_stat.data(), type.data(),
+                       energy.data(), weight.data(), x.data(), y.data(),
+                       z.data(), u.data(), v.data(), w.data(),
+                       n_float > 0 ? extra_float.data() : NULL,
+                       n_long > 0 ? extra_long.data() : NULL);
+    if(n_read <= 0) break;
+    for(IAEA_I32 i=0;i<n_read;i++) sum += energy[i];
+    n_total += n_read;
+  }
+  iaea_destroy_source(&id, &result);
+  *checksum = sum;
+  return n_total;
+}
+
+static int bench_read(const bench_options &o, int n_threads)
+{
+  std::vector<double> sums(n_threads, 0.);
+  std::vector<IAEA_I64> counts(n_threads, 0);
+
+  double t0 = now();
+  if(n_threads == 1) counts[0] = read_range(o, 1, 1, &sums[0]);
+  else
+  {
+    std::vector<std::thread> workers;
+    for(int k=0;k<n_threads;k++)
+      workers.emplace_back([&, k] {
+        counts[k] = read_range(o, k+1, n_threads, &sums[k]); });
+    for(size_t k=0;k<workers.size();k++) workers[k].join();
+  }
+  double t1 = now();
+
+  IAEA_I64 n_total = 0;
+  double checksum = 0.;
+  for(int k=0;k<n_threads;k++)
+  {
+    if(counts[k] < 0) return -1;
+    n_total += counts[k];
+    checksum += sums[k];
+  }
+  if(n_total != o.n_records)
+    fprintf(stderr, "\n WARNING: phsp_bench: read %lld of %lld records\n",
+            (long long) n_total, (long long) o.n_records);
+
+  report(n_threads == 1 ? "read" : "parallel_read", o, access_name(o.access),
+         n_threads, n_total, t1 - t0, checksum);
+  return 0;
+}
+
+// -------------------------------------------------------------------------
+
+static bool parse_args(int argc, char **argv, bench_options *o)
+{
+  for(int i=1;i<argc;i++)
+  {
+    std::string a = argv[i];
+    const char *value = (i+1 < argc) ? argv[i+1] : NULL;
+    bool used = true;
+
+    if(a == "-h" || a == "--help") return false;
+    else if(a == "--store-z") { o->const_z = false; used = false; }
+    else if(a == "--const-weight") { o->const_weight = true; used = false; }
+    else if(a == "--cold") { o->cold = true; used = false; }
+    else if(a == "-k" || a == "--keep") { o->keep = true; used = false; }
+    else if(value == NULL) { fprintf(stderr, "Missing value for %s\n", a.c_str()); return false; }
+    else if(a == "-n" || a == "--records") o->n_records = atoll(value);
+    else if(a == "-b" || a == "--block") o->n_block = atoi(value);
+    else if(a == "--extra-floats") o->n_extra_float = atoi(value);
+    else if(a == "--extra-longs") o->n_extra_long = atoi(value);
+    else if(a == "-r" || a == "--repeat") o->repeat = atoi(value);
+    else if(a == "-o" || a == "--output") o->prefix = value;
+    else if(a == "--read-ahead") o->read_ahead = atoll(value)*1024*1024;
+    else if(a == "--format")
+    {
+      std::string f = value;
+      if(f != "IAEA" && f != "GOSS") { fprintf(stderr, "Unknown format %s\n", value); return false; }
+      o->goss = (f == "GOSS");
+    }
+    else if(a == "--access")
+    {
+      std::string m = value;
+      if(m == "stdio") o->access = 1;
+      else if(m == "mmap") o->access = 4;
+      else if(m == "pread") o->access = 5;
+      else { fprintf(stderr, "Unknown access mode %s\n", value); return false; }
+    }
+    else if(a == "-t" || a == "--threads")
+    {
+      o->threads.clear();
+      for(const char *s = value; *s; )
+      {
+        o->threads.push_back(atoi(s));
+        s = strchr(s, ',');
+        if(s == NULL) break;
+        s++;
+      }
+    }
+    else { fprintf(stderr, "Unknown option %s\n", a.c_str()); return false; }
+
+    if(used) i++;
+  }
+
+  if(o->n_records < 1 || o->n_block < 1 || o->repeat < 1 ||
+     o->n_extra_float < 0 || o->n_extra_float > NUM_EXTRA_FLOAT ||
+     o->n_extra_long < 0 || o->n_extra_long > NUM_EXTRA_LONG)
+  {
+    fprintf(stderr, "Invalid option value\n");
+    return false;
+  }
+  for(size_t k=0;k<o->threads.size();k++)
+    if(o->threads[k] < 1) { fprintf(stderr, "Invalid number of threads\n"); return false; }
+
+  if(o->threads.empty())
+  {
+    int n_max = (int) std::thread::hardware_concurrency();
+    if(n_max < 1) n_max = 1;
+    for(int n=2; n<n_max; n*=2) o->threads.push_back(n);
+    if(n_max > 1) o->threads.push_back(n_max);
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  bench_options o;
+  if(!parse_args(argc, argv, &o)) { usage(); return 1; }
+
+  bench_particles p;
+  make_particles(o, &p);
+
+  int status = bench_write(o, p);
+  for(int r=0; r<o.repeat && status == 0; r++)
+  {
+    status = bench_read(o, 1);
+    for(size_t k=0; k<o.threads.size() && status == 0; k++)
+      if(o.threads[k] > 1) status = bench_read(o, o.threads[k]);
+  }
+
+  if(!o.keep)
+  {
+    const char *ext[] = {".IAEAheader", ".IAEAphsp", ".GOSSphsp", ".IAEAindex"};
+    for(int k=0;k<4;k++) remove((o.prefix + ext[k]).c_str());
+  }
+  return (status == 0) ? 0 : 1;
+}
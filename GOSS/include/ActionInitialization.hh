@@ -35,9 +35,12 @@
 #include "globals.hh"
 
 #include "G4IAEAphspWriterStack.hh"
+#include <memory>
 #include <vector>
 
 class ActionInitializationMessenger;
+class G4IAEAphspHistoryQueue;
+class G4IAEAphspMemorySource;
 
 
 //------------------------------------------------------------------------------
@@ -55,7 +58,11 @@ public:
   // Set-Get methods
 
   void SetIAEAphspReader(const G4String& name);
+  void SetIAEAphspReaderInMemory(const G4bool val);
+  void SetIAEAphspReaderIOThread(const G4bool val);
   void SetIAEAphspWriterPrefix(const G4String& name);
+  void SetIAEAphspWriterFormat(const G4String& format);
+  void SetIAEAphspWriterStreaming(const G4bool val);
   void AddZphsp(const G4double val);
   
   // GOSS commands
@@ -65,11 +72,19 @@ public:
 
 private:
 
+  void LoadIAEAphspReaderMemory();
+  void OpenIAEAphspReaderQueue();
+
   // IAEAphsp-related data members
   G4String fIAEAphspReaderName;
+  G4bool fIAEAphspReaderInMemory;  // phsp file loaded once, shared by threads
+  std::shared_ptr<const G4IAEAphspMemorySource> fIAEAphspReaderMemory;
+  G4bool fIAEAphspReaderIOThread;  // one i/o thread feeds all the readers
+  std::shared_ptr<G4IAEAphspHistoryQueue> fIAEAphspReaderQueue;
   G4String fIAEAphspWriterNamePrefix;
+  G4bool fIAEAphspWriterColumnar;  // GOSS columnar output format
+  G4bool fIAEAphspWriterStreaming; // output kept out of the page cache
   std::vector<G4double>* fZphspVec;
-  G4int fNumberOfThreads;
 
   // Messenger class needed for IAEAphsp commands
   ActionInitializationMessenger* fMessenger;
@@ -35,6 +35,7 @@
 class ActionInitialization;
 
 class G4UIdirectory;
+class G4UIcmdWithABool;
 class G4UIcmdWithADoubleAndUnit;
 class G4UIcmdWithAString;
 
@@ -58,7 +59,11 @@ private:
   G4UIdirectory*             fIAEAphspReaderDir;
   G4UIdirectory*             fIAEAphspWriterDir;
   G4UIcmdWithAString*        fIAEAphspReaderFileCmd;
+  G4UIcmdWithABool*          fIAEAphspReaderInMemoryCmd;
+  G4UIcmdWithABool*          fIAEAphspReaderIOThreadCmd;
   G4UIcmdWithAString*        fIAEAphspWriterFileCmd;
+  G4UIcmdWithAString*        fIAEAphspWriterFormatCmd;
+  G4UIcmdWithABool*          fIAEAphspWriterStreamingCmd;
   G4UIcmdWithADoubleAndUnit* fIAEAphspWriterZphspCmd;
 };
 
@@ -0,0 +1,128 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// G4IAEAphspEventArena
+//
+// Per-event storage of the particles read by G4IAEAphspReader. Each reader
+// (one per worker thread) owns one arena, so no memory is shared between
+// threads. Particles are packed records in a ring whose last element is
+// the look-ahead particle of the next event; their extra variables are
+// kept in flat arrays with a fixed stride, next to the ring. Nothing is
+// allocated per particle: the arrays only grow (doubling) when an event
+// holds more particles than any before.
+//
+
+#ifndef G4IAEAphspEventArena_h
+#define G4IAEAphspEventArena_h 1
+
+#include <vector>
+
+#include "globals.hh"
+#include "G4ThreeVector.hh"
+
+
+class G4IAEAphspEventArena
+{
+
+public:
+
+  // A particle read from the phase-space file, as stored for its event
+  struct Particle
+  {
+    G4int type;
+    G4double kinE;
+    G4double weight;
+    G4ThreeVector pos;
+    G4ThreeVector momDir;
+    G4bool hasExtraFloats, hasExtraInts;
+    G4bool accepted;  // passes the acceptance filter of the reader
+  };
+
+  G4IAEAphspEventArena();
+  ~G4IAEAphspEventArena() = default;
+
+  // Sets the number of extra variables per particle and empties the arena
+  void Configure(const G4int nExtraFloats, const G4int nExtraInts);
+
+  // Empties the arena, keeping its memory
+  inline void Reset() { fHead = fSize = 0; }
+
+  // Drops all the particles but the last one (the look-ahead particle),
+  // which becomes the first particle of the next event
+  inline void KeepLast()
+  {
+    if (fSize > 1) {
+      fHead = Slot(fSize-1);
+      fSize = 1;
+    }
+  }
+
+  // Appends a particle and returns its slot
+  inline G4int Push()
+  {
+    if (fSize == fCapacity) Grow();
+    return Slot(fSize++);
+  }
+
+  inline G4int Size() const { return fSize; }
+
+  // Slot of the i-th particle stored (0 <= i < Size())
+  inline G4int Slot(const G4int i) const
+  { return (fHead + i) & (fCapacity - 1); }
+
+  inline Particle& At(const G4int slot) { return fParticles[slot]; }
+  inline const Particle& At(const G4int slot) const
+  { return fParticles[slot]; }
+
+  // Extra variables of the particle in slot, fNExtraFloats (fNExtraInts)
+  // consecutive values
+  inline G4double* ExtraFloats(const G4int slot)
+  { return fExtraFloats.data() + slot*fNExtraFloats; }
+  inline const G4double* ExtraFloats(const G4int slot) const
+  { return fExtraFloats.data() + slot*fNExtraFloats; }
+  inline G4long* ExtraInts(const G4int slot)
+  { return fExtraInts.data() + slot*fNExtraInts; }
+  inline const G4long* ExtraInts(const G4int slot) const
+  { return fExtraInts.data() + slot*fNExtraInts; }
+
+private:
+
+  void Grow();
+
+  std::vector<Particle> fParticles;
+  std::vector<G4double> fExtraFloats;
+  std::vector<G4long> fExtraInts;
+  // Ring of packed particle records and the flat arrays of their extra
+  // variables, particle in slot s holding the values from s*stride on.
+
+  G4int fNExtraFloats, fNExtraInts;
+  // Strides of the extra variables arrays
+
+  G4int fCapacity, fHead, fSize;
+  // Slots of the ring (a power of 2), first particle stored and number of
+  // particles stored
+};
+
+#endif
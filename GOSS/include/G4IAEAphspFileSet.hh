@@ -0,0 +1,116 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// G4IAEAphspFileSet
+//
+// Several phsp files (e.g. one per parallel job or run that produced them)
+// read as one logical phsp source. Their particles are numbered one file
+// after the other, and the numbers of particles and original histories
+// are the sums of those in their headers. The files must store the same
+// extra variables. A set is opened once per process and shared by the
+// G4IAEAphspReader objects of all the threads, each of which reads its
+// chunk of the set moving from one file to the next.
+//
+
+#ifndef G4IAEAphspFileSet_h
+#define G4IAEAphspFileSet_h 1
+
+#include <map>
+#include <memory>
+#include <vector>
+
+#include "globals.hh"
+#include "G4Threading.hh"
+
+
+class G4IAEAphspFileSet
+{
+
+public:
+
+  // Names of the files given by 'names', a list (separated by blanks or
+  // commas) of file names without the extension. Each name may be a glob
+  // pattern, e.g. "phsp/run_*", expanded in alphabetical order.
+  static std::vector<G4String> ExpandFileNames(const G4String& names);
+
+  // The set of the files given by 'names', whose headers are read at the
+  // first call. Later calls with the same 'names' return the same set.
+  static std::shared_ptr<const G4IAEAphspFileSet>
+  Open(const G4String& names);
+
+  ~G4IAEAphspFileSet() = default;
+
+  inline const G4String& GetName() const       {return fName;}
+  inline G4int GetNumberOfFiles() const
+  {return static_cast<G4int>(fFileNames.size());}
+  inline const G4String& GetFileName(const G4int file) const
+  {return fFileNames[file];}
+  inline G4long GetOrigHistories() const       {return fOrigHistories;}
+
+  // Particles stored in the files before 'file'. For file =
+  // GetNumberOfFiles() it is the total number of particles of the set.
+  inline G4long GetFileOffset(const G4int file) const
+  {return fFileOffsets[file];}
+
+  // Particles of the IAEA type 'type' (1 to 5) in the set, or of all types
+  // for type = -1
+  G4long GetTotalParticles(const G4int type = -1) const;
+
+  // File holding the particle #particle (counting from 1) of the set
+  G4int FindFile(const G4long particle) const;
+
+  // Limits of chunk #chunk of totalChunks, as iaea_get_parallel_limits()
+  // gives for one file: particles first+1 to last of the set (counting
+  // from 1). The chunks hold about the same number of particles and may
+  // span several files; a chunk starting within a file starts at a new
+  // history if that file has a history index.
+  void GetChunkLimits(const G4int chunk, const G4int totalChunks,
+		      G4long& first, G4long& last) const;
+
+private:
+
+  G4IAEAphspFileSet() = default;
+
+  std::vector<G4long> ComputeChunkCuts(const G4int totalChunks) const;
+
+  G4String fName;
+  // List or pattern the set was opened with
+
+  std::vector<G4String> fFileNames;
+  std::vector<G4long> fFileOffsets;
+  // Files of the set and the particles stored before each one (plus the
+  // total at the end)
+
+  G4long fOrigHistories = 0;
+  G4long fParticlesOfType[5] = {0, 0, 0, 0, 0};
+  // Sums of the headers of the files
+
+  mutable G4Mutex fCutsMutex;
+  mutable std::map<G4int, std::vector<G4long>> fChunkCuts;
+  // First particle (counting from 0) of every chunk, for each number of
+  // chunks asked for, plus the total at the end. Computed at first use.
+};
+
+#endif
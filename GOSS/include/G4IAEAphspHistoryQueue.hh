@@ -0,0 +1,152 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// G4IAEAphspHistoryQueue
+//
+// A single i/o thread decodes a phsp file and publishes its particles in
+// batches of complete histories (a batch never splits the particles of an
+// original history) into a bounded lock-free queue. The G4IAEAphspReader
+// objects of all the worker threads pop those batches instead of reading
+// the file themselves, so only one IAEA source is open whatever the number
+// of threads, and a faster thread simply pops more batches.
+// The file, or the fragment of it of one parallel run, is read again from
+// its beginning when its end is reached, until the queue is destroyed.
+//
+
+#ifndef G4IAEAphspHistoryQueue_h
+#define G4IAEAphspHistoryQueue_h 1
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "globals.hh"
+#include "G4Threading.hh"
+
+
+class G4IAEAphspHistoryQueue
+{
+
+public:
+
+  // Particles of one or more complete histories, as decoded by
+  // iaea_get_particles(). Extra variable k of particle i is stored at
+  // k*stride + i, if decoded.
+  struct Batch
+  {
+    std::vector<G4int> nStat, type;
+    std::vector<G4float> energy, weight, x, y, z, u, v, w;
+    std::vector<G4float> extraFloats;
+    std::vector<G4int> extraInts;
+    G4int size = 0, stride = 0;
+    G4bool hasExtraFloats = false, hasExtraInts = false;
+  };
+
+  // Opens the phsp file 'filename' (without the extension) and reads its
+  // header. Returns null, with a warning, if it cannot be opened.
+  static std::shared_ptr<G4IAEAphspHistoryQueue>
+  Open(const G4String& filename);
+
+  ~G4IAEAphspHistoryQueue();
+
+  // Starts the i/o thread over the fragment 'parallelRun' of
+  // 'totalParallelRuns'. Only the first call has an effect, so that all
+  // the readers can issue it with their own (equal) settings.
+  void Start(const G4int parallelRun, const G4int totalParallelRuns,
+	     const G4int accessRead, const G4long readAhead,
+	     const G4bool streaming, const G4bool decodeExtraFloats,
+	     const G4bool decodeExtraInts);
+
+  // Next batch published by the i/o thread, waiting for it if needed.
+  // Returns null if the i/o thread stopped on a read error. The batch must
+  // be given back with Release() once its vectors have been used.
+  Batch* Pop();
+  void Release(Batch* batch);
+
+  inline const G4String& GetFileName() const   {return fFileName;}
+  inline G4long GetOrigHistories() const        {return fOrigHistories;}
+  inline G4long GetTotalParticles() const       {return fTotalParticles;}
+  inline G4int GetNumberOfExtraFloats() const   {return fNExtraFloats;}
+  inline G4int GetNumberOfExtraInts() const     {return fNExtraInts;}
+  inline const std::vector<G4int>& GetExtraFloatTypes() const
+  {return fExtraFloatTypes;}
+  inline const std::vector<G4int>& GetExtraIntTypes() const
+  {return fExtraIntTypes;}
+
+private:
+
+  // Bounded multi-producer multi-consumer queue of batch pointers, after
+  // D. Vyukov: each cell carries a sequence number telling whether it is
+  // ready to be written or read at a given position, so that push and pop
+  // only need one compare-and-swap on the position.
+  class BoundedQueue
+  {
+  public:
+    explicit BoundedQueue(const std::size_t capacity);
+    G4bool Push(Batch* batch);
+    G4bool Pop(Batch*& batch);
+
+  private:
+    struct Cell
+    {
+      std::atomic<std::size_t> sequence;
+      Batch* batch;
+    };
+    std::vector<Cell> fCells;
+    std::size_t fMask;
+    alignas(64) std::atomic<std::size_t> fEnqueuePos;
+    alignas(64) std::atomic<std::size_t> fDequeuePos;
+  };
+
+  G4IAEAphspHistoryQueue();
+
+  void Run();
+  void Publish(Batch*& batch);
+  Batch* TakeFree();
+
+  G4String fFileName;
+  G4int fSourceReadId = -1;
+  G4long fOrigHistories = 0, fTotalParticles = 0;
+  G4int fNExtraFloats = 0, fNExtraInts = 0;
+  std::vector<G4int> fExtraFloatTypes, fExtraIntTypes;
+
+  G4int fChunk = 1, fTotalChunks = 1;
+  G4long fFirstParticle = 0, fLastParticle = 0;
+  G4bool fDecodeExtraFloats = false, fDecodeExtraInts = false;
+  // Fragment of the file read by the i/o thread and extra variables
+  // decoded, fixed by the first call to Start()
+
+  std::vector<Batch> fBatches;
+  BoundedQueue fFull, fFree;
+  // Batches published by the i/o thread, and batches given back by the
+  // readers, ready to be filled again
+
+  G4Mutex fStartMutex;
+  std::thread fThread;
+  std::atomic<G4bool> fStarted, fStop, fFailed;
+};
+
+#endif
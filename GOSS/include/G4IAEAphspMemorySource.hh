@@ -0,0 +1,96 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+// G4IAEAphspMemorySource
+//
+// Read-only copy in memory of all the particles of a phsp file, decoded
+// once into a structure of arrays in float precision (as stored). It is
+// loaded by the master and shared by the G4IAEAphspReader objects of all
+// the worker threads, which copy slices of it instead of reading the file.
+// Repeated runs and recycling through the file then cost no i/o, and the
+// process holds one copy of the particles instead of a buffer per thread.
+//
+
+#ifndef G4IAEAphspMemorySource_h
+#define G4IAEAphspMemorySource_h 1
+
+#include <memory>
+#include <vector>
+
+#include "globals.hh"
+
+
+class G4IAEAphspMemorySource
+{
+
+public:
+
+  // Decodes all the particles of the phsp file 'filename' (without the
+  // extension). The extra variables are only kept if requested, as they
+  // may take more memory than the particles. Returns null, with a warning,
+  // if the file cannot be read or does not fit in memory.
+  static std::shared_ptr<const G4IAEAphspMemorySource>
+  Load(const G4String& filename, const G4bool extraFloats = false,
+       const G4bool extraInts = false);
+
+  ~G4IAEAphspMemorySource() = default;
+
+  inline const G4String& GetFileName() const   {return fFileName;}
+  inline G4long GetNumberOfParticles() const    {return fNParticles;}
+  inline G4int GetNumberOfExtraFloats() const   {return fNExtraFloats;}
+  inline G4int GetNumberOfExtraInts() const     {return fNExtraInts;}
+  inline G4bool HasExtraFloats() const {return fExtraFloatsKept;}
+  inline G4bool HasExtraInts() const   {return fExtraIntsKept;}
+
+  // Copies up to nMax particles from position 'first' (counting from 0)
+  // into the block arrays of a reader, as iaea_get_particles() does. Extra
+  // variable k of particle i goes to extraFloats[k*nMax + i] (resp.
+  // extraInts); these arrays may be null, and are not filled if the extra
+  // variables were not kept. Returns the number of particles copied, 0
+  // past the end.
+  G4int CopyBlock(const G4long first, const G4int nMax,
+		  G4int* nStat, G4int* type, G4float* energy, G4float* weight,
+		  G4float* x, G4float* y, G4float* z,
+		  G4float* u, G4float* v, G4float* w,
+		  G4float* extraFloats, G4int* extraInts) const;
+
+private:
+
+  G4IAEAphspMemorySource() = default;
+
+  G4String fFileName;
+  G4long fNParticles = 0;
+  G4int fNExtraFloats = 0, fNExtraInts = 0;
+  G4bool fExtraFloatsKept = false, fExtraIntsKept = false;
+
+  std::vector<G4int> fNStat, fType;
+  std::vector<G4float> fEnergy, fWeight, fX, fY, fZ, fU, fV, fW;
+  std::vector<G4float> fExtraFloats;
+  std::vector<G4int> fExtraInts;
+  // One column per variable; extra variable k of particle i is stored at
+  // k*fNParticles + i.
+};
+
+#endif
@@ -43,13 +43,20 @@
 
 #include "G4VPrimaryGenerator.hh"
 
+#include <memory>
 #include <vector>
 
 #include "globals.hh"
 #include "G4ThreeVector.hh"
+#include "G4RotationMatrix.hh"
+
+#include "G4IAEAphspEventArena.hh"
 
 
 class G4Event;
+class G4IAEAphspFileSet;
+class G4IAEAphspHistoryQueue;
+class G4IAEAphspMemorySource;
 class G4IAEAphspReaderMessenger;
 
 
@@ -58,9 +65,18 @@ class G4IAEAphspReader :public G4VPrimaryGenerator
 
 public:
 
+  // A particle read from the phase-space file, as stored for its event
+  using EventParticle = G4IAEAphspEventArena::Particle;
+
   G4IAEAphspReader(const char* filename, const G4int threads = 1);
   G4IAEAphspReader(const G4String filename, const G4int threads = 1);
-  // 'filename' must include the path if needed, but NOT the extension
+  // 'filename' must include the path if needed, but NOT the extension.
+  // It may also be a list of files or a glob pattern (see
+  // G4IAEAphspFileSet), read as a single phsp source.
+  G4IAEAphspReader(std::shared_ptr<G4IAEAphspHistoryQueue> queue,
+		   const G4int threads = 1);
+  // Reader taking the particles from the i/o thread of 'queue'. It does not
+  // open any IAEA source itself.
   ~G4IAEAphspReader() override;
   
   void GeneratePrimaryVertex(G4Event* evt) override;   // Mandatory
@@ -81,22 +97,40 @@ public:
   }
 
   void SetParallelRun(const G4int parallelRun);
+  void SetDynamicBlocks(const G4int nBlocks);
+  void SetMemorySource(std::shared_ptr<const G4IAEAphspMemorySource> src);
+  void SetAccessMode(const G4String& mode);
+  void SetReadAheadDepth(const G4int megabytes);
+  void SetStreaming(const G4bool value);
+  void SetDecodeExtraFloats(const G4bool value);
+  void SetDecodeExtraInts(const G4bool value);
   inline void SetTotalThreads(const G4int threads) {fTotalThreads = threads;}
   inline void SetTimesRecycled(const G4int ntimes) {fTimesRecycled = ntimes;}
+  inline void SetEpochMode(const G4bool value) {fEpochMode = value;}
 
+  // The translation and rotations are composed again (ComposeTransform())
+  // at the beginning of the next event
   inline void SetGlobalPhspTranslation(const G4ThreeVector & pos)
-  {fGlobalPhspTranslation = pos;}
-  inline void SetRotationOrder(const G4int ord)  { fRotationOrder = ord; }
-  inline void SetRotationX(const G4double alpha) { fAlpha = alpha; }
-  inline void SetRotationY(const G4double beta)  { fBeta = beta; }
-  inline void SetRotationZ(const G4double gamma) { fGamma = gamma; }
+  {fGlobalPhspTranslation = pos; fTransformChanged = true;}
+  inline void SetRotationOrder(const G4int ord)
+  {fRotationOrder = ord; fTransformChanged = true;}
+  inline void SetRotationX(const G4double alpha)
+  {fAlpha = alpha; fTransformChanged = true;}
+  inline void SetRotationY(const G4double beta)
+  {fBeta = beta; fTransformChanged = true;}
+  inline void SetRotationZ(const G4double gamma)
+  {fGamma = gamma; fTransformChanged = true;}
   inline void SetIsocenterPosition(const G4ThreeVector & pos)
-  {fIsocenterPosition = pos;}
+  {fIsocenterPosition = pos; fTransformChanged = true;}
   void SetCollimatorRotationAxis(const G4ThreeVector & axis);
   void SetGantryRotationAxis(const G4ThreeVector & axis);
-  inline void SetCollimatorAngle(const G4double ang) {fCollimatorAngle = ang;}
-  inline void SetGantryAngle(const G4double ang) {fGantryAngle = ang;}
+  inline void SetCollimatorAngle(const G4double ang)
+  {fCollimatorAngle = ang; fTransformChanged = true;}
+  inline void SetGantryAngle(const G4double ang)
+  {fGantryAngle = ang; fTransformChanged = true;}
 
+  // The acceptance box is checked for each copy when an axial symmetry is
+  // applied, so the filter is evaluated again too (ComposeTransform())
   inline void SetAxialSymmetryX(const G4bool value) 
   {
     fAxialSymmetryX = value;
@@ -104,6 +138,7 @@ public:
       fAxialSymmetryY = false;
       fAxialSymmetryZ = false;
     }
+    fTransformChanged = true;
   }
   inline void SetAxialSymmetryY(const G4bool value)
   {
@@ -112,6 +147,7 @@ public:
       fAxialSymmetryZ = false;
       fAxialSymmetryX = false;
     }
+    fTransformChanged = true;
   }
   inline void SetAxialSymmetryZ(const G4bool value)
   {
@@ -120,9 +156,31 @@ public:
       fAxialSymmetryX = false;
       fAxialSymmetryY = false;
     }
+    fTransformChanged = true;
   }
 
+  // Acceptance filter: particles out of the energy window, of a type not
+  // selected or whose straight line (in the global frame) misses the
+  // acceptance box are not turned into primaries. Their histories are
+  // still counted. The filter is evaluated again at the next event.
+  void SetFilterMinEnergy(const G4double energy);
+  void SetFilterMaxEnergy(const G4double energy);
+  void SetFilterParticles(const G4String& names);
+  // 'names' is a list of "gamma", "e-", "e+", "neutron" and "proton",
+  // or "all"
+  void SetAcceptanceBoxCenter(const G4ThreeVector& center);
+  void SetAcceptanceBoxHalfLength(const G4ThreeVector& halfLength);
+  // The box is used only if its three half lengths are positive
+
   inline G4String GetFileName() const         {return fFileName;}
+  // With several files, GetFileName() is the one being read
+  G4int GetNumberOfFiles() const;
+  inline G4int GetCurrentFile() const         {return fCurrentFile;}
+  G4String GetAccessMode() const;
+  inline G4long GetReadAheadDepth() const     {return fReadAhead;}
+  inline G4bool GetStreaming() const          {return fStreaming;}
+  inline G4bool GetDecodeExtraFloats() const  {return fDecodeExtraFloats;}
+  inline G4bool GetDecodeExtraInts() const    {return fDecodeExtraInts;}
   inline G4int GetSourceReadId() const        {return fSourceReadId;}
   inline G4long GetOrigHistories() const      {return fOrigHistories;}
   inline G4long GetUsedOrigHistories() const  {return fUsedOrigHistories;}
@@ -136,20 +194,25 @@ public:
   G4long GetTotalParticlesOfType(const G4String type) const;
   G4double GetConstantVariable(const G4int index) const;
 
-  inline std::vector<G4int>* GetParticleTypeVec() const
-  {return fParticleTypeVec;}
-  inline std::vector<G4double>* GetKinEVec() const
-  {return fKinEVec;}
-  inline std::vector<G4ThreeVector>* GetPosVec() const
-  {return fPosVec;}
-  inline std::vector<G4ThreeVector>* GetMomDirVec() const
-  {return fMomDirVec;}
-  inline std::vector<G4double>* GetWeightVec() const
-  {return fWeightVec;}
-  inline std::vector< std::vector<G4double> >* GetExtraFloatVec() const
-  {return fExtraFloatVec;}
-  inline std::vector< std::vector<G4long> >* GetExtraIntVec() const
-  {return fExtraIntVec;}
+  // Particles read for the current event, the last one being the first
+  // particle of the next event (unless the end of the chunk was reached).
+  // Their position (in Geant4 units) and direction are given in the global
+  // frame, after the translation and rotations set for this reader.
+  // The extra variables (GetNumberOfExtraFloats() / GetNumberOfExtraInts()
+  // values) are null unless their decoding was requested.
+  inline G4int GetNumberOfStoredParticles() const {return fArena.Size();}
+  inline const EventParticle& GetStoredParticle(const G4int i) const
+  {return fArena.At(fArena.Slot(i));}
+  inline const G4double* GetStoredExtraFloats(const G4int i) const
+  {
+    G4int slot = fArena.Slot(i);
+    return fArena.At(slot).hasExtraFloats ? fArena.ExtraFloats(slot) : 0;
+  }
+  inline const G4long* GetStoredExtraInts(const G4int i) const
+  {
+    G4int slot = fArena.Slot(i);
+    return fArena.At(slot).hasExtraInts ? fArena.ExtraInts(slot) : 0;
+  }
 
   inline G4int GetTotalParallelRuns() const {return fTotalParallelRuns;}
   inline G4int GetParallelRun() const       {return fParallelRun;}
@@ -157,6 +220,12 @@ public:
   inline G4long GetFirstParticle() const    {return fFirstParticle;}
   inline G4long GetLastParticle() const     {return fLastParticle;}
   inline G4int GetTimesRecycled() const     {return fTimesRecycled;}
+  inline G4int GetDynamicBlocks() const     {return fDynamicBlocks;}
+  inline G4bool GetEpochMode() const        {return fEpochMode;}
+  inline G4long GetEpochsCompleted() const  {return fEpochsCompleted;}
+  inline G4bool IsReadingFromMemory() const {return fMemorySource != nullptr;}
+  inline G4bool IsReadingFromQueue() const  {return fHistoryQueue != nullptr;}
+  inline G4bool IsTaskBased() const         {return fTaskBased;}
 
   inline G4ThreeVector GetGlobalPhspTranslation() const
   {return fGlobalPhspTranslation;}
@@ -176,6 +245,22 @@ public:
   inline G4bool GetAxialSymmetryY() const {return fAxialSymmetryY;}
   inline G4bool GetAxialSymmetryZ() const {return fAxialSymmetryZ;}
 
+  inline G4bool IsFiltering() const           {return fFiltering;}
+  inline G4double GetFilterMinEnergy() const  {return fFilterMinEnergy;}
+  inline G4double GetFilterMaxEnergy() const  {return fFilterMaxEnergy;}
+  inline G4int GetFilterTypeMask() const      {return fFilterTypeMask;}
+  inline G4ThreeVector GetAcceptanceBoxCenter() const
+  {return fAcceptanceBoxCenter;}
+  inline G4ThreeVector GetAcceptanceBoxHalfLength() const
+  {return fAcceptanceBoxHalfLength;}
+
+  // Tallies of the filter since the reader was created, counting each
+  // recycled copy as a particle with its share of the weight
+  inline G4long GetAcceptedParticles() const  {return fAcceptedParticles;}
+  inline G4long GetRejectedParticles() const  {return fRejectedParticles;}
+  inline G4double GetAcceptedWeight() const   {return fAcceptedWeight;}
+  inline G4double GetRejectedWeight() const   {return fRejectedWeight;}
+
 
 private:
 
@@ -183,15 +268,32 @@ private:
 
   void InitializeMembers();
   void InitializeSource(const G4String filename);
+  void OpenFile(const G4int file);
+  void SeekParticle(const G4long particle);
   void ComputeFirstLastParticle();
+  void NextBlock();
+  void RewindChunk();
+  void NextEpoch();
   void ReadAndStoreFirstParticle();
   void PrepareThisEvent();
   void ReadThisEvent();
+  G4int ReadNextParticle();
+  G4bool PopHistoryBatch();
+  void StoreParticle(const G4int idx);
   void GeneratePrimaryParticles(G4Event* evt);
-  void PerformRotations(G4ThreeVector& mom);
-  void PerformGlobalRotations(G4ThreeVector& mom);
-  void PerformHeadRotations(G4ThreeVector& mom);
+  void ComposeTransform();
+  void TransformBlock(const G4int first);
+  void FilterBlock(const G4int first);
+  void UpdateFiltering();
+  G4bool AcceptParticle(const G4int type, const G4double kinE,
+			const G4ThreeVector& pos,
+			const G4ThreeVector& dir) const;
+  G4bool ReachesAcceptanceBox(const G4ThreeVector& pos,
+			      const G4ThreeVector& dir) const;
   void RestartSourceFile();
+  void ApplySourceOptions();
+  G4bool MemoryHoldsExtras() const;
+  void LeaveMemorySource();
 
 
   // ========== Data members ==========
@@ -209,14 +311,41 @@ private:
   // The Id the file source has for the IAEA routines.
   // This value is set by IAEA routines, but should correspond to thread Id.
 
-  // static const G4int fAccessRead = 1;
-  // A value needed to open the file in the IAEA codes
+  G4int fAccessRead;
+  // Access code passed to iaea_new_source(): 1 for stdio reads (default),
+  // 4 for a read-only memory mapping of the phsp file.
+
+  G4long fReadAhead;
+  // Bytes of the phsp file read in advance by a background thread while
+  // the particles already read are tracked (0 = off). Not used with mmap.
+
+  G4bool fStreaming;
+  // Drop the pages of the phsp file from the page cache once read, so that
+  // huge files do not evict the data of other jobs. Not used with mmap.
+
+  std::shared_ptr<const G4IAEAphspMemorySource> fMemorySource;
+  // If set, the particles are copied from this copy in memory of the whole
+  // file, shared by all the threads, instead of being read from the file.
+
+  std::shared_ptr<const G4IAEAphspFileSet> fFileSet;
+  G4int fCurrentFile;
+  // If set, the phsp source is this set of files, fFileName being the
+  // one open, fCurrentFile in the set. The particles are numbered over the
+  // whole set, which is split in chunks and blocks as a single file.
+
+  std::shared_ptr<G4IAEAphspHistoryQueue> fHistoryQueue;
+  // If set, the particles are taken in batches of complete histories from
+  // the i/o thread of this queue, shared by all the threads. The reader
+  // then has no IAEA source (fSourceReadId = -1) and reads no fragment of
+  // its own: the queue goes through the file again and again, so the end
+  // of the file is never reached.
 
   G4long fOrigHistories;
   // Number of original histories which generated the phase space file
+  // (all the files of fFileSet)
 
   G4long fTotalParticles;
-  // Number of particles stored in the phase space file
+  // Number of particles stored in the phase space file (idem)
 
   G4int fNumberOfExtraFloats, fNumberOfExtraInts;
   // Number of extra variables stored for each particle
@@ -225,17 +354,57 @@ private:
   std::vector<G4int>* fExtraIntTypes;
   // Identification to classify the different extra variables
 
+  G4bool fDecodeExtraFloats, fDecodeExtraInts;
+  // Whether the extra variables of each kind are copied into
+  // the event arena (default false). Otherwise their bytes
+  // are skipped when decoding. The incremental history number is always
+  // taken into account, since it is decoded into fBlockNStat.
+
   // ---------------------
   // PARTICLE PROPERTIES
   // ---------------------
 
-  std::vector<G4int>* fParticleTypeVec;
-  std::vector<G4double>* fKinEVec;
-  std::vector<G4ThreeVector>* fPosVec;
-  std::vector<G4ThreeVector>* fMomDirVec;
-  std::vector<G4double>* fWeightVec;
-  std::vector< std::vector<G4double> >* fExtraFloatVec;
-  std::vector< std::vector<G4long> >* fExtraIntVec;
+  G4IAEAphspEventArena fArena;
+  // Particles of the current event plus the look-ahead particle, with
+  // their extra variables. Owned by this (thread-local) reader.
+
+  // -----------------------------------------------
+  // BLOCK OF PARTICLES DECODED FROM THE PHSP FILE
+  // -----------------------------------------------
+  // Filled by iaea_get_particles() (structure of arrays) and consumed
+  // particle by particle by ReadThisEvent().
+
+  G4int fBlockCapacity;
+  // Maximum number of particles decoded at once
+
+  G4int fBlockSize, fBlockIndex, fBlockStride;
+  // Particles in the block, next one to use and leading dimension of the
+  // extra variables arrays
+
+  std::vector<G4int> fBlockNStat;
+  std::vector<G4int> fBlockType;
+  std::vector<G4float> fBlockE;
+  std::vector<G4float> fBlockWt;
+  std::vector<G4float> fBlockX;
+  std::vector<G4float> fBlockY;
+  std::vector<G4float> fBlockZ;
+  std::vector<G4float> fBlockU;
+  std::vector<G4float> fBlockV;
+  std::vector<G4float> fBlockW;
+  std::vector<G4float> fBlockExtraFloats;
+  std::vector<G4int> fBlockExtraInts;
+
+  G4bool fBlockExtraFloatsRead, fBlockExtraIntsRead;
+  // Whether the extra variables of the current block have been decoded
+
+  std::vector<G4double> fBlockGlobal;
+  // Position (Geant4 units) and direction of the particles of the block in
+  // the global frame, computed by TransformBlock(): six columns (x, y, z,
+  // u, v, w) of fBlockSize values each
+
+  std::vector<G4bool> fBlockAccepted;
+  // Whether each particle of the block passes the acceptance filter,
+  // computed by FilterBlock() only when filtering
 
   // -------------------
   // COUNTERS AND FLAGS
@@ -259,9 +428,38 @@ private:
   // Last particle to read.
   // Value given by the number of independent parallel runs and threads.
 
+  G4int fDynamicBlocks;
+  // If > 0, the fragment of the file of this parallel run is split in
+  // this many blocks, handed out to the threads on demand (NextBlock()).
+  // Then fFirstParticle and fLastParticle are the limits of the block.
+
+  G4bool fTaskBased;
+  // Running under G4TaskRunManager: the events are handed out in tasks to
+  // whichever thread is free, so a fixed chunk per thread would be read
+  // unevenly. Blocks are then always used (16 per thread by default).
+
   G4int fTimesRecycled;
   // Set the number of times that each particle is recycled (not repeated)
 
+  G4bool fEpochMode;
+  // If true, the chunk is read again from its beginning as soon as its
+  // last particle is read, from the next event on, instead of ending the
+  // chunk with a warning and restarting the reader.
+
+  G4long fEpochsCompleted;
+  // Passes over the chunk completed since the last restart (epoch mode)
+
+  G4bool fNewBlock;
+  // The source has just been placed at the start of a block or chunk, so
+  // the next particle read opens a new history even if its n_stat is 0.
+
+  G4long fBlockPass;
+  // Pass over the blocks of the block read (-1 before the first block)
+
+  G4long fPendingTicket;
+  // Block of a new pass taken from the shared cursor at the end of the
+  // previous pass, read when the reader restarts (-1 if none)
+
   G4int fNStat;
   // Decides how many events should pass before throwing a new particle
 
@@ -277,6 +475,10 @@ private:
   G4bool fLastGenerated;
   // Flag active only when the last particle has been simulated
 
+  G4bool fReopenSource;
+  // The IAEA source must be opened again at the next restart (new access
+  // mode). Otherwise restarting just moves back to the start of the chunk.
+
   // ------------------------
   // SPATIAL TRANSFORMATIONS
   // ------------------------
@@ -299,6 +501,14 @@ private:
   // Angles and axis of isocentric rotations in the machine
   // The collimator ALWAYS rotates first.
 
+  G4RotationMatrix fTransformRotation;
+  G4ThreeVector fTransformTranslation;
+  // All the above composed into one affine transform, x -> R*x + t for
+  // positions and u -> R*u for directions, applied to whole blocks
+
+  G4bool fTransformChanged;
+  // Some of the above changed since the transform was last composed
+
   // --------------------
   // ROTATIONAL SYMMETRY
   // --------------------
@@ -309,6 +519,27 @@ private:
   G4bool fAxialSymmetryY;
   G4bool fAxialSymmetryZ;
 
+  // ------------------
+  // ACCEPTANCE FILTER
+  // ------------------
+
+  G4bool fFiltering;
+  // Some of the cuts below may reject particles
+
+  G4double fFilterMinEnergy, fFilterMaxEnergy;
+  // Window of kinetic energy accepted (Geant4 units)
+
+  G4int fFilterTypeMask;
+  // Bit (type-1) set for each IAEA particle type accepted
+
+  G4ThreeVector fAcceptanceBoxCenter, fAcceptanceBoxHalfLength;
+  G4bool fAcceptanceBox;
+  // Box (global frame) that the straight line of the particle must reach
+
+  G4long fAcceptedParticles, fRejectedParticles;
+  G4double fAcceptedWeight, fRejectedWeight;
+  // Tallies of the particles generated and rejected
+
   // ----------------
   // MESSENGER CLASS
   // ----------------
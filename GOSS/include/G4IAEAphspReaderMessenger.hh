@@ -50,6 +50,7 @@ class G4UIcmdWith3VectorAndUnit;
 class G4UIcmdWithABool;
 class G4UIcmdWithADoubleAndUnit;
 class G4UIcmdWithAnInteger;
+class G4UIcmdWithAString;
 class G4UIcommand;
 class G4UIdirectory;
 
@@ -72,6 +73,19 @@ private:
   G4UIcmdWithAnInteger* fVerboseCmd;
   // UI command for verbosity level.
 
+  G4UIcmdWithAString* fAccessModeCmd;
+  // UI command to choose how the phase-space file is read (stdio or mmap).
+
+  G4UIcmdWithAnInteger* fReadAheadDepthCmd;
+  // UI command to set how many MB of the file are read in advance.
+
+  G4UIcmdWithABool* fStreamingCmd;
+  // UI command to keep the phase-space file out of the page cache.
+
+  G4UIcmdWithABool* fDecodeExtraFloatsCmd;
+  G4UIcmdWithABool* fDecodeExtraIntsCmd;
+  // UI commands to decode the extra variables stored for each particle.
+
   G4UIcmdWithAnInteger* fNofParallelRunsCmd;
   // UI command to define the number of fragments defined in the file.
 
@@ -79,6 +93,12 @@ private:
   // UI command to choose the specific fragment where the particles are 
   // taken from.
 
+  G4UIcmdWithAnInteger* fDynamicBlocksCmd;
+  // UI command to hand out the fragment to the threads in blocks on demand.
+
+  G4UIcmdWithABool* fEpochModeCmd;
+  // UI command to read the chunk again as soon as it ends, with no restart.
+
   G4UIcmdWithAnInteger* fTimesRecycledCmd;
   // UI command to set the number of times each particle is recycled
   // (not repeated).
@@ -121,6 +141,17 @@ private:
 
   G4UIcmdWithABool* fAxialSymmetryZCmd;
   // UI command to turn on/off the rotational symmetry around Z.
+
+  G4UIcmdWithADoubleAndUnit* fFilterMinEnergyCmd;
+  G4UIcmdWithADoubleAndUnit* fFilterMaxEnergyCmd;
+  // UI commands to set the window of kinetic energy generated.
+
+  G4UIcmdWithAString* fFilterParticlesCmd;
+  // UI command to choose the particle types generated.
+
+  G4UIcmdWith3VectorAndUnit* fAcceptanceBoxCenterCmd;
+  G4UIcmdWith3VectorAndUnit* fAcceptanceBoxHalfLengthCmd;
+  // UI commands to set the box that the particles must head to.
 };
 #endif
 
@@ -61,6 +61,13 @@ public:
   void WriteIAEAParticle(const size_t idx, const G4int nStat, const G4int pdg,
 			 const G4double kinE, const G4double wt,
 			 const G4ThreeVector pos, const G4ThreeVector momDir);
+  void WriteIAEAParticles(const size_t idx, const std::vector<G4int>& nStat,
+			  const std::vector<G4int>& pdg,
+			  const std::vector<G4double>& kinE,
+			  const std::vector<G4double>& wt,
+			  const std::vector<G4ThreeVector>& pos,
+			  const std::vector<G4ThreeVector>& momDir);
+  // Same as WriteIAEAParticle() for whole vectors, written in large blocks
   void CloseIAEAphspOutFiles();
 
   void AddZphsp(const G4double zphsp);
@@ -68,11 +75,15 @@ public:
   // void UpdateHeaders();
 
   void SetFileName(const G4String name)     { fFileName = name; }
+  void SetColumnar(const G4bool val)        { fColumnar = val; }
+  void SetStreaming(const G4bool val)       { fStreaming = val; }
   void SetConstVariable(G4int idx, G4double value);
   void SumOrigHistories(size_t idx, G4int value)
   { fOrigHistories->at(idx) += value; }
 
   const G4String GetFileName() const                 { return fFileName; }
+  G4bool GetColumnar() const                         { return fColumnar; }
+  G4bool GetStreaming() const                        { return fStreaming; }
   const std::vector<G4double>* GetZphspVec() const   { return fZphspVec; }
   const std::vector<G4int>* GetOrigHistoriesVec() const
   { return fOrigHistories; }
@@ -92,6 +103,15 @@ private:
   G4String fFileName;
   // Must include the path but not any of the IAEA extensions.
 
+  G4bool fColumnar = false;
+  // Write the particles in the GOSS columnar compressed format (.GOSSphsp)
+  // instead of the IAEA one (.IAEAphsp). The header is the same, and the
+  // IAEA routines read either file transparently.
+
+  G4bool fStreaming = false;
+  // Drop the pages written from the page cache as the files grow, so that
+  // huge outputs do not evict the data of other jobs from memory.
+
   std::vector<G4double>* fZphspVec = nullptr;
   // Vector storing the z-value of the phsp planes.
 
@@ -105,9 +125,10 @@ private:
   // Vector bookkeeping the number of original histories recorded for each phsp.
   // For regular simulations, all the elements should have the same value.
 
-  G4int fIAEASourcesOpen;
-  // This is a counter to consider if there is another IAEA file already open,
-  // e.g. a source IAEAphsp file to generate particles.
+  std::vector<G4int>* fSourceIds = nullptr;
+  // IAEA source ID of the file open for each phsp plane. IDs are assigned by
+  // the IAEA routines and need not be consecutive (other IAEA files may be
+  // open, e.g. a source IAEAphsp file to generate particles).
 
 };
 
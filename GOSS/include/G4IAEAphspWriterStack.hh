@@ -63,8 +63,12 @@ public:
   void ClearRunVectors();
 
   void SetFileName(const G4String name)   { fFileName = name; }
+  void SetColumnar(const G4bool val)      { fColumnar = val; }
+  void SetStreaming(const G4bool val)     { fStreaming = val; }
 
   const G4String GetFileName() const                       {return fFileName;}
+  G4bool GetColumnar() const                               {return fColumnar;}
+  G4bool GetStreaming() const                              {return fStreaming;}
   const std::vector<G4double>* GetZphspVec() const         {return fZphspVec;}
   std::vector<std::vector<G4int>* >* GetPDGMtrx() const    {return fPDGMtrx;}
   std::vector<std::vector<G4ThreeVector>* >* GetPosMtrx() const
@@ -93,6 +97,13 @@ private:
   // Must include the path but not any of the IAEA extensions.
   // (This is set from G4IAEAphspWriter)
 
+  G4bool fColumnar = false;
+  // Files written in the GOSS columnar compressed format (.GOSSphsp)
+  // instead of the IAEA one (.IAEAphsp). The header is the same.
+
+  G4bool fStreaming = false;
+  // Files written in streaming mode (pages dropped from the page cache).
+
   std::vector<G4double>* fZphspVec = nullptr;
   // Vector storing the z-value of the phsp planes.
 
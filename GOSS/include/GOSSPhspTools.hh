@@ -0,0 +1,58 @@
+//
+// GOSSPhspTools - Standalone utilities for IAEA phase space files
+//
+
+#ifndef GOSSPhspTools_h
+#define GOSSPhspTools_h 1
+
+#include "globals.hh"
+#include <string>
+#include <vector>
+
+/// Utility class gathering the phase space operations that can be run
+/// from the command line without starting a simulation.
+///
+/// Files are given without the .IAEAheader / .IAEAphsp (.GOSSphsp) extension.
+
+class GOSSPhspTools
+{
+public:
+  /// Build the .IAEAindex history index of an existing phase space file
+  /// @param fileName   Phase space file name (without extension)
+  /// @param stride     New histories between index entries (0 = library default)
+  /// @param nThreads   Threads scanning the file (0 = all hardware threads)
+  /// @return 0 on success, 1 on failure
+  static int BuildIndex(const std::string& fileName, G4long stride = 0,
+                        G4int nThreads = 0);
+
+  /// Recompute the statistics of an existing phase space file (particles
+  /// of each type, weights, energies, coordinates) and rewrite its header
+  /// @param fileName   Phase space file name (without extension)
+  /// @param nThreads   Threads scanning the file (0 = all hardware threads)
+  /// @return 0 on success, 1 on failure
+  static int ScanStatistics(const std::string& fileName, G4int nThreads = 0);
+
+  /// Concatenate phase space files with the same record layout into one.
+  /// Records are copied as they are (in the kernel where possible) and the
+  /// output header is rebuilt from the input headers.
+  /// @param outputName Merged phase space file name (without extension)
+  /// @param inputNames Files to merge, in order (without extension)
+  /// @param columnar   Write the output in the GOSS columnar format
+  /// @return 0 on success, 1 on failure
+  static int Merge(const std::string& outputName,
+                   const std::vector<std::string>& inputNames,
+                   G4bool columnar = false);
+
+  /// Convert a phase space file between the IAEA format (.IAEAphsp) and the
+  /// GOSS columnar compressed format (.GOSSphsp). Both store the same
+  /// records, so the conversion is lossless either way.
+  /// @param inputName  Phase space file to convert (without extension)
+  /// @param outputName Converted phase space file name (without extension)
+  /// @param format     "IAEA" or "GOSS" (empty = the one the input is not in)
+  /// @return 0 on success, 1 on failure
+  static int Convert(const std::string& inputName,
+                     const std::string& outputName,
+                     const std::string& format = "");
+};
+
+#endif
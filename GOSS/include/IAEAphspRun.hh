@@ -31,6 +31,7 @@
 
 class G4Event;
 
+class G4IAEAphspReader;
 class G4IAEAphspWriter;
 class G4IAEAphspWriterStack;
 
@@ -56,11 +57,23 @@ public:
   // method to dump info into IAEAphsp output files
   void DumpToIAEAphspFiles(const G4IAEAphspWriterStack*);
 
+  // method to print the particles rejected by the reader filter
+  void PrintIAEAphspFilterSummary() const;
+
   // Get/Set methods
   G4IAEAphspWriter* GetIAEAphspWriter() const   { return fIAEAphspWriter; }
   G4IAEAphspWriterStack* GetIAEAphspWriterStack() const
   { return fIAEAphspWriterStack; }
 
+  // The tallies of the acceptance filter of 'reader' are taken at each
+  // event, counting from this call
+  void SetIAEAphspReader(const G4IAEAphspReader* reader);
+  G4bool IsIAEAphspFiltering() const       { return fFiltering; }
+  G4long GetAcceptedParticles() const      { return fAcceptedParticles; }
+  G4long GetRejectedParticles() const      { return fRejectedParticles; }
+  G4double GetAcceptedWeight() const       { return fAcceptedWeight; }
+  G4double GetRejectedWeight() const       { return fRejectedWeight; }
+
 
 private:
 
@@ -69,6 +82,16 @@ private:
   G4IAEAphspWriter* fIAEAphspWriter = nullptr;
   G4IAEAphspWriterStack* fIAEAphspWriterStack = nullptr;
 
+  const G4IAEAphspReader* fIAEAphspReader = nullptr;
+  G4long fAcceptedAtStart = 0, fRejectedAtStart = 0;
+  G4double fAcceptedWeightAtStart = 0., fRejectedWeightAtStart = 0.;
+  // Thread-local reader and its tallies when this run started
+
+  G4bool fFiltering = false;
+  G4long fAcceptedParticles = 0, fRejectedParticles = 0;
+  G4double fAcceptedWeight = 0., fRejectedWeight = 0.;
+  // Particles (and weight) generated and rejected by the reader filter
+
 };
 
 #endif
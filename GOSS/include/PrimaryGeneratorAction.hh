@@ -30,8 +30,12 @@
 #include "G4VUserPrimaryGeneratorAction.hh"
 #include "globals.hh"
 
+#include <memory>
+
 class G4Event;
 class G4GeneralParticleSource;
+class G4IAEAphspHistoryQueue;
+class G4IAEAphspMemorySource;
 class G4IAEAphspReader;
 class PrimaryGeneratorMessenger;
 
@@ -49,7 +53,9 @@ public:
   void GeneratePrimaries(G4Event* anEvent) override;
 
   // PHSP reader configuration
-  void SetIAEAphspReader(const G4String filename);
+  void SetIAEAphspReader(const G4String filename,
+     std::shared_ptr<const G4IAEAphspMemorySource> memorySource = nullptr,
+     std::shared_ptr<G4IAEAphspHistoryQueue> historyQueue = nullptr);
   inline G4IAEAphspReader* GetIAEAphspReader() const { return fIAEAphspReader; }
   
   // Verbose control
@@ -55,6 +55,8 @@ public:
 
   // Modifiers and setters
   void SetIAEAphspWriterStack(const G4String& namePrefix);
+  void SetIAEAphspWriterColumnar(const G4bool val);
+  void SetIAEAphspWriterStreaming(const G4bool val);
   void AddZphsp(const G4double val);
 
 
@@ -27,11 +27,7 @@
 #include "globals.hh"
 #include "Randomize.hh"
 
-#ifdef G4MULTITHREADED
-#include "G4MTRunManager.hh"
-#else
-#include "G4RunManager.hh"
-#endif
+#include "G4RunManagerFactory.hh"
 
 #include "G4UImanager.hh"
 #include "G4UIExecutive.hh"
@@ -42,8 +38,26 @@
 #include "ActionInitialization.hh"
 #include "GOSSMessenger.hh"
 #include "GOSSMerger.hh"
+#include "GOSSPhspTools.hh"
 
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
 #include <string>
+#include <vector>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+// Reads a non-negative count (stride, threads) of the standalone tools.
+// Returns false if arg is not a whole number within [0, max].
+
+static G4bool ParseCount(const char* arg, const long max, long& value)
+{
+  char* end = nullptr;
+  errno = 0;
+  value = std::strtol(arg, &end, 10);
+  return (end != arg && *end == '\0' && errno == 0 &&
+          value >= 0 && value <= max);
+}
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 
@@ -62,6 +76,67 @@ int main(int argc, char** argv) {
     return 0;
   }
 
+  // Check for --phsp-index command
+  if (argc >= 2 && std::string(argv[1]) == "--phsp-index") {
+    G4cout << "\n========================================" << G4endl;
+    G4cout << "  GOSS Phsp Indexer (Standalone Mode)" << G4endl;
+    G4cout << "========================================\n" << G4endl;
+
+    long stride = 0, nThreads = 0;
+    if (argc < 3 || (argc >= 4 && !ParseCount(argv[3], LONG_MAX, stride)) ||
+        (argc >= 5 && !ParseCount(argv[4], INT_MAX, nThreads))) {
+      G4cout << "Usage: ./goss --phsp-index <file> [stride] [threads]" << G4endl;
+      return 1;
+    }
+    return GOSSPhspTools::BuildIndex(argv[2], static_cast<G4long>(stride),
+                                     static_cast<G4int>(nThreads));
+  }
+
+  // Check for --phsp-scan command
+  if (argc >= 2 && std::string(argv[1]) == "--phsp-scan") {
+    G4cout << "\n========================================" << G4endl;
+    G4cout << "  GOSS Phsp Scanner (Standalone Mode)" << G4endl;
+    G4cout << "========================================\n" << G4endl;
+
+    long nThreads = 0;
+    if (argc < 3 || (argc >= 4 && !ParseCount(argv[3], INT_MAX, nThreads))) {
+      G4cout << "Usage: ./goss --phsp-scan <file> [threads]" << G4endl;
+      return 1;
+    }
+    return GOSSPhspTools::ScanStatistics(argv[2],
+                                         static_cast<G4int>(nThreads));
+  }
+
+  // Check for --phsp-merge command
+  if (argc >= 2 && std::string(argv[1]) == "--phsp-merge") {
+    G4cout << "\n========================================" << G4endl;
+    G4cout << "  GOSS Phsp Merger (Standalone Mode)" << G4endl;
+    G4cout << "========================================\n" << G4endl;
+
+    if (argc < 4) {
+      G4cout << "Usage: ./goss --phsp-merge <output> <input> [input ...]"
+             << G4endl;
+      return 1;
+    }
+    std::vector<std::string> inputs(argv + 3, argv + argc);
+    return GOSSPhspTools::Merge(argv[2], inputs);
+  }
+
+  // Check for --phsp-convert command
+  if (argc >= 2 && std::string(argv[1]) == "--phsp-convert") {
+    G4cout << "\n========================================" << G4endl;
+    G4cout << "  GOSS Phsp Converter (Standalone Mode)" << G4endl;
+    G4cout << "========================================\n" << G4endl;
+
+    if (argc < 4) {
+      G4cout << "Usage: ./goss --phsp-convert <input> <output> [IAEA|GOSS]"
+             << G4endl;
+      return 1;
+    }
+    std::string format = (argc >= 5) ? argv[4] : "";
+    return GOSSPhspTools::Convert(argv[2], argv[3], format);
+  }
+
   // Show help if no arguments
   if (argc == 1) {
     G4cout << "\n========================================" << G4endl;
@@ -69,11 +144,23 @@ int main(int argc, char** argv) {
     G4cout << "========================================\n" << G4endl;
     G4cout << "Usage:" << G4endl;
     G4cout << "  ./goss <macro_file>     Run simulation with macro" << G4endl;
-    G4cout << "  ./goss --merge [dir]    Merge CSV files from threads\n" << G4endl;
+    G4cout << "  ./goss --merge [dir]    Merge CSV files from threads" << G4endl;
+    G4cout << "  ./goss --phsp-index <file> [stride] [threads]" << G4endl;
+    G4cout << "                          Build the history index of a phsp file" << G4endl;
+    G4cout << "  ./goss --phsp-scan <file> [threads]" << G4endl;
+    G4cout << "                          Recompute the header statistics of a phsp file" << G4endl;
+    G4cout << "  ./goss --phsp-merge <output> <input> [input ...]" << G4endl;
+    G4cout << "                          Concatenate phsp files into one" << G4endl;
+    G4cout << "  ./goss --phsp-convert <input> <output> [IAEA|GOSS]" << G4endl;
+    G4cout << "                          Convert a phsp file to/from the GOSS columnar format\n" << G4endl;
     G4cout << "Examples:" << G4endl;
     G4cout << "  ./goss macros/my_simulation.mac" << G4endl;
     G4cout << "  ./goss --merge" << G4endl;
     G4cout << "  ./goss --merge ../results" << G4endl;
+    G4cout << "  ./goss --phsp-index phsp/linac_6MV" << G4endl;
+    G4cout << "  ./goss --phsp-scan phsp/linac_6MV 8" << G4endl;
+    G4cout << "  ./goss --phsp-merge phsp/plane1 phsp/plane1_run*" << G4endl;
+    G4cout << "  ./goss --phsp-convert phsp/linac_6MV phsp/linac_6MV_goss" << G4endl;
     G4cout << "\n========================================\n" << G4endl;
     return 0;
   }
@@ -81,12 +168,11 @@ int main(int argc, char** argv) {
   // Choose the Random engine
   G4Random::setTheEngine(new CLHEP::RanecuEngine);
 
-  // Construct the run manager
-#ifdef G4MULTITHREADED
-  auto runManager = new G4MTRunManager;
-#else
-  auto runManager = new G4RunManager;
-#endif
+  // Construct the run manager: tasking if Geant4 was built with it (or as
+  // chosen with the G4RUN_MANAGER_TYPE environment variable: Serial, MT,
+  // Tasking, TBB)
+  auto runManager =
+    G4RunManagerFactory::CreateRunManager(G4RunManagerType::Default);
 
   // Set mandatory initialization classes
   runManager->SetUserInitialization(new DetectorConstruction());
@@ -32,9 +32,13 @@
 #include "RunAction.hh"
 #include "SteppingAction.hh"
 #include "G4RunManager.hh"
+#include "G4RunManagerFactory.hh"
 #include "G4Threading.hh"
 
 #include "G4IAEAphspReader.hh"
+#include "G4IAEAphspFileSet.hh"
+#include "G4IAEAphspMemorySource.hh"
+#include "G4IAEAphspHistoryQueue.hh"
 #include "G4IAEAphspWriterStack.hh"
 
 
@@ -48,10 +52,13 @@ ActionInitialization::ActionInitialization()
 
   // IAEAphsp source file name (including path) for primary generator
   fIAEAphspReaderName = "";
-  fNumberOfThreads = G4RunManager::GetRunManager()->GetNumberOfThreads();
+  fIAEAphspReaderInMemory = false;
+  fIAEAphspReaderIOThread = false;
 
   // Name prefix, including path, of IAEAphsp output files (default, nothing).
   fIAEAphspWriterNamePrefix = "";
+  fIAEAphspWriterColumnar = false;
+  fIAEAphspWriterStreaming = false;
 
   // Vector to register phsp planes (Z=const)
   fZphspVec = new std::vector<G4double>;
@@ -82,9 +89,15 @@ void ActionInitialization::Build() const
   G4cout << "IAEAphsp file to read is \"" << fIAEAphspReaderName << "\"."
 	 << G4endl;
 
-  PrimaryGeneratorAction* prim = new PrimaryGeneratorAction(fNumberOfThreads);
+  // Threads of the master run manager (MT or tasking), as set by
+  // /run/numberOfThreads, which is issued after this object is created
+  G4int nThreads = G4RunManagerFactory::GetMasterRunManager()
+    ->GetNumberOfThreads();
+
+  PrimaryGeneratorAction* prim = new PrimaryGeneratorAction(nThreads);
   if ( !fIAEAphspReaderName.empty() )
-    prim->SetIAEAphspReader(fIAEAphspReaderName);
+    prim->SetIAEAphspReader(fIAEAphspReaderName, fIAEAphspReaderMemory,
+			    fIAEAphspReaderQueue);
   SetUserAction(prim);
 
   RunAction* runAct = new RunAction();
@@ -96,6 +109,8 @@ void ActionInitialization::Build() const
     // Set G4IAEAphspWriterStack object for the local thread
     // and register zphsp values to it
     runAct->SetIAEAphspWriterStack(fIAEAphspWriterNamePrefix);
+    runAct->SetIAEAphspWriterColumnar(fIAEAphspWriterColumnar);
+    runAct->SetIAEAphspWriterStreaming(fIAEAphspWriterStreaming);
 
     if (fZphspVec->size() > 0) {
       for (const auto& zphsp : (*fZphspVec))
@@ -117,6 +132,10 @@ void ActionInitialization::Build() const
 void ActionInitialization::SetIAEAphspReader(const G4String& name)
 {
   fIAEAphspReaderName = name;
+  fIAEAphspReaderMemory.reset();
+  fIAEAphspReaderQueue.reset();
+  LoadIAEAphspReaderMemory();
+  OpenIAEAphspReaderQueue();
 
   if ( !(G4Threading::IsMultithreadedApplication()) ) {
     // In sequential mode, when this command is issued, Build() has been
@@ -133,8 +152,108 @@ void ActionInitialization::SetIAEAphspReader(const G4String& name)
 
     // 2) Drop constness to set G4IAEAphspReader object
     auto* myPrim = const_cast<PrimaryGeneratorAction*>(myConstPrim);
-    myPrim->SetIAEAphspReader(name);
+    myPrim->SetIAEAphspReader(name, fIAEAphspReaderMemory,
+			      fIAEAphspReaderQueue);
+  }
+}
+
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ActionInitialization::SetIAEAphspReaderInMemory(const G4bool val)
+{
+  fIAEAphspReaderInMemory = val;
+  if (!val) fIAEAphspReaderMemory.reset();
+  LoadIAEAphspReaderMemory();
+
+  if ( !(G4Threading::IsMultithreadedApplication()) ) {
+    // In sequential mode the reader may exist already
+    const G4VUserPrimaryGeneratorAction* basePrim =
+      G4RunManager::GetRunManager()->GetUserPrimaryGeneratorAction();
+    if (!basePrim) return;
+
+    const auto* myConstPrim =
+      dynamic_cast<const PrimaryGeneratorAction*>(basePrim);
+    if (!myConstPrim || !myConstPrim->GetIAEAphspReader()) return;
+
+    myConstPrim->GetIAEAphspReader()->SetMemorySource(fIAEAphspReaderMemory);
+  }
+}
+
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+// The phsp file is decoded here, by the master, once both the file name and
+// the in-memory option are known. Worker readers receive it in Build().
+
+void ActionInitialization::LoadIAEAphspReaderMemory()
+{
+  if (!fIAEAphspReaderInMemory || fIAEAphspReaderName.empty() ||
+      fIAEAphspReaderMemory)
+    return;
+
+  if (G4IAEAphspFileSet::ExpandFileNames(fIAEAphspReaderName).size() > 1) {
+    G4ExceptionDescription msg;
+    msg << "The phsp source '" << fIAEAphspReaderName << "' has several "
+	<< "files and cannot be loaded into memory. Each thread will read "
+	<< "them from disk." << G4endl;
+    G4Exception("ActionInitialization::LoadIAEAphspReaderMemory()",
+		"ActionInit002", JustWarning, msg);
+    return;
+  }
+
+  // Without their extra variables, which the readers do not decode unless
+  // /IAEAphspReader/decodeExtraFloats (or Ints) is set afterwards
+  fIAEAphspReaderMemory =
+    G4IAEAphspMemorySource::Load(fIAEAphspReaderName, false, false);
+}
+
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ActionInitialization::SetIAEAphspReaderIOThread(const G4bool val)
+{
+  fIAEAphspReaderIOThread = val;
+  if (!val) fIAEAphspReaderQueue.reset();
+  OpenIAEAphspReaderQueue();
+
+  if ( !(G4Threading::IsMultithreadedApplication()) ) {
+    // In sequential mode the reader may exist already: replace it
+    const G4VUserPrimaryGeneratorAction* basePrim =
+      G4RunManager::GetRunManager()->GetUserPrimaryGeneratorAction();
+    if (!basePrim) return;
+
+    const auto* myConstPrim =
+      dynamic_cast<const PrimaryGeneratorAction*>(basePrim);
+    if (!myConstPrim || !myConstPrim->GetIAEAphspReader()) return;
+
+    auto* myPrim = const_cast<PrimaryGeneratorAction*>(myConstPrim);
+    myPrim->SetIAEAphspReader(fIAEAphspReaderName, fIAEAphspReaderMemory,
+			      fIAEAphspReaderQueue);
+  }
+}
+
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+// Like the copy in memory, the queue is created by the master. Its i/o
+// thread is started by the first worker reader at its first event.
+
+void ActionInitialization::OpenIAEAphspReaderQueue()
+{
+  if (!fIAEAphspReaderIOThread || fIAEAphspReaderName.empty() ||
+      fIAEAphspReaderQueue)
+    return;
+
+  if (G4IAEAphspFileSet::ExpandFileNames(fIAEAphspReaderName).size() > 1) {
+    G4ExceptionDescription msg;
+    msg << "The phsp source '" << fIAEAphspReaderName << "' has several "
+	<< "files and cannot be fed by the i/o thread. Each thread will read "
+	<< "them from disk." << G4endl;
+    G4Exception("ActionInitialization::OpenIAEAphspReaderQueue()",
+		"ActionInit003", JustWarning, msg);
+    return;
   }
+
+  fIAEAphspReaderQueue = G4IAEAphspHistoryQueue::Open(fIAEAphspReaderName);
 }
 
 
@@ -158,6 +277,56 @@ void ActionInitialization::SetIAEAphspWriterPrefix(const G4String& prefix)
     // 2) Drop constness to modify RunAction object status
     auto* myRA = const_cast<RunAction*>(myConstRA);
     myRA->SetIAEAphspWriterStack(prefix);
+    myRA->SetIAEAphspWriterColumnar(fIAEAphspWriterColumnar);
+    myRA->SetIAEAphspWriterStreaming(fIAEAphspWriterStreaming);
+  }
+}
+
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ActionInitialization::SetIAEAphspWriterFormat(const G4String& format)
+{
+  fIAEAphspWriterColumnar = (format == "GOSS");
+
+  if ( !(G4Threading::IsMultithreadedApplication()) ) {
+    // In sequential mode, when this command is issued, Build() has been
+    // called already. Thus, we must set G4IAEAphspWriterStack object here
+    const G4UserRunAction* baseRA =
+      G4RunManager::GetRunManager()->GetUserRunAction();
+    if (!baseRA) return; // No run action defined
+
+    // 1) cast while preserving constness
+    const auto* myConstRA = dynamic_cast<const RunAction*>(baseRA);
+    if (!myConstRA) return;
+
+    // 2) Drop constness to modify RunAction object status
+    auto* myRA = const_cast<RunAction*>(myConstRA);
+    myRA->SetIAEAphspWriterColumnar(fIAEAphspWriterColumnar);
+  }
+}
+
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void ActionInitialization::SetIAEAphspWriterStreaming(const G4bool val)
+{
+  fIAEAphspWriterStreaming = val;
+
+  if ( !(G4Threading::IsMultithreadedApplication()) ) {
+    // In sequential mode, when this command is issued, Build() has been
+    // called already. Thus, we must set G4IAEAphspWriterStack object here
+    const G4UserRunAction* baseRA =
+      G4RunManager::GetRunManager()->GetUserRunAction();
+    if (!baseRA) return; // No run action defined
+
+    // 1) cast while preserving constness
+    const auto* myConstRA = dynamic_cast<const RunAction*>(baseRA);
+    if (!myConstRA) return;
+
+    // 2) Drop constness to modify RunAction object status
+    auto* myRA = const_cast<RunAction*>(myConstRA);
+    myRA->SetIAEAphspWriterStreaming(fIAEAphspWriterStreaming);
   }
 }
 
@@ -29,6 +29,7 @@
 #include "ActionInitializationMessenger.hh"
 #include "ActionInitialization.hh"
 #include "G4UIdirectory.hh"
+#include "G4UIcmdWithABool.hh"
 #include "G4UIcmdWithADoubleAndUnit.hh"
 #include "G4UIcmdWithAString.hh"
 
@@ -53,9 +54,41 @@ ActionInitializationMessenger(ActionInitialization* act)
     ->SetGuidance("Set IAEAphsp source file name, including path if needed.");
   fIAEAphspReaderFileCmd
     ->SetGuidance("(.IAEAphsp or .IAEAheader extension must not be written)");  
+  fIAEAphspReaderFileCmd
+    ->SetGuidance("A list of names or a glob pattern (e.g. 'dir/linac_*')");
+  fIAEAphspReaderFileCmd
+    ->SetGuidance("is read as a single source with summed histories.");
   fIAEAphspReaderFileCmd->SetParameterName("name",false);
   fIAEAphspReaderFileCmd->AvailableForStates(G4State_PreInit);
 
+  fIAEAphspReaderInMemoryCmd =
+    new G4UIcmdWithABool("/action/IAEAphspReader/inMemory",this);
+  fIAEAphspReaderInMemoryCmd
+    ->SetGuidance("Load the whole phsp source file into memory once, at");
+  fIAEAphspReaderInMemoryCmd
+    ->SetGuidance("initialization, and let all the threads read from that");
+  fIAEAphspReaderInMemoryCmd
+    ->SetGuidance("single copy instead of the file (default false).");
+  fIAEAphspReaderInMemoryCmd
+    ->SetGuidance("Useful for files that fit in RAM and are recycled.");
+  fIAEAphspReaderInMemoryCmd->SetParameterName("choice",true);
+  fIAEAphspReaderInMemoryCmd->SetDefaultValue(true);
+  fIAEAphspReaderInMemoryCmd->AvailableForStates(G4State_PreInit);
+
+  fIAEAphspReaderIOThreadCmd =
+    new G4UIcmdWithABool("/action/IAEAphspReader/ioThread",this);
+  fIAEAphspReaderIOThreadCmd
+    ->SetGuidance("Read the phsp source file with a single i/o thread, which");
+  fIAEAphspReaderIOThreadCmd
+    ->SetGuidance("hands out batches of complete histories to the readers of");
+  fIAEAphspReaderIOThreadCmd
+    ->SetGuidance("all the threads through a lock-free queue (default false).");
+  fIAEAphspReaderIOThreadCmd
+    ->SetGuidance("Only one IAEA source is then open, whatever the threads.");
+  fIAEAphspReaderIOThreadCmd->SetParameterName("choice",true);
+  fIAEAphspReaderIOThreadCmd->SetDefaultValue(true);
+  fIAEAphspReaderIOThreadCmd->AvailableForStates(G4State_PreInit);
+
   fIAEAphspWriterFileCmd =
     new G4UIcmdWithAString("/action/IAEAphspWriter/namePrefix",this);
   fIAEAphspWriterFileCmd
@@ -70,6 +103,32 @@ ActionInitializationMessenger(ActionInitialization* act)
   fIAEAphspWriterFileCmd->SetParameterName("prefix",false);
   fIAEAphspWriterFileCmd->AvailableForStates(G4State_PreInit);
 
+  fIAEAphspWriterFormatCmd =
+    new G4UIcmdWithAString("/action/IAEAphspWriter/format",this);
+  fIAEAphspWriterFormatCmd
+    ->SetGuidance("Set the format of the output phsp files:");
+  fIAEAphspWriterFormatCmd
+    ->SetGuidance("  IAEA : .IAEAphsp files (default)");
+  fIAEAphspWriterFormatCmd
+    ->SetGuidance("  GOSS : .GOSSphsp files, compressed losslessly by columns.");
+  fIAEAphspWriterFormatCmd
+    ->SetGuidance("Both are read by the IAEAphsp reader and share the header.");
+  fIAEAphspWriterFormatCmd->SetParameterName("format",false);
+  fIAEAphspWriterFormatCmd->SetCandidates("IAEA GOSS");
+  fIAEAphspWriterFormatCmd->AvailableForStates(G4State_PreInit);
+
+  fIAEAphspWriterStreamingCmd =
+    new G4UIcmdWithABool("/action/IAEAphspWriter/streaming",this);
+  fIAEAphspWriterStreamingCmd
+    ->SetGuidance("Drop the pages of the output phsp files from the page cache");
+  fIAEAphspWriterStreamingCmd
+    ->SetGuidance("as they are written, so that huge outputs do not evict");
+  fIAEAphspWriterStreamingCmd
+    ->SetGuidance("the data of other jobs from memory (default false).");
+  fIAEAphspWriterStreamingCmd->SetParameterName("choice",true);
+  fIAEAphspWriterStreamingCmd->SetDefaultValue(true);
+  fIAEAphspWriterStreamingCmd->AvailableForStates(G4State_PreInit);
+
   fIAEAphspWriterZphspCmd =
     new G4UIcmdWithADoubleAndUnit("/action/IAEAphspWriter/zphsp", this);
   fIAEAphspWriterZphspCmd
@@ -90,7 +149,11 @@ ActionInitializationMessenger::~ActionInitializationMessenger()
   delete fIAEAphspReaderDir;
   delete fIAEAphspWriterDir;
   delete fIAEAphspReaderFileCmd;
+  delete fIAEAphspReaderInMemoryCmd;
+  delete fIAEAphspReaderIOThreadCmd;
   delete fIAEAphspWriterFileCmd;
+  delete fIAEAphspWriterFormatCmd;
+  delete fIAEAphspWriterStreamingCmd;
   delete fIAEAphspWriterZphspCmd;
 }
 
@@ -102,9 +165,24 @@ void ActionInitializationMessenger::SetNewValue(G4UIcommand* command,
   if ( command == fIAEAphspReaderFileCmd )
     fAction->SetIAEAphspReader(newValue);
 
+  else if ( command == fIAEAphspReaderInMemoryCmd )
+    fAction->SetIAEAphspReaderInMemory
+      (fIAEAphspReaderInMemoryCmd->GetNewBoolValue(newValue));
+
+  else if ( command == fIAEAphspReaderIOThreadCmd )
+    fAction->SetIAEAphspReaderIOThread
+      (fIAEAphspReaderIOThreadCmd->GetNewBoolValue(newValue));
+
   else if ( command == fIAEAphspWriterFileCmd )
     fAction->SetIAEAphspWriterPrefix(newValue);
 
+  else if ( command == fIAEAphspWriterFormatCmd )
+    fAction->SetIAEAphspWriterFormat(newValue);
+
+  else if ( command == fIAEAphspWriterStreamingCmd )
+    fAction->SetIAEAphspWriterStreaming
+      (fIAEAphspWriterStreamingCmd->GetNewBoolValue(newValue));
+
   else if ( command == fIAEAphspWriterZphspCmd )
     fAction->AddZphsp(fIAEAphspWriterZphspCmd->GetNewDoubleValue(newValue));
 }
@@ -24,60 +24,55 @@
 // ********************************************************************
 //
 
-#ifndef IAEASourceIdRegistry_hh
-#define IAEASourceIdRegistry_hh 1
+#include "G4IAEAphspEventArena.hh"
 
-#include <bitset>
-#include "G4AutoLock.hh"
-#include "globals.hh"
 
-constexpr G4int kIAEA_MaxSources = 30;  // MAX_NUM_SOURCES
+// =============================================================================
 
-class IAEASourceIdRegistry {
+G4IAEAphspEventArena::G4IAEAphspEventArena()
+  : fNExtraFloats(0), fNExtraInts(0), fCapacity(64), fHead(0), fSize(0)
+{
+  fParticles.resize(fCapacity);
+}
 
-public:
 
-  static IAEASourceIdRegistry& Instance() {
-    static IAEASourceIdRegistry inst;
-    return inst;
-  }
-
-  // Reserve the next free ID (lowest or highest; your choice)
-  G4int ReserveNextLowest() {
-    G4AutoLock lock(&fMutex);
-    for (G4int ii = 0; ii < kIAEA_MaxSources; ii++) {
-      if (!fUsed.test(ii)) {
-	fUsed.set(ii);
-	return ii;
-      }
-    }
-    return -1; // none free
-  }
+// =============================================================================
 
-  // Reserve a specific ID (returns true if we could mark it)
-  bool ReserveExact(G4int id) {
-    if (id < 0 || id >= kIAEA_MaxSources)  return false;
-    G4AutoLock lock(&fMutex);
-    if (fUsed.test(id))  return false;
-    fUsed.set(id);
-    return true;
-  }
+void G4IAEAphspEventArena::Configure(const G4int nExtraFloats,
+				     const G4int nExtraInts)
+{
+  fNExtraFloats = (nExtraFloats > 0) ? nExtraFloats : 0;
+  fNExtraInts = (nExtraInts > 0) ? nExtraInts : 0;
+  fExtraFloats.assign(fCapacity*fNExtraFloats, 0.);
+  fExtraInts.assign(fCapacity*fNExtraInts, 0);
+  Reset();
+}
 
-  void Release(G4int id) {
-    if (id < 0 || id >= kIAEA_MaxSources) return;
-    G4AutoLock lock(&fMutex);
-    fUsed.reset(id);
-  }
 
+// =============================================================================
+// Doubles the ring, unrolling it so that the particles stored start at
+// slot 0 of the new arrays.
 
-private:
+void G4IAEAphspEventArena::Grow()
+{
+  G4int newCapacity = 2*fCapacity;
 
-  IAEASourceIdRegistry() = default;
-  IAEASourceIdRegistry(const IAEASourceIdRegistry&) = delete;
-  IAEASourceIdRegistry& operator=(const IAEASourceIdRegistry&) = delete;
+  std::vector<Particle> particles(newCapacity);
+  std::vector<G4double> extraFloats(newCapacity*fNExtraFloats);
+  std::vector<G4long> extraInts(newCapacity*fNExtraInts);
 
-  std::bitset<kIAEA_MaxSources> fUsed;
-  G4Mutex fMutex = G4MUTEX_INITIALIZER;
-};
+  for (G4int ii = 0; ii < fSize; ii++) {
+    G4int slot = Slot(ii);
+    particles[ii] = fParticles[slot];
+    for (G4int jj = 0; jj < fNExtraFloats; jj++)
+      extraFloats[ii*fNExtraFloats + jj] = fExtraFloats[slot*fNExtraFloats + jj];
+    for (G4int jj = 0; jj < fNExtraInts; jj++)
+      extraInts[ii*fNExtraInts + jj] = fExtraInts[slot*fNExtraInts + jj];
+  }
 
-#endif
+  fParticles.swap(particles);
+  fExtraFloats.swap(extraFloats);
+  fExtraInts.swap(extraInts);
+  fCapacity = newCapacity;
+  fHead = 0;
+}
@@ -0,0 +1,295 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+
+#include "G4IAEAphspFileSet.hh"
+
+#include "iaea_phsp.h"
+#include "iaea_record.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <sstream>
+#include <glob.h>
+
+#include "G4AutoLock.hh"
+
+
+// =============================================================================
+
+namespace
+{
+  G4Mutex fileSetMutex = G4MUTEX_INITIALIZER;
+
+  const G4String headerExtension = ".IAEAheader";
+
+  IAEA_I32 OpenHeader(const G4String& filename)
+  {
+    IAEA_I32 sourceRead = -1, result = 0;
+    const IAEA_I32 accessRead = 1;
+    G4String name = filename;
+    iaea_new_source(&sourceRead, const_cast<char*>(name.data()),
+		    &accessRead, &result, name.size()+1);
+    if (sourceRead < 0 || result < 0) {
+      G4ExceptionDescription ED;
+      ED << "Could not open the phsp file \"" << filename << "\"" << G4endl;
+      G4Exception("G4IAEAphspFileSet::Open()",
+		  "IAEAphspFileSet002", FatalException, ED);
+    }
+    return sourceRead;
+  }
+}
+
+
+// =============================================================================
+
+std::vector<G4String>
+G4IAEAphspFileSet::ExpandFileNames(const G4String& names)
+{
+  std::vector<G4String> files;
+
+  std::string list = names;
+  std::replace(list.begin(), list.end(), ',', ' ');
+  std::istringstream is(list);
+
+  std::string name;
+  while (is >> name) {
+    if (name.find_first_of("*?[") == std::string::npos) {
+      files.push_back(name);
+      continue;
+    }
+
+    // The pattern is matched against the header files
+    glob_t matches;
+    std::string pattern = name + headerExtension;
+    if (glob(pattern.c_str(), 0, nullptr, &matches) != 0) {
+      G4ExceptionDescription ED;
+      ED << "No phsp file matches \"" << name << "\"" << G4endl;
+      G4Exception("G4IAEAphspFileSet::ExpandFileNames()",
+		  "IAEAphspFileSet001", JustWarning, ED);
+    }
+    else {
+      for (std::size_t ii = 0; ii < matches.gl_pathc; ii++) {
+	std::string path = matches.gl_pathv[ii];
+	files.push_back(path.substr(0, path.size()-headerExtension.size()));
+      }
+    }
+    globfree(&matches);
+  }
+
+  return files;
+}
+
+
+// =============================================================================
+
+std::shared_ptr<const G4IAEAphspFileSet>
+G4IAEAphspFileSet::Open(const G4String& names)
+{
+  static std::map<G4String, std::shared_ptr<const G4IAEAphspFileSet>> sets;
+  G4AutoLock lock(&fileSetMutex);
+  std::shared_ptr<const G4IAEAphspFileSet>& set = sets[names];
+  if (set) return set;
+
+  std::vector<G4String> files = ExpandFileNames(names);
+  if (files.empty()) {
+    G4ExceptionDescription ED;
+    ED << "No phsp file to read in \"" << names << "\"" << G4endl;
+    G4Exception("G4IAEAphspFileSet::Open()",
+		"IAEAphspFileSet005", FatalException, ED);
+    return nullptr;
+  }
+
+  std::shared_ptr<G4IAEAphspFileSet> newSet(new G4IAEAphspFileSet);
+  newSet->fName = names;
+  newSet->fFileNames = files;
+  newSet->fFileOffsets.push_back(0);
+
+  // Layout of the records of the first file, which all must share
+  IAEA_I32 nExtraFloat0 = 0, nExtraInt0 = 0;
+  IAEA_I32 extraFloatTypes0[NUM_EXTRA_FLOAT], extraIntTypes0[NUM_EXTRA_LONG];
+
+  for (std::size_t kk = 0; kk < files.size(); kk++) {
+    IAEA_I32 sourceRead = OpenHeader(files[kk]);
+    IAEA_I32 result = 0;
+
+    iaea_check_file_size_byte_order(&sourceRead, &result);
+    if (result < 0 && result != -4) {
+      G4ExceptionDescription ED;
+      ED << "The size of the phsp file \"" << files[kk]
+	 << "\" does not match its header" << G4endl;
+      G4Exception("G4IAEAphspFileSet::Open()",
+		  "IAEAphspFileSet003", FatalException, ED);
+    }
+
+    IAEA_I32 particleType = -1;
+    IAEA_I64 nParticles = 0;
+    iaea_get_max_particles(&sourceRead, &particleType, &nParticles);
+    newSet->fFileOffsets.push_back(newSet->fFileOffsets.back() +
+				   static_cast<G4long>(nParticles));
+
+    for (particleType = 1; particleType <= 5; particleType++) {
+      iaea_get_max_particles(&sourceRead, &particleType, &nParticles);
+      if (nParticles > 0)
+	newSet->fParticlesOfType[particleType-1] +=
+	  static_cast<G4long>(nParticles);
+    }
+
+    IAEA_I64 nHistories = 0;
+    iaea_get_total_original_particles(&sourceRead, &nHistories);
+    newSet->fOrigHistories += static_cast<G4long>(nHistories);
+
+    IAEA_I32 nExtraFloat = 0, nExtraInt = 0;
+    IAEA_I32 extraFloatTypes[NUM_EXTRA_FLOAT], extraIntTypes[NUM_EXTRA_LONG];
+    iaea_get_extra_numbers(&sourceRead, &nExtraFloat, &nExtraInt);
+    iaea_get_type_extra_variables(&sourceRead, &result,
+				  extraIntTypes, extraFloatTypes);
+    iaea_destroy_source(&sourceRead, &result);
+
+    if (kk == 0) {
+      nExtraFloat0 = nExtraFloat;
+      nExtraInt0 = nExtraInt;
+      std::copy(extraFloatTypes, extraFloatTypes+nExtraFloat,
+		extraFloatTypes0);
+      std::copy(extraIntTypes, extraIntTypes+nExtraInt, extraIntTypes0);
+    }
+    else if (nExtraFloat != nExtraFloat0 || nExtraInt != nExtraInt0 ||
+	     !std::equal(extraFloatTypes, extraFloatTypes+nExtraFloat,
+			 extraFloatTypes0) ||
+	     !std::equal(extraIntTypes, extraIntTypes+nExtraInt,
+			 extraIntTypes0)) {
+      G4ExceptionDescription ED;
+      ED << "The phsp file \"" << files[kk] << "\" does not store the same"
+	 << " extra variables as \"" << files[0] << "\", they cannot be"
+	 << " read as one source" << G4endl;
+      G4Exception("G4IAEAphspFileSet::Open()",
+		  "IAEAphspFileSet004", FatalException, ED);
+    }
+  }
+
+  G4cout << "G4IAEAphspFileSet: " << files.size() << " phsp files read as"
+	 << " one source, with " << newSet->fFileOffsets.back()
+	 << " particles and " << newSet->fOrigHistories
+	 << " original histories" << G4endl;
+
+  set = newSet;
+  return set;
+}
+
+
+// =============================================================================
+
+G4long G4IAEAphspFileSet::GetTotalParticles(const G4int type) const
+{
+  if (type == -1) return fFileOffsets.back();
+  if (type < 1 || type > 5) return -1;
+  return fParticlesOfType[type-1];
+}
+
+
+// =============================================================================
+// Empty files are skipped: the file found is the last one whose first
+// particle is not after 'particle'.
+
+G4int G4IAEAphspFileSet::FindFile(const G4long particle) const
+{
+  auto it = std::upper_bound(fFileOffsets.begin(), fFileOffsets.end(),
+			     particle-1);
+  G4int file = static_cast<G4int>(it - fFileOffsets.begin()) - 1;
+  return std::max(0, std::min(file, GetNumberOfFiles()-1));
+}
+
+
+// =============================================================================
+
+void G4IAEAphspFileSet::GetChunkLimits(const G4int chunk,
+				       const G4int totalChunks,
+				       G4long& first, G4long& last) const
+{
+  G4AutoLock lock(&fCutsMutex);
+  std::vector<G4long>& cuts = fChunkCuts[totalChunks];
+  if (cuts.empty()) cuts = ComputeChunkCuts(totalChunks);
+
+  first = cuts[chunk-1];
+  last = cuts[chunk];
+}
+
+
+// =============================================================================
+// The set is cut in totalChunks equal portions of particles. If the file
+// a cut falls in has a history index, the cut is moved to the nearest
+// limit of a fine split of that file (64 pieces per chunk, at most one
+// per particle), as iaea_get_parallel_limits() gives them, so that it
+// starts a new history. File boundaries always start a new history.
+
+std::vector<G4long>
+G4IAEAphspFileSet::ComputeChunkCuts(const G4int totalChunks) const
+{
+  const G4long total = fFileOffsets.back();
+  std::vector<G4long> cuts(totalChunks+1, 0);
+  cuts[totalChunks] = total;
+
+  const G4long maxPieces = std::min<G4long>(64*static_cast<G4long>(totalChunks),
+					    std::numeric_limits<IAEA_I32>::max());
+
+  IAEA_I32 sourceRead = -1, result = 0;
+  G4int openFile = -1;
+
+  for (G4int jj = 1; jj < totalChunks && total > 0; jj++) {
+    const G4long target = static_cast<G4long>(
+      static_cast<long double>(total)*jj/totalChunks);
+    const G4int file = FindFile(target+1);
+    const G4long inFile = fFileOffsets[file+1] - fFileOffsets[file];
+    const G4long pieces = std::min(maxPieces, inFile);
+    const long double inFileTarget = target - fFileOffsets[file];
+    const G4long nearest = std::llround(inFileTarget*pieces/inFile);
+
+    if (nearest <= 0)
+      cuts[jj] = fFileOffsets[file];
+    else if (nearest >= pieces)
+      cuts[jj] = fFileOffsets[file+1];
+    else {
+      if (file != openFile) {
+	if (openFile >= 0) iaea_destroy_source(&sourceRead, &result);
+	sourceRead = OpenHeader(fFileNames[file]);
+	openFile = file;
+      }
+      IAEA_I32 fileChunk = static_cast<IAEA_I32>(nearest+1);
+      IAEA_I32 fileChunks = static_cast<IAEA_I32>(pieces);
+      IAEA_I64 firstRecord = 0, lastRecord = 0;
+      iaea_get_parallel_limits(&sourceRead, &fileChunk, &fileChunks,
+			       &firstRecord, &lastRecord, &result);
+      // Only limits taken from the index (result 1) start a history
+      cuts[jj] = (result != 1) ? target
+	: fFileOffsets[file] + static_cast<G4long>(firstRecord);
+    }
+
+    if (cuts[jj] < cuts[jj-1]) cuts[jj] = cuts[jj-1];
+  }
+
+  if (openFile >= 0) iaea_destroy_source(&sourceRead, &result);
+  return cuts;
+}
@@ -0,0 +1,447 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+
+#include "G4IAEAphspHistoryQueue.hh"
+
+#include "iaea_phsp.h"
+#include "iaea_record.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "G4AutoLock.hh"
+
+
+namespace
+{
+  // A batch is published once it holds this many particles and a new
+  // history begins. Histories longer than that make the batch grow.
+  const G4int batchParticles = 4096;
+
+  // Batches in flight between the i/o thread and the readers (power of 2)
+  const std::size_t queueDepth = 64;
+
+  // Wait politely: spin a little, then yield, then sleep
+  void Backoff(G4int& tries)
+  {
+    if (tries < 16) {}
+    else if (tries < 64) std::this_thread::yield();
+    else std::this_thread::sleep_for(std::chrono::microseconds(50));
+    tries++;
+  }
+}
+
+
+// =============================================================================
+
+G4IAEAphspHistoryQueue::BoundedQueue::BoundedQueue(const std::size_t capacity)
+  :fCells(capacity), fMask(capacity-1), fEnqueuePos(0), fDequeuePos(0)
+{
+  for (std::size_t i = 0; i < capacity; i++) {
+    fCells[i].sequence.store(i, std::memory_order_relaxed);
+    fCells[i].batch = 0;
+  }
+}
+
+
+// =============================================================================
+
+G4bool G4IAEAphspHistoryQueue::BoundedQueue::Push(Batch* batch)
+{
+  Cell* cell;
+  std::size_t pos = fEnqueuePos.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &fCells[pos & fMask];
+    std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+    std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq)
+      - static_cast<std::ptrdiff_t>(pos);
+    if (dif == 0) {
+      if (fEnqueuePos.compare_exchange_weak(pos, pos+1,
+					    std::memory_order_relaxed))
+	break;
+    }
+    else if (dif < 0) return false;   // full
+    else pos = fEnqueuePos.load(std::memory_order_relaxed);
+  }
+  cell->batch = batch;
+  cell->sequence.store(pos+1, std::memory_order_release);
+  return true;
+}
+
+
+// =============================================================================
+
+G4bool G4IAEAphspHistoryQueue::BoundedQueue::Pop(Batch*& batch)
+{
+  Cell* cell;
+  std::size_t pos = fDequeuePos.load(std::memory_order_relaxed);
+  for (;;) {
+    cell = &fCells[pos & fMask];
+    std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+    std::ptrdiff_t dif = static_cast<std::ptrdiff_t>(seq)
+      - static_cast<std::ptrdiff_t>(pos+1);
+    if (dif == 0) {
+      if (fDequeuePos.compare_exchange_weak(pos, pos+1,
+					    std::memory_order_relaxed))
+	break;
+    }
+    else if (dif < 0) return false;   // empty
+    else pos = fDequeuePos.load(std::memory_order_relaxed);
+  }
+  batch = cell->batch;
+  cell->sequence.store(pos+fMask+1, std::memory_order_release);
+  return true;
+}
+
+
+// =============================================================================
+
+G4IAEAphspHistoryQueue::G4IAEAphspHistoryQueue()
+  :fBatches(queueDepth), fFull(queueDepth), fFree(queueDepth),
+   fStarted(false), fStop(false), fFailed(false)
+{
+  for (Batch& batch : fBatches) fFree.Push(&batch);
+}
+
+
+// =============================================================================
+
+G4IAEAphspHistoryQueue::~G4IAEAphspHistoryQueue()
+{
+  fStop = true;
+  if (fThread.joinable()) fThread.join();
+
+  if (fSourceReadId >= 0) {
+    IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+    IAEA_I32 result = 0;
+    iaea_destroy_source(&sourceRead, &result);
+  }
+}
+
+
+// =============================================================================
+// Only the header is read here, the source is opened again by Start() with
+// the access mode chosen for the readers.
+
+std::shared_ptr<G4IAEAphspHistoryQueue>
+G4IAEAphspHistoryQueue::Open(const G4String& filename)
+{
+  IAEA_I32 sourceRead = -1, result = 0;
+  const IAEA_I32 accessRead = 1;
+  G4String name = filename;
+  iaea_new_source(&sourceRead, const_cast<char*>(name.data()),
+		  &accessRead, &result, name.size()+1);
+  if (sourceRead < 0 || result < 0) {
+    G4ExceptionDescription ED;
+    ED << "Could not open the phsp file \"" << filename
+       << "\", it is read by each thread." << G4endl;
+    G4Exception("G4IAEAphspHistoryQueue::Open()",
+		"IAEAphspQueue001", JustWarning, ED);
+    return nullptr;
+  }
+
+  std::shared_ptr<G4IAEAphspHistoryQueue> queue(new G4IAEAphspHistoryQueue);
+  queue->fFileName = filename;
+
+  IAEA_I32 particleType = -1;   // all the particles
+  IAEA_I64 nParticles = 0, nHistories = 0;
+  iaea_get_max_particles(&sourceRead, &particleType, &nParticles);
+  iaea_get_total_original_particles(&sourceRead, &nHistories);
+  queue->fTotalParticles = static_cast<G4long>(nParticles);
+  queue->fOrigHistories = static_cast<G4long>(nHistories);
+
+  IAEA_I32 nExtraFloat = 0, nExtraInt = 0;
+  iaea_get_extra_numbers(&sourceRead, &nExtraFloat, &nExtraInt);
+  queue->fNExtraFloats = static_cast<G4int>(nExtraFloat);
+  queue->fNExtraInts = static_cast<G4int>(nExtraInt);
+
+  IAEA_I32 extraFloatTypes[NUM_EXTRA_FLOAT], extraIntTypes[NUM_EXTRA_LONG];
+  iaea_get_type_extra_variables(&sourceRead, &result,
+				extraIntTypes, extraFloatTypes);
+  queue->fExtraFloatTypes.assign(extraFloatTypes,
+				 extraFloatTypes + queue->fNExtraFloats);
+  queue->fExtraIntTypes.assign(extraIntTypes,
+			       extraIntTypes + queue->fNExtraInts);
+
+  iaea_destroy_source(&sourceRead, &result);
+
+  if (queue->fTotalParticles <= 0) {
+    G4ExceptionDescription ED;
+    ED << "No particles found in the phsp file \"" << filename
+       << "\", it is read by each thread." << G4endl;
+    G4Exception("G4IAEAphspHistoryQueue::Open()",
+		"IAEAphspQueue002", JustWarning, ED);
+    return nullptr;
+  }
+
+  return queue;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspHistoryQueue::Start(const G4int parallelRun,
+				   const G4int totalParallelRuns,
+				   const G4int accessRead,
+				   const G4long readAhead,
+				   const G4bool streaming,
+				   const G4bool decodeExtraFloats,
+				   const G4bool decodeExtraInts)
+{
+  if (fStarted) return;
+  G4AutoLock lock(&fStartMutex);
+  if (fStarted) return;
+
+  IAEA_I32 sourceRead = -1, result = 0;
+  const IAEA_I32 access = static_cast<IAEA_I32>(accessRead);
+  iaea_new_source(&sourceRead, const_cast<char*>(fFileName.data()),
+		  &access, &result, fFileName.size()+1);
+  if (sourceRead < 0 || result < 0)
+    G4Exception("G4IAEAphspHistoryQueue::Start()",
+		"IAEAphspQueue003", FatalException,
+		"Could not open IAEA source file to read");
+  fSourceReadId = static_cast<G4int>(sourceRead);
+
+  // Memory-mapped sources are read ahead and evicted by the kernel
+  if (accessRead != 4) {
+    const IAEA_I32 streamMode = streaming ? 1 : 0;
+    iaea_set_streaming(&sourceRead, &streamMode, &result);
+    const IAEA_I64 nBytes = static_cast<IAEA_I64>(readAhead);
+    iaea_set_read_ahead(&sourceRead, &nBytes, &result);
+  }
+
+  // Fragment of this parallel run, history aligned if the file is indexed
+  fChunk = static_cast<IAEA_I32>(parallelRun);
+  fTotalChunks = static_cast<IAEA_I32>(totalParallelRuns);
+  IAEA_I64 firstParticle = 0, lastParticle = 0;
+  iaea_get_parallel_limits(&sourceRead, &fChunk, &fTotalChunks,
+			   &firstParticle, &lastParticle, &result);
+  if (result < 0) {
+    G4ExceptionDescription ED;
+    ED << "ERROR computing the limits of chunk #" << fChunk << " of "
+       << fTotalChunks << " [iaea_get_parallel_limits()]" << G4endl;
+    G4Exception("G4IAEAphspHistoryQueue::Start()",
+		"IAEAphspQueue004", FatalException, ED);
+  }
+  fFirstParticle = static_cast<G4long>(firstParticle);
+  fLastParticle = static_cast<G4long>(lastParticle);
+  if (fChunk == fTotalChunks || fLastParticle > fTotalParticles)
+    fLastParticle = fTotalParticles;
+
+  fDecodeExtraFloats = decodeExtraFloats && fNExtraFloats > 0;
+  fDecodeExtraInts = decodeExtraInts && fNExtraInts > 0;
+
+  G4cout << "G4IAEAphspHistoryQueue: i/o thread reading the particles from"
+	 << " place #" << fFirstParticle+1 << " to #" << fLastParticle
+	 << " of \"" << fFileName << ".IAEAphsp\" for all the threads"
+	 << G4endl;
+
+  fThread = std::thread(&G4IAEAphspHistoryQueue::Run, this);
+  fStarted = true;
+}
+
+
+// =============================================================================
+
+G4IAEAphspHistoryQueue::Batch* G4IAEAphspHistoryQueue::Pop()
+{
+  Batch* batch = 0;
+  G4int tries = 0;
+  while (!fFull.Pop(batch)) {
+    if (fFailed) return 0;
+    Backoff(tries);
+  }
+  return batch;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspHistoryQueue::Release(Batch* batch)
+{
+  // There are as many cells as batches, this cannot fail
+  fFree.Push(batch);
+}
+
+
+// =============================================================================
+// Returns a batch given back by the readers, with room for batchParticles
+// particles at least, or null if the queue is being destroyed. The vectors
+// of a batch are those a reader swapped with its own, so they are resized
+// here to a common length, the stride of the extra variables.
+
+G4IAEAphspHistoryQueue::Batch* G4IAEAphspHistoryQueue::TakeFree()
+{
+  Batch* batch = 0;
+  G4int tries = 0;
+  while (!fFree.Pop(batch)) {
+    if (fStop) return 0;
+    Backoff(tries);
+  }
+
+  std::size_t n = std::max<std::size_t>(batchParticles, batch->nStat.size());
+  batch->nStat.resize(n);
+  batch->type.resize(n);
+  batch->energy.resize(n);
+  batch->weight.resize(n);
+  batch->x.resize(n);
+  batch->y.resize(n);
+  batch->z.resize(n);
+  batch->u.resize(n);
+  batch->v.resize(n);
+  batch->w.resize(n);
+  if (fDecodeExtraFloats) batch->extraFloats.resize(n*fNExtraFloats);
+  if (fDecodeExtraInts) batch->extraInts.resize(n*fNExtraInts);
+
+  batch->size = 0;
+  batch->stride = static_cast<G4int>(n);
+  batch->hasExtraFloats = fDecodeExtraFloats;
+  batch->hasExtraInts = fDecodeExtraInts;
+  return batch;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspHistoryQueue::Publish(Batch*& batch)
+{
+  fFull.Push(batch);
+  batch = TakeFree();
+}
+
+
+// =============================================================================
+// Body of the i/o thread. Blocks are decoded into local arrays and their
+// particles appended to the current batch, which is published when it is
+// full and the next particle opens a new history (n_stat > 0).
+
+void G4IAEAphspHistoryQueue::Run()
+{
+  IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+
+  std::vector<G4int> nStat(batchParticles), type(batchParticles);
+  std::vector<G4float> energy(batchParticles), weight(batchParticles);
+  std::vector<G4float> x(batchParticles), y(batchParticles);
+  std::vector<G4float> z(batchParticles), u(batchParticles);
+  std::vector<G4float> v(batchParticles), w(batchParticles);
+  std::vector<G4float> extraFloats(fDecodeExtraFloats ?
+				   batchParticles*fNExtraFloats : 0);
+  std::vector<G4int> extraInts(fDecodeExtraInts ?
+			       batchParticles*fNExtraInts : 0);
+
+  Batch* batch = TakeFree();
+  G4long current = fLastParticle;   // place the source at the first block
+  G4long pass = 0;
+
+  while (batch) {
+    if (current >= fLastParticle) {
+      // Back to the beginning of the fragment
+      IAEA_I32 result = 0;
+      iaea_set_parallel(&sourceRead, 0, &fChunk, &fTotalChunks, &result);
+      if (result < 0) break;
+      current = fFirstParticle;
+      if (pass++ > 0)
+	G4cout << "G4IAEAphspHistoryQueue: starting pass #" << pass
+	       << " over the phsp file" << G4endl;
+    }
+
+    IAEA_I32 nMax = static_cast<IAEA_I32>(
+      std::min<G4long>(batchParticles, fLastParticle - current));
+    IAEA_I32 nRead = 0;
+    iaea_get_particles(&sourceRead, &nMax, &nRead,
+		       nStat.data(), type.data(), energy.data(), weight.data(),
+		       x.data(), y.data(), z.data(),
+		       u.data(), v.data(), w.data(),
+		       fDecodeExtraFloats ? extraFloats.data() : 0,
+		       fDecodeExtraInts ? extraInts.data() : 0);
+    if (nRead <= 0) break;
+    current += nRead;
+
+    for (G4int i = 0; i < nRead && batch; i++) {
+      if (nStat[i] > 0 && batch->size >= batchParticles) {
+	Publish(batch);
+	if (!batch) break;
+      }
+
+      // A history longer than the batch: double it
+      if (batch->size == batch->stride) {
+	G4int oldStride = batch->stride;
+	G4int n = 2*oldStride;
+	batch->nStat.resize(n);
+	batch->type.resize(n);
+	batch->energy.resize(n);
+	batch->weight.resize(n);
+	batch->x.resize(n);
+	batch->y.resize(n);
+	batch->z.resize(n);
+	batch->u.resize(n);
+	batch->v.resize(n);
+	batch->w.resize(n);
+	if (fDecodeExtraFloats) {
+	  batch->extraFloats.resize(n*fNExtraFloats);
+	  for (G4int k = fNExtraFloats-1; k > 0; k--)
+	    std::copy_backward(&batch->extraFloats[k*oldStride],
+			       &batch->extraFloats[k*oldStride] + oldStride,
+			       &batch->extraFloats[k*n] + oldStride);
+	}
+	if (fDecodeExtraInts) {
+	  batch->extraInts.resize(n*fNExtraInts);
+	  for (G4int k = fNExtraInts-1; k > 0; k--)
+	    std::copy_backward(&batch->extraInts[k*oldStride],
+			       &batch->extraInts[k*oldStride] + oldStride,
+			       &batch->extraInts[k*n] + oldStride);
+	}
+	batch->stride = n;
+      }
+
+      G4int j = batch->size++;
+      batch->nStat[j] = nStat[i];
+      batch->type[j] = type[i];
+      batch->energy[j] = energy[i];
+      batch->weight[j] = weight[i];
+      batch->x[j] = x[i];
+      batch->y[j] = y[i];
+      batch->z[j] = z[i];
+      batch->u[j] = u[i];
+      batch->v[j] = v[i];
+      batch->w[j] = w[i];
+      for (G4int k = 0; k < (fDecodeExtraFloats ? fNExtraFloats : 0); k++)
+	batch->extraFloats[k*batch->stride + j] = extraFloats[k*nMax + i];
+      for (G4int k = 0; k < (fDecodeExtraInts ? fNExtraInts : 0); k++)
+	batch->extraInts[k*batch->stride + j] = extraInts[k*nMax + i];
+    }
+  }
+
+  if (batch) {
+    // A read error, not a stop request
+    G4ExceptionDescription ED;
+    ED << "Could not read the phsp file \"" << fFileName
+       << "\" past particle #" << current << "." << G4endl;
+    G4Exception("G4IAEAphspHistoryQueue::Run()",
+		"IAEAphspQueue005", JustWarning, ED);
+    fFailed = true;
+  }
+}
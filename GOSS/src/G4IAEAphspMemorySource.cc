@@ -0,0 +1,183 @@
+//
+// ********************************************************************
+// * License and Disclaimer                                           *
+// *                                                                  *
+// * The  Geant4 software  is  copyright of the Copyright Holders  of *
+// * the Geant4 Collaboration.  It is provided  under  the terms  and *
+// * conditions of the Geant4 Software License,  included in the file *
+// * LICENSE and available at  http://cern.ch/geant4/license .  These *
+// * include a list of copyright holders.                             *
+// *                                                                  *
+// * Neither the authors of this software system, nor their employing *
+// * institutes,nor the agencies providing financial support for this *
+// * work  make  any representation or  warranty, express or implied, *
+// * regarding  this  software system or assume any liability for its *
+// * use.  Please see the license in the file  LICENSE  and URL above *
+// * for the full disclaimer and the limitation of liability.         *
+// *                                                                  *
+// * This  code  implementation is the result of  the  scientific and *
+// * technical work of the GEANT4 collaboration.                      *
+// * By using,  copying,  modifying or  distributing the software (or *
+// * any work based  on the software)  you  agree  to acknowledge its *
+// * use  in  resulting  scientific  publications,  and indicate your *
+// * acceptance of all terms of the Geant4 Software license.          *
+// ********************************************************************
+//
+
+#include "G4IAEAphspMemorySource.hh"
+
+#include "iaea_phsp.h"
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+
+// =============================================================================
+
+std::shared_ptr<const G4IAEAphspMemorySource>
+G4IAEAphspMemorySource::Load(const G4String& filename,
+			     const G4bool extraFloats, const G4bool extraInts)
+{
+  IAEA_I32 sourceRead = -1, result = 0;
+  const IAEA_I32 accessRead = 5;
+  G4String name = filename;
+  iaea_new_source(&sourceRead, const_cast<char*>(name.data()),
+		  &accessRead, &result, name.size()+1);
+  if (sourceRead < 0 || result < 0) {
+    G4ExceptionDescription ED;
+    ED << "Could not open the phsp file \"" << filename
+       << "\", it is read from disk by each thread." << G4endl;
+    G4Exception("G4IAEAphspMemorySource::Load()",
+		"IAEAphspMemory001", JustWarning, ED);
+    return nullptr;
+  }
+
+  std::shared_ptr<G4IAEAphspMemorySource> src(new G4IAEAphspMemorySource);
+  src->fFileName = filename;
+
+  IAEA_I32 particleType = -1;   // all the particles
+  IAEA_I64 nParticles = 0;
+  iaea_get_max_particles(&sourceRead, &particleType, &nParticles);
+  IAEA_I32 nExtraFloat = 0, nExtraInt = 0;
+  iaea_get_extra_numbers(&sourceRead, &nExtraFloat, &nExtraInt);
+  src->fNParticles = static_cast<G4long>(nParticles);
+  src->fNExtraFloats = static_cast<G4int>(nExtraFloat);
+  src->fNExtraInts = static_cast<G4int>(nExtraInt);
+  src->fExtraFloatsKept = extraFloats && src->fNExtraFloats > 0;
+  src->fExtraIntsKept = extraInts && src->fNExtraInts > 0;
+  const G4int keptFloats = src->fExtraFloatsKept ? src->fNExtraFloats : 0;
+  const G4int keptInts = src->fExtraIntsKept ? src->fNExtraInts : 0;
+
+  const std::size_t n = static_cast<std::size_t>(src->fNParticles);
+  try {
+    src->fNStat.resize(n);
+    src->fType.resize(n);
+    src->fEnergy.resize(n);
+    src->fWeight.resize(n);
+    src->fX.resize(n);
+    src->fY.resize(n);
+    src->fZ.resize(n);
+    src->fU.resize(n);
+    src->fV.resize(n);
+    src->fW.resize(n);
+    src->fExtraFloats.resize(n*keptFloats);
+    src->fExtraInts.resize(n*keptInts);
+  }
+  catch (const std::bad_alloc&) {
+    iaea_destroy_source(&sourceRead, &result);
+    G4ExceptionDescription ED;
+    ED << "The " << n << " particles of the phsp file \"" << filename
+       << "\" do not fit in memory, it is read from disk by each thread."
+       << G4endl;
+    G4Exception("G4IAEAphspMemorySource::Load()",
+		"IAEAphspMemory002", JustWarning, ED);
+    return nullptr;
+  }
+
+  // Read the file ahead while decoding, block by block
+  const IAEA_I64 readAhead = 16*1024*1024;
+  iaea_set_read_ahead(&sourceRead, &readAhead, &result);
+
+  const G4int blockSize = 65536;
+  std::vector<G4float> blockFloats(blockSize*keptFloats);
+  std::vector<G4int> blockInts(blockSize*keptInts);
+
+  G4long done = 0;
+  while (done < src->fNParticles) {
+    IAEA_I32 nMax = static_cast<IAEA_I32>(
+      std::min<G4long>(blockSize, src->fNParticles - done));
+    IAEA_I32 nRead = 0;
+    iaea_get_particles(&sourceRead, &nMax, &nRead,
+		       &src->fNStat[done], &src->fType[done],
+		       &src->fEnergy[done], &src->fWeight[done],
+		       &src->fX[done], &src->fY[done], &src->fZ[done],
+		       &src->fU[done], &src->fV[done], &src->fW[done],
+		       keptFloats > 0 ? blockFloats.data() : 0,
+		       keptInts > 0 ? blockInts.data() : 0);
+    if (nRead <= 0) break;
+
+    for (G4int k = 0; k < keptFloats; k++)
+      std::memcpy(&src->fExtraFloats[k*n + done], &blockFloats[k*nMax],
+		  nRead*sizeof(G4float));
+    for (G4int k = 0; k < keptInts; k++)
+      std::memcpy(&src->fExtraInts[k*n + done], &blockInts[k*nMax],
+		  nRead*sizeof(G4int));
+    done += nRead;
+  }
+  iaea_destroy_source(&sourceRead, &result);
+
+  if (done != src->fNParticles) {
+    G4ExceptionDescription ED;
+    ED << "Only " << done << " of the " << src->fNParticles
+       << " particles of the phsp file \"" << filename << "\" could be"
+       << " read, it is read from disk by each thread." << G4endl;
+    G4Exception("G4IAEAphspMemorySource::Load()",
+		"IAEAphspMemory003", JustWarning, ED);
+    return nullptr;
+  }
+
+  G4cout << "G4IAEAphspMemorySource: " << src->fNParticles
+	 << " particles of \"" << filename << "\" loaded in memory"
+	 << ((src->fNExtraFloats + src->fNExtraInts > 0 &&
+	      !src->fExtraFloatsKept && !src->fExtraIntsKept)
+	     ? ", without their extra variables" : "") << G4endl;
+  return src;
+}
+
+
+// =============================================================================
+
+G4int G4IAEAphspMemorySource::CopyBlock(const G4long first, const G4int nMax,
+					G4int* nStat, G4int* type,
+					G4float* energy, G4float* weight,
+					G4float* x, G4float* y, G4float* z,
+					G4float* u, G4float* v, G4float* w,
+					G4float* extraFloats,
+					G4int* extraInts) const
+{
+  if (first < 0 || first >= fNParticles || nMax <= 0) return 0;
+  G4int n = static_cast<G4int>(std::min<G4long>(nMax, fNParticles - first));
+
+  std::memcpy(nStat, &fNStat[first], n*sizeof(G4int));
+  std::memcpy(type, &fType[first], n*sizeof(G4int));
+  std::memcpy(energy, &fEnergy[first], n*sizeof(G4float));
+  std::memcpy(weight, &fWeight[first], n*sizeof(G4float));
+  std::memcpy(x, &fX[first], n*sizeof(G4float));
+  std::memcpy(y, &fY[first], n*sizeof(G4float));
+  std::memcpy(z, &fZ[first], n*sizeof(G4float));
+  std::memcpy(u, &fU[first], n*sizeof(G4float));
+  std::memcpy(v, &fV[first], n*sizeof(G4float));
+  std::memcpy(w, &fW[first], n*sizeof(G4float));
+
+  if (extraFloats && fExtraFloatsKept)
+    for (G4int k = 0; k < fNExtraFloats; k++)
+      std::memcpy(extraFloats + k*nMax, &fExtraFloats[k*fNParticles + first],
+		  n*sizeof(G4float));
+  if (extraInts && fExtraIntsKept)
+    for (G4int k = 0; k < fNExtraInts; k++)
+      std::memcpy(extraInts + k*nMax, &fExtraInts[k*fNParticles + first],
+		  n*sizeof(G4int));
+
+  return n;
+}
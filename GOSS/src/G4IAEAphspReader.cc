@@ -43,8 +43,8 @@
 
 #include "iaea_phsp.h"
 #include "iaea_record.h"
-#include "IAEASourceIdRegistry.hh"
 
+#include <utility>
 #include <vector>
 
 #include "globals.hh"
@@ -60,8 +60,39 @@
 #include "G4PrimaryVertex.hh"
 #include "Randomize.hh"
 #include "G4Threading.hh"
+#include "G4RunManagerFactory.hh"
+#include "G4TaskRunManager.hh"
 
 #include "G4IAEAphspReaderMessenger.hh"
+#include "G4IAEAphspMemorySource.hh"
+#include "G4IAEAphspFileSet.hh"
+#include "G4IAEAphspHistoryQueue.hh"
+
+#include <atomic>
+#include <map>
+#include <sstream>
+
+#include "G4AutoLock.hh"
+
+
+// =============================================================================
+// Cursor over the blocks of a phsp file shared by all the readers of this
+// process (see G4IAEAphspReader::NextBlock()). Cursors are created on first
+// use and live until the end of the process.
+
+namespace
+{
+  G4Mutex blockCursorMutex = G4MUTEX_INITIALIZER;
+
+  std::atomic<G4long>* SharedBlockCursor(const G4String& key)
+  {
+    static std::map<G4String, std::atomic<G4long>*> cursors;
+    G4AutoLock lock(&blockCursorMutex);
+    std::atomic<G4long>*& cursor = cursors[key];
+    if (cursor == 0) cursor = new std::atomic<G4long>(0);
+    return cursor;
+  }
+}
 
 
 // =============================================================================
@@ -92,6 +123,33 @@ G4IAEAphspReader::G4IAEAphspReader(const G4String filename, const G4int threads)
 }
 
 
+// =============================================================================
+
+G4IAEAphspReader::G4IAEAphspReader(
+  std::shared_ptr<G4IAEAphspHistoryQueue> queue, const G4int threads)
+  :fVerbose(0)
+{
+  fTotalThreads = threads;
+  fFileName = queue->GetFileName();
+
+  InitializeMembers();
+
+  // The header was read by the queue, which holds the only IAEA source
+  fHistoryQueue = queue;
+  fSourceReadId = -1;
+  fOrigHistories = queue->GetOrigHistories();
+  fTotalParticles = queue->GetTotalParticles();
+  fNumberOfExtraFloats = queue->GetNumberOfExtraFloats();
+  fNumberOfExtraInts = queue->GetNumberOfExtraInts();
+  fArena.Configure(fNumberOfExtraFloats, fNumberOfExtraInts);
+  *fExtraFloatTypes = queue->GetExtraFloatTypes();
+  *fExtraIntTypes = queue->GetExtraIntTypes();
+
+  G4cout << "G4IAEAphspReader ==> This object takes the particles of \""
+	 << fFileName << ".IAEAphsp\" from the i/o thread." << G4endl;
+}
+
+
 // =============================================================================
 
 G4IAEAphspReader::~G4IAEAphspReader()
@@ -100,34 +158,21 @@ G4IAEAphspReader::~G4IAEAphspReader()
   delete fMessenger;
 
   // clear and delete the vectors
-  fParticleTypeVec->clear();
-  fKinEVec->clear();
-  fPosVec->clear();
-  fMomDirVec->clear();
-  fWeightVec->clear();
-
-  if (fNumberOfExtraFloats > 0) {
-    fExtraFloatVec->clear();
+  if (fNumberOfExtraFloats > 0)
     fExtraFloatTypes->clear();
-  }
 
-  if (fNumberOfExtraInts > 0) {
-    fExtraIntVec->clear();
+  if (fNumberOfExtraInts > 0)
     fExtraIntTypes->clear();
-  }
-
-  delete fParticleTypeVec;
-  delete fKinEVec;
-  delete fPosVec;
-  delete fMomDirVec;
-  delete fWeightVec;
-
-  delete fExtraFloatVec;
-  delete fExtraIntVec;
 
   delete fExtraFloatTypes;
   delete fExtraIntTypes;
 
+  // The i/o thread closes the file when the last reader is gone
+  if (fHistoryQueue) {
+    if (fVerbose > 0) G4cout << "G4IAEAphspReader destroyed" << G4endl;
+    return;
+  }
+
   // IAEA file has to be closed
   const IAEA_I32 sourceRead = static_cast<IAEA_I32>( fSourceReadId );
   IAEA_I32 result = 0;
@@ -137,7 +182,6 @@ G4IAEAphspReader::~G4IAEAphspReader()
 
   iaea_destroy_source(&sourceRead, &result);
   if (result > 0) {
-    IAEASourceIdRegistry::Instance().Release(fSourceReadId);
     G4cout << "File " << fFileName << ".IAEAphsp closed successfully!"
 	   << G4endl;
   }
@@ -167,22 +211,45 @@ void G4IAEAphspReader::InitializeMembers()
   else
     fSourceReadId = 0;
 
+  fAccessRead = 1;
+  fReadAhead = 4*1024*1024;
+  fStreaming = false;
+  fDecodeExtraFloats = false;
+  fDecodeExtraInts = false;
   fOrigHistories = -1;
   fTotalParticles = -1;
+  fCurrentFile = 0;
   fExtraFloatTypes = new std::vector<G4int>;
   fExtraIntTypes = new std::vector<G4int>;
 
-  fParticleTypeVec = new std::vector<G4int>;
-  fKinEVec = new std::vector<G4double>;
-  fPosVec = new std::vector<G4ThreeVector>;
-  fMomDirVec = new std::vector<G4ThreeVector>;
-  fWeightVec = new std::vector<G4double>;
-  fExtraFloatVec = new std::vector< std::vector<G4double> >;
-  fExtraIntVec = new std::vector< std::vector<G4long> >;
+
+  fBlockCapacity = 4096;
+  fBlockSize = fBlockIndex = 0;
+  fBlockStride = fBlockCapacity;
+  fBlockExtraFloatsRead = fBlockExtraIntsRead = false;
+  fBlockNStat.resize(fBlockCapacity);
+  fBlockType.resize(fBlockCapacity);
+  fBlockE.resize(fBlockCapacity);
+  fBlockWt.resize(fBlockCapacity);
+  fBlockX.resize(fBlockCapacity);
+  fBlockY.resize(fBlockCapacity);
+  fBlockZ.resize(fBlockCapacity);
+  fBlockU.resize(fBlockCapacity);
+  fBlockV.resize(fBlockCapacity);
+  fBlockW.resize(fBlockCapacity);
 
   fTotalParallelRuns = 1;
   fParallelRun = 1;
   fTimesRecycled = 0;
+  fDynamicBlocks = 0;
+  fTaskBased = (dynamic_cast<G4TaskRunManager*>(
+    G4RunManagerFactory::GetMasterRunManager()) != nullptr);
+  fEpochMode = false;
+  fEpochsCompleted = 0;
+  fNewBlock = false;
+  fBlockPass = -1;
+  fPendingTicket = -1;
+  fReopenSource = false;
   fUsedOrigHistories = 0;
   fCurrentParticle = 0;
   fEndOfFile = false;
@@ -195,11 +262,22 @@ void G4IAEAphspReader::InitializeMembers()
   fCollimatorAngle = fGantryAngle = 0.;
   fCollimatorRotAxis = zAxis;
   fGantryRotAxis = yAxis;
+  fTransformChanged = true;
 
   fAxialSymmetryX = false;
   fAxialSymmetryY = false;
   fAxialSymmetryZ = false;
 
+  fFiltering = false;
+  fFilterMinEnergy = 0.;
+  fFilterMaxEnergy = DBL_MAX;
+  fFilterTypeMask = 0x1f;
+  fAcceptanceBoxCenter = zeroVec;
+  fAcceptanceBoxHalfLength = zeroVec;
+  fAcceptanceBox = false;
+  fAcceptedParticles = fRejectedParticles = 0;
+  fAcceptedWeight = fRejectedWeight = 0.;
+
   // Messenger class
   fMessenger = new G4IAEAphspReaderMessenger(this);
 }
@@ -209,45 +287,46 @@ void G4IAEAphspReader::InitializeMembers()
 
 void G4IAEAphspReader::InitializeSource(const G4String filename)
 {
-  // Reserve a global ID and request it explicitly from IAEA source registry
-  G4int reserved = IAEASourceIdRegistry::Instance().ReserveNextLowest();
-  if (reserved < 0) {
-    G4ExceptionDescription ed;
-    ed << "No free IAEA source_ID's available" << G4endl;
-    G4Exception("G4IAEAphspReader::InitializeSource",
-		"IAEAphspReader002",FatalException, ed);
-  }
-  IAEA_I32 sourceRead = static_cast<IAEA_I32>(reserved);
+  // A list or a pattern of several files is read as one source, starting
+  // with its first file
+  std::vector<G4String> files = G4IAEAphspFileSet::ExpandFileNames(filename);
+  if (files.size() > 1) fFileSet = G4IAEAphspFileSet::Open(filename);
+  if (!files.empty()) fFileName = files[0];
+  fCurrentFile = 0;
+
+  // The IAEA routines assign the lowest free source ID
+  IAEA_I32 sourceRead = -1;
 
   // Now try to open the IAEAphsp file, and check if all it's OK
-  const IAEA_I32 accessRead = 1; //static_cast<IAEA_I32>(fAccessRead);
+  const IAEA_I32 accessRead = static_cast<IAEA_I32>(fAccessRead);
   IAEA_I32 result = 0;
 
-  iaea_new_source(&sourceRead, const_cast<char*>(filename.data()),
-		  &accessRead, &result, filename.size()+1);
+  iaea_new_source(&sourceRead, const_cast<char*>(fFileName.data()),
+		  &accessRead, &result, fFileName.size()+1);
   if ( sourceRead < 0 || result < 0 ) {
-    IAEASourceIdRegistry::Instance().Release(reserved);
     G4ExceptionDescription msg;
     msg << "Could not open IAEA source file to read" << G4endl;
     G4Exception("G4IAEAphspReader::InitializeSource()",
 		"IAEAphspReader003", FatalException, msg);
   }
 
-  // Update fSourceReadId, just in case.
-  fSourceReadId = static_cast<G4int>(sourceRead);   // should equal 'reserved'
-
-  // After creating a new IAEA source, the value of sourceRead
-  // may have change. We check this.
+  fSourceReadId = static_cast<G4int>(sourceRead);
   G4cout << "G4IAEAphspReader ==> This object has IAEA source ID = "
 	 << fSourceReadId << "." << G4endl;
 
 
+  // A byte order mismatch (-4) is fine, records are swapped while read
   iaea_check_file_size_byte_order(&sourceRead, &result);
-  if (result < 0 )
+  if (result == -4)
+    G4cout << "G4IAEAphspReader: phsp file has the opposite byte order, "
+	   << "records will be byte-swapped as they are read" << G4endl;
+  else if (result < 0 )
     G4Exception("G4IAEAphspReader::InitializeSource()",
 		"IAEAphspReader004", FatalException,
 		"Failure at iaea_check_size_byte_order()");
 
+  ApplySourceOptions();
+
 
   // Now get the total number of particles stored in file
 
@@ -262,7 +341,7 @@ void G4IAEAphspReader::InitializeSource(const G4String filename)
   }
   else {
     fTotalParticles = static_cast<G4long>(nParticles);
-    G4cout << "Total number of particles in file \"" << filename
+    G4cout << "Total number of particles in file \"" << fFileName
 	   << ".IAEAphsp\"" << " = " << GetTotalParticles() << G4endl;
   }
 
@@ -274,7 +353,17 @@ void G4IAEAphspReader::InitializeSource(const G4String filename)
   fOrigHistories = static_cast<G4long>(nHistories);
 
   G4cout << "Number of original histories in header file \""
-	 << filename << ".IAEAphsp\"" << " = " << nHistories << G4endl;
+	 << fFileName << ".IAEAphsp\"" << " = " << nHistories << G4endl;
+
+  // The whole set of files counts as the phsp file
+  if (fFileSet) {
+    fTotalParticles = fFileSet->GetTotalParticles();
+    fOrigHistories = fFileSet->GetOrigHistories();
+    G4cout << "G4IAEAphspReader ==> Reading " << fFileSet->GetNumberOfFiles()
+	   << " phsp files as one source: " << fTotalParticles
+	   << " particles, " << fOrigHistories << " original histories"
+	   << G4endl;
+  }
 
 
   // And finally, take all the information related to the extra variables
@@ -283,6 +372,7 @@ void G4IAEAphspReader::InitializeSource(const G4String filename)
   iaea_get_extra_numbers(&sourceRead, &nExtraFloat, &nExtraInt );
   fNumberOfExtraFloats = static_cast<G4int>( nExtraFloat );
   fNumberOfExtraInts = static_cast<G4int>( nExtraInt );
+  fArena.Configure(fNumberOfExtraFloats, fNumberOfExtraInts);
 
   G4cout << "The number of Extra Floats is " << fNumberOfExtraFloats
 	 << " and the number of Extra Ints is " << fNumberOfExtraInts
@@ -314,6 +404,8 @@ void G4IAEAphspReader::InitializeSource(const G4String filename)
 
 void G4IAEAphspReader::GeneratePrimaryVertex(G4Event* evt)
 {
+  if (fTransformChanged) ComposeTransform();
+
   if (fLastGenerated) {
     RestartSourceFile();
     ReadAndStoreFirstParticle();
@@ -334,25 +426,35 @@ void G4IAEAphspReader::RestartSourceFile()
 {
   // Restart counters and flags
   fCurrentParticle = 0;
+  fUsedOrigHistories = 0;
   fEndOfFile = false;
   fLastGenerated = false;
+  fEpochsCompleted = 0;
+  fBlockSize = fBlockIndex = 0;
 
-  // Clear all the vectors
-  fParticleTypeVec->clear();
-  fKinEVec->clear();
-  fPosVec->clear();
-  fMomDirVec->clear();
-  fWeightVec->clear();
-  if (fNumberOfExtraFloats) fExtraFloatVec->clear();
-  if (fNumberOfExtraInts) fExtraIntVec->clear();
+  // Empty the arena of stored particles
+  fArena.Reset();
+
+  // Nothing to reopen, the i/o thread goes on feeding the queue
+  if (fHistoryQueue) return;
+
+  // The source stays open: ReadAndStoreFirstParticle() seeks back to the
+  // beginning of the chunk. It is only reopened for a new access mode.
+  if (!fReopenSource) {
+    if (fVerbose > 0)
+      G4cout << "G4IAEAphspReader ==> Rewinding IAEA source ID = "
+	     << fSourceReadId << G4endl;
+    return;
+  }
+  fReopenSource = false;
 
   // Close and reopen the IAEA source with the same ID
   IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
-  const IAEA_I32 accessRead = 1; // static_cast<IAEA_I32>( fAccessRead );
+  const IAEA_I32 accessRead = static_cast<IAEA_I32>( fAccessRead );
   IAEA_I32 result = 0;
 
   G4cout << "G4IAEAphspReader ==> Closing IAEA source ID = " << fSourceReadId
-	 << " to re-open it and reset fOriginalHistoriesUsed"
+	 << " to re-open it with the new access mode"
 	 << G4endl;
   iaea_destroy_source(&sourceRead, &result);
 
@@ -370,157 +472,118 @@ void G4IAEAphspReader::RestartSourceFile()
 
   iaea_check_file_size_byte_order(&sourceRead, &result);
 
-  if (result < 0 )
+  if (result < 0 && result != -4)
     G4Exception("G4IAEAphspReader::RestartSourceFile()",
 		"IAEAphspReader007", FatalException,
 		"Failure at iaea_check_size_byte_order()");
-}
 
+  ApplySourceOptions();
+}
 
 
 // =============================================================================
 
-void G4IAEAphspReader::ReadAndStoreFirstParticle()
+void G4IAEAphspReader::ApplySourceOptions()
 {
-  // Particle properties
-  IAEA_I32 type, nStat;
-  IAEA_Float E, wt, x, y, z, u, v, w;
-  IAEA_Float extraFloats[NUM_EXTRA_FLOAT];
-  IAEA_I32 extraInts[NUM_EXTRA_LONG]; 
+  // Memory-mapped sources are read ahead and evicted by the kernel.
+  // With an i/o thread, these options are passed on by Start().
+  if (fAccessRead == 4 || fHistoryQueue) return;
 
   IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+  IAEA_I32 result = 0;
 
-  // -------------------------------------------------------------------
-  // Compute first and last particle in case that parallel run commands
-  // may have not been issued
-  // -------------------------------------------------------------------
+  const IAEA_I32 streamMode = fStreaming ? 1 : 0;
+  iaea_set_streaming(&sourceRead, &streamMode, &result);
+  if (result < 0)
+    G4Exception("G4IAEAphspReader::ApplySourceOptions()",
+		"IAEAphspReader024", JustWarning,
+		"Streaming not available, the file stays in the page cache");
 
-  if (fParallelRun == 1)
-    ComputeFirstLastParticle();
+  // Nothing to read ahead if the particles come from memory
+  const IAEA_I64 nBytes = fMemorySource ? 0 : static_cast<IAEA_I64>(fReadAhead);
+  iaea_set_read_ahead(&sourceRead, &nBytes, &result);
+  if (result < 0) {
+    G4ExceptionDescription ED;
+    ED << "Could not read the phsp file ahead (error " << result
+       << "), it is read as particles are needed." << G4endl;
+    G4Exception("G4IAEAphspReader::ApplySourceOptions()",
+		"IAEAphspReader023", JustWarning, ED);
+  }
+}
 
-  // ------------------------------
-  //  Go to the suitable particle
-  // ------------------------------
-  IAEA_I32 chunk = static_cast<IAEA_I32>((fParallelRun-1)*fTotalThreads);
 
-  if ( G4Threading::IsMultithreadedApplication() )
-    chunk += static_cast<IAEA_I32>(G4Threading::G4GetThreadId()+1);
-  else
-    chunk += 1;
 
-  // G4cout << "DEBUG!! fParallelRun= " << fParallelRun << G4endl;
-  // G4cout << "DEBUG!! fTotalThreads= " << fTotalThreads << G4endl;
-  // G4cout << "DEBUG!! chunk= " << chunk << G4endl;
+// =============================================================================
 
-  IAEA_I32 totalChunks =
-    static_cast<IAEA_I32>(fTotalParallelRuns*fTotalThreads);
-  // G4cout << "DEBUG!! totalChunks= " << totalChunks << G4endl;
+void G4IAEAphspReader::ReadAndStoreFirstParticle()
+{
+  if (fHistoryQueue) {
+    // The first reader to get here starts the i/o thread over the
+    // fragment of this parallel run, which is read over and over.
+    fHistoryQueue->Start(fParallelRun, fTotalParallelRuns, fAccessRead,
+			 fReadAhead, fStreaming,
+			 fDecodeExtraFloats, fDecodeExtraInts);
+    fFirstParticle = fCurrentParticle = 0;
+    fLastParticle = -1;
+  }
+  else if (fDynamicBlocks > 0 || fTaskBased) {
+    // Blocks are handed out one at a time by NextBlock(), also to the
+    // threads of the tasking run manager, which claim them per task
+    if (fDynamicBlocks == 0) {
+      SetDynamicBlocks(16*fTotalThreads);
+      G4cout << "G4IAEAphspReader: tasking run manager, the phsp file is "
+	     << "handed out in " << fDynamicBlocks << " blocks" << G4endl;
+    }
+    NextBlock();
+  }
+  else {
+    // -------------------------------------------------------------------
+    // Compute first and last particle in case that parallel run commands
+    // may have not been issued
+    // -------------------------------------------------------------------
 
-  IAEA_I32 result;
-  iaea_set_parallel(&sourceRead, 0, &chunk, &totalChunks, &result);
-  // G4cout << "DEBUG!!!   " << sourceRead << "  " << chunk
-  //  	 << "   " << totalChunks << "    " << result << G4endl;
+    if (fParallelRun == 1)
+      ComputeFirstLastParticle();
 
-  if (result < 0) {
-    G4ExceptionDescription ed;
-    ed << "ERROR placing the cursor within the phsp file [iaea_set_parallel()]"
-       << G4endl;
-    G4Exception("G4IAEAphspReader::ReadAndStoreFirstParticle()",
-		"IAEAphspReader008", FatalException, ed);
+    RewindChunk();
   }
 
-  fCurrentParticle = fFirstParticle;  // To keep track of ordering in phsp file
-
   // -------------------------------------------------
   //  Obtain all the information needed from the file
   // -------------------------------------------------
 
   // read IAEA particle
   fCurrentParticle++; // to keep the position of this particle in the PSF
-  iaea_get_particle(&sourceRead, &nStat, &type, 
-		    &E, &wt, &x, &y, &z, &u, &v, &w, extraFloats, extraInts);
-  // This function increases the number returne
-  // by iaea_get_used_original_particles
-
-  if (fVerbose > 1) {
-    G4cout << std::setprecision(6) << G4endl
-	   << "G4IAEAphspReader: Reading particle # "
-	   << fCurrentParticle << "   type= " << type
-	   << "   n_stat= " << nStat
-	   << G4endl
-	   << "\t\t E= " << E << "   wt= " << wt
-	   << G4endl
-	   << "\t\t x= " << x << "   y= " << y << "   z= " << z
-	   << "   u= " << u << "   v= " << v << "   w= " << w
-	   << G4endl;
-  }
+  G4int idx = ReadNextParticle();
 
-  if (nStat == -1)
+  if (idx < 0)
     G4Exception("G4IAEAphspReader::ReadAndStoreFirstParticle()",
 		"IAEAphspReader009", FatalException,
 		"Cannot find source file");
-  else if (nStat == 0)
+
+  G4int nStat = fBlockNStat[idx];
+  if (nStat == 0)
     fNStat = 1; // needed to set this first particle as new event
   else
     fNStat = nStat;
     // important to calculate correlations properly
+  fNewBlock = false;
 
   // -------------------------------------------------
   //  Store the information into the data members
   // -------------------------------------------------
 
-  fParticleTypeVec->push_back(static_cast<G4int>(type) );
-  fKinEVec->push_back(static_cast<G4double>(E));
-
-  G4ThreeVector pos, momDir;
-  pos.set(static_cast<G4double>(x),
-	  static_cast<G4double>(y),
-	  static_cast<G4double>(z));
-
-  momDir.set(static_cast<G4double>(u),
-	     static_cast<G4double>(v),
-	     static_cast<G4double>(w));
-
-  fPosVec->push_back(pos);
-  fMomDirVec->push_back(momDir);
-
-  fWeightVec->push_back(static_cast<G4double>(wt));
-
-  if (fNumberOfExtraFloats > 0) {
-    std::vector<G4double> vExtraFloats;
-    vExtraFloats.reserve(fNumberOfExtraFloats);
-    for (G4int jj = 0; jj < fNumberOfExtraFloats; jj++)
-      vExtraFloats.push_back( static_cast<G4double>(extraFloats[jj]) );
-
-    fExtraFloatVec->push_back(vExtraFloats);
-  }
-
-  if (fNumberOfExtraInts > 0) {
-    std::vector<G4long> vExtraInts;
-    vExtraInts.reserve(fNumberOfExtraInts);
-    for (G4int ii = 0; ii < fNumberOfExtraInts; ii++)
-      vExtraInts.push_back( static_cast<G4long>(extraInts[ii]) );
-
-    fExtraIntVec->push_back(vExtraInts);
-  }
-
-  //  Update fUsedOrigHistories
-  // ---------------------------------
-
-  IAEA_I64 nUsedOriginal;
-  iaea_get_used_original_particles(&sourceRead, &nUsedOriginal);
-  fUsedOrigHistories = static_cast<G4long>(nUsedOriginal);
-  if (fVerbose > 0)
-    G4cout << "G4IAEAphspReader::fUsedOrigHistories = "
-	   << fUsedOrigHistories << " from IAEAphsp source #" << sourceRead
-	   << G4endl;
+  StoreParticle(idx);
 
   //  Safety check in case that only one particle is stored
   //  or only one particle can be taken into consideration.
   // -------------------------------------------------------
 
-  if (fCurrentParticle == fLastParticle) 
-    fEndOfFile = true;
+  if (fCurrentParticle == fLastParticle) {
+    if (fDynamicBlocks > 0) NextBlock();
+    else if (fEpochMode) NextEpoch();
+    else fEndOfFile = true;
+  }
 }
 
 
@@ -530,26 +593,10 @@ void G4IAEAphspReader::PrepareThisEvent()
 {
   fNStat--;  // A new event begins
 
-  // Erase all the elements but the last in the vectors
-  // In case that the size of the lists is just 1, there's no need
-  // to clean up.
-
-  G4int listSizes = fParticleTypeVec->size();
+  // Drop all the particles but the last one, which opens this event.
+  // In case that just 1 particle is stored, there's no need to clean up.
 
-  if (listSizes > 1) {
-    fParticleTypeVec->erase(fParticleTypeVec->begin(),
-			    fParticleTypeVec->end()-1);
-    fKinEVec->erase(fKinEVec->begin(), fKinEVec->end()-1);
-    fPosVec->erase(fPosVec->begin(), fPosVec->end()-1);
-    fMomDirVec->erase(fMomDirVec->begin(), fMomDirVec->end()-1);
-    fWeightVec->erase(fWeightVec->begin(), fWeightVec->end()-1);
-
-    if (fNumberOfExtraFloats > 0)
-      fExtraFloatVec->erase(fExtraFloatVec->begin(), fExtraFloatVec->end()-1);
-
-    if (fNumberOfExtraInts > 0)
-      fExtraIntVec->erase(fExtraIntVec->begin(), fExtraIntVec->end()-1);
-  }
+  fArena.KeepLast();
 }
 
 
@@ -557,99 +604,219 @@ void G4IAEAphspReader::PrepareThisEvent()
 
 void G4IAEAphspReader::ReadThisEvent()
 {
-  // Particle properties
-  IAEA_I32 type, nStat;
-  IAEA_Float E, wt, x, y, z, u, v, w;
-  IAEA_I32 extraInts[NUM_EXTRA_LONG]; 
-  IAEA_Float extraFloats[NUM_EXTRA_FLOAT];
-
-  IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
-
   // -------------------------------------------------
   //  Obtain all the information needed from the file
   // -------------------------------------------------
 
   while (fNStat == 0 && !fEndOfFile) {
-    //  Read next IAEA particle
-    // -------------------------
+    //  Take next IAEA particle from the block
+    // ----------------------------------------
 
     fCurrentParticle++;
-    iaea_get_particle(&sourceRead, &nStat, &type, &E, &wt,
-		      &x, &y, &z, &u, &v, &w, extraFloats, extraInts);
-    if (fVerbose > 1)
-      G4cout << std::setprecision(6) << G4endl
-	     << "G4IAEAphspReader: Reading particle # "
-	     << fCurrentParticle << "   type= " << type
-	     << "   n_stat= " << nStat
-	     << G4endl
-	     << "\t\t E= " << E << "   wt= " << wt
-	     << G4endl
-	     << "\t\t x= " << x << "   y= " << y << "   z= " << z
-	     << "   u= " << u << "   v= " << v << "   w= " << w
-	     << G4endl;
-
-    if (nStat == -1)
+    G4int idx = ReadNextParticle();
+
+    if (idx < 0)
       G4Exception("G4IAEAphspReader::ReadThisEvent()",
 		  "IAEAphspReader010", FatalException,
 		  "Cannot find source file");
-    else
-      fNStat += nStat;  // statistical book-keeping
+
+    // statistical book-keeping. The first particle of a new block opens
+    // the next event, as in ReadAndStoreFirstParticle(), so that this one
+    // ends at the edge of the block and no history is mixed with another.
+    G4int nStat = fBlockNStat[idx];
+    if (fNewBlock && nStat == 0) nStat = 1;
+    fNewBlock = false;
+    fNStat += nStat;
 
 
     //  Store the information into the data members
     // ---------------------------------------------
 
-    fParticleTypeVec->push_back(static_cast<G4int>(type) );
-    fKinEVec->push_back(static_cast<G4double>(E));
+    StoreParticle(idx);
 
-    G4ThreeVector pos, momDir;
-    pos.set(static_cast<G4double>(x), 
-	    static_cast<G4double>(y),
-	    static_cast<G4double>(z));
-
-    momDir.set(static_cast<G4double>(u),
-	    static_cast<G4double>(v),
-	    static_cast<G4double>(w));
+    //  Check whether the end of chunk has been reached.
+    //  With dynamic blocks, the next event starts at the next block,
+    //  and in epoch mode, at the beginning of the chunk.
+    // ----------------------------------------------------------
+    if (fCurrentParticle == fLastParticle) {
+      if (fDynamicBlocks > 0) NextBlock();
+      else if (fEpochMode) NextEpoch();
+      else fEndOfFile = true;
+    }
+  }
+}
 
-    fPosVec->push_back(pos);
-    fMomDirVec->push_back(momDir);
 
-    fWeightVec->push_back(static_cast<G4double>(wt));
+// =============================================================================
+// Returns the position within the current block of the particle number
+// fCurrentParticle, decoding a new block with iaea_get_particles() when the
+// previous one has been consumed. Blocks never go beyond fLastParticle.
+// Returns -1 if the block could not be read. Extra variables not requested
+// are not decoded (null arrays are skipped by the library).
 
-    if (fNumberOfExtraFloats > 0) {
-      std::vector<G4double> vExtraFloats;
-      vExtraFloats.reserve(fNumberOfExtraFloats);
-      for (G4int jj = 0; jj < fNumberOfExtraFloats; jj++)
-	vExtraFloats.push_back( static_cast<G4double>(extraFloats[jj]) );
+G4int G4IAEAphspReader::ReadNextParticle()
+{
+  if (fBlockIndex >= fBlockSize && fHistoryQueue) {
+    if (!PopHistoryBatch()) return -1;
+    TransformBlock(0);
+  }
 
-      fExtraFloatVec->push_back(vExtraFloats);
+  if (fBlockIndex >= fBlockSize) {
+    // With several files, blocks end with the file, and the particles
+    // after it are read from the next file, with no restart
+    G4long lastParticle = fLastParticle;
+    if (fFileSet) {
+      if (fCurrentParticle > fFileSet->GetFileOffset(fCurrentFile+1))
+	SeekParticle(fCurrentParticle);
+      lastParticle = std::min(lastParticle,
+			      fFileSet->GetFileOffset(fCurrentFile+1));
     }
 
-    if (fNumberOfExtraInts > 0) {
-      std::vector<G4long> vExtraInts;
-      vExtraInts.reserve(fNumberOfExtraInts);
-      for (G4int ii = 0; ii < fNumberOfExtraInts; ii++)
-	vExtraInts.push_back( static_cast<G4long>(extraInts[ii]) );
+    IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+
+    G4long remaining = lastParticle - fCurrentParticle + 1;
+    IAEA_I32 nMax = static_cast<IAEA_I32>(
+      (remaining < fBlockCapacity) ? remaining : fBlockCapacity);
+    if (nMax < 1) nMax = 1;
+    IAEA_I32 nRead = 0;
 
-      fExtraIntVec->push_back(vExtraInts);
+    G4float* extraFloats = 0;
+    if (fDecodeExtraFloats && fNumberOfExtraFloats > 0) {
+      fBlockExtraFloats.resize(fBlockCapacity*fNumberOfExtraFloats);
+      extraFloats = fBlockExtraFloats.data();
+    }
+    G4int* extraInts = 0;
+    if (fDecodeExtraInts && fNumberOfExtraInts > 0) {
+      fBlockExtraInts.resize(fBlockCapacity*fNumberOfExtraInts);
+      extraInts = fBlockExtraInts.data();
     }
 
-    //  Update fUsedOrigHistories
-    // ---------------------------------
+    if (fMemorySource)
+      // Block starting at particle #fCurrentParticle (counting from 1)
+      nRead = fMemorySource->CopyBlock(fCurrentParticle-1, nMax,
+		       fBlockNStat.data(), fBlockType.data(),
+		       fBlockE.data(), fBlockWt.data(),
+		       fBlockX.data(), fBlockY.data(), fBlockZ.data(),
+		       fBlockU.data(), fBlockV.data(), fBlockW.data(),
+		       extraFloats, extraInts);
+    else
+      iaea_get_particles(&sourceRead, &nMax, &nRead,
+		       fBlockNStat.data(), fBlockType.data(),
+		       fBlockE.data(), fBlockWt.data(),
+		       fBlockX.data(), fBlockY.data(), fBlockZ.data(),
+		       fBlockU.data(), fBlockV.data(), fBlockW.data(),
+		       extraFloats, extraInts);
+
+    if (nRead <= 0) return -1;
+
+    fBlockStride = nMax;
+    fBlockExtraFloatsRead = (extraFloats != 0);
+    fBlockExtraIntsRead = (extraInts != 0);
+    fBlockSize = nRead;
+    fBlockIndex = 0;
+    TransformBlock(0);
+  }
 
-    IAEA_I64 nUsedOriginal;
-    iaea_get_used_original_particles(&sourceRead, &nUsedOriginal);
-    fUsedOrigHistories = static_cast<G4long>(nUsedOriginal);
-    if (fVerbose > 0)
-      G4cout << "G4IAEAphspReader::fUsedOrigHistories = "
-	     << fUsedOrigHistories << " from IAEAphsp source #" << sourceRead
-	     << G4endl;
+  G4int idx = fBlockIndex++;
 
-    //  Check whether the end of chunk has been reached
-    // -------------------------------------------------
-    if (fCurrentParticle == fLastParticle)
-      fEndOfFile = true;
+  if (fVerbose > 1)
+    G4cout << std::setprecision(6) << G4endl
+	   << "G4IAEAphspReader: Reading particle # "
+	   << fCurrentParticle << "   type= " << fBlockType[idx]
+	   << "   n_stat= " << fBlockNStat[idx]
+	   << G4endl
+	   << "\t\t E= " << fBlockE[idx] << "   wt= " << fBlockWt[idx]
+	   << G4endl
+	   << "\t\t x= " << fBlockX[idx] << "   y= " << fBlockY[idx]
+	   << "   z= " << fBlockZ[idx]
+	   << "   u= " << fBlockU[idx] << "   v= " << fBlockV[idx]
+	   << "   w= " << fBlockW[idx]
+	   << G4endl;
+
+  return idx;
+}
+
+
+// =============================================================================
+// The vectors of the next batch of the i/o thread become the block arrays
+// of this reader, by swapping them with the vectors of the block already
+// used, which go back to the queue to be filled again. No copy is done.
+
+G4bool G4IAEAphspReader::PopHistoryBatch()
+{
+  G4IAEAphspHistoryQueue::Batch* batch = fHistoryQueue->Pop();
+  if (!batch) return false;
+
+  fBlockNStat.swap(batch->nStat);
+  fBlockType.swap(batch->type);
+  fBlockE.swap(batch->energy);
+  fBlockWt.swap(batch->weight);
+  fBlockX.swap(batch->x);
+  fBlockY.swap(batch->y);
+  fBlockZ.swap(batch->z);
+  fBlockU.swap(batch->u);
+  fBlockV.swap(batch->v);
+  fBlockW.swap(batch->w);
+  fBlockExtraFloats.swap(batch->extraFloats);
+  fBlockExtraInts.swap(batch->extraInts);
+
+  fBlockStride = batch->stride;
+  fBlockExtraFloatsRead = batch->hasExtraFloats;
+  fBlockExtraIntsRead = batch->hasExtraInts;
+  fBlockSize = batch->size;
+  fBlockIndex = 0;
+
+  fHistoryQueue->Release(batch);
+  return fBlockSize > 0;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::StoreParticle(const G4int idx)
+{
+  G4int slot = fArena.Push();
+  EventParticle& part = fArena.At(slot);
+
+  part.type = fBlockType[idx];
+  part.kinE = static_cast<G4double>(fBlockE[idx]);
+  part.weight = static_cast<G4double>(fBlockWt[idx]);
+
+  // Position and direction already in the global frame (TransformBlock())
+  const G4double* global = fBlockGlobal.data();
+  const std::size_t n = static_cast<std::size_t>(fBlockSize);
+  part.pos.set(global[idx], global[n + idx], global[2*n + idx]);
+  part.momDir.set(global[3*n + idx], global[4*n + idx], global[5*n + idx]);
+  part.accepted = fFiltering ? fBlockAccepted[idx] : true;
+
+  // Extra variables go to the flat arrays of the arena, no allocation
+  part.hasExtraFloats = fBlockExtraFloatsRead;
+  if (fBlockExtraFloatsRead) {
+    G4double* extraFloats = fArena.ExtraFloats(slot);
+    for (G4int jj = 0; jj < fNumberOfExtraFloats; jj++)
+      extraFloats[jj] = static_cast<G4double>(
+	fBlockExtraFloats[jj*fBlockStride + idx]);
+  }
+
+  part.hasExtraInts = fBlockExtraIntsRead;
+  if (fBlockExtraIntsRead) {
+    G4long* extraInts = fArena.ExtraInts(slot);
+    for (G4int ii = 0; ii < fNumberOfExtraInts; ii++)
+      extraInts[ii] = static_cast<G4long>(
+	fBlockExtraInts[ii*fBlockStride + idx]);
   }
+
+  //  Update fUsedOrigHistories
+  // ---------------------------------
+  // Counted here rather than with iaea_get_used_original_particles(),
+  // which already includes the particles of the block not used yet.
+
+  G4int nStat = fBlockNStat[idx];
+  if (nStat > 0) fUsedOrigHistories += nStat;
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader::fUsedOrigHistories = "
+	   << fUsedOrigHistories << " from IAEAphsp source #" << fSourceReadId
+	   << G4endl;
 }
 
 
@@ -663,7 +830,7 @@ void G4IAEAphspReader::GeneratePrimaryParticles(G4Event* evt)
   // Otherwise, don't read the last particle.
   // -----------------------------------------------------------
 
-  G4int listSize = fParticleTypeVec->size();
+  G4int listSize = fArena.Size();
 
   if (fEndOfFile && fNStat == 0) {
     // Read all the particles, so this flag switches on
@@ -705,8 +872,17 @@ void G4IAEAphspReader::GeneratePrimaryParticles(G4Event* evt)
     // First: Particle Definition
     // --------------------------
     
+    const EventParticle& part = fArena.At(fArena.Slot(ii));
+
+    // Rejected by the filter (FilterBlock()): no primary at all
+    if (!part.accepted) {
+      fRejectedParticles += fTimesRecycled+1;
+      fRejectedWeight += part.weight;
+      continue;
+    }
+
     G4ParticleDefinition * partDef = 0;
-    switch((*fParticleTypeVec)[ii]) {
+    switch(part.type) {
     case 1:
       partDef = G4Gamma::Definition();
       break;
@@ -725,7 +901,7 @@ void G4IAEAphspReader::GeneratePrimaryParticles(G4Event* evt)
     default:
       G4ExceptionDescription ED;
       ED << "Particle code read at event #" << evt->GetEventID()
-	 << "is" << (*fParticleTypeVec)[ii]
+	 << "is" << part.type
 	 << " - this is not supported by the IAEAphsp format." << G4endl;
       G4Exception("G4IAEAphspReader::GeneratePrimaryParticles()",
 		  "IAEAphspReader011", EventMustBeAborted, ED);
@@ -735,24 +911,18 @@ void G4IAEAphspReader::GeneratePrimaryParticles(G4Event* evt)
     // Second: Particle position, time and momentum
     // --------------------------------------------
 
-    particle_position = (*fPosVec)[ii];
-    particle_position *= cm;        // IAEA file stores in cm
+    // Translation and rotations were applied to the whole block when it
+    // was read (see ComposeTransform() and TransformBlock())
+    particle_position = part.pos;
 
     G4double partMass = partDef->GetPDGMass();
-    G4double partTotE = static_cast<G4double>((*fKinEVec)[ii])*MeV + partMass;
+    G4double partTotE = part.kinE*MeV + partMass;
     G4double partMom = std::sqrt( partTotE*partTotE - partMass*partMass );
 
     G4ThreeVector partMomVec;
-    partMomVec = (*fMomDirVec)[ii];
+    partMomVec = part.momDir;
     partMomVec *= partMom;
 
-    // Third: Translation and rotations
-    // ---------------------------------
-
-    // Translation is performed before rotations
-    particle_position += fGlobalPhspTranslation;
-    PerformRotations(partMomVec);
-
     // -------------------------------------------------
     //  Creation of the new primary particle and vertex
     // -------------------------------------------------
@@ -773,12 +943,23 @@ void G4IAEAphspReader::GeneratePrimaryParticles(G4Event* evt)
 	partMomVec.rotateY(randomRotations[jj]);
       }
 
+      // With an axial symmetry, the acceptance box is checked here for each
+      // rotated copy (the length of the direction does not matter)
+      if (fAcceptanceBox && !randomRotations.empty() &&
+	  !ReachesAcceptanceBox(particle_position, partMomVec)) {
+	fRejectedParticles++;
+	fRejectedWeight += part.weight/(fTimesRecycled+1);
+	continue;
+      }
+      fAcceptedParticles++;
+      fAcceptedWeight += part.weight/(fTimesRecycled+1);
+
       // Create the new primary particle
       G4PrimaryParticle * particle =
 	new G4PrimaryParticle(partDef,
 			      partMomVec.x(),partMomVec.y(),partMomVec.z());
 
-      particle->SetWeight( ((*fWeightVec)[ii])/(fTimesRecycled+1) );
+      particle->SetWeight( part.weight/(fTimesRecycled+1) );
 
       // Create the new primary vertex and set the primary to it
       G4PrimaryVertex * vertex =
@@ -810,105 +991,218 @@ void G4IAEAphspReader::GeneratePrimaryParticles(G4Event* evt)
 
 
 // =============================================================================
-
-void G4IAEAphspReader::PerformRotations(G4ThreeVector & mom)
-{
-  PerformGlobalRotations(mom);
-  PerformHeadRotations(mom);
-}
-
-
-// =============================================================================
-
-void G4IAEAphspReader::PerformGlobalRotations(G4ThreeVector & momentum)
+// The translation, the global rotations (in the order fRotationOrder) and
+// the rotations of the collimator and the gantry around the isocenter are
+// composed once into x -> R*x + t. A particle at x (after the translation
+// T) goes to Rh*(Rg*(x+T) - I) + I, with Rg the global rotation, Rh the
+// head rotation and I the isocenter; so R = Rh*Rg and t = R*T - Rh*I + I.
+// The particles already transformed with the previous transform (those of
+// the arena and the rest of the block) are updated.
+
+void G4IAEAphspReader::ComposeTransform()
 {
+  G4RotationMatrix globalRot;
   switch (fRotationOrder) {
   case 123:
-    particle_position.rotateX(fAlpha);
-    particle_position.rotateY(fBeta);
-    particle_position.rotateZ(fGamma);
-    momentum.rotateX(fAlpha);
-    momentum.rotateY(fBeta);
-    momentum.rotateZ(fGamma);
+    globalRot.rotateX(fAlpha);
+    globalRot.rotateY(fBeta);
+    globalRot.rotateZ(fGamma);
     break;
 
   case 132:
-    particle_position.rotateX(fAlpha);
-    particle_position.rotateZ(fGamma);
-    particle_position.rotateY(fBeta);
-    momentum.rotateX(fAlpha);
-    momentum.rotateZ(fGamma);
-    momentum.rotateY(fBeta);
+    globalRot.rotateX(fAlpha);
+    globalRot.rotateZ(fGamma);
+    globalRot.rotateY(fBeta);
     break;
 
   case 213:
-    particle_position.rotateY(fBeta);
-    particle_position.rotateX(fAlpha);
-    particle_position.rotateZ(fGamma);
-    momentum.rotateY(fBeta);
-    momentum.rotateX(fAlpha);
-    momentum.rotateZ(fGamma);
+    globalRot.rotateY(fBeta);
+    globalRot.rotateX(fAlpha);
+    globalRot.rotateZ(fGamma);
     break;
 
   case 231:
-    particle_position.rotateY(fBeta);
-    particle_position.rotateZ(fGamma);
-    particle_position.rotateX(fAlpha);
-    momentum.rotateY(fBeta);
-    momentum.rotateZ(fGamma);
-    momentum.rotateX(fAlpha);
+    globalRot.rotateY(fBeta);
+    globalRot.rotateZ(fGamma);
+    globalRot.rotateX(fAlpha);
     break;
 
   case 312:
-    particle_position.rotateZ(fGamma);
-    particle_position.rotateX(fAlpha);
-    particle_position.rotateY(fBeta);
-    momentum.rotateZ(fGamma);
-    momentum.rotateX(fAlpha);
-    momentum.rotateY(fBeta);
+    globalRot.rotateZ(fGamma);
+    globalRot.rotateX(fAlpha);
+    globalRot.rotateY(fBeta);
     break;
 
   case 321:
-    particle_position.rotateZ(fGamma);
-    particle_position.rotateY(fBeta);
-    particle_position.rotateX(fAlpha);
-    momentum.rotateZ(fGamma);
-    momentum.rotateY(fBeta);
-    momentum.rotateX(fAlpha);
+    globalRot.rotateZ(fGamma);
+    globalRot.rotateY(fBeta);
+    globalRot.rotateX(fAlpha);
     break;
 
   default:
     G4ExceptionDescription ED;
     ED << "Invalid combination in G4IAEAphspReader::fRotationOrder -> "
        << "NO global rotations are done." << G4endl;
-    G4Exception("G4IAEAphspReader::PerformGlobalRotations()",
+    G4Exception("G4IAEAphspReader::ComposeTransform()",
 		"IAEAphspReader012", FatalErrorInArgument, ED);
   }
+
+  // The collimator rotates first, then the complete machine
+  G4RotationMatrix headRot;
+  headRot.rotate(fCollimatorAngle, fCollimatorRotAxis);
+  headRot.rotate(fGantryAngle, fGantryRotAxis);
+
+  G4RotationMatrix rot = headRot*globalRot;
+  G4ThreeVector trans = rot*fGlobalPhspTranslation
+    - headRot*fIsocenterPosition + fIsocenterPosition;
+
+  // Move the stored particles from the previous transform to this one
+  G4RotationMatrix change = rot*fTransformRotation.inverse();
+  for (G4int ii = 0; ii < fArena.Size(); ii++) {
+    EventParticle& part = fArena.At(fArena.Slot(ii));
+    part.pos = change*(part.pos - fTransformTranslation) + trans;
+    part.momDir = change*part.momDir;
+    part.accepted = !fFiltering ||
+      AcceptParticle(part.type, part.kinE, part.pos, part.momDir);
+  }
+
+  fTransformRotation = rot;
+  fTransformTranslation = trans;
+  fTransformChanged = false;
+
+  if (fBlockIndex < fBlockSize) TransformBlock(fBlockIndex);
 }
 
 
 // =============================================================================
+// Applies the composed transform to the particles of the block from
+// 'first' on, converting the positions from cm (IAEA files) to Geant4
+// units. Plain loops over the columns, so that the compiler vectorizes it.
 
-void G4IAEAphspReader::PerformHeadRotations(G4ThreeVector & momentum)
+void G4IAEAphspReader::TransformBlock(const G4int first)
 {
-  // First we need the position related to the isocenter
-  particle_position -= fIsocenterPosition;
+  const std::size_t n = static_cast<std::size_t>(fBlockSize);
+  if (fBlockGlobal.size() < 6*n) fBlockGlobal.resize(6*n);
+
+  G4double* gx = fBlockGlobal.data();
+  G4double* gy = gx + n;
+  G4double* gz = gy + n;
+  G4double* gu = gz + n;
+  G4double* gv = gu + n;
+  G4double* gw = gv + n;
+
+  const G4float* x = fBlockX.data();
+  const G4float* y = fBlockY.data();
+  const G4float* z = fBlockZ.data();
+  const G4float* u = fBlockU.data();
+  const G4float* v = fBlockV.data();
+  const G4float* w = fBlockW.data();
+
+  const G4RotationMatrix& R = fTransformRotation;
+  const G4double rxx = R.xx(), rxy = R.xy(), rxz = R.xz();
+  const G4double ryx = R.yx(), ryy = R.yy(), ryz = R.yz();
+  const G4double rzx = R.zx(), rzy = R.zy(), rzz = R.zz();
+  const G4double tx = fTransformTranslation.x();
+  const G4double ty = fTransformTranslation.y();
+  const G4double tz = fTransformTranslation.z();
+
+  for (G4int ii = first; ii < fBlockSize; ii++) {
+    const G4double px = x[ii]*cm, py = y[ii]*cm, pz = z[ii]*cm;
+    gx[ii] = rxx*px + rxy*py + rxz*pz + tx;
+    gy[ii] = ryx*px + ryy*py + ryz*pz + ty;
+    gz[ii] = rzx*px + rzy*py + rzz*pz + tz;
+  }
 
-  // And now comes both rotations whose axis contain the isocenter
+  for (G4int ii = first; ii < fBlockSize; ii++) {
+    const G4double du = u[ii], dv = v[ii], dw = w[ii];
+    gu[ii] = rxx*du + rxy*dv + rxz*dw;
+    gv[ii] = ryx*du + ryy*dv + ryz*dw;
+    gw[ii] = rzx*du + rzy*dv + rzz*dw;
+  }
+
+  if (fFiltering) FilterBlock(first);
+}
 
-  // First is the rotation of the collimator around its defined axis
-  particle_position.rotate(fCollimatorRotAxis, fCollimatorAngle);
-  momentum.rotate(fCollimatorRotAxis, fCollimatorAngle);
 
-  // The rotation of the complete machine is applied afterwards
-  particle_position.rotate(fGantryRotAxis, fGantryAngle);
-  momentum.rotate(fGantryRotAxis, fGantryAngle);
+// =============================================================================
+// Evaluates the acceptance filter for the particles of the block from
+// 'first' on, once they are in the global frame, so that the particles
+// rejected never become Geant4 objects.
 
-  // And finally, restore the position to the global coordinate system
-  particle_position += fIsocenterPosition;
+void G4IAEAphspReader::FilterBlock(const G4int first)
+{
+  const std::size_t n = static_cast<std::size_t>(fBlockSize);
+  if (fBlockAccepted.size() < n) fBlockAccepted.resize(n);
+
+  const G4double* global = fBlockGlobal.data();
+  const G4int* type = fBlockType.data();
+  const G4float* kinE = fBlockE.data();
+
+  for (G4int ii = first; ii < fBlockSize; ii++) {
+    const G4ThreeVector pos(global[ii], global[n + ii], global[2*n + ii]);
+    const G4ThreeVector dir(global[3*n + ii], global[4*n + ii],
+			    global[5*n + ii]);
+    fBlockAccepted[ii] = AcceptParticle(type[ii], kinE[ii], pos, dir);
+  }
 }
 
 
+// =============================================================================
+// 'kinE' in MeV, as in the file. Unknown particle types are accepted, to be
+// reported by GeneratePrimaryParticles(). With an axial symmetry the copies
+// of a particle are rotated at random, so the acceptance box is checked for
+// each copy in GeneratePrimaryParticles() instead.
+
+G4bool G4IAEAphspReader::AcceptParticle(const G4int type, const G4double kinE,
+					const G4ThreeVector& pos,
+					const G4ThreeVector& dir) const
+{
+  if (type >= 1 && type <= 5 && !(fFilterTypeMask & (1 << (type-1))))
+    return false;
+
+  if (kinE*MeV < fFilterMinEnergy || kinE*MeV > fFilterMaxEnergy)
+    return false;
+
+  if (fAcceptanceBox && !fAxialSymmetryX && !fAxialSymmetryY &&
+      !fAxialSymmetryZ)
+    return ReachesAcceptanceBox(pos, dir);
+
+  return true;
+}
+
+
+// =============================================================================
+// Slab test: the line pos + t*dir (t >= 0) must cross the three pairs of
+// planes of the box within a common interval of t. Particles already
+// inside the box are accepted.
+
+G4bool G4IAEAphspReader::ReachesAcceptanceBox(const G4ThreeVector& pos,
+					      const G4ThreeVector& dir) const
+{
+  G4double tMin = 0., tMax = DBL_MAX;
+
+  for (G4int kk = 0; kk < 3; kk++) {
+    const G4double p = pos[kk] - fAcceptanceBoxCenter[kk];
+    const G4double d = dir[kk];
+    const G4double h = fAcceptanceBoxHalfLength[kk];
+
+    if (d == 0.) {
+      // Parallel to these planes: it must be between them
+      if (p < -h || p > h) return false;
+      continue;
+    }
+
+    G4double t1 = (-h - p)/d;
+    G4double t2 = (h - p)/d;
+    if (t1 > t2) std::swap(t1, t2);
+    if (t1 > tMin) tMin = t1;
+    if (t2 < tMax) tMax = t2;
+    if (tMin > tMax) return false;
+  }
+
+  return true;
+}
+
 
 // =============================================================================
 
@@ -931,10 +1225,77 @@ void G4IAEAphspReader::SetParallelRun(const G4int parallelRun)
 }
 
 
+// =============================================================================
+
+void G4IAEAphspReader::SetAccessMode(const G4String& mode)
+{
+  if (mode == "stdio") fAccessRead = 1;
+  else if (mode == "mmap") fAccessRead = 4;
+  else if (mode == "pread") fAccessRead = 5;
+  else {
+    G4ExceptionDescription ED;
+    ED << "Unknown access mode \"" << mode << "\", "
+       << "the previous value will remain." << G4endl;
+    G4Exception("G4IAEAphspReader::SetAccessMode()",
+		"IAEAphspReader021", JustWarning, ED);
+    return;
+  }
+
+  // The new mode is used when the source is (re)opened, i.e. at the
+  // beginning of the first event of the next run.
+  fReopenSource = true;
+  fLastGenerated = true;
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader::fAccessRead = " << fAccessRead
+	   << " (" << mode << ")" << G4endl;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetReadAheadDepth(const G4int megabytes)
+{
+  fReadAhead = static_cast<G4long>(megabytes)*1024*1024;
+
+  // The source is open since construction, change it now
+  ApplySourceOptions();
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader::fReadAhead = " << fReadAhead
+	   << " bytes" << G4endl;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetStreaming(const G4bool value)
+{
+  fStreaming = value;
+  ApplySourceOptions();
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader::fStreaming = " << fStreaming << G4endl;
+}
+
+
+// =============================================================================
+
+G4String G4IAEAphspReader::GetAccessMode() const
+{
+  if (fAccessRead == 4) return G4String("mmap");
+  if (fAccessRead == 5) return G4String("pread");
+  return G4String("stdio");
+}
+
+
 // =============================================================================
 
 void G4IAEAphspReader::ComputeFirstLastParticle()
 {
+  // The fragment is read by the i/o thread, see ReadAndStoreFirstParticle()
+  if (fHistoryQueue) return;
+
   // ---------------------------------------------------------
   // Get the limits within this instance reads from the file,
   // defined by first and last particle.
@@ -948,34 +1309,487 @@ void G4IAEAphspReader::ComputeFirstLastParticle()
          << fParallelRun << " of the " << fTotalParallelRuns
          << " defined in the phsp file." << G4endl;
 
-  // Below, operations are done exactly the same way as seen in
-  // iaea_set_parallel() method, for consistency.
-  // This means that all integers are obtained by truncation of floats.
-  // Thus, it is expected that
+  // The limits are those iaea_set_parallel() positions the source at.
+  // If the phsp file has a history index (.IAEAindex) every chunk starts
+  // at a new history; otherwise the file is split in equal portions by
+  // truncation, so that
   // particlesChunk*(fTotalParallelRuns*fTotalThreads) <= fTotalParticles
 
-  IAEA_I64 particlesChunk = fTotalParticles/(fTotalParallelRuns*fTotalThreads);
-  IAEA_I64 firstParticle = particlesChunk*(fParallelRun-1)*fTotalThreads;
+  IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+  IAEA_I32 chunk = static_cast<IAEA_I32>((fParallelRun-1)*fTotalThreads);
 
-  if ( G4Threading::IsMultithreadedApplication() ) {
-    IAEA_I32 threadID = static_cast<IAEA_I32>(G4Threading::G4GetThreadId());
-    firstParticle += particlesChunk*threadID;
-  }
+  if ( G4Threading::IsMultithreadedApplication() )
+    chunk += static_cast<IAEA_I32>(G4Threading::G4GetThreadId()+1);
+  else
+    chunk += 1;
 
-  IAEA_I64 lastParticle = firstParticle + particlesChunk;
+  IAEA_I32 totalChunks =
+    static_cast<IAEA_I32>(fTotalParallelRuns*fTotalThreads);
+
+  IAEA_I64 firstParticle, lastParticle;
+  IAEA_I32 result;
+  if (fFileSet) {
+    // Chunks of the whole set of files
+    G4long first, last;
+    fFileSet->GetChunkLimits(chunk, totalChunks, first, last);
+    firstParticle = first;
+    lastParticle = last;
+    result = 0;
+  }
+  else
+    iaea_get_parallel_limits(&sourceRead, &chunk, &totalChunks,
+			     &firstParticle, &lastParticle, &result);
+  if (result < 0) {
+    G4ExceptionDescription ed;
+    ed << "ERROR computing the limits of chunk #" << chunk << " of "
+       << totalChunks << " [iaea_get_parallel_limits()]" << G4endl;
+    G4Exception("G4IAEAphspReader::ComputeFirstLastParticle()",
+		"IAEAphspReader022", FatalException, ed);
+  }
 
   fFirstParticle = static_cast<G4long>(firstParticle);
   fLastParticle = static_cast<G4long>(lastParticle);
 
   // In case of roundings instead of truncation, the following may happen.
-  if (fLastParticle > fTotalParticles)
+  // The last chunk takes the particles left over by the truncation.
+  if (fLastParticle > fTotalParticles || chunk == totalChunks)
     fLastParticle = fTotalParticles;
 
+  if (result == 1)
+    G4cout << "G4IAEAphspReader: Chunks aligned to histories "
+	   << "using the phsp history index" << G4endl;
+
   // Note: The first particle is at position #1, not #0.
   G4cout << "G4IAEAphspReader: "
 	 << "This thread is reading the particles from place #"
 	 << fFirstParticle+1 << " to #" << fLastParticle
-	 << " within the phsp file" << G4endl;
+	 << (fFileSet ? " within the phsp files" : " within the phsp file")
+	 << G4endl;
+}
+
+
+// =============================================================================
+// Dynamic scheduling. The fragment of the file of this parallel run is
+// split in fDynamicBlocks blocks (history aligned if the file has a
+// history index), handed out to the readers of all the threads from a
+// shared atomic cursor. A thread that runs faster just takes more blocks.
+// When all the blocks have been handed out, the cursor goes on with a new
+// pass over the fragment. A thread whose next block belongs to a new pass
+// ends its chunk there, as at the end of a fixed chunk, and takes that
+// block when the reader restarts (in epoch mode it goes on at once). The
+// source is placed at the beginning of the block taken and the particles
+// already decoded are dropped.
+
+void G4IAEAphspReader::NextBlock()
+{
+  std::ostringstream key;
+  key << (fFileSet ? fFileSet->GetName() : fFileName) << ":" << fParallelRun
+      << "/" << fTotalParallelRuns << ":" << fDynamicBlocks;
+  std::atomic<G4long>* cursor = SharedBlockCursor(key.str());
+
+  IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+  IAEA_I32 totalBlocks =
+    static_cast<IAEA_I32>(fTotalParallelRuns*fDynamicBlocks);
+  IAEA_I64 firstParticle = 0, lastParticle = 0;
+  IAEA_I32 block = 0, result = 0;
+
+  // Empty blocks (more blocks than histories) are skipped
+  for (G4int tries = 0; tries < fDynamicBlocks; tries++) {
+    G4long ticket = fPendingTicket;
+    const G4bool restarted = (ticket >= 0);
+    fPendingTicket = -1;
+    if (!restarted) ticket = cursor->fetch_add(1);
+
+    // End of this pass for this thread: restart as at the end of a chunk
+    if (!restarted && !fEpochMode && fBlockPass >= 0 &&
+	ticket/fDynamicBlocks > fBlockPass) {
+      fPendingTicket = ticket;
+      fEndOfFile = true;
+      return;
+    }
+    fBlockPass = ticket/fDynamicBlocks;
+
+    G4long inFragment = ticket % fDynamicBlocks;
+    if (inFragment == 0 && ticket > 0)
+      G4cout << "G4IAEAphspReader: All the blocks of the phsp file have been"
+	     << " handed out, starting pass #" << ticket/fDynamicBlocks + 1
+	     << " over the file" << G4endl;
+
+    block = static_cast<IAEA_I32>((fParallelRun-1)*fDynamicBlocks
+				  + inFragment + 1);
+    if (fFileSet) {
+      G4long first, last;
+      fFileSet->GetChunkLimits(block, totalBlocks, first, last);
+      firstParticle = first;
+      lastParticle = last;
+    }
+    else
+      iaea_get_parallel_limits(&sourceRead, &block, &totalBlocks,
+			       &firstParticle, &lastParticle, &result);
+    if (result < 0) break;
+
+    // The last block takes the particles left over by the truncation
+    if (block == totalBlocks || lastParticle > fTotalParticles)
+      lastParticle = fTotalParticles;
+    if (lastParticle > firstParticle) break;
+  }
+
+  if (result >= 0 && fFileSet)
+    SeekParticle(static_cast<G4long>(firstParticle)+1);
+  else if (result >= 0)
+    iaea_set_parallel(&sourceRead, 0, &block, &totalBlocks, &result);
+
+  if (result < 0 || lastParticle <= firstParticle) {
+    G4ExceptionDescription ed;
+    ed << "ERROR placing the cursor at block #" << block << " of "
+       << totalBlocks << " within the phsp file [iaea_set_parallel()]"
+       << G4endl;
+    G4Exception("G4IAEAphspReader::NextBlock()",
+		"IAEAphspReader025", FatalException, ed);
+  }
+
+  fFirstParticle = static_cast<G4long>(firstParticle);
+  fLastParticle = static_cast<G4long>(lastParticle);
+  fCurrentParticle = fFirstParticle;
+  fBlockSize = fBlockIndex = 0;
+  fNewBlock = true;
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader: Reading block #" << block << " of "
+	   << totalBlocks << ", particles #" << fFirstParticle+1
+	   << " to #" << fLastParticle << G4endl;
+}
+
+
+// =============================================================================
+// Places the source at the first particle of the chunk of this thread,
+// seeking within the file already open.
+
+void G4IAEAphspReader::RewindChunk()
+{
+  if (fFileSet) {
+    SeekParticle(fFirstParticle+1);
+    fCurrentParticle = fFirstParticle;
+    return;
+  }
+
+  IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+  IAEA_I32 chunk = static_cast<IAEA_I32>((fParallelRun-1)*fTotalThreads);
+
+  if ( G4Threading::IsMultithreadedApplication() )
+    chunk += static_cast<IAEA_I32>(G4Threading::G4GetThreadId()+1);
+  else
+    chunk += 1;
+
+  IAEA_I32 totalChunks =
+    static_cast<IAEA_I32>(fTotalParallelRuns*fTotalThreads);
+
+  IAEA_I32 result;
+  iaea_set_parallel(&sourceRead, 0, &chunk, &totalChunks, &result);
+
+  if (result < 0) {
+    G4ExceptionDescription ed;
+    ed << "ERROR placing the cursor within the phsp file [iaea_set_parallel()]"
+       << G4endl;
+    G4Exception("G4IAEAphspReader::RewindChunk()",
+		"IAEAphspReader008", FatalException, ed);
+  }
+
+  fCurrentParticle = fFirstParticle;  // To keep track of ordering in phsp file
+  fBlockSize = fBlockIndex = 0;
+}
+
+
+// =============================================================================
+// Places the source at the particle #particle (counting from 1) of the set
+// of files, opening first the file that holds it if it is not the one open.
+
+void G4IAEAphspReader::SeekParticle(const G4long particle)
+{
+  G4int file = fFileSet->FindFile(particle);
+  if (file != fCurrentFile) OpenFile(file);
+
+  IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+  IAEA_I64 record = static_cast<IAEA_I64>(
+    particle - fFileSet->GetFileOffset(file));
+  IAEA_I32 result = 0;
+  iaea_set_record(&sourceRead, &record, &result);
+
+  if (result < 0) {
+    G4ExceptionDescription ed;
+    ed << "ERROR placing the cursor at particle #" << record << " of \""
+       << fFileName << "\" [iaea_set_record()]" << G4endl;
+    G4Exception("G4IAEAphspReader::SeekParticle()",
+		"IAEAphspReader029", FatalException, ed);
+  }
+
+  fBlockSize = fBlockIndex = 0;
+}
+
+
+// =============================================================================
+// Closes the file of the set being read and opens 'file' instead, with the
+// same access mode and options. The particles already decoded are kept.
+
+void G4IAEAphspReader::OpenFile(const G4int file)
+{
+  IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+  const IAEA_I32 accessRead = static_cast<IAEA_I32>(fAccessRead);
+  IAEA_I32 result = 0;
+  iaea_destroy_source(&sourceRead, &result);
+
+  fFileName = fFileSet->GetFileName(file);
+  fCurrentFile = file;
+
+  sourceRead = -1;
+  iaea_new_source(&sourceRead, const_cast<char*>(fFileName.data()),
+		  &accessRead, &result, fFileName.size()+1);
+  if (sourceRead < 0 || result < 0) {
+    G4ExceptionDescription ed;
+    ed << "Could not open the phsp file \"" << fFileName << "\" to read"
+       << G4endl;
+    G4Exception("G4IAEAphspReader::OpenFile()",
+		"IAEAphspReader030", FatalException, ed);
+  }
+  fSourceReadId = static_cast<G4int>(sourceRead);
+
+  iaea_check_file_size_byte_order(&sourceRead, &result);
+  if (result < 0 && result != -4)
+    G4Exception("G4IAEAphspReader::OpenFile()",
+		"IAEAphspReader031", FatalException,
+		"Failure at iaea_check_size_byte_order()");
+
+  ApplySourceOptions();
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader ==> Reading file #" << fCurrentFile+1
+	   << " of " << fFileSet->GetNumberOfFiles() << ", \"" << fFileName
+	   << "\", with IAEA source ID = " << fSourceReadId << G4endl;
+}
+
+
+// =============================================================================
+
+G4int G4IAEAphspReader::GetNumberOfFiles() const
+{
+  return fFileSet ? fFileSet->GetNumberOfFiles() : 1;
+}
+
+
+// =============================================================================
+// Epoch mode: the last particle of the chunk has just been read, so the
+// reading goes on from the first one, which opens the next event, without
+// restarting the reader. The random rotations of the axial symmetries are
+// drawn for every event, so each pass is rotated anew; without them the
+// particles are repeated.
+
+void G4IAEAphspReader::NextEpoch()
+{
+  RewindChunk();
+  fEpochsCompleted++;
+  fNewBlock = true;
+
+  if (fEpochsCompleted == 1 &&
+      !(fAxialSymmetryX || fAxialSymmetryY || fAxialSymmetryZ)) {
+    G4ExceptionDescription ED;
+    ED << "The chunk of the phsp file is read again with no axial symmetry,"
+       << " so the same particles are repeated." << G4endl;
+    G4Exception("G4IAEAphspReader::NextEpoch()",
+		"IAEAphspReader027", JustWarning, ED);
+  }
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader: starting pass #" << fEpochsCompleted+1
+	   << " over particles #" << fFirstParticle+1 << " to #"
+	   << fLastParticle << G4endl;
+}
+
+
+// =============================================================================
+// The copy in memory must hold the same file as this reader. The particles
+// are then taken from it from the next block decoded on.
+
+void G4IAEAphspReader::SetMemorySource(
+  std::shared_ptr<const G4IAEAphspMemorySource> src)
+{
+  if (src && (src->GetFileName() != fFileName ||
+	      src->GetNumberOfParticles() != fTotalParticles)) {
+    G4ExceptionDescription ED;
+    ED << "The phsp file in memory \"" << src->GetFileName()
+       << "\" is not the one of this reader, \"" << fFileName
+       << "\" is read from disk." << G4endl;
+    G4Exception("G4IAEAphspReader::SetMemorySource()",
+		"IAEAphspReader026", JustWarning, ED);
+    return;
+  }
+  fMemorySource = src;
+  ApplySourceOptions();
+  if (!MemoryHoldsExtras()) LeaveMemorySource();
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader: reading particles from "
+	   << (fMemorySource ? "memory" : "the phsp file") << G4endl;
+}
+
+
+// =============================================================================
+// The copy in memory only keeps the extra variables asked for when it was
+// loaded (none by default).
+
+G4bool G4IAEAphspReader::MemoryHoldsExtras() const
+{
+  if (!fMemorySource) return true;
+  return (!fDecodeExtraFloats || fNumberOfExtraFloats == 0 ||
+	  fMemorySource->HasExtraFloats()) &&
+    (!fDecodeExtraInts || fNumberOfExtraInts == 0 ||
+     fMemorySource->HasExtraInts());
+}
+
+
+// =============================================================================
+// The particles are read from the file again, from the one after the last
+// particle used: the file was not read while they came from memory.
+
+void G4IAEAphspReader::LeaveMemorySource()
+{
+  G4ExceptionDescription ED;
+  ED << "The copy in memory of \"" << fFileName << "\" does not hold the "
+     << "extra variables to decode, they are read from disk." << G4endl;
+  G4Exception("G4IAEAphspReader::LeaveMemorySource()",
+	      "IAEAphspReader032", JustWarning, ED);
+
+  fMemorySource.reset();
+  ApplySourceOptions();
+
+  if (fCurrentParticle > 0 && !fLastGenerated) {
+    IAEA_I32 sourceRead = static_cast<IAEA_I32>(fSourceReadId);
+    IAEA_I64 record = static_cast<IAEA_I64>(fCurrentParticle+1);
+    IAEA_I32 result = 0;
+    iaea_set_record(&sourceRead, &record, &result);
+  }
+  fBlockSize = fBlockIndex = 0;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetDecodeExtraFloats(const G4bool value)
+{
+  fDecodeExtraFloats = value;
+  if (!MemoryHoldsExtras()) LeaveMemorySource();
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetDecodeExtraInts(const G4bool value)
+{
+  fDecodeExtraInts = value;
+  if (!MemoryHoldsExtras()) LeaveMemorySource();
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetDynamicBlocks(const G4int nBlocks)
+{
+  fDynamicBlocks = (nBlocks > 0) ? nBlocks : 0;
+  fBlockPass = fPendingTicket = -1;  // other blocks, other shared cursor
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader::fDynamicBlocks = " << fDynamicBlocks
+	   << G4endl;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetFilterMinEnergy(const G4double energy)
+{
+  fFilterMinEnergy = energy;
+  UpdateFiltering();
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetFilterMaxEnergy(const G4double energy)
+{
+  fFilterMaxEnergy = energy;
+  UpdateFiltering();
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetFilterParticles(const G4String& names)
+{
+  static const std::map<G4String, G4int> types = {
+    {"gamma", 1}, {"e-", 2}, {"e+", 3}, {"neutron", 4}, {"proton", 5}
+  };
+
+  G4int mask = 0;
+  std::istringstream is(names);
+  G4String name;
+  while (is >> name) {
+    if (name == "all") {
+      mask = 0x1f;
+      continue;
+    }
+
+    auto it = types.find(name);
+    if (it == types.end()) {
+      G4ExceptionDescription ED;
+      ED << "Particle '" << name << "' cannot be read from an IAEAphsp file."
+	 << " The particles accepted are not changed." << G4endl;
+      G4Exception("G4IAEAphspReader::SetFilterParticles()",
+		  "IAEAphspReader028", JustWarning, ED);
+      return;
+    }
+    mask |= 1 << (it->second - 1);
+  }
+
+  fFilterTypeMask = mask;
+  UpdateFiltering();
+
+  if (fVerbose > 0)
+    G4cout << "G4IAEAphspReader::fFilterTypeMask = " << fFilterTypeMask
+	   << G4endl;
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetAcceptanceBoxCenter(const G4ThreeVector& center)
+{
+  fAcceptanceBoxCenter = center;
+  UpdateFiltering();
+}
+
+
+// =============================================================================
+
+void G4IAEAphspReader::SetAcceptanceBoxHalfLength(
+  const G4ThreeVector& halfLength)
+{
+  fAcceptanceBoxHalfLength = halfLength;
+  UpdateFiltering();
+}
+
+
+// =============================================================================
+// The particles already read are filtered again by ComposeTransform()
+
+void G4IAEAphspReader::UpdateFiltering()
+{
+  fAcceptanceBox = (fAcceptanceBoxHalfLength.x() > 0. &&
+		    fAcceptanceBoxHalfLength.y() > 0. &&
+		    fAcceptanceBoxHalfLength.z() > 0.);
+
+  fFiltering = (fAcceptanceBox || fFilterTypeMask != 0x1f ||
+		fFilterMinEnergy > 0. || fFilterMaxEnergy < DBL_MAX);
+
+  fTransformChanged = true;
 }
 
 
@@ -993,6 +1807,7 @@ void G4IAEAphspReader::SetCollimatorRotationAxis(const G4ThreeVector & axis)
     fCollimatorRotAxis.setX(ux);
     fCollimatorRotAxis.setY(uy);
     fCollimatorRotAxis.setZ(uz);
+    fTransformChanged = true;
   }
   else {
     G4ExceptionDescription ED;
@@ -1018,6 +1833,7 @@ void G4IAEAphspReader::SetGantryRotationAxis(const G4ThreeVector & axis)
     fGantryRotAxis.setX(ux);
     fGantryRotAxis.setY(uy);
     fGantryRotAxis.setZ(uz);
+    fTransformChanged = true;
   }
   else {
     G4ExceptionDescription ED;
@@ -1053,9 +1869,12 @@ G4long G4IAEAphspReader::GetTotalParticlesOfType(const G4String type) const
     return -1;
   }
 
-  IAEA_I64 nParticles;
+  IAEA_I64 nParticles = -1;
   const IAEA_I32 sourceRead = static_cast<IAEA_I32>( fSourceReadId );
-  iaea_get_max_particles(&sourceRead, &particleType, &nParticles);
+  if (fFileSet)
+    nParticles = fFileSet->GetTotalParticles(particleType);
+  else if (fSourceReadId >= 0)
+    iaea_get_max_particles(&sourceRead, &particleType, &nParticles);
 
   if (nParticles < 0)
     G4Exception("G4IAEAphspReader::GetTotalParticlesOfType()",
@@ -1064,7 +1883,8 @@ G4long G4IAEAphspReader::GetTotalParticlesOfType(const G4String type) const
   else
     G4cout << "G4IAEAphspReader: "
 	   << "Total number of " << type << " in filename "
-	   << fFileName << ".IAEAphsp" << " = " << nParticles << G4endl;
+	   << (fFileSet ? fFileSet->GetName() : fFileName)
+	   << ".IAEAphsp" << " = " << nParticles << G4endl;
 
   return ( static_cast<G4long>(nParticles) );
 }
@@ -1076,10 +1896,11 @@ G4double G4IAEAphspReader::GetConstantVariable(const G4int index) const
 {
   const IAEA_I32 sourceRead = static_cast<IAEA_I32>( fSourceReadId );
   const IAEA_I32 idx = static_cast<IAEA_I32>( index );
-  IAEA_Float constVariable;
-  IAEA_I32 result;
+  IAEA_Float constVariable = 0;
+  IAEA_I32 result = -1;
 
-  iaea_get_constant_variable(&sourceRead, &idx, &constVariable, &result);
+  if (fSourceReadId >= 0)
+    iaea_get_constant_variable(&sourceRead, &idx, &constVariable, &result);
 
   if (result == -1)
     G4Exception("G4IAEAphspReader::GetConstantVariable()",
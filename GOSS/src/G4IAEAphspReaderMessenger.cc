@@ -46,6 +46,7 @@
 #include "G4UIcmdWithABool.hh"
 #include "G4UIcmdWithADoubleAndUnit.hh"
 #include "G4UIcmdWithAnInteger.hh"
+#include "G4UIcmdWithAString.hh"
 #include "G4UIdirectory.hh"
 
 
@@ -63,6 +64,65 @@ G4IAEAphspReaderMessenger::G4IAEAphspReaderMessenger(G4IAEAphspReader* reader)
   fVerboseCmd->SetRange("value >= 0");
   fVerboseCmd->AvailableForStates(G4State_Idle);
 
+  fAccessModeCmd = new G4UIcmdWithAString("/IAEAphspReader/accessMode", this);
+  fAccessModeCmd->SetGuidance("Select how the phase-space file is read.");
+  fAccessModeCmd->SetGuidance("  stdio: buffered reads through a FILE* (default)");
+  fAccessModeCmd->SetGuidance("  mmap : records decoded from a read-only memory");
+  fAccessModeCmd->SetGuidance("         mapping shared by all threads");
+  fAccessModeCmd->SetGuidance("  pread: one file descriptor shared by all threads,");
+  fAccessModeCmd->SetGuidance("         each one reading its chunk at its own offset");
+  fAccessModeCmd->SetGuidance("The source is re-opened at the next event.");
+  fAccessModeCmd->SetParameterName("mode", false);
+  fAccessModeCmd->SetCandidates("stdio mmap pread");
+  fAccessModeCmd->AvailableForStates(G4State_Idle);
+
+  fReadAheadDepthCmd =
+    new G4UIcmdWithAnInteger("/IAEAphspReader/readAheadDepth", this);
+  fReadAheadDepthCmd
+    ->SetGuidance("Set the MB of the phase-space file that a background");
+  fReadAheadDepthCmd
+    ->SetGuidance(" thread keeps read ahead of each worker (default 4).");
+  fReadAheadDepthCmd->SetGuidance("0 reads the file only as particles are needed.");
+  fReadAheadDepthCmd->SetGuidance("Not used with the mmap access mode.");
+  fReadAheadDepthCmd->SetParameterName("MB", false);
+  fReadAheadDepthCmd->SetRange("MB >= 0");
+  fReadAheadDepthCmd->AvailableForStates(G4State_Idle);
+
+  fStreamingCmd = new G4UIcmdWithABool("/IAEAphspReader/streaming", this);
+  fStreamingCmd
+    ->SetGuidance("Drop the pages of the phase-space file from the page cache");
+  fStreamingCmd
+    ->SetGuidance(" once read, so that huge files do not evict the data of");
+  fStreamingCmd->SetGuidance(" other jobs from memory (default false).");
+  fStreamingCmd->SetGuidance("Not used with the mmap access mode.");
+  fStreamingCmd->SetParameterName("choice", true);
+  fStreamingCmd->SetDefaultValue(true);
+  fStreamingCmd->AvailableForStates(G4State_Idle);
+
+  fDecodeExtraFloatsCmd =
+    new G4UIcmdWithABool("/IAEAphspReader/decodeExtraFloats", this);
+  fDecodeExtraFloatsCmd
+    ->SetGuidance("Copy the extra floats of each particle into the reader");
+  fDecodeExtraFloatsCmd
+    ->SetGuidance(" (GetStoredExtraFloats()). Otherwise they are skipped when");
+  fDecodeExtraFloatsCmd->SetGuidance(" the file is decoded (default false).");
+  fDecodeExtraFloatsCmd->SetParameterName("choice", true);
+  fDecodeExtraFloatsCmd->SetDefaultValue(true);
+  fDecodeExtraFloatsCmd->AvailableForStates(G4State_Idle);
+
+  fDecodeExtraIntsCmd =
+    new G4UIcmdWithABool("/IAEAphspReader/decodeExtraInts", this);
+  fDecodeExtraIntsCmd
+    ->SetGuidance("Copy the extra longs of each particle into the reader");
+  fDecodeExtraIntsCmd
+    ->SetGuidance(" (GetStoredExtraInts()). Otherwise they are skipped when");
+  fDecodeExtraIntsCmd->SetGuidance(" the file is decoded (default false).");
+  fDecodeExtraIntsCmd
+    ->SetGuidance("The incremental history number is always used.");
+  fDecodeExtraIntsCmd->SetParameterName("choice", true);
+  fDecodeExtraIntsCmd->SetDefaultValue(true);
+  fDecodeExtraIntsCmd->AvailableForStates(G4State_Idle);
+
   fNofParallelRunsCmd =
     new G4UIcmdWithAnInteger("/IAEAphspReader/numberOfParallelRuns", this);
   fNofParallelRunsCmd
@@ -82,6 +142,33 @@ G4IAEAphspReaderMessenger::G4IAEAphspReaderMessenger(G4IAEAphspReader* reader)
   fParallelRunCmd->SetRange("frag > 0");
   fParallelRunCmd->AvailableForStates(G4State_Idle);
 
+  fDynamicBlocksCmd =
+    new G4UIcmdWithAnInteger("/IAEAphspReader/dynamicBlocks", this);
+  fDynamicBlocksCmd
+    ->SetGuidance("Split the fragment of the phase-space file in B blocks,");
+  fDynamicBlocksCmd
+    ->SetGuidance(" handed out to the threads as they need more particles,");
+  fDynamicBlocksCmd
+    ->SetGuidance(" instead of one fixed chunk per thread (B = 0, default).");
+  fDynamicBlocksCmd
+    ->SetGuidance("Blocks start at new histories if the file has an index.");
+  fDynamicBlocksCmd->SetParameterName("B", false);
+  fDynamicBlocksCmd->SetRange("B >= 0");
+  fDynamicBlocksCmd->AvailableForStates(G4State_Idle);
+
+  fEpochModeCmd = new G4UIcmdWithABool("/IAEAphspReader/epochs", this);
+  fEpochModeCmd
+    ->SetGuidance("Read the chunk of the phase-space file again from its");
+  fEpochModeCmd
+    ->SetGuidance(" beginning as soon as its last particle is read, without");
+  fEpochModeCmd
+    ->SetGuidance(" restarting the reader (default false). Use it with an");
+  fEpochModeCmd
+    ->SetGuidance(" axial symmetry, so that each pass is rotated anew.");
+  fEpochModeCmd->SetParameterName("choice", true);
+  fEpochModeCmd->SetDefaultValue(true);
+  fEpochModeCmd->AvailableForStates(G4State_Idle);
+
   fTimesRecycledCmd =
     new G4UIcmdWithAnInteger("/IAEAphspReader/recycling", this);
   fTimesRecycledCmd
@@ -202,6 +289,56 @@ G4IAEAphspReaderMessenger::G4IAEAphspReaderMessenger(G4IAEAphspReader* reader)
   fAxialSymmetryZCmd->SetParameterName("choice", true);
   fAxialSymmetryZCmd->SetDefaultValue(true);
   fAxialSymmetryZCmd->AvailableForStates(G4State_Idle);
+
+  fFilterMinEnergyCmd =
+    new G4UIcmdWithADoubleAndUnit("/IAEAphspReader/filterMinEnergy", this);
+  fFilterMinEnergyCmd
+    ->SetGuidance("Particles with a lower kinetic energy are not generated.");
+  fFilterMinEnergyCmd->SetParameterName("Emin", false);
+  fFilterMinEnergyCmd->SetRange("Emin >= 0");
+  fFilterMinEnergyCmd->SetDefaultUnit("MeV");
+  fFilterMinEnergyCmd->AvailableForStates(G4State_Idle);
+
+  fFilterMaxEnergyCmd =
+    new G4UIcmdWithADoubleAndUnit("/IAEAphspReader/filterMaxEnergy", this);
+  fFilterMaxEnergyCmd
+    ->SetGuidance("Particles with a higher kinetic energy are not generated.");
+  fFilterMaxEnergyCmd->SetParameterName("Emax", false);
+  fFilterMaxEnergyCmd->SetRange("Emax > 0");
+  fFilterMaxEnergyCmd->SetDefaultUnit("MeV");
+  fFilterMaxEnergyCmd->AvailableForStates(G4State_Idle);
+
+  fFilterParticlesCmd =
+    new G4UIcmdWithAString("/IAEAphspReader/filterParticles", this);
+  fFilterParticlesCmd
+    ->SetGuidance("Generate only the particles of the types listed:");
+  fFilterParticlesCmd
+    ->SetGuidance(" gamma, e-, e+, neutron, proton, or all (default).");
+  fFilterParticlesCmd->SetParameterName("names", false);
+  fFilterParticlesCmd->AvailableForStates(G4State_Idle);
+
+  fAcceptanceBoxCenterCmd = new G4UIcmdWith3VectorAndUnit(
+    "/IAEAphspReader/acceptanceBoxCenter", this);
+  fAcceptanceBoxCenterCmd
+    ->SetGuidance("Set the center of the acceptance box (global frame).");
+  fAcceptanceBoxCenterCmd->SetParameterName("Xc", "Yc", "Zc", false);
+  fAcceptanceBoxCenterCmd->SetDefaultUnit("cm");
+  fAcceptanceBoxCenterCmd->SetUnitCandidates("mm cm m");
+  fAcceptanceBoxCenterCmd->AvailableForStates(G4State_Idle);
+
+  fAcceptanceBoxHalfLengthCmd = new G4UIcmdWith3VectorAndUnit(
+    "/IAEAphspReader/acceptanceBoxHalfLength", this);
+  fAcceptanceBoxHalfLengthCmd
+    ->SetGuidance("Set the half lengths of the acceptance box. Particles");
+  fAcceptanceBoxHalfLengthCmd
+    ->SetGuidance(" whose straight line does not reach the box are not");
+  fAcceptanceBoxHalfLengthCmd
+    ->SetGuidance(" generated. A zero half length removes the box.");
+  fAcceptanceBoxHalfLengthCmd->SetParameterName("Dx", "Dy", "Dz", false);
+  fAcceptanceBoxHalfLengthCmd->SetRange("Dx >= 0 && Dy >= 0 && Dz >= 0");
+  fAcceptanceBoxHalfLengthCmd->SetDefaultUnit("cm");
+  fAcceptanceBoxHalfLengthCmd->SetUnitCandidates("mm cm m");
+  fAcceptanceBoxHalfLengthCmd->AvailableForStates(G4State_Idle);
 }
 
 
@@ -209,8 +346,15 @@ G4IAEAphspReaderMessenger::~G4IAEAphspReaderMessenger()
 { 
   delete fPhaseSpaceDir;
   delete fVerboseCmd;
+  delete fAccessModeCmd;
+  delete fReadAheadDepthCmd;
+  delete fStreamingCmd;
+  delete fDecodeExtraFloatsCmd;
+  delete fDecodeExtraIntsCmd;
   delete fNofParallelRunsCmd;
   delete fParallelRunCmd;
+  delete fDynamicBlocksCmd;
+  delete fEpochModeCmd;
   delete fTimesRecycledCmd;
   delete fPhspGlobalTranslationCmd;
   delete fPhspRotationOrderCmd;
@@ -225,6 +369,11 @@ G4IAEAphspReaderMessenger::~G4IAEAphspReaderMessenger()
   delete fAxialSymmetryXCmd;
   delete fAxialSymmetryYCmd;
   delete fAxialSymmetryZCmd;
+  delete fFilterMinEnergyCmd;
+  delete fFilterMaxEnergyCmd;
+  delete fFilterParticlesCmd;
+  delete fAcceptanceBoxCenterCmd;
+  delete fAcceptanceBoxHalfLengthCmd;
 }
 
 
@@ -234,6 +383,24 @@ void G4IAEAphspReaderMessenger::SetNewValue(G4UIcommand* command,
   if( command == fVerboseCmd )
     fIAEAphspReader->SetVerbose(fVerboseCmd->GetNewIntValue(newValue));
 
+  else if( command == fAccessModeCmd )
+    fIAEAphspReader->SetAccessMode(newValue);
+
+  else if( command == fReadAheadDepthCmd )
+    fIAEAphspReader
+      ->SetReadAheadDepth(fReadAheadDepthCmd->GetNewIntValue(newValue));
+
+  else if( command == fStreamingCmd )
+    fIAEAphspReader->SetStreaming(fStreamingCmd->GetNewBoolValue(newValue));
+
+  else if( command == fDecodeExtraFloatsCmd )
+    fIAEAphspReader->SetDecodeExtraFloats
+      (fDecodeExtraFloatsCmd->GetNewBoolValue(newValue));
+
+  else if( command == fDecodeExtraIntsCmd )
+    fIAEAphspReader->SetDecodeExtraInts
+      (fDecodeExtraIntsCmd->GetNewBoolValue(newValue));
+
   else if( command == fNofParallelRunsCmd )
     fIAEAphspReader
       ->SetTotalParallelRuns(fNofParallelRunsCmd->GetNewIntValue(newValue));
@@ -241,6 +408,13 @@ void G4IAEAphspReaderMessenger::SetNewValue(G4UIcommand* command,
   else if( command == fParallelRunCmd )
     fIAEAphspReader->SetParallelRun(fParallelRunCmd->GetNewIntValue(newValue));
 
+  else if( command == fDynamicBlocksCmd )
+    fIAEAphspReader
+      ->SetDynamicBlocks(fDynamicBlocksCmd->GetNewIntValue(newValue));
+
+  else if( command == fEpochModeCmd )
+    fIAEAphspReader->SetEpochMode(fEpochModeCmd->GetNewBoolValue(newValue));
+
   else if( command == fTimesRecycledCmd )
     fIAEAphspReader
       ->SetTimesRecycled(fTimesRecycledCmd->GetNewIntValue(newValue) );
@@ -296,4 +470,23 @@ void G4IAEAphspReaderMessenger::SetNewValue(G4UIcommand* command,
     fIAEAphspReader
       ->SetAxialSymmetryZ( fAxialSymmetryZCmd->GetNewBoolValue(newValue) );
 
+  else if( command == fFilterMinEnergyCmd )
+    fIAEAphspReader
+      ->SetFilterMinEnergy(fFilterMinEnergyCmd->GetNewDoubleValue(newValue));
+
+  else if( command == fFilterMaxEnergyCmd )
+    fIAEAphspReader
+      ->SetFilterMaxEnergy(fFilterMaxEnergyCmd->GetNewDoubleValue(newValue));
+
+  else if( command == fFilterParticlesCmd )
+    fIAEAphspReader->SetFilterParticles(newValue);
+
+  else if( command == fAcceptanceBoxCenterCmd )
+    fIAEAphspReader->SetAcceptanceBoxCenter(
+      fAcceptanceBoxCenterCmd->GetNew3VectorValue(newValue) );
+
+  else if( command == fAcceptanceBoxHalfLengthCmd )
+    fIAEAphspReader->SetAcceptanceBoxHalfLength(
+      fAcceptanceBoxHalfLengthCmd->GetNew3VectorValue(newValue) );
+
 }
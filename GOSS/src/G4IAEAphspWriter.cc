@@ -43,9 +43,9 @@
 #include "G4Track.hh"
 
 #include "iaea_phsp.h"
-#include "IAEASourceIdRegistry.hh"
 #include "G4IAEAphspWriterStack.hh"
 
+#include <algorithm>
 #include <map>
 #include <sstream>
 #include <vector>
@@ -58,7 +58,7 @@ G4IAEAphspWriter::G4IAEAphspWriter(const G4String filename)
   fZphspVec = new std::vector<G4double>;
   fConstVariables = new std::map<G4int, G4double>;
   fOrigHistories = new std::vector<G4int>;
-  fIAEASourcesOpen = 0;
+  fSourceIds = new std::vector<G4int>;
   G4cout << "G4IAEAphspWriter object constructed." << G4endl;
 }
 
@@ -68,6 +68,7 @@ G4IAEAphspWriter::~G4IAEAphspWriter()
   if (fZphspVec) delete fZphspVec;
   if (fConstVariables) delete fConstVariables;
   if (fOrigHistories) delete fOrigHistories;
+  if (fSourceIds) delete fSourceIds;
 }
 
 
@@ -97,6 +98,8 @@ void G4IAEAphspWriter::SetDataFromIAEAStack(const G4IAEAphspWriterStack* stack)
   }
   else {
     fFileName = stack->GetFileName();
+    fColumnar = stack->GetColumnar();
+    fStreaming = stack->GetStreaming();
 
     if (stack->GetZphspVec()->size() > 0) {
       (*fZphspVec) = *(stack->GetZphspVec()); // copy objects, not pointers
@@ -190,7 +193,7 @@ void G4IAEAphspWriter::WriteIAEAParticle(const size_t idx, const G4int incHist,
     return;
   }
 
-  IAEA_I32 sourceID = static_cast<IAEA_I32>(idx+fIAEASourcesOpen);
+  IAEA_I32 sourceID = static_cast<IAEA_I32>( fSourceIds->at(idx) );
 
   IAEA_I32 nStat = static_cast<IAEA_I32>(incHist);
   IAEA_Float energy = static_cast<IAEA_Float>(kinE/MeV);
@@ -214,13 +217,108 @@ void G4IAEAphspWriter::WriteIAEAParticle(const size_t idx, const G4int incHist,
 
 
 
+//==============================================================================
+
+void G4IAEAphspWriter::WriteIAEAParticles(const size_t idx,
+					  const std::vector<G4int>& nStat,
+					  const std::vector<G4int>& pdg,
+					  const std::vector<G4double>& kinE,
+					  const std::vector<G4double>& wt,
+					  const std::vector<G4ThreeVector>& pos,
+					  const std::vector<G4ThreeVector>& momDir)
+{
+  // Particles are converted to the IAEA units and types in chunks, each
+  // chunk being handed over to iaea_write_particles() in one call.
+  const size_t chunkSize = 65536;
+
+  IAEA_I32 sourceID = static_cast<IAEA_I32>( fSourceIds->at(idx) );
+
+  std::vector<IAEA_I32> nStatBuf, typeBuf;
+  std::vector<IAEA_Float> eBuf, wtBuf, xBuf, yBuf, zBuf, uBuf, vBuf, wBuf;
+  std::map<G4int, size_t> skipped; // unsupported PDG -> number of particles
+
+  const size_t nPart = pdg.size();
+  for (size_t first = 0; first < nPart; first += chunkSize) {
+    const size_t last = std::min(first+chunkSize, nPart);
+
+    nStatBuf.clear(); typeBuf.clear(); eBuf.clear(); wtBuf.clear();
+    xBuf.clear(); yBuf.clear(); zBuf.clear();
+    uBuf.clear(); vBuf.clear(); wBuf.clear();
+
+    for (size_t ii = first; ii < last; ii++) {
+      IAEA_I32 partType;
+      switch(pdg[ii]) {
+      case 22:
+	partType = 1;  // gamma
+	break;
+      case 11:
+	partType = 2;  // electron
+	break;
+      case -11:
+	partType = 3;  // positron
+	break;
+      case 2112:
+	partType = 4;  // neutron
+	break;
+      case 2212:
+	partType = 5;  // proton
+	break;
+      default:
+	skipped[pdg[ii]]++;
+	continue;
+      }
+
+      nStatBuf.push_back( static_cast<IAEA_I32>(nStat[ii]) );
+      typeBuf.push_back( partType );
+      eBuf.push_back( static_cast<IAEA_Float>(kinE[ii]/MeV) );
+      wtBuf.push_back( static_cast<IAEA_Float>(wt[ii]) );
+      xBuf.push_back( static_cast<IAEA_Float>( pos[ii].x()/cm ) );
+      yBuf.push_back( static_cast<IAEA_Float>( pos[ii].y()/cm ) );
+      zBuf.push_back( static_cast<IAEA_Float>( pos[ii].z()/cm ) );
+      uBuf.push_back( static_cast<IAEA_Float>( momDir[ii].x() ) );
+      vBuf.push_back( static_cast<IAEA_Float>( momDir[ii].y() ) );
+      wBuf.push_back( static_cast<IAEA_Float>( momDir[ii].z() ) );
+    }
+
+    IAEA_I32 n = static_cast<IAEA_I32>(typeBuf.size());
+    if (n == 0) continue;
+
+    // The only extra variable is the incremental history number (no floats)
+    IAEA_I32 nWritten;
+    iaea_write_particles(&sourceID, &n, &nWritten, nStatBuf.data(),
+			 typeBuf.data(), eBuf.data(), wtBuf.data(),
+			 xBuf.data(), yBuf.data(), zBuf.data(),
+			 uBuf.data(), vBuf.data(), wBuf.data(),
+			 nullptr, nStatBuf.data());
+
+    if (nWritten != n) {
+      G4ExceptionDescription msg;
+      msg << "Failed to write " << n << " particles into IAEAphsp file #"
+	  << idx << G4endl;
+      G4Exception("G4IAEAphspWriter::WriteIAEAParticles()",
+		  "IAEAphspWriter009", FatalException, msg);
+      return;
+    }
+  }
+
+  for (const auto& entry : skipped) {
+    G4ExceptionDescription msg;
+    msg << "PDG " << entry.first
+	<< " is not supported by IAEAphsp format and " << entry.second
+	<< " particle(s) will not be recorded." << G4endl;
+    G4Exception("G4IAEAphspWriter::WriteIAEAParticles()",
+		"IAEAphspWriter003", JustWarning, msg);
+  }
+}
+
+
+
 //==============================================================================
 
 void G4IAEAphspWriter::WriteIAEAParticle(const G4Step* aStep,
 					 const G4int zStopIdx)
 {
-  IAEA_I32 sourceID =
-    static_cast<IAEA_I32>(zStopIdx+fIAEASourcesOpen); // beware
+  IAEA_I32 sourceID = static_cast<IAEA_I32>( fSourceIds->at(zStopIdx) );
   G4double zStop = (*fZphspVec)[zStopIdx];
 
   // The particle type and kinetic energy
@@ -317,8 +415,10 @@ void G4IAEAphspWriter::OpenIAEAphspOutFiles(const G4Run* aRun)
   // Open all the files intended to store
   // the phase spaces following the IAEA format.
 
-  const IAEA_I32 accessWrite = 2;  // 2 = Writing mode in IAEA routines
+  // 2 = Writing mode in IAEA routines, 6 = same in GOSS columnar format
+  const IAEA_I32 accessWrite = fColumnar ? 6 : 2;
 
+  fSourceIds->clear();
   size_t nZphsps = fZphspVec->size();
   for (size_t ii = 0; ii < nZphsps; ii++) {
     // Set the source ID and file name in a unique way
@@ -341,15 +441,8 @@ void G4IAEAphspWriter::OpenIAEAphspOutFiles(const G4Run* aRun)
     
     // Create the file to store the IAEA phase space
 
-    // Reserve a global ID and request it explicitly
-    G4int reserved = IAEASourceIdRegistry::Instance().ReserveNextLowest();
-    if (reserved < 0) {
-      G4ExceptionDescription ed;
-      ed << "No free IAEA source IDs available for writer" << G4endl;
-      G4Exception("G4IAEAphspWriter::OpenIAEAphspOutFiles",
-		  "IAEAphspWriter005",FatalException, ed);
-    }
-    IAEA_I32 sourceWrite = static_cast<IAEA_I32>(reserved);
+    // The IAEA routines assign the lowest free source ID
+    IAEA_I32 sourceWrite = -1;
     char* filename = const_cast<char*>(fullName.data());
     IAEA_I32 result = 0;
     
@@ -357,19 +450,27 @@ void G4IAEAphspWriter::OpenIAEAphspOutFiles(const G4Run* aRun)
 		     &result, fullName.size()+1 );
 
     if (result < 0 || sourceWrite < 0) {
-      IAEASourceIdRegistry::Instance().Release(reserved);
       G4ExceptionDescription ed;
       ed << "IAEAphsp output file opening operation failed!" << G4endl;
       G4Exception("G4IAEAphspWriter::OpenIAEAphspOutFiles()",
 		  "IAEAphspWriter006", FatalException, ed);
     }
     
-    // This difference tells about the number of IAEA files already open.
-    fIAEASourcesOpen = sourceWrite - ii;
+    // IDs are not necessarily consecutive, so each plane keeps its own.
+    fSourceIds->push_back( static_cast<G4int>(sourceWrite) );
     G4cout << "G4IAEAphspWriter::OpenOutputIAEAphspFiles() ==> "
 	   << "\"" << fullName << "\"   IAEAphsp id = " << sourceWrite << "."
 	   << G4endl;
 
+    if (fStreaming) {
+      const IAEA_I32 streamMode = 1;
+      iaea_set_streaming(&sourceWrite, &streamMode, &result);
+      if (result < 0)
+	G4Exception("G4IAEAphspWriter::OpenIAEAphspOutFiles()",
+		    "IAEAphspWriter010", JustWarning,
+		    "Streaming not available, the file goes through the page cache");
+    }
+
 
     // Set the global information and options.
 
@@ -407,7 +508,7 @@ void G4IAEAphspWriter::CloseIAEAphspOutFiles()
   // Close the IAEA files
   G4int nZphsps = fZphspVec->size();
   for (G4int ii = 0; ii < nZphsps; ii++) {
-    const IAEA_I32 sourceID = static_cast<IAEA_I32>(ii+fIAEASourcesOpen);
+    const IAEA_I32 sourceID = static_cast<IAEA_I32>( fSourceIds->at(ii) );
     IAEA_I64 nEvts = static_cast<IAEA_I64>( fOrigHistories->at(ii) );
     iaea_set_total_original_particles(&sourceID, &nEvts);
 
@@ -421,7 +522,6 @@ void G4IAEAphspWriter::CloseIAEAphspOutFiles()
 
     iaea_destroy_source(&sourceID, &result);
     if (result > 0) {
-      IAEASourceIdRegistry::Instance().Release(static_cast<G4int>(sourceID));
       G4cout << "Phase-space file at z_phsp = " << (*fZphspVec)[ii]/cm
 	     << " cm (IAEA source id #" << sourceID << ") closed successfully!"
 	     << G4endl << G4endl;
@@ -432,4 +532,5 @@ void G4IAEAphspWriter::CloseIAEAphspOutFiles()
 		  "IAEA file not closed properly");
     }
   }
+  fSourceIds->clear();
 }
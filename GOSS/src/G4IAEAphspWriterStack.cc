@@ -114,6 +114,8 @@ void G4IAEAphspWriterStack::SetDataFromWriter(const G4IAEAphspWriter* writer)
   }
   else {
     fFileName = writer->GetFileName();
+    fColumnar = writer->GetColumnar();
+    fStreaming = writer->GetStreaming();
 
     if (writer->GetZphspVec()->size() > 0) {
       (*fZphspVec) = *(writer->GetZphspVec()); // copy objects, not pointers
@@ -0,0 +1,215 @@
+//
+// GOSSPhspTools - Standalone utilities for IAEA phase space files
+//
+
+#include "GOSSPhspTools.hh"
+
+#include "iaea_phsp.h"
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+int GOSSPhspTools::BuildIndex(const std::string& fileName, G4long stride,
+                              G4int nThreads)
+{
+  if (nThreads <= 0)
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  G4cout << "  Indexing: " << fileName << G4endl;
+  if (stride > 0)
+    G4cout << "  Stride  : " << stride << " histories" << G4endl;
+  G4cout << "  Threads : " << nThreads << G4endl;
+
+  IAEA_I32 sourceId = -1;
+  const IAEA_I32 access = 1;
+  IAEA_I32 result = 0;
+  std::string name = fileName;
+  iaea_new_source(&sourceId, const_cast<char*>(name.data()),
+                  &access, &result, name.size()+1);
+  if (sourceId < 0 || result < 0) {
+    G4cerr << "  ERROR: Could not open phase space file " << fileName
+           << G4endl;
+    return 1;
+  }
+
+  const IAEA_I64 indexStride = static_cast<IAEA_I64>(stride);
+  const IAEA_I32 indexThreads = static_cast<IAEA_I32>(nThreads);
+  iaea_build_index(&sourceId, &indexStride, &indexThreads, &result);
+
+  IAEA_I32 destroyed = 0;
+  iaea_destroy_source(&sourceId, &destroyed);
+
+  if (result < 0) {
+    G4cerr << "  ERROR: Could not build the history index (code "
+           << result << ")" << G4endl;
+    return 1;
+  }
+
+  G4cout << "  Written : " << fileName << ".IAEAindex" << G4endl;
+  return 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+int GOSSPhspTools::ScanStatistics(const std::string& fileName, G4int nThreads)
+{
+  if (nThreads <= 0)
+    nThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  G4cout << "  Scanning: " << fileName << G4endl;
+  G4cout << "  Threads : " << nThreads << G4endl;
+
+  IAEA_I32 sourceId = -1;
+  const IAEA_I32 access = 5;
+  IAEA_I32 result = 0;
+  std::string name = fileName;
+  iaea_new_source(&sourceId, const_cast<char*>(name.data()),
+                  &access, &result, name.size()+1);
+  if (sourceId < 0 || result < 0) {
+    G4cerr << "  ERROR: Could not open phase space file " << fileName
+           << G4endl;
+    return 1;
+  }
+
+  const IAEA_I32 scanThreads = static_cast<IAEA_I32>(nThreads);
+  const IAEA_I32 updateHeader = 1;
+  iaea_scan_statistics(&sourceId, &scanThreads, &updateHeader, &result);
+
+  if (result == 0) {
+    IAEA_I32 printed = 0;
+    iaea_print_header(&sourceId, &printed);
+  }
+
+  IAEA_I32 destroyed = 0;
+  iaea_destroy_source(&sourceId, &destroyed);
+
+  if (result < 0) {
+    G4cerr << "  ERROR: Could not "
+           << (result == -3 ? "rewrite the header" : "scan the file")
+           << " (code " << result << ")" << G4endl;
+    return 1;
+  }
+
+  G4cout << "  Written : " << fileName << ".IAEAheader" << G4endl;
+  return 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+int GOSSPhspTools::Merge(const std::string& outputName,
+                         const std::vector<std::string>& inputNames,
+                         G4bool columnar)
+{
+  if (inputNames.empty()) {
+    G4cerr << "  ERROR: No phase space files to merge" << G4endl;
+    return 1;
+  }
+
+  G4cout << "  Output  : " << outputName << G4endl;
+  G4cout << "  Inputs  : " << inputNames.size() << " files" << G4endl;
+
+  IAEA_I32 outputId = -1;
+  const IAEA_I32 writeAccess = columnar ? 6 : 2;
+  IAEA_I32 result = 0;
+  std::string name = outputName;
+  iaea_new_source(&outputId, const_cast<char*>(name.data()),
+                  &writeAccess, &result, name.size()+1);
+  if (outputId < 0 || result < 0) {
+    G4cerr << "  ERROR: Could not create phase space file " << outputName
+           << G4endl;
+    return 1;
+  }
+
+  // Every record is used once: keep the files out of the page cache where
+  // the system allows it (the result is not needed otherwise)
+  const IAEA_I32 streaming = 1;
+  IAEA_I32 streamed = 0;
+  iaea_set_streaming(&outputId, &streaming, &streamed);
+
+  int status = 0;
+  for (std::size_t i = 0; i < inputNames.size() && status == 0; ++i) {
+    IAEA_I32 inputId = -1;
+    const IAEA_I32 readAccess = 5;
+    name = inputNames[i];
+    iaea_new_source(&inputId, const_cast<char*>(name.data()),
+                    &readAccess, &result, name.size()+1);
+    if (inputId < 0 || result < 0) {
+      G4cerr << "  ERROR: Could not open phase space file " << inputNames[i]
+             << G4endl;
+      status = 1;
+      break;
+    }
+    iaea_set_streaming(&inputId, &streaming, &streamed);
+
+    // The description of the merged file is that of the first input;
+    // original histories are summed over the inputs by the append
+    if (i == 0) {
+      iaea_copy_header(&inputId, &outputId, &result);
+      IAEA_I64 noHistories = 0;
+      iaea_set_total_original_particles(&outputId, &noHistories);
+    }
+
+    IAEA_I64 nParticles = 0;
+    const IAEA_I32 allTypes = -1;
+    iaea_get_max_particles(&inputId, &allTypes, &nParticles);
+
+    iaea_append_source(&outputId, &inputId, &result);
+    if (result == -2)
+      G4cerr << "  ERROR: " << inputNames[i]
+             << " does not have the record layout of the previous files"
+             << G4endl;
+    else if (result < 0)
+      G4cerr << "  ERROR: Could not copy " << inputNames[i]
+             << " (code " << result << ")" << G4endl;
+    else
+      G4cout << "  Appended: " << inputNames[i] << " (" << nParticles
+             << " particles)" << G4endl;
+    if (result < 0) status = 1;
+
+    IAEA_I32 destroyed = 0;
+    iaea_destroy_source(&inputId, &destroyed);
+  }
+
+  IAEA_I64 nTotal = 0, nOriginal = 0;
+  const IAEA_I32 allTypes = -1;
+  iaea_get_max_particles(&outputId, &allTypes, &nTotal);
+  iaea_get_total_original_particles(&outputId, &nOriginal);
+
+  IAEA_I32 destroyed = 0;
+  iaea_destroy_source(&outputId, &destroyed);
+
+  if (status != 0) return status;
+
+  G4cout << "  Written : " << outputName
+         << (columnar ? ".GOSSphsp" : ".IAEAphsp") << " with " << nTotal
+         << " particles from " << nOriginal << " original histories"
+         << G4endl;
+  return 0;
+}
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+int GOSSPhspTools::Convert(const std::string& inputName,
+                           const std::string& outputName,
+                           const std::string& format)
+{
+  // The library reads a .GOSSphsp file when there is no .IAEAphsp one
+  G4bool inputColumnar = !std::ifstream(inputName + ".IAEAphsp").good() &&
+                         std::ifstream(inputName + ".GOSSphsp").good();
+
+  G4bool columnar = !inputColumnar;
+  if (format == "GOSS") columnar = true;
+  else if (format == "IAEA") columnar = false;
+  else if (!format.empty()) {
+    G4cerr << "  ERROR: Unknown phase space format " << format
+           << " (IAEA or GOSS)" << G4endl;
+    return 1;
+  }
+
+  G4cout << "  Format  : " << (inputColumnar ? "GOSS" : "IAEA") << " -> "
+         << (columnar ? "GOSS" : "IAEA") << G4endl;
+  return Merge(outputName, std::vector<std::string>(1, inputName), columnar);
+}
@@ -33,6 +33,7 @@
 
 #include <vector>
 
+#include "G4IAEAphspReader.hh"
 #include "G4IAEAphspWriter.hh"
 #include "G4IAEAphspWriterStack.hh"
 
@@ -84,6 +85,32 @@ void IAEAphspRun::RecordEvent(const G4Event* aEvent)
 
   if (fIAEAphspWriterStack)
     fIAEAphspWriterStack->PrepareNextEvent();
+
+  if (fIAEAphspReader) {
+    fFiltering = fIAEAphspReader->IsFiltering();
+    fAcceptedParticles =
+      fIAEAphspReader->GetAcceptedParticles() - fAcceptedAtStart;
+    fRejectedParticles =
+      fIAEAphspReader->GetRejectedParticles() - fRejectedAtStart;
+    fAcceptedWeight =
+      fIAEAphspReader->GetAcceptedWeight() - fAcceptedWeightAtStart;
+    fRejectedWeight =
+      fIAEAphspReader->GetRejectedWeight() - fRejectedWeightAtStart;
+  }
+}
+
+
+
+//==============================================================================
+
+void IAEAphspRun::SetIAEAphspReader(const G4IAEAphspReader* reader)
+{
+  fIAEAphspReader = reader;
+  fFiltering = reader->IsFiltering();
+  fAcceptedAtStart = reader->GetAcceptedParticles();
+  fRejectedAtStart = reader->GetRejectedParticles();
+  fAcceptedWeightAtStart = reader->GetAcceptedWeight();
+  fRejectedWeightAtStart = reader->GetRejectedWeight();
 }
 
 
@@ -108,6 +135,12 @@ void IAEAphspRun::Merge(const G4Run* aRun)
       fIAEAphspWriter->SumOrigHistories(jj, histories);
   }
 
+  fFiltering = fFiltering || localRun->IsIAEAphspFiltering();
+  fAcceptedParticles += localRun->GetAcceptedParticles();
+  fRejectedParticles += localRun->GetRejectedParticles();
+  fAcceptedWeight += localRun->GetAcceptedWeight();
+  fRejectedWeight += localRun->GetRejectedWeight();
+
   G4Run::Merge(aRun);
 }
 
@@ -172,28 +205,14 @@ void IAEAphspRun::DumpToIAEAphspFiles(const G4IAEAphspWriterStack* phspStack)
 	    fIAEAphspWriter->OpenIAEAphspOutFiles(this);
 	  }
 
-	  // 2. Loop over all vectors of this phsp to get the dynamic info
-	  // and write it into the corresponding IAEAphsp file
-
-	  size_t ii = 0;
-	  for (const auto& pdg : *phspPdgVec) {
-	    G4int nStat = (*(*localNstatMtrx)[jj])[ii];
-	    G4double kinE = (*(*localEneMtrx)[jj])[ii];
-	    G4double wt = (*(*localWtMtrx)[jj])[ii];
-	    G4ThreeVector pos = (*(*localPosMtrx)[jj])[ii];
-	    G4ThreeVector momDir = (*(*localMomMtrx)[jj])[ii];
-	    fIAEAphspWriter->WriteIAEAParticle(jj, nStat, pdg, kinE, wt,
-					       pos, momDir);
-	    ii++;
-
-	    // -- DEBUG!!
-	    // G4cout << "\tPDG = " << pdg
-	    // 	   << "  n_stat = " << (*(*localNstatMtrx)[jj])[ii]
-	    // 	   << "  pos/cm = " << ((*(*localPosMtrx)[jj])[ii]) /cm
-	    // 	   << "  momDir = " << (*(*localMomMtrx)[jj])[ii]
-	    // 	   << "  kinE/MeV = " << ((*(*localEneMtrx)[jj])[ii]) /MeV
-	    // 	   << "  wt = " << (*(*localWtMtrx)[jj])[ii] << G4endl;
-	  }
+	  // 2. Write all the particles stored for this phsp into the
+	  // corresponding IAEAphsp file in large blocks
+	  fIAEAphspWriter->WriteIAEAParticles(jj, *(*localNstatMtrx)[jj],
+					      *phspPdgVec,
+					      *(*localEneMtrx)[jj],
+					      *(*localWtMtrx)[jj],
+					      *(*localPosMtrx)[jj],
+					      *(*localMomMtrx)[jj]);
 	}
 	jj++;
       }
@@ -208,3 +227,24 @@ void IAEAphspRun::DumpToIAEAphspFiles(const G4IAEAphspWriterStack* phspStack)
 		"IAEAphspRun003", FatalException, msg);
   }
 }
+
+
+
+//==============================================================================
+
+void IAEAphspRun::PrintIAEAphspFilterSummary() const
+{
+  if (!fFiltering) return;
+
+  const G4double totalWeight = fAcceptedWeight + fRejectedWeight;
+  G4cout << G4endl
+	 << "--- IAEAphsp reader acceptance filter ---" << G4endl
+	 << " Particles generated: " << fAcceptedParticles
+	 << " (weight " << fAcceptedWeight << ")" << G4endl
+	 << " Particles rejected:  " << fRejectedParticles
+	 << " (weight " << fRejectedWeight << ")" << G4endl;
+  if (totalWeight > 0.)
+    G4cout << " Weight rejected: " << 100.*fRejectedWeight/totalWeight
+	   << " %" << G4endl;
+  G4cout << G4endl;
+}
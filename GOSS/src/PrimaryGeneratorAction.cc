@@ -28,6 +28,8 @@
 #include "PrimaryGeneratorAction.hh"
 #include "PrimaryGeneratorMessenger.hh"
 #include "G4IAEAphspReader.hh"
+#include "G4IAEAphspMemorySource.hh"
+#include "G4IAEAphspHistoryQueue.hh"
 
 #include "globals.hh"
 #include "G4SystemOfUnits.hh"
@@ -78,8 +80,20 @@ void PrimaryGeneratorAction::GeneratePrimaries(G4Event* anEvent)
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 
-void PrimaryGeneratorAction::SetIAEAphspReader(const G4String filename)
+void PrimaryGeneratorAction::SetIAEAphspReader(const G4String filename,
+     std::shared_ptr<const G4IAEAphspMemorySource> memorySource,
+     std::shared_ptr<G4IAEAphspHistoryQueue> historyQueue)
 {
   fIAEAphspReaderName = filename;
-  fIAEAphspReader = new G4IAEAphspReader(filename, fThreads);
+
+  // A reader set before (e.g. another file or i/o option in sequential
+  // mode) is closed first, so that its commands are not defined twice
+  delete fIAEAphspReader;
+
+  if (historyQueue)
+    fIAEAphspReader = new G4IAEAphspReader(historyQueue, fThreads);
+  else
+    fIAEAphspReader = new G4IAEAphspReader(filename, fThreads);
+  if (memorySource)
+    fIAEAphspReader->SetMemorySource(memorySource);
 }
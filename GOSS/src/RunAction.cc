@@ -29,12 +29,15 @@
 
 #include "globals.hh"
 #include "G4Threading.hh"
+#include "G4RunManager.hh"
 
+#include "G4IAEAphspReader.hh"
 #include "G4IAEAphspWriter.hh"
 #include "G4IAEAphspWriterStack.hh"
 #include "IAEAphspRun.hh"
 #include "GOSSMerger.hh"
 #include "GOSSMessenger.hh"
+#include "PrimaryGeneratorAction.hh"
 
 
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
@@ -56,24 +59,35 @@ G4Run* RunAction::GenerateRun()
   // Generate new RUN object, which is specially
   // dedicated to store run-persistent data.
 
+  IAEAphspRun* run = nullptr;
+
   if ( G4Threading::IsMultithreadedApplication() ) {
     if (!(IsMaster()) && fIAEAphspWriterStack ) {
       G4cout << "Generating a worker IAEAphspRun with IAEAphspWriterStack!!"
 	     << G4endl;
-      return new IAEAphspRun(fIAEAphspWriterStack);
+      run = new IAEAphspRun(fIAEAphspWriterStack);
     }
     else {
       if (IsMaster()) G4cout << "Generating a master IAEAphspRun!!" << G4endl;
       else G4cout << "Generating a worker IAEAphspRun!!" << G4endl;
-      return new IAEAphspRun();
+      run = new IAEAphspRun();
     }
   }
   else {  // sequential mode
     if (fIAEAphspWriterStack)
-      return new IAEAphspRun(fIAEAphspWriterStack);
+      run = new IAEAphspRun(fIAEAphspWriterStack);
     else
-      return new IAEAphspRun();
+      run = new IAEAphspRun();
   }
+
+  // The run takes the filter tallies of the phsp reader of this thread
+  // (there is no primary generator in the master)
+  auto primaryGenerator = static_cast<const PrimaryGeneratorAction*>(
+    G4RunManager::GetRunManager()->GetUserPrimaryGeneratorAction());
+  if (primaryGenerator && primaryGenerator->GetIAEAphspReader())
+    run->SetIAEAphspReader(primaryGenerator->GetIAEAphspReader());
+
+  return run;
 }
 
 
@@ -86,6 +100,8 @@ void RunAction::EndOfRunAction(const G4Run* aRun)
   if ( G4Threading::IsMultithreadedApplication() ) {
     if (IsMaster()) {
       auto masterRun = static_cast<const IAEAphspRun*>(aRun);
+      masterRun->PrintIAEAphspFilterSummary();
+
       auto iaeaphspWriter = masterRun->GetIAEAphspWriter();
       if (iaeaphspWriter) {
 	// The IAEAphsp files are open at first call of IAEAphspRun::Merge()
@@ -101,6 +117,7 @@ void RunAction::EndOfRunAction(const G4Run* aRun)
   else {    // sequential mode
     const IAEAphspRun* constRun = dynamic_cast<const IAEAphspRun*>(aRun);
     IAEAphspRun* iaeaRun = const_cast<IAEAphspRun*>(constRun);
+    iaeaRun->PrintIAEAphspFilterSummary();
 
     auto phspStack = iaeaRun->GetIAEAphspWriterStack();
 
@@ -138,6 +155,27 @@ void RunAction::SetIAEAphspWriterStack(const G4String& namePrefix)
 }
 
 
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunAction::SetIAEAphspWriterColumnar(const G4bool val)
+{
+  // Without a stack there is no output, the format is passed again when
+  // the output file name prefix is set
+  if (fIAEAphspWriterStack)
+    fIAEAphspWriterStack->SetColumnar(val);
+}
+
+
+//....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
+
+void RunAction::SetIAEAphspWriterStreaming(const G4bool val)
+{
+  // Same as SetIAEAphspWriterColumnar()
+  if (fIAEAphspWriterStack)
+    fIAEAphspWriterStack->SetStreaming(val);
+}
+
+
 //....oooOO0OOooo........oooOO0OOooo........oooOO0OOooo........oooOO0OOooo......
 
 void RunAction::AddZphsp(const G4double val)